@@ -0,0 +1,160 @@
+#include "archive.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// blob layout: header, then the compressed records each followed by its strings (no terminators)
+typedef struct
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t count;
+    uint32_t raw_length; // size of the records before compression
+    uint32_t reserved;
+} ArchiveHeader;
+
+typedef struct
+{
+    int32_t id;
+    uint8_t visibility;
+    uint8_t reserved;
+    int16_t start; // minutes after midnight, -1 for an all-day event
+    int16_t end;
+    uint16_t date_length;
+    uint16_t name_length;
+    uint16_t description_length;
+} ArchiveRecord;
+
+unsigned char *archive_pack(Event *const *events, int count, size_t *length)
+{
+    size_t raw_length = 0;
+    for (int i = 0; i < count; i++)
+    {
+        raw_length += sizeof(ArchiveRecord) + strlen(events[i]->date) + strlen(events[i]->name) + strlen(events[i]->description);
+    }
+    if (raw_length > ARCHIVE_MAX_RAW_LENGTH)
+    {
+        return NULL;
+    }
+
+    unsigned char *raw = malloc(raw_length ? raw_length : 1);
+    if (raw == NULL)
+    {
+        return NULL;
+    }
+    size_t offset = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const Event *event = events[i];
+        ArchiveRecord record = {0};
+        record.id = event->id;
+        record.visibility = event->visibility;
+        record.start = event->start;
+        record.end = event->end;
+        record.date_length = strlen(event->date);
+        record.name_length = strlen(event->name);
+        record.description_length = strlen(event->description);
+
+        memcpy(raw + offset, &record, sizeof(record));
+        offset += sizeof(record);
+        memcpy(raw + offset, event->date, record.date_length);
+        offset += record.date_length;
+        memcpy(raw + offset, event->name, record.name_length);
+        offset += record.name_length;
+        memcpy(raw + offset, event->description, record.description_length);
+        offset += record.description_length;
+    }
+
+    // names and descriptions of a month repeat a lot, the best level pays off as a blob is written once and read rarely
+    uLongf packed_length = compressBound(raw_length);
+    unsigned char *blob = malloc(sizeof(ArchiveHeader) + packed_length);
+    if (blob == NULL || compress2(blob + sizeof(ArchiveHeader), &packed_length, raw, raw_length, Z_BEST_COMPRESSION) != Z_OK)
+    {
+        free(blob);
+        free(raw);
+        return NULL;
+    }
+    free(raw);
+
+    ArchiveHeader header = {0};
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.format = ARCHIVE_FORMAT;
+    header.count = count;
+    header.raw_length = raw_length;
+    memcpy(blob, &header, sizeof(header));
+    *length = sizeof(ArchiveHeader) + packed_length;
+    return blob;
+}
+
+// copies length bytes at *offset into a terminated string, NULL if the record runs past the end
+static char *read_string(const unsigned char *data, size_t size, size_t *offset, size_t length, char *buffer, size_t buffer_size)
+{
+    if (length >= buffer_size || *offset + length > size)
+        return NULL;
+    memcpy(buffer, data + *offset, length);
+    buffer[length] = '\0';
+    *offset += length;
+    return buffer;
+}
+
+int archive_unpack(const unsigned char *blob, size_t length, int (*store)(Event *event, void *context), void *context)
+{
+    ArchiveHeader header;
+    if (length < sizeof(header))
+    {
+        return -1;
+    }
+    memcpy(&header, blob, sizeof(header));
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || header.format != ARCHIVE_FORMAT ||
+        header.raw_length > ARCHIVE_MAX_RAW_LENGTH)
+    {
+        return -1;
+    }
+
+    unsigned char *raw = malloc(header.raw_length ? header.raw_length : 1);
+    uLongf raw_length = header.raw_length;
+    if (raw == NULL || uncompress(raw, &raw_length, blob + sizeof(header), length - sizeof(header)) != Z_OK ||
+        raw_length != header.raw_length)
+    {
+        free(raw);
+        return -1;
+    }
+
+    size_t offset = 0;
+    char date[MAX_DATE_LENGTH], name[MAX_NAME_LENGTH], description[MAX_DESC_LENGTH];
+    int result = header.count;
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        ArchiveRecord record;
+        if (offset + sizeof(record) > raw_length)
+        {
+            result = -1;
+            break;
+        }
+        memcpy(&record, raw + offset, sizeof(record));
+        offset += sizeof(record);
+
+        Event *event = NULL;
+        if (read_string(raw, raw_length, &offset, record.date_length, date, sizeof(date)) &&
+            read_string(raw, raw_length, &offset, record.name_length, name, sizeof(name)) &&
+            read_string(raw, raw_length, &offset, record.description_length, description, sizeof(description)))
+        {
+            event = create_event(record.id, record.visibility, date, name, description);
+        }
+        if (event == NULL)
+        {
+            result = -1;
+            break;
+        }
+        event->start = record.start;
+        event->end = record.end;
+        if (!store(event, context))
+        {
+            free_event(event);
+        }
+    }
+
+    free(raw);
+    return result;
+}
@@ -0,0 +1,20 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include "event.h"
+
+// archive parameter
+#define ARCHIVE_MAGIC "CALARCH"
+#define ARCHIVE_FORMAT 1
+#define ARCHIVE_MAX_RAW_LENGTH (16 << 20) // unpacked size of one month, a blob claiming more is refused
+#define ARCHIVE_MAX_ID_FIELD "max_id"    // highest id ever archived, the other fields of archive:{<user>} are yyyy-mm
+
+// packs single events into one zlib compressed blob, returns NULL when out of memory
+unsigned char *archive_pack(Event *const *events, int count, size_t *length);
+
+// unpacks a blob and hands every event to store, which returns 1 when it kept the event and 0 to have it freed
+// returns the number of events in the blob or -1 if it is damaged
+int archive_unpack(const unsigned char *blob, size_t length, int (*store)(Event *event, void *context), void *context);
+
+#endif
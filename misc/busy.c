@@ -0,0 +1,184 @@
+#include "busy.h"
+#include "db.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// adds ARGV[1] to the event count of every day in ARGV[2..] and keeps the bit of the day in sync with its count
+#define BUSY_SCRIPT "for i = 2, #ARGV do "                                              \
+                    "local n = redis.call('HINCRBY', KEYS[2], ARGV[i], ARGV[1]) "      \
+                    "if n <= 0 then redis.call('HDEL', KEYS[2], ARGV[i]) end "          \
+                    "redis.call('SETBIT', KEYS[1], ARGV[i], n > 0 and 1 or 0) end "     \
+                    "return #ARGV - 1"
+
+// recounts the days of a user from the dates in the date index KEYS[1], yyyymmdd scores turned into days since 1970
+#define BUSY_RECOUNT_SCRIPT "redis.call('DEL', KEYS[2], KEYS[3]) "                                                                   \
+                            "local dates = redis.call('ZRANGE', KEYS[1], 0, -1, 'WITHSCORES') "                                      \
+                            "for i = 2, #dates, 2 do local s = tonumber(dates[i]) "                                                  \
+                            "local y, m, d = math.floor(s / 10000), math.floor(s / 100) % 100, s % 100 "                             \
+                            "if m <= 2 then y = y - 1 end local era = math.floor(y / 400) local yoe = y - era * 400 "                \
+                            "local day = era * 146097 + yoe * 365 + math.floor(yoe / 4) - math.floor(yoe / 100) + "                  \
+                            "math.floor((153 * ((m + 9) % 12) + 2) / 5) + d - 1 - 719468 "                                           \
+                            "if day >= 0 then redis.call('HINCRBY', KEYS[3], day, 1) redis.call('SETBIT', KEYS[2], day, 1) end end " \
+                            "return #dates / 2"
+
+// bit of a date, days before 1970 are not tracked
+static long day_offset(const char *date)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+    {
+        return -1;
+    }
+    return date_to_days(year, month, day);
+}
+
+// queues one script call for a list of day offsets, returns the number of queued commands
+static int append_days(redisContext *c, const char *user, const long *days, int count, int delta)
+{
+    char busy_key[96], count_key[96], delta_arg[16];
+    snprintf(busy_key, sizeof(busy_key), "busy_events:{%s}", user);
+    snprintf(count_key, sizeof(count_key), "busy_event_days:{%s}", user);
+    snprintf(delta_arg, sizeof(delta_arg), "%d", delta);
+
+    const char **argv = malloc((count + 6) * sizeof(char *));
+    char (*offsets)[24] = malloc(count * sizeof(*offsets));
+    if (argv == NULL || offsets == NULL)
+    {
+        free(argv);
+        free(offsets);
+        return 0;
+    }
+
+    argv[0] = "EVAL";
+    argv[1] = BUSY_SCRIPT;
+    argv[2] = "2";
+    argv[3] = busy_key;
+    argv[4] = count_key;
+    argv[5] = delta_arg;
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(offsets[i], sizeof(offsets[i]), "%ld", days[i]);
+        argv[6 + i] = offsets[i];
+    }
+    redis_append_argv(c, count + 6, argv, NULL);
+
+    free(argv);
+    free(offsets);
+    return 1;
+}
+
+int busy_append_date(redisContext *c, const char *user, const char *date, int delta)
+{
+    long day = day_offset(date);
+    if (day < 0)
+    {
+        return 0;
+    }
+    return append_days(c, user, &day, 1, delta);
+}
+
+int busy_append_recount(redisContext *c, const char *user)
+{
+    redis_append(c, "EVAL %s 3 events_by_date:{%s} busy_events:{%s} busy_event_days:{%s}", BUSY_RECOUNT_SCRIPT, user, user, user);
+    return 1;
+}
+
+// days of a query that the occurrences of rules fill
+typedef struct
+{
+    long first;
+    long last;
+    unsigned char *free_days;
+} BusyRange;
+
+// marks the occurrences of one rule within the range as busy, whatever its visibility
+static int mark_recurrence(const DbEventFields *fields, int id, int recurring, void *context)
+{
+    (void)recurring;
+    BusyRange *range = context;
+    Recurrence *recurrence = db_recurrence_from_fields(fields, id);
+    if (recurrence == NULL)
+    {
+        return 0;
+    }
+
+    int year, month, day;
+    char from[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH];
+    days_to_date(range->first, &year, &month, &day);
+    snprintf(from, sizeof(from), "%04d-%02d-%02d", year, month, day);
+    while (recurrence_next(recurrence, from, date))
+    {
+        long offset = day_offset(date);
+        if (offset > range->last)
+        {
+            break;
+        }
+        if (offset >= range->first)
+        {
+            range->free_days[offset - range->first] = 0;
+        }
+
+        days_to_date(offset + 1, &year, &month, &day);
+        snprintf(from, sizeof(from), "%04d-%02d-%02d", year, month, day);
+    }
+    free_recurrence(recurrence);
+    return 1;
+}
+
+int busy_free_days(redisContext *c, const char **users, int user_count, long first, long last, unsigned char *free_days)
+{
+    if (user_count < 1 || user_count > BUSY_MAX_USERS || first < 0 || last < first || last - first >= BUSY_MAX_RANGE_DAYS)
+    {
+        return -1;
+    }
+
+    // the bitmaps may live on different nodes, so the bytes of the range are fetched in one pipeline and combined here
+    for (int i = 0; i < user_count; i++)
+    {
+        redis_append(c, "GETRANGE busy_events:{%s} %ld %ld", users[i], first / 8, last / 8);
+    }
+
+    unsigned char busy[BUSY_MAX_RANGE_DAYS / 8 + 2] = {0};
+    size_t bytes = last / 8 - first / 8 + 1;
+    int failed = 0;
+    for (int i = 0; i < user_count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (reply == NULL || reply->type != REDIS_REPLY_STRING)
+        {
+            failed = 1;
+        }
+        for (size_t byte = 0; !failed && byte < reply->len && byte < bytes; byte++)
+        {
+            busy[byte] |= (unsigned char)reply->str[byte];
+        }
+        freeReplyObject(reply);
+    }
+    if (failed)
+    {
+        return -1;
+    }
+
+    // bit 0 is the highest bit of the first byte, bytes past the end of a bitmap are all free
+    for (long day = first; day <= last; day++)
+    {
+        size_t byte = day / 8 - first / 8;
+        free_days[day - first] = !((busy[byte] >> (7 - day % 8)) & 1);
+    }
+
+    // the rules of each user are read from the node of that user and expanded for the range only
+    BusyRange range = {first, last, free_days};
+    for (int i = 0; i < user_count; i++)
+    {
+        if (db_load_events(c, users[i], 1, mark_recurrence, &range) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
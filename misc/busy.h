@@ -0,0 +1,23 @@
+#ifndef BUSY_H
+#define BUSY_H
+
+#include "common.h"
+
+// free/busy parameter
+#define BUSY_MAX_USERS 32       // users compared by one free day query
+#define BUSY_MAX_RANGE_DAYS 366 // days covered by one free day query
+
+// per user bitmap busy_events:{<user>} with one bit per day since 1970-01-01, set while busy_event_days:{<user>} counts single events on that day
+// recurring events have no end to count up to, their occurrences are expanded for each query instead
+
+// queues the day count change for one event date, returns the number of queued commands
+int busy_append_date(redisContext *c, const char *user, const char *date, int delta);
+
+// queues the recount of a user's days from the events in their date index, returns the number of queued commands
+// it runs as one script, so an event a session writes meanwhile is either in the index already or adds to the new count
+int busy_append_recount(redisContext *c, const char *user);
+
+// marks the days from first to last (days since 1970) on which none of the users has an event, returns 0 or -1
+int busy_free_days(redisContext *c, const char **users, int user_count, long first, long last, unsigned char *free_days);
+
+#endif
@@ -1,21 +1,266 @@
 #include "common.h"
+#include "stats.h"
+#include "shard.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <hiredis/hiredis.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
 
-redisContext *connect_redis()
+// connects to the node that holds key (the first node for NULL), commands for keys on other nodes are routed from there
+redisContext *connect_redis(const char *key)
 {
-    redisContext *c = redisConnect("127.0.0.1", 6379);
+    const char *host;
+    int port, node = key ? shard_node_of(key, strlen(key)) : 0;
+    shard_address(node, &host, &port);
+
+    redisContext *c = redisConnect(host, port);
     if (c == NULL || c->err)
     {
-        printf("%sError connecting to Redis: %s\n%s", RED_COLOR, c->errstr, RESET_COLOR);
+        printf("%sError connecting to Redis: %s\n%s", RED_COLOR, c ? c->errstr : "out of memory", RESET_COLOR);
         redisFree(c);
         exit(1);
     }
+    shard_attach(c, node);
+    return c;
+}
+
+// connects with time limits so a dead server cannot hang the session, c->err is set if it failed
+redisContext *try_connect_redis(const char *key)
+{
+    const char *host;
+    int port, node = key ? shard_node_of(key, strlen(key)) : 0;
+    shard_address(node, &host, &port);
+
+    struct timeval timeout = {REDIS_TIMEOUT_MS / 1000, (REDIS_TIMEOUT_MS % 1000) * 1000};
+    redisContext *c = redisConnectWithTimeout(host, port, timeout);
+    if (c != NULL && !c->err)
+    {
+        redisSetTimeout(c, timeout);
+    }
+    if (c != NULL)
+    {
+        shard_attach(c, node);
+    }
     return c;
 }
 
+// returns 1 if a request may be sent, once the cooldown is over a single reconnect probes the server
+int breaker_allow(Breaker *breaker, redisContext *c)
+{
+    if (!breaker->open)
+    {
+        return 1;
+    }
+    if (time(NULL) < breaker->retry_at)
+    {
+        return 0;
+    }
+
+    struct timeval timeout = {REDIS_TIMEOUT_MS / 1000, (REDIS_TIMEOUT_MS % 1000) * 1000};
+    redisReply *reply = NULL;
+    if (redisReconnect(c) == REDIS_OK && redisSetTimeout(c, timeout) == REDIS_OK)
+    {
+        reply = redis_command(c, "PING");
+    }
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+    {
+        freeReplyObject(reply);
+        breaker_failure(breaker);
+        return 0;
+    }
+    freeReplyObject(reply);
+
+    breaker->open = 0;
+    breaker->cooldown = 0;
+    return 1;
+}
+
+// a broken connection opens the breaker, every failed reconnect doubles the wait
+void breaker_failure(Breaker *breaker)
+{
+    if (!breaker->open)
+        breaker->cooldown = BREAKER_COOLDOWN;
+    else if (breaker->cooldown * 2 <= BREAKER_MAX_COOLDOWN)
+        breaker->cooldown *= 2;
+    else
+        breaker->cooldown = BREAKER_MAX_COOLDOWN;
+    breaker->open = 1;
+    breaker->retry_at = time(NULL) + breaker->cooldown;
+}
+
+// records a command under "redis.<command name>"
+static void record_command(const char *command, size_t length, uint64_t start)
+{
+    char name[STATS_NAME_LENGTH] = "redis.";
+    size_t prefix = strlen(name);
+    if (length > sizeof(name) - prefix - 1)
+        length = sizeof(name) - prefix - 1;
+    memcpy(name + prefix, command, length);
+    name[prefix + length] = '\0';
+    stats_record_since(name, start);
+}
+
+// copies the name out of a formatted command, "*<argc>\r\n$<length>\r\n<name>\r\n..."
+static void formatted_name(const char *command, long long length, char *name, size_t size)
+{
+    snprintf(name, size, "unknown");
+    const char *p = length > 0 ? memchr(command, '$', length) : NULL;
+    if (p == NULL)
+    {
+        return;
+    }
+    char *end;
+    long name_length = strtol(p + 1, &end, 10);
+    if (name_length >= 0 && end + 2 + name_length <= command + length)
+    {
+        snprintf(name, size, "%.*s", (int)name_length, end + 2);
+    }
+}
+
+// sends one formatted command through the router and waits for its reply
+static redisReply *routed_command(redisContext *c, char *command, long long length)
+{
+    void *reply = NULL;
+    if (length < 0)
+    {
+        return NULL;
+    }
+    if (shard_append(c, command, length) == REDIS_OK)
+    {
+        shard_get_reply(c, &reply);
+    }
+    redisFreeCommand(command);
+    return reply;
+}
+
+// redisCommand with its round trip recorded per command name
+redisReply *redis_command(redisContext *c, const char *format, ...)
+{
+    uint64_t start = stats_now();
+    va_list ap;
+    va_start(ap, format);
+    char *command = NULL;
+    int length = redisvFormatCommand(&command, format, ap);
+    va_end(ap);
+
+    // the name is read from the expanded command, a format may start with %s
+    char name[STATS_NAME_LENGTH];
+    formatted_name(command, length, name, sizeof(name));
+    redisReply *reply = routed_command(c, command, length);
+    record_command(name, strlen(name), start);
+    return reply;
+}
+
+// redisCommandArgv with its round trip recorded per command name
+redisReply *redis_command_argv(redisContext *c, int argc, const char **argv, const size_t *argvlen)
+{
+    uint64_t start = stats_now();
+    redisReply *reply;
+    if (shard_node_count() > 1)
+    {
+        char *command = NULL;
+        long long length = redisFormatCommandArgv(&command, argc, argv, argvlen);
+        reply = routed_command(c, command, length);
+    }
+    else
+    {
+        reply = redisCommandArgv(c, argc, argv, argvlen);
+    }
+    record_command(argv[0], argvlen ? argvlen[0] : strlen(argv[0]), start);
+    return reply;
+}
+
+// redisAppendCommand, queued on the node of the key when there are several
+int redis_append(redisContext *c, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    int result;
+    if (shard_node_count() > 1)
+    {
+        char *command = NULL;
+        int length = redisvFormatCommand(&command, format, ap);
+        result = length < 0 ? REDIS_ERR : shard_append(c, command, length);
+        redisFreeCommand(command);
+    }
+    else
+    {
+        result = redisvAppendCommand(c, format, ap);
+    }
+    va_end(ap);
+    return result;
+}
+
+// redisAppendCommandArgv, queued on the node of the key when there are several
+int redis_append_argv(redisContext *c, int argc, const char **argv, const size_t *argvlen)
+{
+    if (shard_node_count() <= 1)
+    {
+        return redisAppendCommandArgv(c, argc, argv, argvlen);
+    }
+    char *command = NULL;
+    long long length = redisFormatCommandArgv(&command, argc, argv, argvlen);
+    int result = length < 0 ? REDIS_ERR : shard_append(c, command, length);
+    redisFreeCommand(command);
+    return result;
+}
+
+// redisGetReply, the replies of commands queued on several nodes come back in the order they were queued
+int redis_get_reply(redisContext *c, void **reply)
+{
+    return shard_node_count() > 1 ? shard_get_reply(c, reply) : redisGetReply(c, reply);
+}
+
+// reads the replies of pipelined commands, returns the number of failed commands
+int drain_replies(redisContext *c, int count)
+{
+    int failed = 0;
+    uint64_t start = stats_now();
+
+    for (int i = 0; i < count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            return failed + count - i; // connection is unusable, the rest is lost
+        }
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+        {
+            failed++;
+        }
+        freeReplyObject(reply);
+    }
+
+    // the queued commands are sent with the first read, so this is the round trip of the whole pipeline
+    if (count > 0)
+    {
+        stats_record_since("redis.pipeline", start);
+    }
+    return failed;
+}
+
+// prints a string as a quoted JSON string
+void print_json_string(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(file, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(file, "\\u%04x", *p);
+        else
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
 void empty_input_buffer()
 {
     int ch;
@@ -33,3 +278,99 @@ void press_enter_to_continue()
     printf("\nPress Enter to continue...");
     empty_input_buffer();
 }
+
+// terminal settings from before raw_mode_enter
+static struct termios saved_terminal;
+static int raw_terminal;
+
+// restores the line based terminal
+void raw_mode_leave()
+{
+    if (raw_terminal)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+        raw_terminal = 0;
+    }
+}
+
+// switches the terminal to single keystrokes without echo, returns 0 if stdin is a terminal
+int raw_mode_enter()
+{
+    static int registered;
+    if (raw_terminal)
+    {
+        return 0;
+    }
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_terminal) != 0)
+    {
+        return -1;
+    }
+
+    // ctrl-c arrives as a key so the terminal is always restored
+    struct termios raw = saved_terminal;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+    {
+        return -1;
+    }
+    raw_terminal = 1;
+
+    if (!registered)
+    {
+        atexit(raw_mode_leave);
+        registered = 1;
+    }
+    return 0;
+}
+
+// waits up to wait_ms (-1 for ever) for input, returns 1 if there is some
+static int input_ready(int wait_ms)
+{
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    return poll(&input, 1, wait_ms) > 0;
+}
+
+// reads one keystroke, returns KEY_NONE if none arrives within wait_ms (-1 waits for ever) and EOF at the end of input
+int read_key(int wait_ms)
+{
+    unsigned char ch;
+    if (!input_ready(wait_ms))
+    {
+        return KEY_NONE;
+    }
+    if (read(STDIN_FILENO, &ch, 1) != 1)
+    {
+        return EOF;
+    }
+    if (ch != 27)
+    {
+        return ch;
+    }
+
+    // arrow keys send ESC [ A to ESC [ D (ESC O A in application mode), a lone ESC is the key itself
+    unsigned char sequence[2];
+    if (!input_ready(KEY_ESCAPE_MS) || read(STDIN_FILENO, &sequence[0], 1) != 1)
+    {
+        return 27;
+    }
+    if ((sequence[0] != '[' && sequence[0] != 'O') || !input_ready(KEY_ESCAPE_MS) || read(STDIN_FILENO, &sequence[1], 1) != 1)
+    {
+        return KEY_UNKNOWN;
+    }
+    switch (sequence[1])
+    {
+    case 'A':
+        return KEY_UP;
+    case 'B':
+        return KEY_DOWN;
+    case 'C':
+        return KEY_RIGHT;
+    case 'D':
+        return KEY_LEFT;
+    default:
+        return KEY_UNKNOWN;
+    }
+}
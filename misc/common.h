@@ -5,6 +5,7 @@
 #include <hiredis/hiredis.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define RESET_COLOR "\033[0m"
 #define BOLD "\033[1m"
@@ -17,7 +18,40 @@
 #define ORANGE_COLOR "\033[38;5;214m"
 #define GREY "\033[38;5;245m"
 
-redisContext *connect_redis();
+// circuit breaker parameter
+#define REDIS_TIMEOUT_MS 3000   // connect and reply limit of a breaker guarded connection
+#define BREAKER_COOLDOWN 2      // seconds before the first reconnect attempt
+#define BREAKER_MAX_COOLDOWN 60 // the wait doubles after every failed attempt up to this
+
+// stops a session from retrying a dead server on every request
+typedef struct
+{
+    int open;     // redis is considered down
+    int cooldown; // seconds until the next attempt
+    time_t retry_at;
+} Breaker;
+
+redisContext *connect_redis(const char *key);
+
+redisContext *try_connect_redis(const char *key);
+
+int breaker_allow(Breaker *breaker, redisContext *c);
+
+void breaker_failure(Breaker *breaker);
+
+redisReply *redis_command(redisContext *c, const char *format, ...);
+
+redisReply *redis_command_argv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+
+int redis_append(redisContext *c, const char *format, ...);
+
+int redis_append_argv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+
+int redis_get_reply(redisContext *c, void **reply);
+
+int drain_replies(redisContext *c, int count);
+
+void print_json_string(FILE *file, const char *text);
 
 void empty_input_buffer();
 
@@ -25,4 +59,19 @@ void clear();
 
 void press_enter_to_continue();
 
+// keys read_key returns besides plain characters
+#define KEY_NONE 0        // nothing arrived in time
+#define KEY_UNKNOWN 0x100 // an escape sequence without a meaning here
+#define KEY_UP 0x101
+#define KEY_DOWN 0x102
+#define KEY_RIGHT 0x103
+#define KEY_LEFT 0x104
+#define KEY_ESCAPE_MS 30 // the rest of an escape sequence arrives within this
+
+int raw_mode_enter();
+
+void raw_mode_leave();
+
+int read_key(int wait_ms);
+
 #endif
@@ -0,0 +1,928 @@
+#include "db.h"
+#include "shard.h"
+#include "stats.h"
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// hashes fetched per pipeline when a calendar is loaded
+#define DB_LOAD_BATCH 1000
+
+// HSETNX claims the name, the other fields follow in the same script so no half written account is ever seen
+#define DB_NEW_USER_SCRIPT "if redis.call('HSETNX', KEYS[1], 'password', ARGV[1]) == 0 then return 0 end redis.call('HSET', KEYS[1], 'created_at', ARGV[2]) return 1"
+
+static char last_error[256];
+
+static void set_error(const char *message)
+{
+    snprintf(last_error, sizeof(last_error), "%s", message);
+}
+
+// COMMANDS --------------------
+void db_command_init(DbCommand *command, const char *name)
+{
+    command->argc = 0;
+    command->used = 0;
+    command->overflow = 0;
+    db_arg(command, name);
+}
+
+// adds a string argument, it must stay valid until the command is sent
+void db_arg(DbCommand *command, const char *value)
+{
+    db_arg_binary(command, value, strlen(value));
+}
+
+// adds an argument of any bytes, spaces and quotes included
+void db_arg_binary(DbCommand *command, const void *value, size_t length)
+{
+    if (command->argc == DB_MAX_ARGS)
+    {
+        command->overflow = 1;
+        return;
+    }
+    command->argv[command->argc] = value;
+    command->lengths[command->argc] = length;
+    command->argc++;
+}
+
+// adds a printf formatted argument such as a key or a number, copied into the command
+void db_arg_format(DbCommand *command, const char *format, ...)
+{
+    char *target = command->storage + command->used;
+    size_t room = sizeof(command->storage) - command->used;
+
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(target, room, format, ap);
+    va_end(ap);
+
+    if (length < 0 || (size_t)length >= room)
+    {
+        command->overflow = 1;
+        return;
+    }
+    command->used += length + 1;
+    db_arg_binary(command, target, length);
+}
+
+// queues a command on the pipeline, returns the number of queued commands (0 if it could not be built)
+int db_append(redisContext *c, DbCommand *command)
+{
+    if (command->overflow)
+    {
+        set_error("command too long");
+        return 0;
+    }
+    return redis_append_argv(c, command->argc, command->argv, command->lengths) == REDIS_OK;
+}
+
+// sends a command and waits for its reply, NULL if it could not be built or the connection failed
+redisReply *db_run(redisContext *c, DbCommand *command)
+{
+    if (command->overflow)
+    {
+        set_error("command too long");
+        return NULL;
+    }
+
+    redisReply *reply = redis_command_argv(c, command->argc, command->argv, command->lengths);
+    if (reply == NULL)
+        set_error(c->errstr[0] ? c->errstr : "connection lost");
+    else if (reply->type == REDIS_REPLY_ERROR)
+        set_error(reply->str);
+    return reply;
+}
+
+// reads the replies of queued commands, returns the number that failed, the first error is kept for db_last_error
+int db_submit(redisContext *c, int count)
+{
+    int failed = 0;
+    uint64_t start = stats_now();
+
+    for (int i = 0; i < count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            set_error(c->errstr[0] ? c->errstr : "connection lost");
+            return failed + count - i;
+        }
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+        {
+            if (failed == 0)
+                set_error(reply ? reply->str : "no reply");
+            failed++;
+        }
+        freeReplyObject(reply);
+    }
+
+    if (count > 0)
+    {
+        stats_record_since("redis.pipeline", start);
+    }
+    return failed;
+}
+
+// message of the last failed command
+const char *db_last_error()
+{
+    return last_error[0] ? last_error : "unknown error";
+}
+
+// KEYS --------------------
+int db_key_user(const char *key, char *user, size_t size)
+{
+    const char *open = strchr(key, '{');
+    const char *close = open ? strchr(open + 1, '}') : NULL;
+    if (close == NULL || close == open + 1)
+    {
+        return 0;
+    }
+    snprintf(user, size, "%.*s", (int)(close - open - 1), open + 1);
+    return 1;
+}
+
+int db_key_member(const char *key, char *member, size_t size)
+{
+    const char *open = strchr(key, '{');
+    const char *close = open ? strchr(open + 1, '}') : NULL;
+    if (close == NULL || close == open + 1)
+    {
+        return 0;
+    }
+    snprintf(member, size, "%.*s%s", (int)(close - open - 1), open + 1, close + 1);
+    return 1;
+}
+
+void db_member_key(const char *type, const char *member, char *key, size_t size)
+{
+    int user_length = (int)strcspn(member, ":");
+    snprintf(key, size, "%s:{%.*s}%s", type, user_length, member, member + user_length);
+}
+
+// EVENTS --------------------
+static int packed_writes = -1;
+
+int db_packed_writes()
+{
+    if (packed_writes < 0)
+    {
+        const char *encoding = getenv(DB_ENCODING_ENV);
+        packed_writes = encoding != NULL && strcmp(encoding, "packed") == 0;
+    }
+    return packed_writes;
+}
+
+static void clear_fields(DbEventFields *fields)
+{
+    memset(fields, 0, sizeof(DbEventFields));
+    fields->visibility = -1;
+    fields->start = fields->end = -1;
+    fields->interval = 1;
+    fields->uid = fields->until = fields->exceptions = "";
+}
+
+static int is_packed_field(const char *field)
+{
+    return strcmp(field, DB_PACKED_FIELD) == 0;
+}
+
+static void set_field(DbEventFields *fields, const char *field, const char *value)
+{
+    if (strcmp(field, "visibility") == 0)
+        fields->visibility = atoi(value);
+    else if (strcmp(field, "date") == 0)
+        fields->date = value;
+    else if (strcmp(field, "start") == 0 && !parse_time(value, &fields->start))
+        fields->start = -1;
+    else if (strcmp(field, "end") == 0 && !parse_time(value, &fields->end))
+        fields->end = -1;
+    else if (strcmp(field, "name") == 0)
+        fields->name = value;
+    else if (strcmp(field, "description") == 0)
+        fields->description = value;
+    else if (strcmp(field, "uid") == 0)
+        fields->uid = value;
+    else if (strcmp(field, "frequency") == 0)
+        fields->frequency = parse_frequency(value);
+    else if (strcmp(field, "interval") == 0)
+        fields->interval = atoi(value);
+    else if (strcmp(field, "until") == 0)
+        fields->until = value;
+    else if (strcmp(field, "exceptions") == 0)
+        fields->exceptions = value;
+}
+
+static int complete_fields(DbEventFields *fields)
+{
+    if (fields->start < 0 || fields->end <= fields->start)
+    {
+        fields->start = fields->end = -1;
+    }
+    return fields->visibility != -1 && fields->date && fields->name;
+}
+
+static size_t put_varint(unsigned char *out, size_t value)
+{
+    size_t used = 0;
+    while (value >= 0x80)
+    {
+        out[used++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[used++] = (unsigned char)value;
+    return used;
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, size_t *value)
+{
+    *value = 0;
+    for (int shift = 0; *p < end && shift < 35; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        *value |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+// version 2: version, visibility, frequency, start and end as 16 bit little endian minutes (0xffff all day), the interval as
+// a varint, then date, name, description, uid, until and exceptions, each a varint length, the bytes and a NUL
+// version 1 had the interval as one byte between frequency and start
+char *db_pack_event(const DbEventFields *fields, size_t *length)
+{
+    const char *strings[] = {fields->date, fields->name, fields->description, fields->uid, fields->until, fields->exceptions};
+    size_t count = sizeof(strings) / sizeof(strings[0]);
+    size_t size = DB_PACKED_HEADER + 5;
+    for (size_t i = 0; i < count; i++)
+    {
+        size += 5 + (strings[i] ? strlen(strings[i]) : 0) + 1;
+    }
+
+    unsigned char *value = malloc(size);
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    int start = fields->start < 0 ? 0xffff : fields->start, end = fields->start < 0 ? 0xffff : fields->end;
+    value[0] = DB_PACKED_VERSION;
+    value[1] = (unsigned char)fields->visibility;
+    value[2] = (unsigned char)fields->frequency;
+    value[3] = start & 0xff;
+    value[4] = start >> 8;
+    value[5] = end & 0xff;
+    value[6] = end >> 8;
+
+    size_t used = DB_PACKED_HEADER;
+    used += put_varint(value + used, fields->interval > 0 ? (size_t)fields->interval : 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t string_length = strings[i] ? strlen(strings[i]) : 0;
+        used += put_varint(value + used, string_length);
+        memcpy(value + used, strings[i] ? strings[i] : "", string_length);
+        used += string_length;
+        value[used++] = '\0';
+    }
+    *length = used;
+    return (char *)value;
+}
+
+int db_unpack_event(const char *value, size_t length, DbEventFields *fields)
+{
+    const unsigned char *p = (const unsigned char *)value, *end = p + length;
+    int version = length > 0 ? p[0] : 0;
+    if ((version != 1 && version != DB_PACKED_VERSION) || length < (size_t)(version == 1 ? DB_PACKED_HEADER + 1 : DB_PACKED_HEADER))
+    {
+        return 0;
+    }
+    fields->visibility = p[1];
+    fields->frequency = p[2];
+    p += 3;
+    if (version == 1)
+    {
+        fields->interval = *p++;
+    }
+    fields->start = p[0] | p[1] << 8;
+    fields->end = p[2] | p[3] << 8;
+    if (fields->start == 0xffff)
+    {
+        fields->start = fields->end = -1;
+    }
+    p += 4;
+
+    size_t interval;
+    if (version != 1)
+    {
+        if (!get_varint(&p, end, &interval) || interval < 1 || interval > INT_MAX)
+        {
+            return 0;
+        }
+        fields->interval = (int)interval;
+    }
+
+    // the strings keep their NUL, they are used where they are in the reply
+    const char **strings[] = {&fields->date, &fields->name, &fields->description, &fields->uid, &fields->until, &fields->exceptions};
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++)
+    {
+        size_t string_length;
+        if (!get_varint(&p, end, &string_length) || string_length >= (size_t)(end - p) || p[string_length] != '\0')
+        {
+            return 0;
+        }
+        *strings[i] = (const char *)p;
+        p += string_length + 1;
+    }
+    return 1;
+}
+
+// events the packed encoding has to give back unchanged, the intervals sit on the varint byte boundaries
+static const struct
+{
+    const char *name;
+    int start;
+    int end;
+    int frequency;
+    int interval;
+} known_packings[] = {
+    {"all day", -1, -1, 0, 1},
+    {"timed", 540, 600, 0, 1},
+    {"last minute", 0, 1439, 1, 127},
+    {"interval 128", 60, 120, 2, 128},
+    {"interval 300", 60, 120, 3, 300},
+    {"interval 16383", 60, 120, 1, 16383},
+    {"interval 16384", 60, 120, 1, 16384},
+    {"interval INT_MAX", 60, 120, 1, INT_MAX},
+};
+
+const char *db_check_packing()
+{
+    for (size_t i = 0; i < sizeof(known_packings) / sizeof(known_packings[0]); i++)
+    {
+        DbEventFields fields, unpacked;
+        clear_fields(&fields);
+        fields.visibility = 1;
+        fields.date = "2024-02-29";
+        fields.name = known_packings[i].name;
+        fields.description = "";
+        fields.uid = "uid@example.com";
+        fields.start = known_packings[i].start;
+        fields.end = known_packings[i].end;
+        fields.frequency = known_packings[i].frequency;
+        fields.interval = known_packings[i].interval;
+        fields.until = fields.frequency ? "2025-01-01" : "";
+        fields.exceptions = fields.frequency ? "2024-03-07,2024-03-14" : "";
+
+        size_t length;
+        char *value = db_pack_event(&fields, &length);
+        if (value == NULL)
+        {
+            return known_packings[i].name;
+        }
+        // a value cut short must be refused, the last byte is the NUL of the exceptions
+        int truncated = db_unpack_event(value, length - 1, &unpacked);
+        clear_fields(&unpacked);
+        int same = !truncated && db_unpack_event(value, length, &unpacked) && unpacked.visibility == fields.visibility &&
+                   unpacked.start == fields.start && unpacked.end == fields.end && unpacked.frequency == fields.frequency &&
+                   unpacked.interval == fields.interval && strcmp(unpacked.date, fields.date) == 0 &&
+                   strcmp(unpacked.name, fields.name) == 0 && strcmp(unpacked.description, fields.description) == 0 &&
+                   strcmp(unpacked.uid, fields.uid) == 0 && strcmp(unpacked.until, fields.until) == 0 &&
+                   strcmp(unpacked.exceptions, fields.exceptions) == 0;
+        free(value);
+        if (!same)
+        {
+            return known_packings[i].name;
+        }
+    }
+
+    // version 1 kept the interval in one byte before the times
+    const char version1[] = "\x01\x00\x02\x05\xff\xff\xff\xff\x0a" "2024-01-01\x00\x03old\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+    DbEventFields old;
+    clear_fields(&old);
+    if (!db_unpack_event(version1, sizeof(version1) - 1, &old) || old.interval != 5 || old.start != -1 ||
+        strcmp(old.date, "2024-01-01") != 0 || strcmp(old.name, "old") != 0)
+    {
+        return "version 1";
+    }
+    return NULL;
+}
+
+// reads an event or rule hash, returns 1 if visibility, date and name are present (description may be missing)
+int db_parse_event(const redisReply *reply, DbEventFields *fields)
+{
+    clear_fields(fields);
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements % 2 != 0)
+    {
+        return 0;
+    }
+
+    // a packed value is read first wherever it is in the hash, fields written next to it (skipped occurrences) override it
+    for (size_t j = 0; j < reply->elements; j += 2)
+    {
+        const redisReply *field = reply->element[j], *value = reply->element[j + 1];
+        if (field->str != NULL && value->str != NULL && is_packed_field(field->str) && !db_unpack_event(value->str, value->len, fields))
+        {
+            clear_fields(fields);
+        }
+    }
+    for (size_t j = 0; j < reply->elements; j += 2)
+    {
+        const char *field = reply->element[j]->str, *value = reply->element[j + 1]->str;
+        if (field != NULL && value != NULL && !is_packed_field(field))
+            set_field(fields, field, value);
+    }
+    return complete_fields(fields);
+}
+
+int db_append_event_get(redisContext *c, const char *key, const char *const *names, int count)
+{
+    DbCommand command;
+    db_command_init(&command, "HMGET");
+    db_arg(&command, key);
+    db_arg(&command, DB_PACKED_FIELD);
+    for (int i = 0; i < count; i++)
+    {
+        db_arg(&command, names[i]);
+    }
+    return db_append(c, &command);
+}
+
+int db_parse_event_get(const redisReply *reply, const char *const *names, int count, DbEventFields *fields)
+{
+    clear_fields(fields);
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != (size_t)count + 1)
+    {
+        return 0;
+    }
+
+    int found = 0;
+    const redisReply *packed = reply->element[0];
+    if (packed->type == REDIS_REPLY_STRING)
+    {
+        found = db_unpack_event(packed->str, packed->len, fields);
+        if (!found)
+            clear_fields(fields);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (reply->element[i + 1]->type == REDIS_REPLY_STRING)
+        {
+            set_field(fields, names[i], reply->element[i + 1]->str);
+            found = 1;
+        }
+    }
+    complete_fields(fields);
+    return found;
+}
+
+Event *db_event_from_fields(const DbEventFields *fields, int id)
+{
+    Event *event = create_event(id, fields->visibility, fields->date, fields->name, fields->description);
+    if (event != NULL)
+    {
+        event->start = fields->start;
+        event->end = fields->end;
+    }
+    return event;
+}
+
+// NULL if the hash has no valid rule or memory runs out
+Recurrence *db_recurrence_from_fields(const DbEventFields *fields, int id)
+{
+    if (!fields->frequency)
+    {
+        return NULL;
+    }
+
+    Event *event = db_event_from_fields(fields, id);
+    Recurrence *recurrence = event ? create_recurrence(event, fields->frequency, fields->interval, fields->until, fields->exceptions) : NULL;
+    if (recurrence == NULL && event != NULL)
+    {
+        free_event(event);
+    }
+    return recurrence;
+}
+
+// the fields of an event, a single one has no rule fields
+static void event_fields(const Event *event, const char *uid, DbEventFields *fields)
+{
+    clear_fields(fields);
+    fields->visibility = event->visibility;
+    fields->date = event->date;
+    fields->start = event->start;
+    fields->end = event->end;
+    fields->name = event->name;
+    fields->description = event->description;
+    fields->uid = uid ? uid : "";
+}
+
+int db_put_fields(redisContext *c, const char *key, const DbEventFields *fields, int packed)
+{
+    DbCommand command;
+    db_command_init(&command, "HSET");
+    db_arg(&command, key);
+
+    if (packed)
+    {
+        size_t length;
+        char *value = db_pack_event(fields, &length);
+        if (value == NULL)
+        {
+            set_error("out of memory");
+            return -1;
+        }
+        db_arg(&command, DB_PACKED_FIELD);
+        db_arg_binary(&command, value, length);
+        int queued = db_append(c, &command);
+        free(value);
+        return queued;
+    }
+
+    char start[MAX_TIME_LENGTH] = "", end[MAX_TIME_LENGTH] = "";
+    if (fields->start >= 0)
+    {
+        format_time(fields->start, start);
+        format_time(fields->end, end);
+    }
+    db_arg(&command, "visibility");
+    db_arg_format(&command, "%d", fields->visibility);
+    db_arg(&command, "date");
+    db_arg(&command, fields->date);
+    db_arg(&command, "start");
+    db_arg(&command, start);
+    db_arg(&command, "end");
+    db_arg(&command, end);
+    db_arg(&command, "name");
+    db_arg(&command, fields->name);
+    db_arg(&command, "description");
+    db_arg(&command, fields->description ? fields->description : "");
+    if (fields->frequency)
+    {
+        db_arg(&command, "frequency");
+        db_arg(&command, frequency_name(fields->frequency));
+        db_arg(&command, "interval");
+        db_arg_format(&command, "%d", fields->interval);
+        db_arg(&command, "until");
+        db_arg(&command, fields->until);
+        db_arg(&command, "exceptions");
+        db_arg(&command, fields->exceptions);
+    }
+    if (fields->frequency || fields->uid[0])
+    {
+        db_arg(&command, "uid");
+        db_arg(&command, fields->uid);
+    }
+    return db_append(c, &command);
+}
+
+// queues the hash of a single event, returns the number of queued commands
+int db_put_event(redisContext *c, const char *user, const Event *event, const char *uid)
+{
+    char key[DB_KEY_LENGTH];
+    DbEventFields fields;
+    snprintf(key, sizeof(key), "event:{%s}:%d", user, event->id);
+    event_fields(event, uid, &fields);
+
+    // an event that could not be packed is not queued, like one whose command could not be built
+    int queued = db_put_fields(c, key, &fields, db_packed_writes());
+    return queued < 0 ? 0 : queued;
+}
+
+// queues the hash of a recurring event rule, returns the number of queued commands or -1 if memory runs out
+int db_put_recurrence(redisContext *c, const char *user, const Recurrence *recurrence, const char *uid)
+{
+    char *exceptions = recurrence_join_exceptions(recurrence);
+    if (exceptions == NULL)
+    {
+        return -1;
+    }
+
+    char key[DB_KEY_LENGTH];
+    DbEventFields fields;
+    snprintf(key, sizeof(key), "recurrence:{%s}:%d", user, recurrence->event->id);
+    event_fields(recurrence->event, uid, &fields);
+    fields.frequency = recurrence->frequency;
+    fields.interval = recurrence->interval;
+    fields.until = recurrence->until;
+    fields.exceptions = exceptions;
+
+    int queued = db_put_fields(c, key, &fields, db_packed_writes());
+    free(exceptions);
+    if (queued <= 0)
+    {
+        return queued;
+    }
+
+    DbCommand command;
+    db_command_init(&command, "SADD");
+    db_arg_format(&command, "rules:{%s}", user);
+    db_arg_format(&command, "%d", recurrence->event->id);
+    return queued + db_append(c, &command);
+}
+
+// queues the skipped occurrences of a rule, returns the number of queued commands or -1 if memory runs out
+// a packed rule keeps them as a field of their own that overrides its packed list, so nothing has to be read first
+int db_put_exceptions(redisContext *c, const char *user, const Recurrence *recurrence)
+{
+    char *exceptions = recurrence_join_exceptions(recurrence);
+    if (exceptions == NULL)
+    {
+        return -1;
+    }
+
+    DbCommand command;
+    db_command_init(&command, "HSET");
+    db_arg_format(&command, "recurrence:{%s}:%d", user, recurrence->event->id);
+    db_arg(&command, "exceptions");
+    db_arg(&command, exceptions);
+
+    int queued = db_append(c, &command);
+    free(exceptions);
+    return queued;
+}
+
+// queues the removal of an event or rule hash, a rule also leaves the index of its user, returns the number of queued commands
+int db_delete_event(redisContext *c, const char *user, int id, int recurring)
+{
+    DbCommand command;
+    db_command_init(&command, "DEL");
+    db_arg_format(&command, "%s:{%s}:%d", recurring ? "recurrence" : "event", user, id);
+    int queued = db_append(c, &command);
+    if (recurring)
+    {
+        db_command_init(&command, "SREM");
+        db_arg_format(&command, "rules:{%s}", user);
+        db_arg_format(&command, "%d", id);
+        queued += db_append(c, &command);
+    }
+    return queued;
+}
+
+// keeps an id read from an index or a key in a growing array, returns 0 if memory runs out
+static int keep_id(int **ids, long *count, long *capacity, int id)
+{
+    if (*count == *capacity)
+    {
+        long grown = *capacity ? *capacity * 2 : 64;
+        int *larger = realloc(*ids, grown * sizeof(int));
+        if (larger == NULL)
+        {
+            set_error("out of memory");
+            return 0;
+        }
+        *ids = larger;
+        *capacity = grown;
+    }
+    (*ids)[(*count)++] = id;
+    return 1;
+}
+
+// reads the ids of a user's rules into a malloc'd array, returns their number or -1
+// they come from rules:{<user>} once the rules from before it are in it, until then from a SCAN of the user's node
+static long rule_ids(redisContext *c, const char *user, int **ids)
+{
+    long count = 0, capacity = 0;
+    *ids = NULL;
+
+    DbCommand command;
+    db_command_init(&command, "EXISTS");
+    db_arg(&command, DB_RULES_READY);
+    db_append(c, &command);
+    db_command_init(&command, "SMEMBERS");
+    db_arg_format(&command, "rules:{%s}", user);
+    db_append(c, &command);
+
+    redisReply *ready = NULL, *members = NULL;
+    if (redis_get_reply(c, (void **)&ready) != REDIS_OK || redis_get_reply(c, (void **)&members) != REDIS_OK)
+    {
+        set_error(c->errstr[0] ? c->errstr : "connection lost");
+        freeReplyObject(ready);
+        return -1;
+    }
+    int indexed = ready != NULL && ready->type == REDIS_REPLY_INTEGER && ready->integer == 1;
+    freeReplyObject(ready);
+    if (members == NULL || members->type != REDIS_REPLY_ARRAY)
+    {
+        set_error(members && members->type == REDIS_REPLY_ERROR ? members->str : "no reply");
+        freeReplyObject(members);
+        return -1;
+    }
+    for (size_t i = 0; indexed && i < members->elements; i++)
+    {
+        if (!keep_id(ids, &count, &capacity, atoi(members->element[i]->str)))
+        {
+            freeReplyObject(members);
+            return -1;
+        }
+    }
+    freeReplyObject(members);
+    if (indexed)
+    {
+        return count;
+    }
+
+    char key[DB_KEY_LENGTH], pattern[DB_KEY_LENGTH];
+    snprintf(key, sizeof(key), "rules:{%s}", user);
+    snprintf(pattern, sizeof(pattern), "recurrence:{%s}:*", user);
+    redisContext *node = shard_node(c, shard_node_of(key, strlen(key)));
+    char cursor[32] = "0";
+    do
+    {
+        db_command_init(&command, "SCAN");
+        db_arg(&command, cursor);
+        db_arg(&command, "MATCH");
+        db_arg(&command, pattern);
+        db_arg(&command, "COUNT");
+        db_arg_format(&command, "%d", DB_LOAD_BATCH);
+        redisReply *reply = node ? db_run(node, &command) : NULL;
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+        {
+            freeReplyObject(reply);
+            return -1;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+        // the id is the last part of the key
+        redisReply *keys = reply->element[1];
+        for (size_t i = 0; i < keys->elements; i++)
+        {
+            const char *id = strrchr(keys->element[i]->str, ':');
+            if (id != NULL && id[1] != '\0' && !keep_id(ids, &count, &capacity, atoi(id + 1)))
+            {
+                freeReplyObject(reply);
+                return -1;
+            }
+        }
+        freeReplyObject(reply);
+    } while (strcmp(cursor, "0") != 0);
+    return count;
+}
+
+// reads the ids of a user's single events from their date index into a malloc'd array, returns their number or -1
+static long event_ids(redisContext *c, const char *user, int **ids)
+{
+    long count = 0, capacity = 0;
+    *ids = NULL;
+
+    DbCommand command;
+    db_command_init(&command, "ZRANGE");
+    db_arg_format(&command, "events_by_date:{%s}", user);
+    db_arg(&command, "0");
+    db_arg(&command, "-1");
+    redisReply *members = db_run(c, &command);
+    if (members == NULL || members->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(members);
+        return -1;
+    }
+    for (size_t i = 0; i < members->elements; i++)
+    {
+        if (!keep_id(ids, &count, &capacity, atoi(members->element[i]->str)))
+        {
+            count = -1;
+            break;
+        }
+    }
+    freeReplyObject(members);
+    return count;
+}
+
+// fetches the listed event (or rule) hashes in pipelined batches and hands each to store, returns the number stored or -1
+static int load_hashes(redisContext *c, const char *user, int recurring, const int *ids, long count,
+                       int (*store)(const DbEventFields *fields, int id, int recurring, void *context), void *context)
+{
+    DbCommand command;
+    int stored = 0;
+    for (long first = 0; first < count; first += DB_LOAD_BATCH)
+    {
+        long last = first + DB_LOAD_BATCH < count ? first + DB_LOAD_BATCH : count;
+
+        for (long i = first; i < last; i++)
+        {
+            db_command_init(&command, "HGETALL");
+            db_arg_format(&command, "%s:{%s}:%d", recurring ? "recurrence" : "event", user, ids[i]);
+            db_append(c, &command);
+        }
+
+        for (long i = first; i < last; i++)
+        {
+            redisReply *reply = NULL;
+            if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+            {
+                set_error(c->errstr[0] ? c->errstr : "connection lost");
+                return -1;
+            }
+
+            // an id whose hash was removed meanwhile reads as an empty hash and is skipped
+            DbEventFields fields;
+            if (db_parse_event(reply, &fields))
+            {
+                stored += store(&fields, ids[i], recurring, context);
+            }
+            freeReplyObject(reply);
+        }
+    }
+    return stored;
+}
+
+// hands every event (or rule) hash of a user to store, returns the number stored or -1
+int db_load_events(redisContext *c, const char *user, int recurring, int (*store)(const DbEventFields *fields, int id, int recurring, void *context), void *context)
+{
+    int *ids = NULL;
+    long count = recurring ? rule_ids(c, user, &ids) : event_ids(c, user, &ids);
+    int stored = count < 0 ? -1 : load_hashes(c, user, recurring, ids, count, store, context);
+    free(ids);
+    return stored;
+}
+
+// USERS --------------------
+// reads an account, returns 1 if it exists, 0 if not and -1 on failure
+int db_get_user(redisContext *c, const char *name, DbUser *user)
+{
+    DbCommand command;
+    db_command_init(&command, "HMGET");
+    db_arg_format(&command, "user:{%s}", name);
+    db_arg(&command, "password");
+    db_arg(&command, "created_at");
+
+    redisReply *reply = db_run(c, &command);
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    int found = reply->element[0]->type == REDIS_REPLY_STRING;
+    if (found)
+    {
+        snprintf(user->password, sizeof(user->password), "%s", reply->element[0]->str);
+        user->created_at = reply->element[1]->type == REDIS_REPLY_STRING ? atol(reply->element[1]->str) : 0;
+    }
+    freeReplyObject(reply);
+    return found;
+}
+
+// returns 1 if the account exists, 0 if not and -1 on failure
+int db_user_exists(redisContext *c, const char *name)
+{
+    DbCommand command;
+    db_command_init(&command, "EXISTS");
+    db_arg_format(&command, "user:{%s}", name);
+
+    redisReply *reply = db_run(c, &command);
+    int exists = reply != NULL && reply->type == REDIS_REPLY_INTEGER ? reply->integer == 1 : -1;
+    freeReplyObject(reply);
+    return exists;
+}
+
+// stores an account and adds it to the username index in one pipeline, returns 0 on success
+int db_put_user(redisContext *c, const char *name, const char *password, long created_at)
+{
+    DbCommand command;
+    db_command_init(&command, "HSET");
+    db_arg_format(&command, "user:{%s}", name);
+    db_arg(&command, "password");
+    db_arg(&command, password);
+    db_arg(&command, "created_at");
+    db_arg_format(&command, "%ld", created_at);
+    int queued = db_append(c, &command);
+
+    db_command_init(&command, "ZADD");
+    db_arg(&command, USERS_INDEX);
+    db_arg(&command, "0");
+    db_arg(&command, name);
+    queued += db_append(c, &command);
+
+    // a command that could not be queued fails the whole write, the replies of the ones that were still come back
+    if (queued != 2)
+    {
+        drain_replies(c, queued);
+        return -1;
+    }
+    return db_submit(c, queued) == 0 ? 0 : -1;
+}
+
+int db_append_new_user(redisContext *c, const char *name, const char *password, long created_at)
+{
+    DbCommand command;
+    db_command_init(&command, "EVAL");
+    db_arg(&command, DB_NEW_USER_SCRIPT);
+    db_arg(&command, "1");
+    db_arg_format(&command, "user:{%s}", name);
+    db_arg(&command, password);
+    db_arg_format(&command, "%ld", created_at);
+    if (db_append(c, &command) == 0)
+    {
+        return 0;
+    }
+
+    // the index only holds names, adding one that is there already changes nothing
+    db_command_init(&command, "ZADD");
+    db_arg(&command, USERS_INDEX);
+    db_arg(&command, "0");
+    db_arg(&command, name);
+    return 1 + db_append(c, &command);
+}
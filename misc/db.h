@@ -0,0 +1,141 @@
+#ifndef DB_H
+#define DB_H
+
+#include "common.h"
+#include "recurrence.h"
+
+// command builder parameter
+#define DB_MAX_ARGS 32
+#define DB_STORAGE_LENGTH 512 // formatted arguments such as keys and numbers
+#define DB_KEY_LENGTH 128
+
+// event encoding parameter
+#define DB_ENCODING_ENV "EVENT_ENCODING" // "packed" writes new events and rules as one binary field instead of a field per value
+#define DB_PACKED_FIELD "p"              // the field of a packed event or rule
+#define DB_PACKED_VERSION 2              // first byte of every packed value, version 1 values are still read
+#define DB_PACKED_HEADER 7               // version, visibility, frequency, start and end
+
+#define DB_PASSWORD_LENGTH 128
+
+#define USERS_INDEX "users_lex"            // every username with score 0, ordered lexicographically
+#define DB_RULES_READY "rules_index_ready" // set once the rules from before rules:{<user>} are in it
+
+// argv command under construction, plain arguments are referenced and formatted ones copied into storage
+typedef struct
+{
+    int argc;
+    const char *argv[DB_MAX_ARGS];
+    size_t lengths[DB_MAX_ARGS];
+    char storage[DB_STORAGE_LENGTH];
+    size_t used;
+    int overflow;
+} DbCommand;
+
+// fields of an event or rule hash, strings point into the reply they were parsed from
+typedef struct
+{
+    int visibility;
+    const char *date;
+    int start; // minutes after midnight, -1 for an all-day event
+    int end;
+    const char *name;
+    const char *description;
+    const char *uid;
+    int frequency; // 0 in the hash of a single event
+    int interval;
+    const char *until;
+    const char *exceptions;
+} DbEventFields;
+
+typedef struct
+{
+    char password[DB_PASSWORD_LENGTH]; // base64 of the argon2 hash followed by the salt
+    long created_at;
+} DbUser;
+
+void db_command_init(DbCommand *command, const char *name);
+
+void db_arg(DbCommand *command, const char *value);
+
+void db_arg_binary(DbCommand *command, const void *value, size_t length);
+
+void db_arg_format(DbCommand *command, const char *format, ...);
+
+// queues a command on the pipeline, returns 1 or 0 if it could not be built
+int db_append(redisContext *c, DbCommand *command);
+
+redisReply *db_run(redisContext *c, DbCommand *command);
+
+// reads the replies of count queued commands, returns the number that failed
+int db_submit(redisContext *c, int count);
+
+// message of the last failed command
+const char *db_last_error();
+
+// key layout, every key of a user has the name as hash tag: user:{<user>}, event:{<user>}:<id>, events_by_date:{<user>}, ...
+// rules:{<user>} is the set of the ids of a user's rules
+// copies the user out of a key, returns 0 if the key has no tag
+int db_key_user(const char *key, char *user, size_t size);
+
+// "<type>:{<user>}:<id>" to the "<user>:<id>" member of the feed indexes, returns 0 if the key has no tag
+int db_key_member(const char *key, char *member, size_t size);
+
+// "<user>:<id>" feed member to the key of its hash
+void db_member_key(const char *type, const char *member, char *key, size_t size);
+
+// events and rules, stored as a hash with a field per value or as one packed field, both are read everywhere
+// 1 if EVENT_ENCODING asks for packed writes
+int db_packed_writes();
+
+// encodes an event or rule into a malloc'd value of the packed field, NULL if memory runs out
+char *db_pack_event(const DbEventFields *fields, size_t *length);
+
+// decodes a packed value, the strings point into it, returns 0 if it is not a valid one
+int db_unpack_event(const char *value, size_t length, DbEventFields *fields);
+
+// packs and unpacks some known events, returns NULL if all come back unchanged and else the name of the first that does not
+const char *db_check_packing();
+
+// reads the reply of HGETALL on an event or rule
+int db_parse_event(const redisReply *reply, DbEventFields *fields);
+
+// queues an HMGET of some fields of an event or rule in either encoding, returns the number of queued commands
+int db_append_event_get(redisContext *c, const char *key, const char *const *names, int count);
+
+// reads the reply of db_append_event_get, returns 1 if the event exists (the fields asked for may still be missing)
+int db_parse_event_get(const redisReply *reply, const char *const *names, int count, DbEventFields *fields);
+
+Event *db_event_from_fields(const DbEventFields *fields, int id);
+
+Recurrence *db_recurrence_from_fields(const DbEventFields *fields, int id);
+
+// the put and delete functions queue their command and return the number queued, -1 if memory runs out
+// writes a whole event or rule to key, packed or a field per value, returns -1 if memory runs out
+int db_put_fields(redisContext *c, const char *key, const DbEventFields *fields, int packed);
+
+int db_put_event(redisContext *c, const char *user, const Event *event, const char *uid);
+
+int db_put_recurrence(redisContext *c, const char *user, const Recurrence *recurrence, const char *uid);
+
+int db_put_exceptions(redisContext *c, const char *user, const Recurrence *recurrence);
+
+int db_delete_event(redisContext *c, const char *user, int id, int recurring);
+
+// hands every event (or rule) hash of a user to store, returns the number stored or -1
+// events are read through events_by_date:{<user>}, rules through rules:{<user>} and before DB_RULES_READY is set through a SCAN of the user's node
+int db_load_events(redisContext *c, const char *user, int recurring, int (*store)(const DbEventFields *fields, int id, int recurring, void *context), void *context);
+
+// users
+// 1 if the account exists, 0 if not and -1 on failure
+int db_get_user(redisContext *c, const char *name, DbUser *user);
+
+int db_user_exists(redisContext *c, const char *name);
+
+// stores an account and indexes its name, returns 0 on success
+int db_put_user(redisContext *c, const char *name, const char *password, long created_at);
+
+// queues the creation of an account unless the name is taken, and its username index entry
+// the first reply is 1 if the account was created and 0 if it existed, returns the number of queued commands
+int db_append_new_user(redisContext *c, const char *name, const char *password, long created_at);
+
+#endif
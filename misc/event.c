@@ -0,0 +1,108 @@
+#include "event.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// allocates heap memory for a event
+Event *create_event(int id, int visibility, const char *date, const char *name, const char *description)
+{
+    Event *new_event = (Event *)malloc(sizeof(Event));
+    if (new_event == NULL)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        return NULL;
+    }
+
+    new_event->id = id;
+    new_event->visibility = visibility;
+    new_event->date = strdup(date);
+    new_event->name = strdup(name);
+    new_event->description = strdup(description);
+    new_event->start = -1;
+    new_event->end = -1;
+
+    return new_event;
+}
+
+// function to free an event
+void free_event(Event *event)
+{
+    free(event->date);
+    free(event->name);
+    free(event->description);
+    free(event);
+}
+
+// function to calculate the number of days in the current month
+int get_days_in_month(int month, int year)
+{
+    if (month == 2)
+    { // february
+        if ((year % 4 == 0 && year % 100 != 0) || (year % 400 == 0))
+            return 29; // leap year
+        return 28;
+    }
+    // months with 31 days
+    if (month == 1 || month == 3 || month == 5 || month == 7 ||
+        month == 8 || month == 10 || month == 12)
+        return 31;
+    return 30; // months with 30 days
+}
+
+// splits a YYYY-MM-DD date, returns 1 if it is a valid calendar date
+int parse_date(const char *date, int *year, int *month, int *day)
+{
+    if (sscanf(date, "%d-%d-%d", year, month, day) != 3)
+        return 0;
+    return *year >= 1 && *year <= 9999 && *month >= 1 && *month <= 12 &&
+           *day >= 1 && *day <= get_days_in_month(*month, *year);
+}
+
+// days since 1970-01-01 (proleptic gregorian calendar)
+long date_to_days(int year, int month, int day)
+{
+    long y = year - (month <= 2);
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// inverse of date_to_days
+void days_to_date(long days, int *year, int *month, int *day)
+{
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long doe = days - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+// HH:MM to minutes after midnight, 24:00 is allowed as the end of a day, returns 1 if valid
+int parse_time(const char *text, int *minutes)
+{
+    int hours, mins;
+    char end;
+    if (sscanf(text, "%d:%2d%c", &hours, &mins, &end) != 2 || hours < 0 || mins < 0 || mins > 59)
+        return 0;
+    *minutes = hours * 60 + mins;
+    return *minutes <= MINUTES_PER_DAY;
+}
+
+// minutes after midnight to HH:MM, text holds MAX_TIME_LENGTH bytes
+void format_time(int minutes, char *text)
+{
+    snprintf(text, MAX_TIME_LENGTH, "%02u:%02u", (unsigned)minutes / 60 % 100, (unsigned)minutes % 60);
+}
+
+// 1 if the event has a start and end time
+int event_is_timed(const Event *event)
+{
+    return event->start >= 0 && event->end > event->start;
+}
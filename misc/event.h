@@ -0,0 +1,48 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+// event parameter
+#define MAX_EVENTS 100000
+#define MAX_NAME_LENGTH 50
+#define MAX_DESC_LENGTH 256
+#define MAX_DATE_LENGTH 12
+#define MAX_TIME_LENGTH 6
+#define MINUTES_PER_DAY 1440
+
+// global feed of the public events of all users, members are "<user>:<id>"
+#define PUBLIC_EVENTS_INDEX "public_events"       // single events, scored by yyyymmdd
+#define PUBLIC_RULE_STARTS "{public_rules}:start" // recurring events scored by their first date, expanded when the feed is read
+#define PUBLIC_RULE_ENDS "{public_rules}:end"     // the same rules scored by their until date
+#define PUBLIC_RULE_ENDLESS 99991231              // end score of a rule without until
+
+// structure for an event
+typedef struct
+{
+    int id;
+    int visibility;
+    char *date;
+    char *name;
+    char *description;
+    int start; // minutes after midnight, -1 for an all-day event
+    int end;   // minutes after midnight, later than start and at most MINUTES_PER_DAY
+} Event;
+
+Event *create_event(int id, int visibility, const char *date, const char *name, const char *description);
+
+void free_event(Event *event);
+
+int get_days_in_month(int month, int year);
+
+int parse_date(const char *date, int *year, int *month, int *day);
+
+long date_to_days(int year, int month, int day);
+
+void days_to_date(long days, int *year, int *month, int *day);
+
+int parse_time(const char *text, int *minutes);
+
+void format_time(int minutes, char *text);
+
+int event_is_timed(const Event *event);
+
+#endif
@@ -0,0 +1,371 @@
+#include "ics.h"
+#include "recurrence.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// octets per line before folding (RFC 5545 3.1)
+#define ICS_FOLD_LENGTH 75
+
+void ics_reader_init(IcsReader *reader, FILE *file)
+{
+    memset(reader, 0, sizeof(IcsReader));
+    reader->file = file;
+}
+
+// reads one logical line, joining folded continuation lines, returns 0 at end of file
+static int read_unfolded_line(IcsReader *reader)
+{
+    int length = 0, ch;
+
+    while ((ch = getc(reader->file)) != EOF)
+    {
+        if (ch == '\r')
+            continue;
+        if (ch == '\n')
+        {
+            reader->line_number++;
+            int next = getc(reader->file);
+            if (next == ' ' || next == '\t')
+                continue; // folded line continues
+            if (next != EOF)
+                ungetc(next, reader->file);
+            break;
+        }
+        if (length < ICS_LINE_LENGTH - 1)
+            reader->line[length++] = ch; // overlong lines are truncated
+    }
+
+    reader->line[length] = '\0';
+    return ch != EOF || length > 0;
+}
+
+// splits "NAME;PARAM=x:VALUE", returns the value or NULL for a malformed line
+static char *split_property(char *line, char **params)
+{
+    *params = NULL;
+    int quoted = 0;
+
+    for (char *p = line; *p; p++)
+    {
+        if (*p == '"')
+            quoted = !quoted;
+        else if (*p == ';' && !quoted && *params == NULL)
+        {
+            *p = '\0';
+            *params = p + 1;
+        }
+        else if (*p == ':' && !quoted)
+        {
+            *p = '\0';
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// copies an escaped TEXT value, line breaks become spaces
+static void unescape_text(char *dest, size_t size, const char *value)
+{
+    size_t length = 0;
+
+    for (; *value && length + 1 < size; value++)
+    {
+        char ch = *value;
+        if (ch == '\\' && value[1])
+        {
+            value++;
+            ch = (*value == 'n' || *value == 'N') ? ' ' : *value;
+        }
+        dest[length++] = ch;
+    }
+    dest[length] = '\0';
+}
+
+// converts the YYYYMMDD prefix of a DATE or DATE-TIME value, returns 1 if valid
+static int parse_ics_date(const char *value, char *date)
+{
+    int year, month, day;
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (!isdigit((unsigned char)value[i]))
+            return 0;
+    }
+    if (sscanf(value, "%4d%2d%2d", &year, &month, &day) != 3)
+        return 0;
+
+    snprintf(date, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+    return parse_date(date, &year, &month, &day);
+}
+
+// minutes after midnight of the THHMM part of a DATE-TIME value, -1 for a DATE value
+static int parse_ics_time(const char *value)
+{
+    int hours, minutes;
+    if (value[8] != 'T' || sscanf(value + 9, "%2d%2d", &hours, &minutes) != 2 || hours > 23 || minutes > 59)
+        return -1;
+    return hours * 60 + minutes;
+}
+
+// PT1H30M style durations of at most a day, returns the minutes or 0
+static int parse_ics_duration(const char *value)
+{
+    int minutes = 0, number = 0;
+    if (*value == '+')
+        value++;
+    if (*value++ != 'P')
+        return 0;
+    for (; *value; value++)
+    {
+        if (isdigit((unsigned char)*value))
+            number = number * 10 + (*value - '0');
+        else
+        {
+            if (*value == 'D')
+                minutes += number * MINUTES_PER_DAY;
+            else if (*value == 'H')
+                minutes += number * 60;
+            else if (*value == 'M')
+                minutes += number;
+            else if (*value != 'T' && *value != 'S')
+                return 0;
+            number = 0;
+        }
+    }
+    return minutes;
+}
+
+// FREQ=WEEKLY;INTERVAL=2;UNTIL=20241231 (BYDAY and similar parts are not supported)
+static void parse_rrule(IcsEvent *event, char *value)
+{
+    for (char *part = strtok(value, ";"); part; part = strtok(NULL, ";"))
+    {
+        if (strncmp(part, "FREQ=", 5) == 0)
+        {
+            for (char *p = part + 5; *p; p++)
+                *p = tolower((unsigned char)*p);
+            event->frequency = parse_frequency(part + 5);
+        }
+        else if (strncmp(part, "INTERVAL=", 9) == 0)
+            event->interval = atoi(part + 9);
+        else if (strncmp(part, "COUNT=", 6) == 0)
+            event->count = atoi(part + 6);
+        else if (strncmp(part, "UNTIL=", 6) == 0 && !parse_ics_date(part + 6, event->until))
+            event->until[0] = '\0';
+    }
+    if (event->interval < 1)
+        event->interval = 1;
+}
+
+// EXDATE values may be a comma separated list and the property may repeat
+static void parse_exdate(IcsEvent *event, char *value)
+{
+    char date[MAX_DATE_LENGTH];
+
+    for (char *part = strtok(value, ","); part; part = strtok(NULL, ","))
+    {
+        size_t length = strlen(event->exceptions);
+        if (parse_ics_date(part, date) && length + MAX_DATE_LENGTH < sizeof(event->exceptions))
+        {
+            snprintf(event->exceptions + length, sizeof(event->exceptions) - length, "%s%s", length ? "," : "", date);
+        }
+    }
+}
+
+static void apply_property(IcsEvent *event, const char *name, char *value)
+{
+    if (strcmp(name, "UID") == 0)
+        snprintf(event->uid, sizeof(event->uid), "%s", value);
+    else if (strcmp(name, "DTSTART") == 0)
+    {
+        if (!parse_ics_date(value, event->date))
+            event->date[0] = '\0';
+        else
+            event->start = parse_ics_time(value);
+    }
+    else if (strcmp(name, "DTEND") == 0)
+    {
+        if (parse_ics_date(value, event->end_date))
+            event->end = parse_ics_time(value);
+    }
+    else if (strcmp(name, "DURATION") == 0)
+        event->duration = parse_ics_duration(value);
+    else if (strcmp(name, "SUMMARY") == 0)
+        unescape_text(event->name, sizeof(event->name), value);
+    else if (strcmp(name, "DESCRIPTION") == 0)
+        unescape_text(event->description, sizeof(event->description), value);
+    else if (strcmp(name, "CLASS") == 0)
+        event->visibility = strcmp(value, "PUBLIC") != 0;
+    else if (strcmp(name, "RRULE") == 0)
+        parse_rrule(event, value);
+    else if (strcmp(name, "EXDATE") == 0)
+        parse_exdate(event, value);
+}
+
+// reads the next VEVENT, returns 1 for an event and 0 at end of file
+int ics_read_event(IcsReader *reader, IcsEvent *event)
+{
+    int depth = 0; // nesting inside the current VEVENT, e.g. VALARM
+
+    while (read_unfolded_line(reader))
+    {
+        char *params;
+        char *value = split_property(reader->line, &params);
+        if (value == NULL)
+            continue;
+
+        char *name = reader->line;
+        for (char *p = name; *p; p++)
+            *p = toupper((unsigned char)*p);
+
+        if (strcmp(name, "BEGIN") == 0)
+        {
+            if (depth == 0 && strcmp(value, "VEVENT") == 0)
+            {
+                memset(event, 0, sizeof(IcsEvent));
+                event->visibility = 1; // private unless CLASS:PUBLIC
+                event->start = -1;
+                event->end = -1;
+                depth = 1;
+            }
+            else if (depth > 0)
+                depth++;
+        }
+        else if (strcmp(name, "END") == 0 && depth > 0)
+        {
+            if (--depth == 0)
+            {
+                if (event->date[0] && event->name[0])
+                {
+                    // an end on a later day runs to midnight, the calendar has no multi-day events
+                    if (event->end_date[0] && strcmp(event->end_date, event->date) != 0)
+                        event->end = event->start >= 0 && event->end >= 0 ? MINUTES_PER_DAY : -1;
+                    else if (!event->end_date[0] && event->start >= 0 && event->duration > 0)
+                        event->end = event->start + event->duration < MINUTES_PER_DAY ? event->start + event->duration : MINUTES_PER_DAY;
+                    if (event->start < 0 || event->end <= event->start || event->end > MINUTES_PER_DAY)
+                        event->start = event->end = -1;
+                    if (event->description[0] == '\0')
+                        snprintf(event->description, sizeof(event->description), "-");
+                    return 1;
+                }
+                reader->skipped++;
+            }
+        }
+        else if (depth == 1)
+        {
+            apply_property(event, name, value);
+        }
+    }
+    return 0;
+}
+
+// writes one property with TEXT escaping and line folding
+static void write_property(FILE *file, const char *name, const char *value, int escape)
+{
+    char line[ICS_LINE_LENGTH * 2];
+    size_t length = snprintf(line, sizeof(line), "%s:", name);
+
+    for (; *value && length + 3 < sizeof(line); value++)
+    {
+        if (escape && (*value == '\\' || *value == ';' || *value == ','))
+            line[length++] = '\\';
+        line[length++] = *value;
+    }
+    line[length] = '\0';
+
+    size_t column = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        // fold before the limit, never inside a UTF-8 sequence
+        if (column >= ICS_FOLD_LENGTH - 1 && ((unsigned char)line[i] & 0xC0) != 0x80)
+        {
+            fputs("\r\n ", file);
+            column = 1;
+        }
+        putc(line[i], file);
+        column++;
+    }
+    fputs("\r\n", file);
+}
+
+// date in the compact DATE form
+static void compact_date(const char *date, char *out)
+{
+    int year, month, day;
+    if (sscanf(date, "%d-%d-%d", &year, &month, &day) == 3)
+        snprintf(out, 9, "%04d%02d%02d", year, month, day);
+    else
+        out[0] = '\0';
+}
+
+void ics_write_begin(FILE *file)
+{
+    fputs("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//Command Line Calendar//EN\r\n", file);
+}
+
+void ics_write_event(FILE *file, const IcsEvent *event)
+{
+    char stamp[32], date[9], value[ICS_EXCEPTIONS_LENGTH];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", gmtime(&now));
+
+    fputs("BEGIN:VEVENT\r\n", file);
+    write_property(file, "UID", event->uid, 0);
+    write_property(file, "DTSTAMP", stamp, 0);
+    compact_date(event->date, date);
+    if (event->start >= 0 && event->end > event->start)
+    {
+        // floating local times, the calendar has no time zones
+        char date_time[20];
+        snprintf(date_time, sizeof(date_time), "%.8sT%02u%02u00", date, (unsigned)event->start / 60 % 24, (unsigned)event->start % 60);
+        write_property(file, "DTSTART", date_time, 0);
+        if (event->end < MINUTES_PER_DAY)
+        {
+            snprintf(date_time, sizeof(date_time), "%.8sT%02u%02u00", date, (unsigned)event->end / 60 % 24, (unsigned)event->end % 60);
+            write_property(file, "DTEND", date_time, 0);
+        }
+        else
+        {
+            snprintf(date_time, sizeof(date_time), "PT%dM", event->end - event->start);
+            write_property(file, "DURATION", date_time, 0);
+        }
+    }
+    else
+    {
+        write_property(file, "DTSTART;VALUE=DATE", date, 0);
+    }
+    write_property(file, "SUMMARY", event->name, 1);
+    write_property(file, "DESCRIPTION", event->description, 1);
+    write_property(file, "CLASS", event->visibility ? "PRIVATE" : "PUBLIC", 0);
+
+    if (event->frequency)
+    {
+        int length = snprintf(value, sizeof(value), "FREQ=%s;INTERVAL=%d", frequency_name(event->frequency), event->interval);
+        for (int i = 5; value[i] && value[i] != ';'; i++)
+            value[i] = toupper((unsigned char)value[i]);
+        if (event->until[0])
+        {
+            compact_date(event->until, date);
+            snprintf(value + length, sizeof(value) - length, ";UNTIL=%s", date);
+        }
+        write_property(file, "RRULE", value, 0);
+
+        // one EXDATE per skipped occurrence keeps the lines short
+        char exceptions[ICS_EXCEPTIONS_LENGTH];
+        snprintf(exceptions, sizeof(exceptions), "%s", event->exceptions);
+        for (char *part = strtok(exceptions, ","); part; part = strtok(NULL, ","))
+        {
+            compact_date(part, date);
+            write_property(file, "EXDATE;VALUE=DATE", date, 0);
+        }
+    }
+
+    fputs("END:VEVENT\r\n", file);
+}
+
+void ics_write_end(FILE *file)
+{
+    fputs("END:VCALENDAR\r\n", file);
+}
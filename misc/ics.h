@@ -0,0 +1,50 @@
+#ifndef ICS_H
+#define ICS_H
+
+#include <stdio.h>
+#include "event.h"
+
+// iCalendar parameter
+#define ICS_LINE_LENGTH 1024
+#define ICS_UID_LENGTH 256
+#define ICS_EXCEPTIONS_LENGTH 1024
+
+// one VEVENT, fields that do not fit are truncated
+typedef struct
+{
+    char uid[ICS_UID_LENGTH];
+    char date[MAX_DATE_LENGTH];
+    int start; // minutes after midnight, -1 for an all-day event
+    int end;
+    char end_date[MAX_DATE_LENGTH]; // date of DTEND, resolved with DURATION once the whole VEVENT is read
+    int duration;
+    char name[MAX_NAME_LENGTH];
+    char description[MAX_DESC_LENGTH];
+    int visibility;
+    int frequency; // REPEAT_* from recurrence.h, 0 for a single event
+    int interval;
+    int count;     // number of occurrences of the rule, 0 if not limited by count
+    char until[MAX_DATE_LENGTH];
+    char exceptions[ICS_EXCEPTIONS_LENGTH]; // comma separated dates
+} IcsEvent;
+
+// streaming reader, only the current (unfolded) line is kept in memory
+typedef struct
+{
+    FILE *file;
+    char line[ICS_LINE_LENGTH];
+    long line_number;
+    long skipped; // VEVENTs without a usable DTSTART or SUMMARY
+} IcsReader;
+
+void ics_reader_init(IcsReader *reader, FILE *file);
+
+int ics_read_event(IcsReader *reader, IcsEvent *event);
+
+void ics_write_begin(FILE *file);
+
+void ics_write_event(FILE *file, const IcsEvent *event);
+
+void ics_write_end(FILE *file);
+
+#endif
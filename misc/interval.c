@@ -0,0 +1,308 @@
+#include "interval.h"
+#include <stdlib.h>
+
+// orders nodes by start first and by id for events starting at the same minute
+static int compare_key(const IntervalNode *node, long start, int id)
+{
+    if (node->start != start)
+        return node->start > start ? 1 : -1;
+    return (node->event->id > id) - (node->event->id < id);
+}
+
+// xorshift like the timeline, keeps rand() untouched
+static unsigned int random_priority(IntervalIndex *index)
+{
+    index->seed ^= index->seed << 13;
+    index->seed ^= index->seed >> 17;
+    index->seed ^= index->seed << 5;
+    return index->seed;
+}
+
+static void update_max(IntervalNode *node)
+{
+    node->max_end = node->end;
+    if (node->left && node->left->max_end > node->max_end)
+        node->max_end = node->left->max_end;
+    if (node->right && node->right->max_end > node->max_end)
+        node->max_end = node->right->max_end;
+}
+
+static IntervalNode *rotate_right(IntervalNode *node)
+{
+    IntervalNode *left = node->left;
+    node->left = left->right;
+    left->right = node;
+    update_max(node);
+    update_max(left);
+    return left;
+}
+
+static IntervalNode *rotate_left(IntervalNode *node)
+{
+    IntervalNode *right = node->right;
+    node->right = right->left;
+    right->left = node;
+    update_max(node);
+    update_max(right);
+    return right;
+}
+
+static IntervalNode *insert_node(IntervalNode *root, IntervalNode *node)
+{
+    if (root == NULL)
+        return node;
+
+    if (compare_key(root, node->start, node->event->id) > 0)
+    {
+        root->left = insert_node(root->left, node);
+        if (root->left->priority > root->priority)
+            root = rotate_right(root);
+    }
+    else
+    {
+        root->right = insert_node(root->right, node);
+        if (root->right->priority > root->priority)
+            root = rotate_left(root);
+    }
+    update_max(root);
+    return root;
+}
+
+// removes the node with the key, *removed is set to it
+static IntervalNode *remove_node(IntervalNode *root, long start, int id, IntervalNode **removed)
+{
+    if (root == NULL)
+        return NULL;
+
+    int cmp = compare_key(root, start, id);
+    if (cmp > 0)
+        root->left = remove_node(root->left, start, id, removed);
+    else if (cmp < 0)
+        root->right = remove_node(root->right, start, id, removed);
+    else
+    {
+        // rotate the node down until it has at most one child
+        if (root->left == NULL || root->right == NULL)
+        {
+            *removed = root;
+            return root->left ? root->left : root->right;
+        }
+        if (root->left->priority > root->right->priority)
+        {
+            root = rotate_right(root);
+            root->right = remove_node(root->right, start, id, removed);
+        }
+        else
+        {
+            root = rotate_left(root);
+            root->left = remove_node(root->left, start, id, removed);
+        }
+    }
+    update_max(root);
+    return root;
+}
+
+// subtrees that end before the query or start after it are skipped
+static void collect(const IntervalNode *node, long start, long end, Event **results, int max, int *count)
+{
+    if (node == NULL || node->max_end <= start)
+        return;
+
+    collect(node->left, start, end, results, max, count);
+    if (node->start >= end)
+        return;
+    if (node->end > start)
+    {
+        if (*count < max)
+            results[*count] = node->event;
+        (*count)++;
+    }
+    collect(node->right, start, end, results, max, count);
+}
+
+static void free_nodes(IntervalNode *node)
+{
+    if (node == NULL)
+        return;
+    free_nodes(node->left);
+    free_nodes(node->right);
+    free(node);
+}
+
+void interval_init(IntervalIndex *index)
+{
+    index->root = NULL;
+    index->count = 0;
+    index->seed = 0x9e3779b9u;
+}
+
+// minutes since 1970 covered by a timed event on a date, returns 0 for an all-day event
+int interval_span(const Event *event, const char *date, long *start, long *end)
+{
+    int year, month, day;
+    if (!event_is_timed(event) || !parse_date(date, &year, &month, &day))
+        return 0;
+
+    long midnight = date_to_days(year, month, day) * MINUTES_PER_DAY;
+    *start = midnight + event->start;
+    *end = midnight + event->end;
+    return 1;
+}
+
+// adds a timed event, all-day events are not indexed, returns -1 if memory runs out
+int interval_insert(IntervalIndex *index, Event *event)
+{
+    long start, end;
+    if (!interval_span(event, event->date, &start, &end))
+        return 0;
+
+    IntervalNode *node = calloc(1, sizeof(IntervalNode));
+    if (node == NULL)
+        return -1;
+    node->event = event;
+    node->start = start;
+    node->end = end;
+    node->max_end = end;
+    node->priority = random_priority(index);
+
+    index->root = insert_node(index->root, node);
+    index->count++;
+    return 0;
+}
+
+void interval_remove(IntervalIndex *index, const Event *event)
+{
+    long start, end;
+    if (!interval_span(event, event->date, &start, &end))
+        return;
+
+    IntervalNode *removed = NULL;
+    index->root = remove_node(index->root, start, event->id, &removed);
+    if (removed != NULL)
+    {
+        free(removed);
+        index->count--;
+    }
+}
+
+// events overlapping [start, end) in start order, up to max are stored, returns how many overlap
+int interval_overlapping(const IntervalIndex *index, long start, long end, Event **results, int max)
+{
+    int count = 0;
+    collect(index->root, start, end, results, max, &count);
+    return count;
+}
+
+void interval_clear(IntervalIndex *index)
+{
+    free_nodes(index->root);
+    interval_init(index);
+}
+
+// events and windows the overlap query is compared on against a plain scan, with touching ends, nesting and neighbouring dates
+static const struct
+{
+    int id;
+    const char *date;
+    int start;
+    int end;
+} known_events[] = {
+    {1, "2024-03-10", 540, 600},
+    {2, "2024-03-10", 540, 720}, // same start, later end
+    {3, "2024-03-10", 600, 660}, // starts where 1 ends
+    {4, "2024-03-10", 0, 1440},
+    {5, "2024-03-10", 1380, 1440},
+    {6, "2024-03-11", 0, 30},
+    {7, "2024-03-11", 570, 575},
+    {8, "2024-03-09", 1200, 1440},
+    {9, "2024-03-10", -1, -1}, // all day, never indexed
+    {10, "2024-02-29", 60, 120},
+    {11, "2024-03-10", 599, 601},
+    {12, "2024-03-12", 540, 600},
+};
+
+static const struct
+{
+    const char *name;
+    const char *date;
+    int start; // minutes after midnight of the date, the end may run into the next days
+    int end;
+} known_windows[] = {
+    {"morning", "2024-03-10", 540, 600},
+    {"touching end", "2024-03-10", 600, 601},
+    {"single minute", "2024-03-10", 599, 600},
+    {"before midnight", "2024-03-10", 1439, 1440},
+    {"across midnight", "2024-03-10", 1400, 1480},
+    {"whole week", "2024-03-07", 0, 7 * MINUTES_PER_DAY},
+    {"leap day", "2024-02-29", 0, MINUTES_PER_DAY},
+    {"empty day", "2024-03-13", 0, MINUTES_PER_DAY},
+    {"empty window", "2024-03-10", 600, 600},
+};
+
+// compares interval_overlapping with a scan over the events still in the index, returns the first window they differ on
+static const char *check_windows(const IntervalIndex *index, Event *events, const int *indexed, int count)
+{
+    for (size_t i = 0; i < sizeof(known_windows) / sizeof(known_windows[0]); i++)
+    {
+        int year, month, day;
+        parse_date(known_windows[i].date, &year, &month, &day);
+        long midnight = date_to_days(year, month, day) * MINUTES_PER_DAY;
+        long start = midnight + known_windows[i].start, end = midnight + known_windows[i].end;
+
+        Event *results[sizeof(known_events) / sizeof(known_events[0])];
+        int found = interval_overlapping(index, start, end, results, count);
+        int expected = 0;
+        for (int j = 0; j < count; j++)
+        {
+            long event_start, event_end;
+            if (indexed[j] && interval_span(&events[j], events[j].date, &event_start, &event_end) && event_start < end &&
+                event_end > start)
+            {
+                expected++;
+                int listed = 0;
+                for (int k = 0; k < found && k < count; k++)
+                    listed |= results[k] == &events[j];
+                if (!listed)
+                    return known_windows[i].name;
+            }
+        }
+        if (found != expected)
+            return known_windows[i].name;
+    }
+    return NULL;
+}
+
+const char *interval_check()
+{
+    int count = sizeof(known_events) / sizeof(known_events[0]);
+    Event events[sizeof(known_events) / sizeof(known_events[0])];
+    int indexed[sizeof(known_events) / sizeof(known_events[0])];
+    IntervalIndex index;
+    interval_init(&index);
+    for (int i = 0; i < count; i++)
+    {
+        events[i] = (Event){known_events[i].id, 1, (char *)known_events[i].date, "", "", known_events[i].start, known_events[i].end};
+        indexed[i] = 1;
+        if (interval_insert(&index, &events[i]) < 0)
+        {
+            interval_clear(&index);
+            return "insert";
+        }
+    }
+    const char *failed = NULL;
+    if (index.count != count - 1)
+        failed = "all-day event indexed";
+    else if ((failed = check_windows(&index, events, indexed, count)) == NULL)
+    {
+        // removing from the middle and the ends must keep the latest end of every subtree right
+        int removed[] = {1, 3, 7};
+        for (size_t i = 0; i < sizeof(removed) / sizeof(removed[0]); i++)
+        {
+            interval_remove(&index, &events[removed[i]]);
+            indexed[removed[i]] = 0;
+        }
+        failed = index.count != count - 4 ? "remove" : check_windows(&index, events, indexed, count);
+    }
+    interval_clear(&index);
+    return failed;
+}
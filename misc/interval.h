@@ -0,0 +1,42 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include "event.h"
+
+// node of the interval treap, keyed by (start, id) and augmented with the latest end below it
+typedef struct IntervalNode
+{
+    Event *event;
+    long start; // minutes since 1970-01-01
+    long end;
+    long max_end;
+    unsigned int priority;
+    struct IntervalNode *left;
+    struct IntervalNode *right;
+} IntervalNode;
+
+// timed single events, answers overlap queries in O(log n + k)
+typedef struct
+{
+    IntervalNode *root;
+    int count;
+    unsigned int seed;
+} IntervalIndex;
+
+void interval_init(IntervalIndex *index);
+
+int interval_span(const Event *event, const char *date, long *start, long *end);
+
+int interval_insert(IntervalIndex *index, Event *event);
+
+void interval_remove(IntervalIndex *index, const Event *event);
+
+int interval_overlapping(const IntervalIndex *index, long start, long end, Event **results, int max);
+
+void interval_clear(IntervalIndex *index);
+
+// runs overlap queries over some known events against a plain scan, returns NULL if all agree and else the name of the first
+// failing case
+const char *interval_check();
+
+#endif
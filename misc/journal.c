@@ -0,0 +1,411 @@
+#include "journal.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// file layout: one frame per change, a frame is a header, the record and its strings (no terminators)
+typedef struct
+{
+    uint32_t length;   // bytes after the header
+    uint32_t checksum; // FNV-1a over those bytes
+} JournalFrame;
+
+typedef struct
+{
+    int32_t id;
+    uint8_t op;
+    uint8_t kind; // 1 for a rule
+    uint8_t visibility;
+    uint8_t frequency;
+    uint16_t interval;
+    int16_t start; // minutes after midnight, -1 for an all-day event
+    int16_t end;
+    uint16_t date_length;
+    uint16_t name_length;
+    uint16_t description_length;
+    uint16_t until_length;
+    uint16_t skipped_length;
+    uint32_t exceptions_length;
+} JournalRecord;
+
+static uint32_t checksum_update(uint32_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// makes room for length more bytes in the buffer
+static int reserve(Journal *journal, size_t length)
+{
+    if (journal->used + length <= journal->size)
+        return 0;
+
+    size_t size = journal->size ? journal->size : 4096;
+    while (size < journal->used + length)
+        size *= 2;
+    char *grown = realloc(journal->buffer, size);
+    if (grown == NULL)
+        return -1;
+    journal->buffer = grown;
+    journal->size = size;
+    return 0;
+}
+
+static void put(Journal *journal, const void *data, size_t length)
+{
+    memcpy(journal->buffer + journal->used, data, length);
+    journal->used += length;
+}
+
+int journal_append(Journal *journal, int op, const Event *event, const Recurrence *recurrence, const char *skipped)
+{
+    char *exceptions = recurrence ? recurrence_join_exceptions(recurrence) : NULL;
+    if (recurrence && exceptions == NULL)
+    {
+        return -1;
+    }
+
+    JournalRecord record = {0};
+    record.id = event->id;
+    record.op = op;
+    record.kind = recurrence != NULL;
+    record.visibility = event->visibility;
+    record.start = event->start;
+    record.end = event->end;
+    record.date_length = strlen(event->date);
+    record.name_length = strlen(event->name);
+    record.description_length = strlen(event->description);
+    record.skipped_length = skipped ? strlen(skipped) : 0;
+    if (recurrence)
+    {
+        record.frequency = recurrence->frequency;
+        record.interval = recurrence->interval;
+        record.until_length = strlen(recurrence->until);
+        record.exceptions_length = strlen(exceptions);
+    }
+
+    JournalFrame frame;
+    frame.length = sizeof(record) + record.date_length + record.name_length + record.description_length +
+                   record.until_length + record.exceptions_length + record.skipped_length;
+    if (reserve(journal, sizeof(frame) + frame.length) != 0)
+    {
+        free(exceptions);
+        return -1;
+    }
+
+    // the frame header is filled in once the checksum is known
+    size_t start = journal->used;
+    journal->used += sizeof(frame);
+    put(journal, &record, sizeof(record));
+    put(journal, event->date, record.date_length);
+    put(journal, event->name, record.name_length);
+    put(journal, event->description, record.description_length);
+    if (recurrence)
+    {
+        put(journal, recurrence->until, record.until_length);
+        put(journal, exceptions, record.exceptions_length);
+    }
+    if (skipped)
+    {
+        put(journal, skipped, record.skipped_length);
+    }
+    free(exceptions);
+
+    frame.checksum = checksum_update(2166136261u, journal->buffer + start + sizeof(frame), frame.length);
+    memcpy(journal->buffer + start, &frame, sizeof(frame));
+    return 0;
+}
+
+// copies length bytes at *offset into the next terminated string of the scratch space
+static const char *take(const unsigned char *data, size_t *offset, size_t length, char **scratch)
+{
+    char *text = *scratch;
+    memcpy(text, data + *offset, length);
+    text[length] = '\0';
+    *offset += length;
+    *scratch += length + 1;
+    return text;
+}
+
+// decodes one record and hands it to apply, returns its result
+static int apply_record(const unsigned char *data, size_t length, int (*apply)(const JournalEntry *, void *), void *context)
+{
+    JournalRecord record;
+    if (length < sizeof(record))
+        return -1;
+    memcpy(&record, data, sizeof(record));
+    if (sizeof(record) + (size_t)record.date_length + record.name_length + record.description_length +
+            record.until_length + record.exceptions_length + record.skipped_length != length)
+        return -1;
+
+    char *strings = malloc(length + 6), *scratch = strings;
+    if (strings == NULL)
+        return -1;
+
+    JournalEntry entry = {0};
+    size_t offset = sizeof(record);
+    entry.op = record.op;
+    entry.id = record.id;
+    entry.recurring = record.kind;
+    entry.fields.visibility = record.visibility;
+    entry.fields.start = record.start;
+    entry.fields.end = record.end;
+    entry.fields.frequency = record.frequency;
+    entry.fields.interval = record.interval;
+    entry.fields.date = take(data, &offset, record.date_length, &scratch);
+    entry.fields.name = take(data, &offset, record.name_length, &scratch);
+    entry.fields.description = take(data, &offset, record.description_length, &scratch);
+    entry.fields.uid = "";
+    entry.fields.until = take(data, &offset, record.until_length, &scratch);
+    entry.fields.exceptions = take(data, &offset, record.exceptions_length, &scratch);
+    entry.skipped = take(data, &offset, record.skipped_length, &scratch);
+
+    int result = apply(&entry, context);
+    free(strings);
+    return result;
+}
+
+// walks the complete frames from the start of the file, returns the offset after the last good one
+// with apply set every record is applied, *failed is set and the walk stops if one fails
+static size_t scan(const unsigned char *data, size_t size, int *count, int (*apply)(const JournalEntry *, void *), void *context, int *failed)
+{
+    size_t offset = 0;
+    *count = 0;
+
+    while (offset + sizeof(JournalFrame) <= size)
+    {
+        JournalFrame frame;
+        memcpy(&frame, data + offset, sizeof(frame));
+        if (frame.length > size - offset - sizeof(frame) ||
+            checksum_update(2166136261u, data + offset + sizeof(frame), frame.length) != frame.checksum)
+        {
+            break;
+        }
+        if (apply && apply_record(data + offset + sizeof(frame), frame.length, apply, context) < 0)
+        {
+            *failed = 1;
+            break;
+        }
+        offset += sizeof(frame) + frame.length;
+        (*count)++;
+    }
+    return offset;
+}
+
+// reads the whole file, the caller holds the lock and frees the data
+static unsigned char *read_all(int fd, size_t *size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return NULL;
+
+    *size = st.st_size;
+    unsigned char *data = malloc(*size ? *size : 1);
+    size_t done = 0;
+    while (data != NULL && done < *size)
+    {
+        ssize_t got = pread(fd, data + done, *size - done, done);
+        if (got <= 0)
+        {
+            free(data);
+            return NULL;
+        }
+        done += got;
+    }
+    return data;
+}
+
+int journal_open(Journal *journal, const char *path)
+{
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (journal->fd < 0)
+    {
+        return -1;
+    }
+
+    flock(journal->fd, LOCK_EX);
+    size_t size;
+    unsigned char *data = read_all(journal->fd, &size);
+    if (data != NULL)
+    {
+        size_t end = scan(data, size, &journal->records, NULL, NULL, NULL);
+        if (end < size && ftruncate(journal->fd, end) == 0)
+        {
+            fsync(journal->fd);
+        }
+        free(data);
+    }
+    flock(journal->fd, LOCK_UN);
+
+    if (data == NULL)
+    {
+        close(journal->fd);
+        journal->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void journal_close(Journal *journal)
+{
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+    free(journal->buffer);
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = -1;
+}
+
+int journal_sync(Journal *journal)
+{
+    if (journal->used == 0)
+    {
+        return 0;
+    }
+    if (journal->fd < 0)
+    {
+        return -1;
+    }
+
+    flock(journal->fd, LOCK_EX);
+    off_t start = lseek(journal->fd, 0, SEEK_END);
+    size_t done = 0;
+    while (done < journal->used)
+    {
+        ssize_t written = write(journal->fd, journal->buffer + done, journal->used - done);
+        if (written <= 0)
+            break;
+        done += written;
+    }
+
+    int result = done == journal->used && fdatasync(journal->fd) == 0 ? 0 : -1;
+    if (result != 0)
+    {
+        // a half written frame would hide the frames appended after it
+        if (start >= 0)
+            ftruncate(journal->fd, start);
+    }
+    else
+    {
+        int count;
+        scan((const unsigned char *)journal->buffer, journal->used, &count, NULL, NULL, NULL);
+        journal->records += count;
+        journal->used = 0;
+    }
+    flock(journal->fd, LOCK_UN);
+    return result;
+}
+
+void journal_discard(Journal *journal)
+{
+    journal->used = 0;
+}
+
+int journal_replay(Journal *journal, int (*apply)(const JournalEntry *entry, void *context), void *context, int clear)
+{
+    if (journal->fd < 0)
+    {
+        return 0;
+    }
+
+    flock(journal->fd, LOCK_EX);
+    size_t size;
+    unsigned char *data = read_all(journal->fd, &size);
+    int count = 0, failed = data == NULL;
+    if (data != NULL)
+    {
+        scan(data, size, &count, apply, context, &failed);
+        free(data);
+    }
+    if (!failed && clear && ftruncate(journal->fd, 0) == 0)
+    {
+        fsync(journal->fd);
+        journal->records = 0;
+    }
+    flock(journal->fd, LOCK_UN);
+    return failed ? -1 : count;
+}
+
+// the two records journal_check writes, a timed event and a rule with a skipped occurrence
+static const JournalEntry known_records[] = {
+    {JOURNAL_ADD, 7, 0, {1, "2024-03-10", 540, 600, "standup", "daily sync", "", 0, 0, "", ""}, ""},
+    {JOURNAL_SKIP, 8, 1, {0, "2024-02-29", -1, -1, "review", "", "", REPEAT_WEEKLY, 2, "2025-01-01", "2024-03-14,2024-03-28"}, "2024-03-28"},
+};
+
+// the apply function of journal_check, fails on a record that does not read back as it was written
+static int check_record(const JournalEntry *entry, void *context)
+{
+    int *next = context;
+    if (*next >= 2)
+        return -1;
+    const JournalEntry *known = &known_records[(*next)++];
+    const DbEventFields *fields = &entry->fields;
+    int same = entry->op == known->op && entry->id == known->id && entry->recurring == known->recurring &&
+               fields->visibility == known->fields.visibility && fields->start == known->fields.start &&
+               fields->end == known->fields.end && fields->frequency == known->fields.frequency &&
+               fields->interval == known->fields.interval && strcmp(fields->date, known->fields.date) == 0 &&
+               strcmp(fields->name, known->fields.name) == 0 && strcmp(fields->description, known->fields.description) == 0 &&
+               strcmp(fields->until, known->fields.until) == 0 && strcmp(fields->exceptions, known->fields.exceptions) == 0 &&
+               strcmp(entry->skipped, known->skipped) == 0;
+    return same ? 0 : -1;
+}
+
+const char *journal_check()
+{
+    Journal journal = {-1, NULL, 0, 0, 0};
+    Event events[2];
+    for (int i = 0; i < 2; i++)
+    {
+        const DbEventFields *fields = &known_records[i].fields;
+        events[i] = (Event){known_records[i].id, fields->visibility, (char *)fields->date, (char *)fields->name,
+                            (char *)fields->description, fields->start, fields->end};
+    }
+    char exceptions[][MAX_DATE_LENGTH] = {"2024-03-14", "2024-03-28"};
+    Recurrence rule = {0};
+    rule.event = &events[1];
+    rule.frequency = known_records[1].fields.frequency;
+    rule.interval = known_records[1].fields.interval;
+    snprintf(rule.until, sizeof(rule.until), "%s", known_records[1].fields.until);
+    rule.exceptions = exceptions;
+    rule.exception_count = 2;
+    if (journal_append(&journal, JOURNAL_ADD, &events[0], NULL, NULL) != 0 ||
+        journal_append(&journal, JOURNAL_SKIP, &events[1], &rule, "2024-03-28") != 0)
+    {
+        free(journal.buffer);
+        return "append";
+    }
+
+    const unsigned char *data = (const unsigned char *)journal.buffer;
+    JournalFrame first;
+    memcpy(&first, data, sizeof(first));
+    size_t first_end = sizeof(first) + first.length;
+    int count, next = 0, failed = 0;
+    const char *result = NULL;
+    if (scan(data, journal.used, &count, check_record, &next, &failed) != journal.used || count != 2 || failed)
+        result = "round trip";
+    else if (scan(data, journal.used - 1, &count, NULL, NULL, NULL) != first_end || count != 1)
+        result = "torn record";
+    else if (scan(data, first_end + sizeof(first) - 1, &count, NULL, NULL, NULL) != first_end || count != 1)
+        result = "torn header";
+    else
+    {
+        // a flipped bit in the second record must stop the walk after the first
+        journal.buffer[journal.used - 3] ^= 0x20;
+        if (scan(data, journal.used, &count, NULL, NULL, NULL) != first_end || count != 1)
+            result = "checksum";
+    }
+    free(journal.buffer);
+    return result;
+}
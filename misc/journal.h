@@ -0,0 +1,54 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include "db.h"
+
+// journal operations
+#define JOURNAL_ADD 0    // the event or rule as it was stored
+#define JOURNAL_REMOVE 1 // the event or rule that was removed
+#define JOURNAL_SKIP 2   // the rule after one of its occurrences was skipped
+
+// local log of the changes redis has not confirmed, the records are kept in memory until they are synced
+typedef struct
+{
+    int fd;
+    char *buffer; // records not written to the file yet
+    size_t used;
+    size_t size;
+    int records; // records in the file
+} Journal;
+
+// one change read back from the journal, the strings live until the apply function returns
+typedef struct
+{
+    int op;
+    int id;
+    int recurring;
+    DbEventFields fields;
+    const char *skipped; // occurrence removed by a JOURNAL_SKIP
+} JournalEntry;
+
+// opens or creates the journal and cuts off a record torn by a crash, returns 0 on success
+int journal_open(Journal *journal, const char *path);
+
+void journal_close(Journal *journal);
+
+// buffers a change, returns 0 on success and -1 if memory runs out
+int journal_append(Journal *journal, int op, const Event *event, const Recurrence *recurrence, const char *skipped);
+
+// writes the buffered changes with a single fsync, returns 0 on success
+int journal_sync(Journal *journal);
+
+// drops the buffered changes once redis has confirmed them
+void journal_discard(Journal *journal);
+
+// hands every synced change to apply in order, the file is emptied if all were applied and clear is set
+// returns the number of changes or -1 if apply failed, the file is then kept for the next attempt
+int journal_replay(Journal *journal, int (*apply)(const JournalEntry *entry, void *context), void *context, int clear);
+
+// frames two known changes in memory and reads them back whole, torn and with a flipped bit, returns NULL if each read
+// stops where it should and else the name of the first case that does not
+const char *journal_check();
+
+#endif
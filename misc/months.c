@@ -0,0 +1,85 @@
+#include "months.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// adds ARGV[1] to the count of the month ARGV[2], an empty month is dropped
+#define MONTHS_SCRIPT "local n = redis.call('HINCRBY', KEYS[1], ARGV[2], ARGV[1]) " \
+                      "if n <= 0 then redis.call('HDEL', KEYS[1], ARGV[2]) end return n"
+
+int months_append_date(redisContext *c, const char *user, int visibility, const char *date, int delta)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+    {
+        return 0;
+    }
+
+    char key[96], delta_arg[16], field[24];
+    snprintf(key, sizeof(key), "month_counts:{%s}", user);
+    snprintf(delta_arg, sizeof(delta_arg), "%d", delta);
+    snprintf(field, sizeof(field), "%d:%04d-%02d", visibility, year, month);
+
+    const char *argv[] = {"EVAL", MONTHS_SCRIPT, "1", key, delta_arg, field};
+    redis_append_argv(c, sizeof(argv) / sizeof(argv[0]), argv, NULL);
+    return 1;
+}
+
+int months_fetch(redisContext *c, const char *user, int privilege_level, int first_year, int years, int (*counts)[13])
+{
+    if (years < 1 || years > MONTHS_MAX_YEARS || privilege_level < 0)
+    {
+        return -1;
+    }
+    int levels = privilege_level > 0 ? 2 : 1;
+
+    // one HMGET for every visible field of the range, a few hundred bytes instead of the events
+    char key[96];
+    char (*fields)[24] = malloc(levels * years * 12 * sizeof(*fields));
+    const char **argv = malloc((2 + levels * years * 12) * sizeof(char *));
+    if (fields == NULL || argv == NULL)
+    {
+        free(fields);
+        free(argv);
+        return -1;
+    }
+    snprintf(key, sizeof(key), "month_counts:{%s}", user);
+
+    int argc = 0;
+    argv[argc++] = "HMGET";
+    argv[argc++] = key;
+    for (int level = 0; level < levels; level++)
+    {
+        for (int year = 0; year < years; year++)
+        {
+            for (int month = 1; month <= 12; month++)
+            {
+                char *field = fields[argc - 2];
+                snprintf(field, sizeof(fields[0]), "%d:%04d-%02d", level, first_year + year, month);
+                argv[argc++] = field;
+            }
+        }
+    }
+
+    redisReply *reply = redis_command_argv(c, argc, argv, NULL);
+    free(argv);
+    free(fields);
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != (size_t)(argc - 2))
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    memset(counts, 0, years * sizeof(*counts));
+    for (size_t i = 0; i < reply->elements; i++)
+    {
+        redisReply *element = reply->element[i];
+        if (element->type == REDIS_REPLY_STRING)
+        {
+            int year = (int)(i / 12) % years;
+            counts[year][i % 12 + 1] += atoi(element->str);
+        }
+    }
+    freeReplyObject(reply);
+    return 0;
+}
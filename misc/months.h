@@ -0,0 +1,19 @@
+#ifndef MONTHS_H
+#define MONTHS_H
+
+#include "common.h"
+#include "event.h"
+
+// month counter parameter
+#define MONTHS_MAX_YEARS 12 // years covered by one counter fetch
+
+// per user hash month_counts:{<user>} with one field <visibility>:<yyyy-mm> per month, counting the single events in that month
+// recurring events have no end to count up to, their occurrences are added from the loaded rules for the years shown
+
+// queues the count change for one event date, returns the number of queued commands
+int months_append_date(redisContext *c, const char *user, int visibility, const char *date, int delta);
+
+// reads the counts of the months of years first_year.. visible at a privilege level into counts[year][1..12], returns 0 or -1
+int months_fetch(redisContext *c, const char *user, int privilege_level, int first_year, int years, int (*counts)[13]);
+
+#endif
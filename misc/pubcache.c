@@ -0,0 +1,302 @@
+#include "pubcache.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// segment layout: header, then PUBCACHE_SLOTS slots of PUBCACHE_SLOT_SIZE bytes, each a slot header followed by snapshot records
+typedef struct
+{
+    char magic[8]; // written last by the session that created the segment
+    uint32_t format;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t reserved;
+} CacheHeader;
+
+// seqlock: a writer makes the sequence odd, copies, then makes it even again, a reader keeps its copy only if the sequence did not move
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t length;   // bytes of records after the slot header
+    uint32_t checksum; // of the records and the fields below, catches two writers that raced on a stale slot
+    uint32_t event_count;
+    uint32_t recurrence_count;
+    int32_t next_event_id;
+    uint32_t index_version;
+    uint32_t reserved;
+    int64_t version;
+    uint64_t written_at; // ms, when the last writer took the slot
+    uint64_t read_at;    // ms, the last hit, the least recently read slot is replaced
+    char user[PUBCACHE_USER_LENGTH];
+} CacheSlot;
+
+#define SLOT_CAPACITY (PUBCACHE_SLOT_SIZE - sizeof(CacheSlot))
+
+static unsigned char *segment;
+static int attached; // 1 once mapped, -1 if this process goes without the cache
+
+static uint64_t now_ms()
+{
+    return stats_now() / 1000000;
+}
+
+// maps the segment once, the first session of the host creates it
+static int attach()
+{
+    if (attached != 0)
+    {
+        return attached > 0 ? 0 : -1;
+    }
+    attached = -1;
+
+    const char *name = getenv(PUBCACHE_ENV);
+    if (name == NULL || name[0] == '\0')
+    {
+        name = PUBCACHE_DEFAULT_NAME;
+    }
+    if (strcmp(name, "off") == 0)
+    {
+        return -1;
+    }
+
+    size_t size = sizeof(CacheHeader) + (size_t)PUBCACHE_SLOTS * PUBCACHE_SLOT_SIZE;
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    // pages are only backed once a slot is written, an empty segment costs nothing
+    struct stat st;
+    if ((created && ftruncate(fd, size) != 0) || fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+    {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    CacheHeader *header = map;
+    if (created)
+    {
+        header->format = PUBCACHE_FORMAT;
+        header->slot_count = PUBCACHE_SLOTS;
+        header->slot_size = PUBCACHE_SLOT_SIZE;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(header->magic, PUBCACHE_MAGIC, sizeof(PUBCACHE_MAGIC));
+    }
+
+    // a segment still being created or left by a build with other sizes is not used
+    int usable = memcmp(header->magic, PUBCACHE_MAGIC, sizeof(PUBCACHE_MAGIC)) == 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!usable || header->format != PUBCACHE_FORMAT || header->slot_count != PUBCACHE_SLOTS || header->slot_size != PUBCACHE_SLOT_SIZE)
+    {
+        munmap(map, size);
+        return -1;
+    }
+    segment = map;
+    attached = 1;
+    return 0;
+}
+
+static CacheSlot *slot_at(const char *user, int probe)
+{
+    uint32_t home = snapshot_checksum(SNAPSHOT_CHECKSUM_BASIS, user, strlen(user)) % PUBCACHE_SLOTS;
+    return (CacheSlot *)(segment + sizeof(CacheHeader) + (size_t)((home + probe) % PUBCACHE_SLOTS) * PUBCACHE_SLOT_SIZE);
+}
+
+// checksum of a slot, over its records and then the fields that describe them
+static uint32_t slot_checksum(const CacheSlot *slot, uint32_t records)
+{
+    uint32_t hash = snapshot_checksum(records, slot->user, sizeof(slot->user));
+    hash = snapshot_checksum(hash, &slot->length, sizeof(slot->length));
+    hash = snapshot_checksum(hash, &slot->event_count, sizeof(slot->event_count));
+    hash = snapshot_checksum(hash, &slot->recurrence_count, sizeof(slot->recurrence_count));
+    hash = snapshot_checksum(hash, &slot->next_event_id, sizeof(slot->next_event_id));
+    hash = snapshot_checksum(hash, &slot->index_version, sizeof(slot->index_version));
+    return snapshot_checksum(hash, &slot->version, sizeof(slot->version));
+}
+
+// copies the slot into copy and data while no writer is in it, returns 1 if it holds the calendar of the user
+static int read_slot(CacheSlot *slot, const char *user, CacheSlot *copy, unsigned char *data)
+{
+    for (int attempt = 0; attempt < PUBCACHE_READ_RETRIES; attempt++)
+    {
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, slot, sizeof(*copy));
+        if (copy->length <= SLOT_CAPACITY)
+        {
+            memcpy(data, slot + 1, copy->length);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != before)
+        {
+            continue;
+        }
+
+        // the copy is consistent, whatever it holds
+        return strncmp(copy->user, user, sizeof(copy->user)) == 0 && copy->length <= SLOT_CAPACITY &&
+               slot_checksum(copy, snapshot_checksum(SNAPSHOT_CHECKSUM_BASIS, data, copy->length)) == copy->checksum;
+    }
+    return 0;
+}
+
+int pubcache_load(const char *user, SnapshotInfo *info, Timeline *timeline, int (*store_recurrence)(Recurrence *))
+{
+    if (attach() != 0 || strlen(user) >= PUBCACHE_USER_LENGTH)
+    {
+        return -1;
+    }
+    unsigned char *data = malloc(SLOT_CAPACITY);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    CacheSlot copy;
+    CacheSlot *slot = NULL;
+    for (int probe = 0; probe < PUBCACHE_PROBES && slot == NULL; probe++)
+    {
+        if (read_slot(slot_at(user, probe), user, &copy, data))
+        {
+            slot = slot_at(user, probe);
+        }
+    }
+    if (slot == NULL)
+    {
+        free(data);
+        return -1;
+    }
+    __atomic_store_n(&slot->read_at, now_ms(), __ATOMIC_RELAXED);
+
+    // the records are parsed from the private copy, writers may already be replacing the slot
+    int result = snapshot_read_records(data, copy.length, copy.event_count + copy.recurrence_count, timeline, store_recurrence);
+    free(data);
+    if (result != 0)
+    {
+        return -2;
+    }
+    info->version = copy.version;
+    info->index_version = copy.index_version;
+    info->next_event_id = copy.next_event_id;
+    return 0;
+}
+
+int pubcache_publish(const char *user, const SnapshotInfo *info, const Timeline *timeline,
+                     Recurrence *const *recurrences, int recurrence_count)
+{
+    if (attach() != 0 || strlen(user) >= PUBCACHE_USER_LENGTH)
+    {
+        return -1;
+    }
+
+    // the slot of the user if it has one, else an empty one, else the one read least recently
+    CacheSlot *target = NULL, *empty = NULL, *oldest = NULL;
+    for (int probe = 0; probe < PUBCACHE_PROBES && target == NULL; probe++)
+    {
+        CacheSlot *slot = slot_at(user, probe);
+        if (strncmp(slot->user, user, sizeof(slot->user)) == 0)
+        {
+            target = slot;
+        }
+        else if (slot->user[0] == '\0' && empty == NULL)
+        {
+            empty = slot;
+        }
+        else if (oldest == NULL || slot->read_at < oldest->read_at)
+        {
+            oldest = slot;
+        }
+    }
+    if (target != NULL && !(__atomic_load_n(&target->sequence, __ATOMIC_ACQUIRE) & 1) && target->version >= info->version)
+    {
+        return -1;
+    }
+    if (target == NULL)
+    {
+        target = empty != NULL ? empty : oldest;
+    }
+
+    // the records are written before the slot is taken, so it stays odd for a memcpy only
+    char *records = NULL;
+    size_t length = 0;
+    uint32_t records_checksum = SNAPSHOT_CHECKSUM_BASIS;
+    FILE *file = open_memstream(&records, &length);
+    if (file == NULL)
+    {
+        return -1;
+    }
+    int result = snapshot_write_records(file, &records_checksum, timeline, recurrences, recurrence_count);
+    if (fclose(file) != 0 || result != 0 || length > SLOT_CAPACITY)
+    {
+        free(records);
+        return -1;
+    }
+
+    CacheSlot fields = {0};
+    snprintf(fields.user, sizeof(fields.user), "%s", user);
+    fields.length = length;
+    fields.event_count = timeline->count;
+    fields.recurrence_count = recurrence_count;
+    fields.next_event_id = info->next_event_id;
+    fields.index_version = info->index_version;
+    fields.version = info->version;
+    fields.checksum = slot_checksum(&fields, records_checksum);
+
+    // a slot left odd by a writer that died is taken over once it is stale, it stays odd for the new writer
+    uint32_t sequence = __atomic_load_n(&target->sequence, __ATOMIC_RELAXED);
+    uint32_t claimed = sequence + 1;
+    if (sequence & 1)
+    {
+        if (now_ms() - __atomic_load_n(&target->written_at, __ATOMIC_RELAXED) < PUBCACHE_STALE_MS)
+        {
+            free(records);
+            return -1;
+        }
+        claimed = sequence + 2;
+    }
+    if (!__atomic_compare_exchange_n(&target->sequence, &sequence, claimed, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        free(records);
+        return -1;
+    }
+    __atomic_store_n(&target->written_at, now_ms(), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(target->user, fields.user, sizeof(fields.user));
+    target->length = fields.length;
+    target->event_count = fields.event_count;
+    target->recurrence_count = fields.recurrence_count;
+    target->next_event_id = fields.next_event_id;
+    target->index_version = fields.index_version;
+    target->version = fields.version;
+    target->checksum = fields.checksum;
+    target->read_at = now_ms();
+    memcpy(target + 1, records, length);
+    free(records);
+
+    // if another writer took the slot over meanwhile it finishes it, a mix of both fails the checksum
+    __atomic_compare_exchange_n(&target->sequence, &claimed, claimed + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef PUBCACHE_H
+#define PUBCACHE_H
+
+#include "snapshot.h"
+
+// public cache parameter
+#define PUBCACHE_ENV "CALENDAR_SHM"              // shared memory name, "off" turns the cache off
+#define PUBCACHE_DEFAULT_NAME "/calendar-public"
+#define PUBCACHE_MAGIC "CALPUBC"
+#define PUBCACHE_FORMAT 1
+#define PUBCACHE_SLOTS 64                        // calendars kept at once
+#define PUBCACHE_SLOT_SIZE (256 << 10)           // bytes per calendar, a larger one is not shared
+#define PUBCACHE_PROBES 4                        // slots a user can live in, the least recently read one is replaced
+#define PUBCACHE_USER_LENGTH 64
+#define PUBCACHE_READ_RETRIES 16                 // copies attempted while writers keep changing the slot
+#define PUBCACHE_STALE_MS 2000                   // a slot written for longer than this belongs to a session that died
+
+// the segment saves viewers of a public calendar the redis reads and the decoding of its hashes, not memory:
+// every session still copies the slot and builds its own timeline from it, since the views change their events
+
+// copies the public events and rules of a user out of the segment all sessions of the host share
+// returns 0 on a hit, -1 on a miss, and -2 if the copy was damaged after some events were added already
+int pubcache_load(const char *user, SnapshotInfo *info, Timeline *timeline, int (*store_recurrence)(Recurrence *));
+
+// puts the public events and rules of a user into the segment, unless it holds them at this version already
+// returns 0 once published and -1 when skipped, it is only a cache so callers may ignore it
+int pubcache_publish(const char *user, const SnapshotInfo *info, const Timeline *timeline,
+                     Recurrence *const *recurrences, int recurrence_count);
+
+#endif
@@ -0,0 +1,247 @@
+#include "recurrence.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// upper bound of skipped candidates (exceptions, missing month days) per lookup
+#define MAX_SKIPPED_OCCURRENCES 4096
+
+static const char *frequency_names[] = {"", "daily", "weekly", "monthly", "yearly"};
+
+const char *frequency_name(int frequency)
+{
+    if (frequency < REPEAT_DAILY || frequency > REPEAT_YEARLY)
+        return "";
+    return frequency_names[frequency];
+}
+
+// returns the REPEAT_* value for a frequency name, 0 if unknown
+int parse_frequency(const char *name)
+{
+    for (int i = REPEAT_DAILY; i <= REPEAT_YEARLY; i++)
+    {
+        if (strcmp(name, frequency_names[i]) == 0)
+            return i;
+    }
+    return 0;
+}
+
+static int compare_dates(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+static int is_exception(const Recurrence *recurrence, const char *date)
+{
+    return recurrence->exception_count > 0 &&
+           bsearch(date, recurrence->exceptions, recurrence->exception_count, MAX_DATE_LENGTH, compare_dates) != NULL;
+}
+
+// takes ownership of the event, exceptions is a comma separated list of dates or NULL
+Recurrence *create_recurrence(Event *event, int frequency, int interval, const char *until, const char *exceptions)
+{
+    int year, month, day;
+    if (!parse_date(event->date, &year, &month, &day) || frequency < REPEAT_DAILY || frequency > REPEAT_YEARLY || interval < 1)
+        return NULL;
+
+    Recurrence *recurrence = calloc(1, sizeof(Recurrence));
+    if (recurrence == NULL)
+        return NULL;
+
+    recurrence->event = event;
+    recurrence->frequency = frequency;
+    recurrence->interval = interval;
+    recurrence->start_days = date_to_days(year, month, day);
+    recurrence->start_month_index = year * 12L + month - 1;
+    recurrence->start_day = day;
+    if (until != NULL)
+        snprintf(recurrence->until, sizeof(recurrence->until), "%s", until);
+
+    // split the stored exception list
+    while (exceptions != NULL && *exceptions)
+    {
+        size_t length = strcspn(exceptions, ",");
+        char date[MAX_DATE_LENGTH];
+        if (length < sizeof(date))
+        {
+            memcpy(date, exceptions, length);
+            date[length] = '\0';
+            recurrence_add_exception(recurrence, date);
+        }
+        exceptions += length;
+        if (*exceptions == ',')
+            exceptions++;
+    }
+
+    return recurrence;
+}
+
+void free_recurrence(Recurrence *recurrence)
+{
+    free_event(recurrence->event);
+    free(recurrence->exceptions);
+    free(recurrence);
+}
+
+// marks a date as skipped, returns 0 on success
+int recurrence_add_exception(Recurrence *recurrence, const char *date)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+        return -1;
+    if (is_exception(recurrence, date))
+        return 0;
+
+    char(*exceptions)[MAX_DATE_LENGTH] = realloc(recurrence->exceptions, (recurrence->exception_count + 1) * MAX_DATE_LENGTH);
+    if (exceptions == NULL)
+        return -1;
+    recurrence->exceptions = exceptions;
+
+    // insert in sorted position
+    int i = recurrence->exception_count;
+    while (i > 0 && strcmp(exceptions[i - 1], date) > 0)
+    {
+        memcpy(exceptions[i], exceptions[i - 1], MAX_DATE_LENGTH);
+        i--;
+    }
+    snprintf(exceptions[i], MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+    recurrence->exception_count++;
+    return 0;
+}
+
+// comma separated exception list for storage, caller frees
+char *recurrence_join_exceptions(const Recurrence *recurrence)
+{
+    char *joined = malloc(recurrence->exception_count * MAX_DATE_LENGTH + 1);
+    if (joined == NULL)
+        return NULL;
+
+    joined[0] = '\0';
+    for (int i = 0; i < recurrence->exception_count; i++)
+    {
+        if (i > 0)
+            strcat(joined, ",");
+        strcat(joined, recurrence->exceptions[i]);
+    }
+    return joined;
+}
+
+static int is_monthly(const Recurrence *recurrence)
+{
+    return recurrence->frequency == REPEAT_MONTHLY || recurrence->frequency == REPEAT_YEARLY;
+}
+
+// distance between occurrences in days (daily, weekly) or months (monthly, yearly)
+static long step(const Recurrence *recurrence)
+{
+    switch (recurrence->frequency)
+    {
+    case REPEAT_WEEKLY:
+        return 7L * recurrence->interval;
+    case REPEAT_YEARLY:
+        return 12L * recurrence->interval;
+    default:
+        return recurrence->interval;
+    }
+}
+
+// date of the k-th repetition: 1 if it exists, 0 if the month is too short, -1 past year 9999
+static int occurrence(const Recurrence *recurrence, long k, char *date)
+{
+    int year, month, day;
+
+    if (is_monthly(recurrence))
+    {
+        long month_index = recurrence->start_month_index + k * step(recurrence);
+        year = month_index / 12;
+        month = month_index % 12 + 1;
+        day = recurrence->start_day;
+        if (year > 9999)
+            return -1;
+        if (day > get_days_in_month(month, year))
+            return 0;
+    }
+    else
+    {
+        days_to_date(recurrence->start_days + k * step(recurrence), &year, &month, &day);
+        if (year > 9999)
+            return -1;
+    }
+
+    snprintf(date, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+    return 1;
+}
+
+// index of the last repetition on or before a date, -1 if the date is before the start
+static long last_index_until(const Recurrence *recurrence, int year, int month, int day)
+{
+    long k;
+
+    if (is_monthly(recurrence))
+    {
+        long distance = year * 12L + month - 1 - recurrence->start_month_index;
+        if (distance < 0)
+            return -1;
+        k = distance / step(recurrence);
+        if (k * step(recurrence) == distance && day < recurrence->start_day)
+            k--;
+    }
+    else
+    {
+        long distance = date_to_days(year, month, day) - recurrence->start_days;
+        if (distance < 0)
+            return -1;
+        k = distance / step(recurrence);
+    }
+    return k;
+}
+
+// first occurrence on or after from (an empty string means the start), returns 1 if there is one
+int recurrence_next(const Recurrence *recurrence, const char *from, char *date)
+{
+    long k = 0;
+    int year, month, day;
+
+    if (from[0] != '\0' && strcmp(from, recurrence->event->date) > 0)
+    {
+        if (!parse_date(from, &year, &month, &day))
+            return 0;
+        days_to_date(date_to_days(year, month, day) - 1, &year, &month, &day);
+        k = last_index_until(recurrence, year, month, day) + 1;
+    }
+
+    for (int skipped = 0; skipped < MAX_SKIPPED_OCCURRENCES; skipped++, k++)
+    {
+        int found = occurrence(recurrence, k, date);
+        if (found < 0 || (recurrence->until[0] && strcmp(date, recurrence->until) > 0))
+            return 0;
+        if (found && !is_exception(recurrence, date))
+            return 1;
+    }
+    return 0;
+}
+
+// last occurrence strictly before a date, returns 1 if there is one
+int recurrence_prev(const Recurrence *recurrence, const char *before, char *date)
+{
+    int year, month, day;
+
+    if (strcmp(before, recurrence->event->date) <= 0 || !parse_date(before, &year, &month, &day))
+        return 0;
+
+    // the latest candidate is the day before, or the end of the rule
+    days_to_date(date_to_days(year, month, day) - 1, &year, &month, &day);
+    if (recurrence->until[0] && strcmp(recurrence->until, before) < 0)
+    {
+        if (!parse_date(recurrence->until, &year, &month, &day))
+            return 0;
+    }
+
+    long k = last_index_until(recurrence, year, month, day);
+    for (int skipped = 0; skipped < MAX_SKIPPED_OCCURRENCES && k >= 0; skipped++, k--)
+    {
+        if (occurrence(recurrence, k, date) == 1 && !is_exception(recurrence, date))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef RECURRENCE_H
+#define RECURRENCE_H
+
+#include "event.h"
+
+// repetition rules
+#define REPEAT_DAILY 1
+#define REPEAT_WEEKLY 2
+#define REPEAT_MONTHLY 3
+#define REPEAT_YEARLY 4
+
+// structure for a recurring event, its first occurrence is event->date
+typedef struct
+{
+    Event *event;
+    int frequency;
+    int interval;
+    char until[MAX_DATE_LENGTH]; // last possible occurrence, empty for no end
+    char (*exceptions)[MAX_DATE_LENGTH]; // skipped occurrences, sorted
+    int exception_count;
+    long start_days;
+    long start_month_index;
+    int start_day;
+} Recurrence;
+
+Recurrence *create_recurrence(Event *event, int frequency, int interval, const char *until, const char *exceptions);
+
+void free_recurrence(Recurrence *recurrence);
+
+int recurrence_add_exception(Recurrence *recurrence, const char *date);
+
+char *recurrence_join_exceptions(const Recurrence *recurrence);
+
+int recurrence_next(const Recurrence *recurrence, const char *from, char *date);
+
+int recurrence_prev(const Recurrence *recurrence, const char *before, char *date);
+
+const char *frequency_name(int frequency);
+
+int parse_frequency(const char *name);
+
+#endif
@@ -0,0 +1,66 @@
+#include "reminder.h"
+#include <stdio.h>
+
+time_t reminder_start(const char *date, int start)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+    {
+        return -1;
+    }
+    struct tm tm = {0};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = start > 0 ? start / 60 : 0;
+    tm.tm_min = start > 0 ? start % 60 : 0;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+time_t reminder_next(const Event *event, const Recurrence *recurrence, time_t now)
+{
+    if (recurrence == NULL)
+    {
+        time_t start = reminder_start(event->date, event->start);
+        return start >= now ? start : -1;
+    }
+
+    // the occurrence of today may have started already, then the one after it is next
+    struct tm tm;
+    localtime_r(&now, &tm);
+    long day = date_to_days(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+    for (int i = 0; i < 2; i++)
+    {
+        int year, month, mday;
+        char from[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH];
+        days_to_date(day, &year, &month, &mday);
+        snprintf(from, sizeof(from), "%04d-%02d-%02d", year, month, mday);
+        if (!recurrence_next(recurrence, from, date))
+        {
+            return -1;
+        }
+        time_t start = reminder_start(date, event->start);
+        if (start >= now)
+        {
+            return start;
+        }
+        parse_date(date, &year, &month, &mday);
+        day = date_to_days(year, month, mday) + 1;
+    }
+    return -1;
+}
+
+int reminder_append(redisContext *c, const char *user, int id, time_t due)
+{
+    if (due < 0)
+    {
+        redis_append(c, "ZREM " REMINDER_INDEX " %s:%d", user, id);
+    }
+    else
+    {
+        redis_append(c, "ZADD " REMINDER_INDEX " %lld %s:%d", (long long)due, user, id);
+    }
+    redis_append(c, "XADD " REMINDER_CHANGES " MAXLEN ~ %d * member %s:%d due %lld", REMINDER_STREAM_LENGTH, user, id, (long long)due);
+    return 2;
+}
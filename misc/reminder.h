@@ -0,0 +1,25 @@
+#ifndef REMINDER_H
+#define REMINDER_H
+
+#include <time.h>
+#include "common.h"
+#include "recurrence.h"
+
+// reminder parameter, the keys share one hash tag so the daemon's script sees all of them on one node
+#define REMINDER_INDEX "{reminders}:schedule"   // "<user>:<id>" scored by the unix time of the next start
+#define REMINDER_CHANGES "{reminders}:changes"  // every update of the schedule, the daemon follows it instead of rescanning
+#define REMINDER_SINK "{reminders}:due"         // delivered reminders
+#define REMINDER_READY "{reminders}:ready"      // set once the events from before the schedule are in it
+#define REMINDER_CLAIM "{reminders}:backfill"   // taken by the one daemon that schedules them
+#define REMINDER_STREAM_LENGTH 100000           // entries kept in each stream, trimmed approximately
+
+// unix time an event starts on a date, all-day events at midnight, -1 if the date is invalid
+time_t reminder_start(const char *date, int start);
+
+// next start at or after now of an event, recurrence is NULL for a single event, -1 if there is none
+time_t reminder_next(const Event *event, const Recurrence *recurrence, time_t now);
+
+// queues the schedule update of an event, a due time of -1 takes it off, returns the number of queued commands
+int reminder_append(redisContext *c, const char *user, int id, time_t due);
+
+#endif
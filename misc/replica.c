@@ -0,0 +1,165 @@
+#include "replica.h"
+#include "common.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// structure for a configured replica
+typedef struct
+{
+    char host[64];
+    int port;
+    int node;
+} Replica;
+
+static Replica replicas[REPLICA_MAX];
+static int replica_count = -1;
+
+// reads the replica list once, entries that are not host:port[@node] are reported and skipped
+static void load_replicas()
+{
+    if (replica_count >= 0)
+    {
+        return;
+    }
+    replica_count = 0;
+
+    const char *list = getenv(REPLICA_NODES_ENV);
+    while (list != NULL && *list != '\0' && replica_count < REPLICA_MAX)
+    {
+        size_t length = strcspn(list, ",");
+        char entry[80];
+        snprintf(entry, sizeof(entry), "%.*s", (int)length, list);
+        list += length + (list[length] == ',');
+
+        char *at = strchr(entry, '@');
+        int node = at ? atoi(at + 1) : 0;
+        if (at != NULL)
+        {
+            *at = '\0';
+        }
+        char *colon = strrchr(entry, ':');
+        int port = colon ? atoi(colon + 1) : 0;
+        if (colon == NULL || colon == entry || port < 1 || port > 65535 || (size_t)(colon - entry) >= sizeof(replicas[0].host) ||
+            node < 0 || node >= shard_node_count())
+        {
+            printf("%sIgnoring redis replica '%s', expected host:port or host:port@node%s\n", RED_COLOR, entry, RESET_COLOR);
+            continue;
+        }
+        snprintf(replicas[replica_count].host, sizeof(replicas[replica_count].host), "%.*s", (int)(colon - entry), entry);
+        replicas[replica_count].port = port;
+        replicas[replica_count].node = node;
+        replica_count++;
+    }
+}
+
+// number of replicas configured for a node
+static int node_replicas(int node)
+{
+    load_replicas();
+    int count = 0;
+    for (int i = 0; i < replica_count; i++)
+    {
+        count += replicas[i].node == node;
+    }
+    return count;
+}
+
+void read_route_init(ReadRoute *route)
+{
+    memset(route, 0, sizeof(*route));
+    const char *consistent = getenv(REPLICA_CONSISTENCY_ENV);
+    route->consistent = consistent == NULL || strcmp(consistent, "0") != 0;
+}
+
+// sessions spread over the replicas of a node by their process id
+static redisContext *connect_replica(int node)
+{
+    int count = node_replicas(node);
+    int pick = getpid() % count;
+    for (int i = 0; i < replica_count; i++)
+    {
+        if (replicas[i].node != node || pick-- > 0)
+        {
+            continue;
+        }
+        struct timeval timeout = {REDIS_TIMEOUT_MS / 1000, (REDIS_TIMEOUT_MS % 1000) * 1000};
+        redisContext *c = redisConnectWithTimeout(replicas[i].host, replicas[i].port, timeout);
+        if (c == NULL || c->err || redisSetTimeout(c, timeout) != REDIS_OK)
+        {
+            redisFree(c);
+            return NULL;
+        }
+        // keys of other nodes are read from their primaries
+        shard_attach(c, node);
+        return c;
+    }
+    return NULL;
+}
+
+redisContext *read_context(ReadRoute *route, redisContext *primary, const char *key)
+{
+    int node = shard_node_of(key, strlen(key));
+    if (node_replicas(node) == 0 || route->failed[node])
+    {
+        return primary;
+    }
+    if (route->consistent && route->written_at != 0 && stats_now() - route->written_at < (uint64_t)REPLICA_STICKY_MS * 1000000)
+    {
+        return primary;
+    }
+
+    // a replica that broke is not tried again, the primary can serve everything
+    redisContext *replica = route->replicas[node];
+    if (replica != NULL && replica->err)
+    {
+        shard_detach(replica);
+        redisFree(replica);
+        route->replicas[node] = replica = NULL;
+        route->failed[node] = 1;
+    }
+    if (replica == NULL && !route->failed[node])
+    {
+        replica = route->replicas[node] = connect_replica(node);
+        route->failed[node] = replica == NULL;
+    }
+    return replica != NULL ? replica : primary;
+}
+
+void read_route_wrote(ReadRoute *route)
+{
+    route->written_at = stats_now();
+    route->unsynced = 1;
+}
+
+int read_route_sync(ReadRoute *route, redisContext *primary, const char *key)
+{
+    int count = node_replicas(shard_node_of(key, strlen(key)));
+    if (!route->consistent || !route->unsynced || count == 0 || primary->err)
+    {
+        return 0;
+    }
+
+    // WAIT holds the reply until the replicas acknowledged every earlier write of this connection
+    redisReply *reply = redis_command(primary, "WAIT %d %d", count, REPLICA_WAIT_MS);
+    int confirmed = reply != NULL && reply->type == REDIS_REPLY_INTEGER ? (int)reply->integer : -1;
+    freeReplyObject(reply);
+    route->unsynced = 0;
+    return confirmed;
+}
+
+void read_route_close(ReadRoute *route)
+{
+    for (int i = 0; i < SHARD_MAX_NODES; i++)
+    {
+        if (route->replicas[i] != NULL)
+        {
+            shard_detach(route->replicas[i]);
+            redisFree(route->replicas[i]);
+            route->replicas[i] = NULL;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <hiredis/hiredis.h>
+#include <stdint.h>
+#include "shard.h"
+
+// replica parameter
+#define REPLICA_MAX 16
+#define REPLICA_NODES_ENV "REDIS_REPLICAS"               // host:port[@node],... read only copies of the nodes in REDIS_NODES, node 0 when not given
+#define REPLICA_CONSISTENCY_ENV "REDIS_READ_YOUR_WRITES" // "0" lets a session read from replicas right after its own writes
+#define REPLICA_STICKY_MS 2000                           // reads stay on the primary this long after a write
+#define REPLICA_WAIT_MS 500                              // a session that wrote waits this long at most for a replica before it ends
+
+// where the reads of one session go, the replica of a node is connected on first use
+typedef struct
+{
+    redisContext *replicas[SHARD_MAX_NODES];
+    int failed[SHARD_MAX_NODES]; // the replica broke, reads of the node stay on the primary
+    int consistent;              // read your own writes
+    uint64_t written_at;         // stats_now() of the last write, 0 before the first
+    int unsynced;                // writes no replica has confirmed yet
+} ReadRoute;
+
+void read_route_init(ReadRoute *route);
+
+// connection to read key from: a replica of its node, or the primary if there is none, it broke or the session just wrote
+redisContext *read_context(ReadRoute *route, redisContext *primary, const char *key);
+
+// a write went to the primary
+void read_route_wrote(ReadRoute *route);
+
+// waits until the replicas of key's node have the session's writes, returns the number that confirmed or -1
+int read_route_sync(ReadRoute *route, redisContext *primary, const char *key);
+
+void read_route_close(ReadRoute *route);
+
+#endif
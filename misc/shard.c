@@ -0,0 +1,417 @@
+#include "shard.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#define NODE_UNREACHABLE 0xff // queued in place of a command that could not be sent
+
+// structure for a configured node
+typedef struct
+{
+    char host[64];
+    int port;
+} ShardNode;
+
+// the commands a connection queued and the nodes that will answer them, oldest first
+typedef struct
+{
+    redisContext *home;
+    int home_node;
+    redisContext *nodes[SHARD_MAX_NODES]; // connections opened to the other nodes
+    unsigned char *pending;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} Router;
+
+static ShardNode nodes[SHARD_MAX_NODES];
+static int node_count;
+static Router routers[SHARD_MAX_ROUTERS];
+
+// commands without a key run on the connection they were sent on
+static const char *keyless_commands[] = {"MULTI", "EXEC", "DISCARD", "WATCH", "UNWATCH", "PING", "SCAN", "SELECT", "INFO", "DBSIZE",
+                                         "FLUSHDB", "FLUSHALL", "SCRIPT", "WAIT", "MIGRATE", "RANDOMKEY", "TIME", "CLIENT", "CONFIG"};
+
+// crc16 xmodem, the checksum redis cluster assigns slots with
+static unsigned int crc16(const char *data, size_t length)
+{
+    unsigned int crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (unsigned char)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc & 0xffff;
+}
+
+// finds the hash tag of a key, returns 0 if it has none
+static int hash_tag(const char *key, size_t length, const char **tag, size_t *tag_length)
+{
+    const char *open = memchr(key, '{', length);
+    if (open == NULL)
+    {
+        return 0;
+    }
+    const char *close = memchr(open + 1, '}', key + length - open - 1);
+    if (close == NULL || close == open + 1)
+    {
+        return 0;
+    }
+    *tag = open + 1;
+    *tag_length = close - open - 1;
+    return 1;
+}
+
+int shard_slot(const char *key, size_t length)
+{
+    const char *tag;
+    size_t tag_length;
+    if (hash_tag(key, length, &tag, &tag_length))
+    {
+        return crc16(tag, tag_length) % SHARD_SLOTS;
+    }
+    return crc16(key, length) % SHARD_SLOTS;
+}
+
+// keys and the slot CLUSTER KEYSLOT answers for them, the tagged ones cover the cases of the cluster specification
+static const struct
+{
+    const char *key;
+    int slot;
+} known_slots[] = {
+    {"123456789", 12739}, // crc16 xmodem check value 0x31c3
+    {"foo", 12182},
+    {"bar", 5061},
+    {"hello", 866},
+    {"somekey", 11058},
+    {"foo{hash_tag}", 2515},
+    {"{user1000}.following", 3443},
+    {"{user1000}.followers", 3443},
+    {"foo{bar}{zap}", 5061}, // only the first tag counts
+    {"foo{}{bar}", 8363},    // an empty first tag hashes the whole key
+    {"foo{{bar}}zap", 4015}, // the tag is "{bar"
+};
+
+const char *shard_check_slots()
+{
+    for (size_t i = 0; i < sizeof(known_slots) / sizeof(known_slots[0]); i++)
+    {
+        if (shard_slot(known_slots[i].key, strlen(known_slots[i].key)) != known_slots[i].slot)
+        {
+            return known_slots[i].key;
+        }
+    }
+    return NULL;
+}
+
+// reads the node list once, entries that are not host:port are reported and skipped
+static void load_nodes()
+{
+    if (node_count > 0)
+    {
+        return;
+    }
+
+    const char *list = getenv(SHARD_NODES_ENV);
+    while (list != NULL && *list != '\0' && node_count < SHARD_MAX_NODES)
+    {
+        size_t length = strcspn(list, ",");
+        char entry[80];
+        snprintf(entry, sizeof(entry), "%.*s", (int)length, list);
+        list += length + (list[length] == ',');
+
+        char *colon = strrchr(entry, ':');
+        int port = colon ? atoi(colon + 1) : 0;
+        if (colon == NULL || colon == entry || port < 1 || port > 65535 || (size_t)(colon - entry) >= sizeof(nodes[0].host))
+        {
+            printf("%sIgnoring redis node '%s', expected host:port%s\n", RED_COLOR, entry, RESET_COLOR);
+            continue;
+        }
+        snprintf(nodes[node_count].host, sizeof(nodes[node_count].host), "%.*s", (int)(colon - entry), entry);
+        nodes[node_count].port = port;
+        node_count++;
+    }
+
+    if (node_count == 0)
+    {
+        snprintf(nodes[0].host, sizeof(nodes[0].host), "%s", SHARD_DEFAULT_HOST);
+        nodes[0].port = SHARD_DEFAULT_PORT;
+        node_count = 1;
+    }
+}
+
+int shard_node_count()
+{
+    load_nodes();
+    return node_count;
+}
+
+int shard_node_of(const char *key, size_t length)
+{
+    load_nodes();
+    return (int)((long)shard_slot(key, length) * node_count / SHARD_SLOTS);
+}
+
+void shard_address(int node, const char **host, int *port)
+{
+    load_nodes();
+    *host = nodes[node].host;
+    *port = nodes[node].port;
+}
+
+static Router *find_router(redisContext *c)
+{
+    for (int i = 0; i < SHARD_MAX_ROUTERS; i++)
+    {
+        if (routers[i].home == c && c != NULL)
+        {
+            return &routers[i];
+        }
+    }
+    return NULL;
+}
+
+void shard_attach(redisContext *c, int node)
+{
+    if (shard_node_count() <= 1 || find_router(c) != NULL)
+    {
+        return;
+    }
+    Router *router = NULL;
+    for (int i = 0; i < SHARD_MAX_ROUTERS && router == NULL; i++)
+    {
+        if (routers[i].home == NULL)
+            router = &routers[i];
+    }
+    if (router != NULL)
+    {
+        memset(router, 0, sizeof(*router));
+        router->home = c;
+        router->home_node = node;
+    }
+}
+
+void shard_detach(redisContext *c)
+{
+    Router *router = find_router(c);
+    if (router == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < SHARD_MAX_NODES; i++)
+    {
+        if (router->nodes[i] != NULL)
+            redisFree(router->nodes[i]);
+    }
+    free(router->pending);
+    memset(router, 0, sizeof(*router));
+}
+
+redisContext *shard_node(redisContext *c, int node)
+{
+    Router *router = find_router(c);
+    if (router == NULL || node == router->home_node)
+    {
+        return node == 0 || router != NULL ? c : NULL;
+    }
+    if (node < 0 || node >= node_count)
+    {
+        return NULL;
+    }
+
+    // a connection that broke is opened again, its pending replies were dropped with the error
+    redisContext *target = router->nodes[node];
+    if (target != NULL && !target->err)
+    {
+        return target;
+    }
+    if (target != NULL)
+    {
+        redisFree(target);
+    }
+
+    struct timeval timeout = {REDIS_TIMEOUT_MS / 1000, (REDIS_TIMEOUT_MS % 1000) * 1000};
+    target = redisConnectWithTimeout(nodes[node].host, nodes[node].port, timeout);
+    if (target == NULL || target->err || redisSetTimeout(target, timeout) != REDIS_OK)
+    {
+        redisFree(target);
+        target = NULL;
+    }
+    router->nodes[node] = target;
+    return target;
+}
+
+// argument index of a formatted command, returns 0 if it has fewer
+static int command_arg(const char *command, size_t length, int index, const char **arg, size_t *arg_length)
+{
+    const char *end = command + length;
+    char *p;
+    if (length < 4 || command[0] != '*' || strtol(command + 1, &p, 10) <= index)
+    {
+        return 0;
+    }
+    for (int i = 0;; i++)
+    {
+        p += 2;
+        if (p >= end || *p != '$')
+        {
+            return 0;
+        }
+        long size = strtol(p + 1, &p, 10);
+        p += 2;
+        if (size < 0 || p + size > end)
+        {
+            return 0;
+        }
+        if (i == index)
+        {
+            *arg = p;
+            *arg_length = size;
+            return 1;
+        }
+        p += size;
+    }
+}
+
+// node that has to run a formatted command
+static int command_node(const Router *router, const char *command, size_t length)
+{
+    const char *name, *key;
+    size_t name_length, key_length;
+    if (!command_arg(command, length, 0, &name, &name_length))
+    {
+        return router->home_node;
+    }
+
+    int key_index = 1;
+    if ((name_length == 4 && strncasecmp(name, "EVAL", 4) == 0) || (name_length == 7 && strncasecmp(name, "EVALSHA", 7) == 0))
+    {
+        // scripts name their keys after the key count, all of them share one slot
+        const char *count;
+        size_t count_length;
+        if (!command_arg(command, length, 2, &count, &count_length) || atoi(count) < 1)
+        {
+            return router->home_node;
+        }
+        key_index = 3;
+    }
+    else if (name_length == 5 && strncasecmp(name, "XREAD", 5) == 0)
+    {
+        // the streams follow the options, all of them share one slot
+        const char *option;
+        size_t option_length;
+        for (int i = 1; command_arg(command, length, i, &option, &option_length); i++)
+        {
+            if (option_length == 7 && strncasecmp(option, "STREAMS", 7) == 0)
+            {
+                key_index = i + 1;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(keyless_commands) / sizeof(keyless_commands[0]); i++)
+    {
+        if (name_length == strlen(keyless_commands[i]) && strncasecmp(name, keyless_commands[i], name_length) == 0)
+        {
+            return router->home_node;
+        }
+    }
+    if (!command_arg(command, length, key_index, &key, &key_length))
+    {
+        return router->home_node;
+    }
+
+    // a KEYS pattern can only be routed when its tag is spelled out, event:{bob}:*
+    const char *tag;
+    size_t tag_length;
+    if (name_length == 4 && strncasecmp(name, "KEYS", 4) == 0 && !hash_tag(key, key_length, &tag, &tag_length))
+    {
+        return router->home_node;
+    }
+    return shard_node_of(key, key_length);
+}
+
+static int push_pending(Router *router, int node)
+{
+    if (router->head == router->tail)
+    {
+        router->head = router->tail = 0;
+    }
+    if (router->tail == router->capacity)
+    {
+        size_t capacity = router->capacity ? router->capacity * 2 : 256;
+        unsigned char *pending = realloc(router->pending, capacity);
+        if (pending == NULL)
+        {
+            return -1;
+        }
+        router->pending = pending;
+        router->capacity = capacity;
+    }
+    router->pending[router->tail++] = (unsigned char)node;
+    return 0;
+}
+
+// reads and drops the replies still expected after a failure, so the next pipeline starts clean
+static void discard_pending(Router *router)
+{
+    while (router->head < router->tail)
+    {
+        int node = router->pending[router->head++];
+        redisContext *target = node == router->home_node ? router->home : node == NODE_UNREACHABLE ? NULL : router->nodes[node];
+        void *reply = NULL;
+        if (target != NULL && !target->err && redisGetReply(target, &reply) == REDIS_OK)
+        {
+            freeReplyObject(reply);
+        }
+    }
+    router->head = router->tail = 0;
+}
+
+int shard_append(redisContext *c, const char *command, size_t length)
+{
+    Router *router = find_router(c);
+    if (router == NULL)
+    {
+        return redisAppendFormattedCommand(c, command, length);
+    }
+
+    int node = command_node(router, command, length);
+    if (push_pending(router, node) != 0)
+    {
+        return REDIS_ERR;
+    }
+
+    // a node that cannot be reached keeps its place in the order, reading its reply fails like a broken connection
+    redisContext *target = shard_node(c, node);
+    if (target == NULL || redisAppendFormattedCommand(target, command, length) != REDIS_OK)
+    {
+        router->pending[router->tail - 1] = NODE_UNREACHABLE;
+    }
+    return REDIS_OK;
+}
+
+int shard_get_reply(redisContext *c, void **reply)
+{
+    Router *router = find_router(c);
+    if (router == NULL || router->head == router->tail)
+    {
+        return redisGetReply(c, reply);
+    }
+
+    int node = router->pending[router->head++];
+    redisContext *target = node == router->home_node ? router->home : node == NODE_UNREACHABLE ? NULL : router->nodes[node];
+    *reply = NULL;
+    if (target == NULL || redisGetReply(target, reply) != REDIS_OK)
+    {
+        discard_pending(router);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
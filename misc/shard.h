@@ -0,0 +1,45 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <hiredis/hiredis.h>
+
+// sharding parameter
+#define SHARD_SLOTS 16384                // hash slots as in redis cluster, split in equal ranges over the nodes in order
+#define SHARD_MAX_NODES 16
+#define SHARD_MAX_ROUTERS 16             // connections that route their commands, one per session
+#define SHARD_NODES_ENV "REDIS_NODES"    // host:port,host:port,... the default is one node on 127.0.0.1:6379
+#define SHARD_DEFAULT_HOST "127.0.0.1"
+#define SHARD_DEFAULT_PORT 6379
+
+// every key of a user carries the name as hash tag, user:{<user>} and event:{<user>}:<id>, so a calendar lives on one node
+// global keys such as users_lex have no tag and land on the node of their whole name
+
+// hash slot of a key, only the part between the first { and the next } counts when it is not empty
+int shard_slot(const char *key, size_t length);
+
+// compares shard_slot with the slots redis cluster gives some known keys, returns NULL if all match and else the first key that does not
+const char *shard_check_slots();
+
+// number of configured nodes, 1 unless REDIS_NODES lists more
+int shard_node_count();
+
+// node that holds a key
+int shard_node_of(const char *key, size_t length);
+
+void shard_address(int node, const char **host, int *port);
+
+// makes c, connected to node, route its commands: keyed commands go to the node of their key, the others stay on c
+void shard_attach(redisContext *c, int node);
+
+// forgets the routing of c and closes the connections it opened to the other nodes
+void shard_detach(redisContext *c);
+
+// connection of c's router to a node, c itself for its own node, NULL if the node cannot be reached
+redisContext *shard_node(redisContext *c, int node);
+
+// queues a formatted command on the node of its key, replies are read back in the order the commands were queued
+int shard_append(redisContext *c, const char *command, size_t length);
+
+int shard_get_reply(redisContext *c, void **reply);
+
+#endif
@@ -0,0 +1,283 @@
+#include "snapshot.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_EVENT 0
+#define RECORD_RECURRENCE 1
+
+// file layout: header, then one record per event or rule followed by its strings (no terminators)
+typedef struct
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t privilege_level;
+    int64_t version;
+    uint32_t index_version;
+    uint32_t event_count;
+    uint32_t recurrence_count;
+    int32_t next_event_id;
+    uint32_t checksum; // FNV-1a over everything after the header
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct
+{
+    int32_t id;
+    uint8_t kind;
+    uint8_t visibility;
+    uint8_t frequency;
+    uint8_t reserved;
+    uint16_t interval;
+    uint16_t date_length;
+    uint16_t name_length;
+    uint16_t description_length;
+    uint16_t until_length;
+    int16_t start; // minutes after midnight, -1 for an all-day event
+    int16_t end;
+    uint16_t reserved2;
+    uint32_t exceptions_length;
+} SnapshotRecord;
+
+uint32_t snapshot_checksum(uint32_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void write_bytes(FILE *file, uint32_t *checksum, const void *data, size_t length)
+{
+    fwrite(data, 1, length, file);
+    *checksum = snapshot_checksum(*checksum, data, length);
+}
+
+static void write_record(FILE *file, uint32_t *checksum, const Event *event, const Recurrence *recurrence, const char *exceptions)
+{
+    SnapshotRecord record = {0};
+    record.id = event->id;
+    record.kind = recurrence ? RECORD_RECURRENCE : RECORD_EVENT;
+    record.visibility = event->visibility;
+    record.date_length = strlen(event->date);
+    record.name_length = strlen(event->name);
+    record.description_length = strlen(event->description);
+    record.start = event->start;
+    record.end = event->end;
+    if (recurrence)
+    {
+        record.frequency = recurrence->frequency;
+        record.interval = recurrence->interval;
+        record.until_length = strlen(recurrence->until);
+        record.exceptions_length = strlen(exceptions);
+    }
+
+    write_bytes(file, checksum, &record, sizeof(record));
+    write_bytes(file, checksum, event->date, record.date_length);
+    write_bytes(file, checksum, event->name, record.name_length);
+    write_bytes(file, checksum, event->description, record.description_length);
+    if (recurrence)
+    {
+        write_bytes(file, checksum, recurrence->until, record.until_length);
+        write_bytes(file, checksum, exceptions, record.exceptions_length);
+    }
+}
+
+int snapshot_write_records(FILE *file, uint32_t *checksum, const Timeline *timeline, Recurrence *const *recurrences, int recurrence_count)
+{
+    for (TimelineNode *node = timeline_first(timeline); node; node = node->next[0])
+    {
+        write_record(file, checksum, node->event, NULL, NULL);
+    }
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        char *exceptions = recurrence_join_exceptions(recurrences[i]);
+        if (exceptions == NULL)
+        {
+            return -1;
+        }
+        write_record(file, checksum, recurrences[i]->event, recurrences[i], exceptions);
+        free(exceptions);
+    }
+    return 0;
+}
+
+// writes the snapshot to a temporary file and renames it into place, returns 0 on success
+int snapshot_save(const char *path, const SnapshotInfo *info, int privilege_level,
+                  const Timeline *timeline, Recurrence *const *recurrences, int recurrence_count)
+{
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL)
+        return -1;
+
+    SnapshotHeader header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.format = SNAPSHOT_FORMAT;
+    header.privilege_level = privilege_level;
+    header.version = info->version;
+    header.index_version = info->index_version;
+    header.event_count = timeline->count;
+    header.recurrence_count = recurrence_count;
+    header.next_event_id = info->next_event_id;
+    header.checksum = SNAPSHOT_CHECKSUM_BASIS;
+
+    // the header is written again once the checksum is known
+    fwrite(&header, sizeof(header), 1, file);
+
+    if (snapshot_write_records(file, &header.checksum, timeline, recurrences, recurrence_count) != 0)
+    {
+        fclose(file);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    rewind(file);
+    fwrite(&header, sizeof(header), 1, file);
+
+    if (fflush(file) != 0 || ferror(file) || fsync(fileno(file)) != 0)
+    {
+        fclose(file);
+        unlink(tmp_path);
+        return -1;
+    }
+    fclose(file);
+
+    if (rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// copies length bytes at *offset into a terminated string, NULL if the record runs past the end
+static char *read_string(const unsigned char *data, size_t size, size_t *offset, size_t length, char *buffer, size_t buffer_size)
+{
+    if (length >= buffer_size || *offset + length > size)
+        return NULL;
+    memcpy(buffer, data + *offset, length);
+    buffer[length] = '\0';
+    *offset += length;
+    return buffer;
+}
+
+int snapshot_read_records(const unsigned char *data, size_t size, uint32_t count,
+                          Timeline *timeline, int (*store_recurrence)(Recurrence *))
+{
+    size_t offset = 0;
+    char date[MAX_DATE_LENGTH], name[MAX_NAME_LENGTH], description[MAX_DESC_LENGTH], until[MAX_DATE_LENGTH];
+    char *exceptions = NULL;
+    int result = 0;
+
+    for (uint32_t i = 0; i < count && result == 0; i++)
+    {
+        SnapshotRecord record;
+        if (offset + sizeof(record) > size)
+        {
+            result = -1;
+            break;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (!read_string(data, size, &offset, record.date_length, date, sizeof(date)) ||
+            !read_string(data, size, &offset, record.name_length, name, sizeof(name)) ||
+            !read_string(data, size, &offset, record.description_length, description, sizeof(description)))
+        {
+            result = -1;
+            break;
+        }
+
+        Event *event = create_event(record.id, record.visibility, date, name, description);
+        if (event == NULL)
+        {
+            result = -1;
+            break;
+        }
+        event->start = record.start;
+        event->end = record.end;
+
+        if (record.kind == RECORD_EVENT)
+        {
+            if (timeline_insert(timeline, event) != 0)
+                free_event(event);
+            continue;
+        }
+
+        free(exceptions);
+        exceptions = malloc(record.exceptions_length + 1);
+        Recurrence *recurrence = NULL;
+        if (exceptions != NULL &&
+            read_string(data, size, &offset, record.until_length, until, sizeof(until)) &&
+            read_string(data, size, &offset, record.exceptions_length, exceptions, record.exceptions_length + 1))
+        {
+            recurrence = create_recurrence(event, record.frequency, record.interval, until, exceptions);
+        }
+        if (recurrence == NULL)
+        {
+            free_event(event);
+            result = -1;
+        }
+        else if (store_recurrence(recurrence) != 0)
+        {
+            free_recurrence(recurrence);
+        }
+    }
+
+    free(exceptions);
+    return result;
+}
+
+// maps the snapshot and adds its events and rules, returns 0 on success and -1 if it is missing or unusable
+int snapshot_load(const char *path, SnapshotInfo *info, int privilege_level,
+                  Timeline *timeline, int (*store_recurrence)(Recurrence *))
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.format != SNAPSHOT_FORMAT ||
+        header.privilege_level != (uint32_t)privilege_level ||
+        snapshot_checksum(SNAPSHOT_CHECKSUM_BASIS, data + sizeof(header), size - sizeof(header)) != header.checksum)
+    {
+        munmap((void *)data, size);
+        return -1;
+    }
+
+    int result = snapshot_read_records(data + sizeof(header), size - sizeof(header), header.event_count + header.recurrence_count,
+                                       timeline, store_recurrence);
+    munmap((void *)data, size);
+
+    if (result == 0)
+    {
+        info->version = header.version;
+        info->index_version = header.index_version;
+        info->next_event_id = header.next_event_id;
+    }
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "timeline.h"
+#include "recurrence.h"
+
+// snapshot parameter
+#define SNAPSHOT_MAGIC "CALSNAP"
+#define SNAPSHOT_FORMAT 2 // 2: start and end times
+#define SNAPSHOT_CHECKSUM_BASIS 2166136261u
+
+// state of the calendar the snapshot was taken from
+typedef struct
+{
+    int64_t version;   // per-user version counter in redis
+    int index_version; // INDEX_VERSION the redis indexes were known to be at, 0 if unknown
+    int next_event_id;
+} SnapshotInfo;
+
+// FNV-1a, continues the hash over data, start from SNAPSHOT_CHECKSUM_BASIS
+uint32_t snapshot_checksum(uint32_t hash, const void *data, size_t length);
+
+// writes one record per event and rule, the same layout the snapshot file uses, returns 0 on success
+int snapshot_write_records(FILE *file, uint32_t *checksum, const Timeline *timeline, Recurrence *const *recurrences, int recurrence_count);
+
+// adds count records read from data, returns 0 on success and -1 if they are damaged
+int snapshot_read_records(const unsigned char *data, size_t size, uint32_t count,
+                          Timeline *timeline, int (*store_recurrence)(Recurrence *));
+
+int snapshot_save(const char *path, const SnapshotInfo *info, int privilege_level,
+                  const Timeline *timeline, Recurrence *const *recurrences, int recurrence_count);
+
+int snapshot_load(const char *path, SnapshotInfo *info, int privilege_level,
+                  Timeline *timeline, int (*store_recurrence)(Recurrence *));
+
+#endif
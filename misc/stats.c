@@ -0,0 +1,298 @@
+#include "stats.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// histograms live for the whole process, the dump thread only reads them
+static Histogram histograms[STATS_MAX_HISTOGRAMS];
+static int histogram_count;
+static pthread_mutex_t histogram_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// dump target
+static const char *program_name = "";
+static char dump_path[256];
+static int dump_socket = -1;
+static int dump_interval = 10;
+static pid_t dump_owner;                                      // a forked child that exits leaves the file of its parent alone
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER; // keeps a last dump from recreating the file after shutdown removed it
+
+uint64_t stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// values below 2 * STATS_SUB_BUCKETS get their own bucket, above that each power of two is split in STATS_SUB_BUCKETS
+static int bucket_index(uint64_t value)
+{
+    if (value < 2 * STATS_SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    if (value >> STATS_MAX_BIT)
+    {
+        value = (1ULL << (STATS_MAX_BIT + 1)) - 1;
+    }
+    int bit = 63 - __builtin_clzll(value);
+    int shift = bit - 4;
+    return 2 * STATS_SUB_BUCKETS + (bit - 5) * STATS_SUB_BUCKETS + (int)(value >> shift) - STATS_SUB_BUCKETS;
+}
+
+// middle of the value range of a bucket
+static uint64_t bucket_value(int index)
+{
+    if (index < 2 * STATS_SUB_BUCKETS)
+    {
+        return index;
+    }
+    int bit = (index - 2 * STATS_SUB_BUCKETS) / STATS_SUB_BUCKETS + 5;
+    int shift = bit - 4;
+    uint64_t top = (index - 2 * STATS_SUB_BUCKETS) % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS;
+    return (top << shift) + (1ULL << shift) / 2;
+}
+
+Histogram *stats_histogram(const char *name)
+{
+    int count = __atomic_load_n(&histogram_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(histograms[i].name, name) == 0)
+        {
+            return &histograms[i];
+        }
+    }
+
+    pthread_mutex_lock(&histogram_lock);
+    Histogram *histogram = NULL;
+    for (int i = 0; i < histogram_count && histogram == NULL; i++)
+    {
+        if (strcmp(histograms[i].name, name) == 0)
+        {
+            histogram = &histograms[i];
+        }
+    }
+    if (histogram == NULL && histogram_count < STATS_MAX_HISTOGRAMS)
+    {
+        histogram = &histograms[histogram_count];
+        snprintf(histogram->name, sizeof(histogram->name), "%s", name);
+        __atomic_store_n(&histogram_count, histogram_count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&histogram_lock);
+    return histogram;
+}
+
+void stats_record(Histogram *histogram, uint64_t nanoseconds)
+{
+    if (histogram == NULL)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&histogram->buckets[bucket_index(nanoseconds)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, nanoseconds, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (nanoseconds > max && !__atomic_compare_exchange_n(&histogram->max, &max, nanoseconds, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void stats_record_since(const char *name, uint64_t start)
+{
+    stats_record(stats_histogram(name), stats_now() - start);
+}
+
+uint64_t stats_percentile(const Histogram *histogram, double percentile)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        total += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+        {
+            uint64_t value = bucket_value(i);
+            uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+            return value < max ? value : max;
+        }
+    }
+    return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+void stats_write(FILE *file)
+{
+    int count = __atomic_load_n(&histogram_count, __ATOMIC_ACQUIRE);
+    long now = (long)time(NULL);
+
+    for (int i = 0; i < count; i++)
+    {
+        const Histogram *h = &histograms[i];
+        uint64_t samples = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        if (samples == 0)
+            continue;
+
+        fprintf(file, "{\"time\":%ld,\"program\":\"%s\",\"pid\":%d,\"name\":\"%s\",\"count\":%llu,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"mean_us\":%.1f}\n",
+                now, program_name, (int)getpid(), h->name, (unsigned long long)samples,
+                stats_percentile(h, 50) / 1e3, stats_percentile(h, 90) / 1e3, stats_percentile(h, 99) / 1e3,
+                __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1e3, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e3 / samples);
+    }
+}
+
+void stats_print()
+{
+    int count = __atomic_load_n(&histogram_count, __ATOMIC_ACQUIRE);
+
+    printf("%s%-24s %8s %10s %10s %10s %10s%s\n", BOLD, "Operation", "Count", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)", RESET_COLOR);
+    printf("%s--------------------------------------------------------------------------------%s\n", BLUE_COLOR, RESET_COLOR);
+    for (int i = 0; i < count; i++)
+    {
+        const Histogram *h = &histograms[i];
+        if (h->count == 0)
+            continue;
+        printf("%-24s %8llu %10.1f %10.1f %10.1f %10.1f\n", h->name, (unsigned long long)h->count,
+               stats_percentile(h, 50) / 1e3, stats_percentile(h, 90) / 1e3, stats_percentile(h, 99) / 1e3, h->max / 1e3);
+    }
+}
+
+// replaces the dump file at once so a scraper never reads half of it
+static void dump_to_file()
+{
+    char tmp_path[sizeof(dump_path) + 8];
+    pthread_mutex_lock(&dump_lock);
+    if (dump_path[0] == '\0')
+    {
+        pthread_mutex_unlock(&dump_lock);
+        return;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dump_path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file != NULL)
+    {
+        stats_write(file);
+        if (fclose(file) == 0)
+        {
+            rename(tmp_path, dump_path);
+        }
+    }
+    pthread_mutex_unlock(&dump_lock);
+}
+
+// every connection to the socket gets the current stats, the file is rewritten every interval
+static void *dump_thread(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        struct pollfd listener = {dump_socket, POLLIN, 0};
+        int ready = poll(&listener, dump_socket >= 0 ? 1 : 0, dump_interval * 1000);
+
+        if (dump_socket < 0)
+        {
+            dump_to_file();
+            continue;
+        }
+        if (ready <= 0)
+        {
+            continue;
+        }
+
+        int connection = accept(dump_socket, NULL, NULL);
+        if (connection < 0)
+        {
+            continue;
+        }
+        FILE *file = fdopen(connection, "w");
+        if (file == NULL)
+        {
+            close(connection);
+            continue;
+        }
+        stats_write(file);
+        fclose(file);
+    }
+    return NULL;
+}
+
+void stats_init(const char *program)
+{
+    program_name = program;
+
+    const char *target = getenv("STATS_DUMP");
+    if (target == NULL || target[0] == '\0')
+    {
+        return;
+    }
+    const char *interval = getenv("STATS_INTERVAL");
+    if (interval != NULL && atoi(interval) > 0)
+    {
+        dump_interval = atoi(interval);
+    }
+
+    // one file or socket per process, several sessions run at once
+    int is_socket = strncmp(target, "unix:", 5) == 0;
+    snprintf(dump_path, sizeof(dump_path), "%s.%s.%d", is_socket ? target + 5 : target, program, (int)getpid());
+
+    if (is_socket)
+    {
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        if (strlen(dump_path) >= sizeof(address.sun_path))
+        {
+            dump_path[0] = '\0';
+            return;
+        }
+        memcpy(address.sun_path, dump_path, strlen(dump_path) + 1);
+        dump_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (dump_socket < 0 || bind(dump_socket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(dump_socket, 4) != 0)
+        {
+            if (dump_socket >= 0)
+                close(dump_socket);
+            dump_socket = -1;
+            dump_path[0] = '\0';
+            return;
+        }
+    }
+
+    // exit() on an error path removes the file as well
+    dump_owner = getpid();
+    atexit(stats_shutdown);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dump_thread, NULL) == 0)
+    {
+        pthread_detach(thread);
+    }
+}
+
+// the file or socket of the process goes with it, so a host does not collect one per session that ever ran
+void stats_shutdown()
+{
+    pthread_mutex_lock(&dump_lock);
+    if (dump_path[0] != '\0' && getpid() == dump_owner)
+    {
+        unlink(dump_path);
+        dump_path[0] = '\0';
+    }
+    pthread_mutex_unlock(&dump_lock);
+}
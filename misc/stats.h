@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// histogram parameter
+#define STATS_MAX_HISTOGRAMS 64
+#define STATS_NAME_LENGTH 32
+#define STATS_SUB_BUCKETS 16 // per power of two, values are kept within about 6%
+#define STATS_MAX_BIT 47     // values up to about 39 hours in nanoseconds
+#define STATS_BUCKETS (2 * STATS_SUB_BUCKETS + (STATS_MAX_BIT - 4) * STATS_SUB_BUCKETS)
+
+// log-linear latency histogram in nanoseconds, recording is lock free
+typedef struct
+{
+    char name[STATS_NAME_LENGTH];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} Histogram;
+
+// starts the periodic dump when STATS_DUMP is set (a file path or unix:<socket path>)
+// each process writes <path>.<program>.<pid>
+void stats_init(const char *program);
+
+// removes the dump file or socket of the process
+void stats_shutdown();
+
+// monotonic clock in nanoseconds
+uint64_t stats_now();
+
+// finds or creates the histogram of a name, returns NULL when all are in use
+Histogram *stats_histogram(const char *name);
+
+void stats_record(Histogram *histogram, uint64_t nanoseconds);
+
+// records the time since start under a name
+void stats_record_since(const char *name, uint64_t start);
+
+uint64_t stats_percentile(const Histogram *histogram, double percentile);
+
+// one JSON line per histogram
+void stats_write(FILE *file);
+
+// table of all histograms for the hidden stats screen
+void stats_print();
+
+#endif
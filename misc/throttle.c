@@ -0,0 +1,40 @@
+#include "throttle.h"
+#include "stats.h"
+#include <time.h>
+
+void throttle_init(Throttle *throttle, double rate, double burst)
+{
+    throttle->rate = rate;
+    throttle->burst = burst;
+    throttle->tokens = burst;
+    throttle->updated = stats_now();
+    pthread_mutex_init(&throttle->lock, NULL);
+}
+
+void throttle_take(Throttle *throttle, int count)
+{
+    pthread_mutex_lock(&throttle->lock);
+    uint64_t now = stats_now();
+    throttle->tokens += (now - throttle->updated) / 1e9 * throttle->rate;
+    if (throttle->tokens > throttle->burst)
+    {
+        throttle->tokens = throttle->burst;
+    }
+    throttle->updated = now;
+
+    // the tokens are taken at once and the debt is waited off outside the lock, so the threads queue up in order
+    throttle->tokens -= count;
+    double wait = throttle->tokens < 0 ? -throttle->tokens / throttle->rate : 0;
+    pthread_mutex_unlock(&throttle->lock);
+
+    if (wait > 0)
+    {
+        struct timespec pause = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+        nanosleep(&pause, NULL);
+    }
+}
+
+void throttle_destroy(Throttle *throttle)
+{
+    pthread_mutex_destroy(&throttle->lock);
+}
@@ -0,0 +1,24 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// token bucket shared by threads, one token per redis command
+typedef struct
+{
+    double rate;   // tokens per second
+    double burst;  // tokens that can pile up while nothing is sent
+    double tokens; // below zero while taken tokens are still being paid off
+    uint64_t updated;
+    pthread_mutex_t lock;
+} Throttle;
+
+void throttle_init(Throttle *throttle, double rate, double burst);
+
+// takes count tokens, sleeps until the budget covers them
+void throttle_take(Throttle *throttle, int count);
+
+void throttle_destroy(Throttle *throttle);
+
+#endif
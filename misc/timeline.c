@@ -0,0 +1,232 @@
+#include "timeline.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TIMELINE_INITIAL_BUCKETS 64
+
+// orders events by date first and by id for events on the same day
+static int compare_key(const Event *event, const char *date, int id)
+{
+    int cmp = strcmp(event->date, date);
+    if (cmp != 0)
+        return cmp;
+    return (event->id > id) - (event->id < id);
+}
+
+// picks a level with probability 1/4 per additional level (xorshift, keeps rand() untouched)
+static int random_level(Timeline *timeline)
+{
+    int level = 1;
+    while (level < TIMELINE_MAX_LEVEL)
+    {
+        timeline->seed ^= timeline->seed << 13;
+        timeline->seed ^= timeline->seed >> 17;
+        timeline->seed ^= timeline->seed << 5;
+        if ((timeline->seed & 3) != 0)
+            break;
+        level++;
+    }
+    return level;
+}
+
+static TimelineNode *create_node(int level, Event *event)
+{
+    TimelineNode *node = calloc(1, sizeof(TimelineNode) + level * sizeof(TimelineNode *));
+    if (node == NULL)
+        return NULL;
+    node->event = event;
+    node->level = level;
+    return node;
+}
+
+static unsigned int id_hash(int id)
+{
+    unsigned int h = (unsigned int)id;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+// doubles the id index once it is fully loaded
+static void grow_buckets(Timeline *timeline)
+{
+    int new_count = timeline->bucket_count * 2;
+    TimelineNode **new_buckets = calloc(new_count, sizeof(TimelineNode *));
+    if (new_buckets == NULL)
+        return; // keep the old, longer chains
+
+    for (int i = 0; i < timeline->bucket_count; i++)
+    {
+        TimelineNode *node = timeline->buckets[i];
+        while (node)
+        {
+            TimelineNode *next = node->id_next;
+            unsigned int b = id_hash(node->event->id) & (new_count - 1);
+            node->id_next = new_buckets[b];
+            new_buckets[b] = node;
+            node = next;
+        }
+    }
+
+    free(timeline->buckets);
+    timeline->buckets = new_buckets;
+    timeline->bucket_count = new_count;
+}
+
+static TimelineNode *find_node(const Timeline *timeline, int id)
+{
+    TimelineNode *node = timeline->buckets[id_hash(id) & (timeline->bucket_count - 1)];
+    while (node && node->event->id != id)
+        node = node->id_next;
+    return node;
+}
+
+// sets up an empty timeline, returns 0 on success
+int timeline_init(Timeline *timeline)
+{
+    memset(timeline, 0, sizeof(Timeline));
+    timeline->head = create_node(TIMELINE_MAX_LEVEL, NULL);
+    timeline->buckets = calloc(TIMELINE_INITIAL_BUCKETS, sizeof(TimelineNode *));
+    if (timeline->head == NULL || timeline->buckets == NULL)
+    {
+        free(timeline->head);
+        free(timeline->buckets);
+        return -1;
+    }
+    timeline->bucket_count = TIMELINE_INITIAL_BUCKETS;
+    timeline->level = 1;
+    timeline->seed = 0x9e3779b9;
+    return 0;
+}
+
+// inserts an event at its date position, returns -1 on duplicate id or allocation failure
+int timeline_insert(Timeline *timeline, Event *event)
+{
+    if (event == NULL || find_node(timeline, event->id) != NULL)
+        return -1;
+
+    TimelineNode *update[TIMELINE_MAX_LEVEL];
+    TimelineNode *x = timeline->head;
+    for (int i = timeline->level - 1; i >= 0; i--)
+    {
+        while (x->next[i] && compare_key(x->next[i]->event, event->date, event->id) < 0)
+            x = x->next[i];
+        update[i] = x;
+    }
+
+    int level = random_level(timeline);
+    TimelineNode *node = create_node(level, event);
+    if (node == NULL)
+        return -1;
+
+    if (level > timeline->level)
+    {
+        for (int i = timeline->level; i < level; i++)
+            update[i] = timeline->head;
+        timeline->level = level;
+    }
+
+    for (int i = 0; i < level; i++)
+    {
+        node->next[i] = update[i]->next[i];
+        update[i]->next[i] = node;
+    }
+    node->prev = update[0] == timeline->head ? NULL : update[0];
+    if (node->next[0])
+        node->next[0]->prev = node;
+    else
+        timeline->tail = node;
+
+    // add to the id index
+    unsigned int b = id_hash(event->id) & (timeline->bucket_count - 1);
+    node->id_next = timeline->buckets[b];
+    timeline->buckets[b] = node;
+
+    timeline->count++;
+    if (timeline->count > timeline->bucket_count)
+        grow_buckets(timeline);
+
+    return 0;
+}
+
+// unlinks the event with the given id and hands it back to the caller, NULL if not found
+Event *timeline_remove(Timeline *timeline, int id)
+{
+    TimelineNode *target = find_node(timeline, id);
+    if (target == NULL)
+        return NULL;
+
+    Event *event = target->event;
+    TimelineNode *x = timeline->head;
+    for (int i = timeline->level - 1; i >= 0; i--)
+    {
+        while (x->next[i] && compare_key(x->next[i]->event, event->date, event->id) < 0)
+            x = x->next[i];
+        if (x->next[i] == target)
+            x->next[i] = target->next[i];
+    }
+
+    if (target->next[0])
+        target->next[0]->prev = target->prev;
+    else
+        timeline->tail = target->prev;
+
+    while (timeline->level > 1 && timeline->head->next[timeline->level - 1] == NULL)
+        timeline->level--;
+
+    // drop from the id index
+    TimelineNode **link = &timeline->buckets[id_hash(id) & (timeline->bucket_count - 1)];
+    while (*link != target)
+        link = &(*link)->id_next;
+    *link = target->id_next;
+
+    free(target);
+    timeline->count--;
+    return event;
+}
+
+// looks up an event by id
+Event *timeline_find(const Timeline *timeline, int id)
+{
+    TimelineNode *node = find_node(timeline, id);
+    return node ? node->event : NULL;
+}
+
+// returns the first node on or after the given date (a "YYYY-MM" prefix works too), NULL if none
+TimelineNode *timeline_seek(const Timeline *timeline, const char *date)
+{
+    TimelineNode *x = timeline->head;
+    for (int i = timeline->level - 1; i >= 0; i--)
+    {
+        while (x->next[i] && strcmp(x->next[i]->event->date, date) < 0)
+            x = x->next[i];
+    }
+    return x->next[0];
+}
+
+TimelineNode *timeline_first(const Timeline *timeline)
+{
+    return timeline->head->next[0];
+}
+
+TimelineNode *timeline_last(const Timeline *timeline)
+{
+    return timeline->tail;
+}
+
+// frees all nodes and their events
+void timeline_clear(Timeline *timeline)
+{
+    TimelineNode *node = timeline->head ? timeline->head->next[0] : NULL;
+    while (node)
+    {
+        TimelineNode *next = node->next[0];
+        free_event(node->event);
+        free(node);
+        node = next;
+    }
+    free(timeline->head);
+    free(timeline->buckets);
+    memset(timeline, 0, sizeof(Timeline));
+}
@@ -0,0 +1,47 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "event.h"
+
+// skiplist parameter
+#define TIMELINE_MAX_LEVEL 24
+
+// node of the date ordered skiplist, keyed by (date, id)
+typedef struct TimelineNode
+{
+    Event *event;
+    struct TimelineNode *prev;    // previous node on level 0, NULL for the first node
+    struct TimelineNode *id_next; // chain in the id index
+    int level;
+    struct TimelineNode *next[];
+} TimelineNode;
+
+// events ordered by date, with an id index for lookups by id
+typedef struct
+{
+    TimelineNode *head;
+    TimelineNode *tail;
+    int level;
+    int count;
+    unsigned int seed;
+    TimelineNode **buckets;
+    int bucket_count;
+} Timeline;
+
+int timeline_init(Timeline *timeline);
+
+int timeline_insert(Timeline *timeline, Event *event);
+
+Event *timeline_remove(Timeline *timeline, int id);
+
+Event *timeline_find(const Timeline *timeline, int id);
+
+TimelineNode *timeline_seek(const Timeline *timeline, const char *date);
+
+TimelineNode *timeline_first(const Timeline *timeline);
+
+TimelineNode *timeline_last(const Timeline *timeline);
+
+void timeline_clear(Timeline *timeline);
+
+#endif
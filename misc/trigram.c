@@ -0,0 +1,63 @@
+#include "trigram.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// appends the lowercased trigrams of a text to out[count..max), returns the new count
+int trigram_extract(const char *text, Trigram *out, int count, int max)
+{
+    size_t length = strlen(text);
+
+    for (size_t i = 0; i + TRIGRAM_LENGTH <= length && count < max; i++)
+    {
+        for (int j = 0; j < TRIGRAM_LENGTH; j++)
+        {
+            out[count].bytes[j] = (unsigned char)tolower((unsigned char)text[i + j]);
+        }
+        count++;
+    }
+    return count;
+}
+
+static int compare_trigrams(const void *a, const void *b)
+{
+    return memcmp(a, b, TRIGRAM_LENGTH);
+}
+
+// sorts the trigrams and drops duplicates, returns the number of unique trigrams
+int trigram_unique(Trigram *trigrams, int count)
+{
+    if (count == 0)
+        return 0;
+
+    qsort(trigrams, count, sizeof(Trigram), compare_trigrams);
+
+    int unique = 1;
+    for (int i = 1; i < count; i++)
+    {
+        if (memcmp(&trigrams[i], &trigrams[unique - 1], TRIGRAM_LENGTH) != 0)
+        {
+            trigrams[unique++] = trigrams[i];
+        }
+    }
+    return unique;
+}
+
+// case insensitive substring check
+int contains_ignore_case(const char *haystack, const char *needle)
+{
+    size_t needle_length = strlen(needle);
+
+    for (; *haystack; haystack++)
+    {
+        size_t i = 0;
+        while (i < needle_length && haystack[i] &&
+               tolower((unsigned char)haystack[i]) == tolower((unsigned char)needle[i]))
+        {
+            i++;
+        }
+        if (i == needle_length)
+            return 1;
+    }
+    return needle_length == 0;
+}
@@ -0,0 +1,19 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stddef.h>
+
+#define TRIGRAM_LENGTH 3
+
+typedef struct
+{
+    unsigned char bytes[TRIGRAM_LENGTH];
+} Trigram;
+
+int trigram_extract(const char *text, Trigram *out, int count, int max);
+
+int trigram_unique(Trigram *trigrams, int count);
+
+int contains_ignore_case(const char *haystack, const char *needle);
+
+#endif
@@ -0,0 +1,186 @@
+#include "wheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+void wheel_init(Wheel *wheel, int64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+// links an entry into the slot of the lowest level whose span covers it
+static void place(Wheel *wheel, WheelEntry *entry)
+{
+    int64_t delta = entry->due - wheel->now;
+    int64_t due = entry->due;
+    int level = 0;
+
+    if (delta < 0)
+    {
+        due = wheel->now;
+    }
+    else
+    {
+        while (level < WHEEL_LEVELS - 1 && delta >= (int64_t)1 << (WHEEL_BITS * (level + 1)))
+            level++;
+        // beyond the top level the entry waits in its last slot and is placed again when that comes round
+        if (delta >= (int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+            due = wheel->now + ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    // slots are indexed by the bits of the absolute time, so a level is only emptied when the level below wraps
+    int slot = (int)((due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    entry->next = wheel->slots[level][slot];
+    wheel->slots[level][slot] = entry;
+}
+
+int wheel_insert(Wheel *wheel, int64_t due, const char *member)
+{
+    size_t length = strlen(member);
+    WheelEntry *entry = malloc(sizeof(WheelEntry) + length + 1);
+    if (entry == NULL)
+    {
+        return -1;
+    }
+    entry->due = due;
+    memcpy(entry->member, member, length + 1);
+    place(wheel, entry);
+    wheel->count++;
+    return 0;
+}
+
+// moves the entries of a higher slot down to the levels that now cover them, returns the slot index
+static int cascade(Wheel *wheel, int level)
+{
+    int slot = (int)((wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    WheelEntry *entry = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    while (entry != NULL)
+    {
+        WheelEntry *next = entry->next;
+        place(wheel, entry);
+        entry = next;
+    }
+    return slot;
+}
+
+size_t wheel_advance(Wheel *wheel, int64_t now, void (*fire)(WheelEntry *entry, void *context), void *context)
+{
+    size_t fired = 0;
+    while (wheel->now <= now)
+    {
+        int slot = (int)(wheel->now & (WHEEL_SLOTS - 1));
+        for (int level = 1; slot == 0 && level < WHEEL_LEVELS; level++)
+        {
+            slot = cascade(wheel, level);
+        }
+
+        WheelEntry *entry = wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)];
+        wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)] = NULL;
+        while (entry != NULL)
+        {
+            WheelEntry *next = entry->next;
+            wheel->count--;
+            fired++;
+            fire(entry, context);
+            entry = next;
+        }
+        wheel->now++;
+
+        // nothing left to expire, the rest of a long gap is skipped a whole first level turn at a time
+        if (wheel->count == 0 && now - wheel->now >= WHEEL_SLOTS)
+        {
+            wheel->now = now - (now & (WHEEL_SLOTS - 1));
+        }
+    }
+    return fired;
+}
+
+void wheel_clear(Wheel *wheel)
+{
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            WheelEntry *entry = wheel->slots[level][slot];
+            while (entry != NULL)
+            {
+                WheelEntry *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+    wheel->count = 0;
+}
+
+// offsets from an unaligned start that sit on the slot and level boundaries, every entry has to fire in the second it is due
+static const struct
+{
+    const char *name;
+    int64_t offset;
+} known_dues[] = {
+    {"past", -10},
+    {"now", 0},
+    {"next second", 1},
+    {"last first level slot", WHEEL_SLOTS - 1},
+    {"first cascade", WHEEL_SLOTS},
+    {"after first cascade", WHEEL_SLOTS + 1},
+    {"last second level slot", ((int64_t)1 << (2 * WHEEL_BITS)) - 1},
+    {"third level", (int64_t)1 << (2 * WHEEL_BITS)},
+    {"inside third level", 70000},
+    {"fourth level", ((int64_t)1 << (3 * WHEEL_BITS)) + 300},
+};
+
+typedef struct
+{
+    const Wheel *wheel;
+    int64_t start;
+    const char *late; // name of the first entry that fired in another second than it was due
+    size_t fired;
+} WheelCheck;
+
+static void check_fire(WheelEntry *entry, void *context)
+{
+    WheelCheck *check = context;
+    int64_t due = entry->due < check->start ? check->start : entry->due;
+    if (due != check->wheel->now && check->late == NULL)
+    {
+        for (size_t i = 0; i < sizeof(known_dues) / sizeof(known_dues[0]); i++)
+        {
+            if (strcmp(entry->member, known_dues[i].name) == 0)
+                check->late = known_dues[i].name;
+        }
+    }
+    check->fired++;
+    free(entry);
+}
+
+const char *wheel_check()
+{
+    static Wheel wheel;
+    WheelCheck check = {&wheel, 1700000000 + 123, NULL, 0};
+    size_t count = sizeof(known_dues) / sizeof(known_dues[0]);
+    wheel_init(&wheel, check.start);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (wheel_insert(&wheel, check.start + known_dues[i].offset, known_dues[i].name) < 0)
+        {
+            wheel_clear(&wheel);
+            return "insert";
+        }
+    }
+
+    // advanced in uneven steps the way the reminder loop wakes up
+    int64_t end = check.start + known_dues[count - 1].offset;
+    for (int64_t now = check.start; now < end && check.late == NULL; now += now - check.start + 7)
+    {
+        wheel_advance(&wheel, now, check_fire, &check);
+    }
+    wheel_advance(&wheel, end, check_fire, &check);
+    wheel_clear(&wheel);
+    if (check.late != NULL)
+        return check.late;
+    return check.fired == count ? NULL : "count";
+}
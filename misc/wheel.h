@@ -0,0 +1,42 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// timing wheel parameter
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 8 // 256 one second slots on the first level, each level above spans 256 times the one below
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+// a scheduled entry, the member is kept in the same allocation
+typedef struct WheelEntry
+{
+    struct WheelEntry *next;
+    int64_t due; // unix time in seconds
+    char member[];
+} WheelEntry;
+
+// hierarchical timing wheel, inserts and expiries are O(1) and an entry moves down at most WHEEL_LEVELS - 1 times
+typedef struct
+{
+    WheelEntry *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    int64_t now; // the next second to expire, everything before it is done
+    size_t count;
+} Wheel;
+
+void wheel_init(Wheel *wheel, int64_t now);
+
+// schedules member at due, an entry that is due already expires with the next second, returns -1 when out of memory
+int wheel_insert(Wheel *wheel, int64_t due, const char *member);
+
+// expires every second up to and including now, fire gets each due entry and frees it with free()
+size_t wheel_advance(Wheel *wheel, int64_t now, void (*fire)(WheelEntry *entry, void *context), void *context);
+
+void wheel_clear(Wheel *wheel);
+
+// schedules entries on the slot and level boundaries and advances past them, returns NULL if each fired in the second it
+// was due and else the name of the first that did not
+const char *wheel_check();
+
+#endif
@@ -9,7 +9,16 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "common.h"
+#include "stats.h"
+#include "event.h"
+#include "recurrence.h"
+#include "busy.h"
+#include "db.h"
+#include "shard.h"
+#include "replica.h"
 #include <time.h>
 
 // login parameter
@@ -17,6 +26,48 @@
 #define PWD_LENGTH 48
 #define USERNAME_LENGTH 32
 #define SALT_LENGTH 16
+#define ARGON2_TIME_COST 2
+#define ARGON2_MEMORY_KIB (1 << 16) // 64 MiB per hash
+#define ARGON2_PARALLELISM 1
+#define STORED_PASSWORD_LENGTH EVP_ENCODE_LENGTH(HASHED_PWD_LENGTH + SALT_LENGTH)
+
+// user search parameter
+#define USERS_INDEX_READY "users_lex_ready" // set once the accounts from before the index are in it
+#define USER_SEARCH_RESULTS 10
+#define USERS_BACKFILL_BATCH 1000
+
+// what's on parameter
+#define PUBLIC_INDEX_READY "public_feed_ready"    // set once the events from before the feed are in it, renamed when the rules got their date range
+#define PUBLIC_INDEX_LEGACY "public_recurrences"  // set of all public rules the date range index replaced
+#define PUBLIC_INDEX_CLAIM "public_feed_backfill" // taken by the one session that fills the feed
+#define PUBLIC_INDEX_CLAIM_SECONDS 300            // renewed per page, a claim left by a session that died expires
+// public rules that can occur between ARGV[1] and ARGV[2]: started by the end of the range and not ended before its start,
+// the smaller of the two score ranges is walked and each of its rules checked against the other index
+#define PUBLIC_RULES_SCRIPT "local s = redis.call('ZCOUNT', KEYS[1], '-inf', ARGV[2]) local e = redis.call('ZCOUNT', KEYS[2], ARGV[1], '+inf') "                \
+                            "local rules, check, low, high = nil, KEYS[2], tonumber(ARGV[1]), math.huge "                                                       \
+                            "if s <= e then rules = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', ARGV[2]) "                                                     \
+                            "else rules = redis.call('ZRANGEBYSCORE', KEYS[2], ARGV[1], '+inf') check, low, high = KEYS[1], -math.huge, tonumber(ARGV[2]) end " \
+                            "local r = {} for _, m in ipairs(rules) do local x = tonumber(redis.call('ZSCORE', check, m)) "                                     \
+                            "if x and x >= low and x <= high then r[#r + 1] = m end end return r"
+#define FEED_PAGE_SIZE 10
+#define FEED_MAX_PAGES 1000
+#define FEED_MAX_OCCURRENCES 5000 // occurrences of recurring events kept for one range
+
+// free day parameter
+#define BUSY_INDEX_READY "busy_events_ready"     // set once the events from before the bitmaps are counted, renamed when rules left them
+#define BUSY_INDEX_CLAIM "busy_events_backfill"  // taken by the one session that counts them
+#define BUSY_INDEX_CLAIM_SECONDS 300             // renewed per page, a claim left by a session that died expires
+#define RULES_INDEX_CLAIM "rules_index_backfill" // taken by the one session that indexes the rules from before rules:{<user>}
+#define FREE_DAYS_DEFAULT_RANGE 30
+
+// bulk import parameter
+#define IMPORT_BATCH 256                      // records hashed and then written in one pipeline
+#define IMPORT_LINE_LENGTH 256
+#define IMPORT_MEMORY_ENV "AUTH_IMPORT_MEMORY_MB" // caps the argon2 memory of the hashes running at once
+#define IMPORT_DEFAULT_MEMORY_MB 1024
+
+// the user search and the feed read from a replica when REDIS_REPLICAS lists one, logins and writes stay on the primary
+ReadRoute browse_reads;
 
 // function to validate input for password and username
 int input_validation(char *input, const char *str, int length)
@@ -45,8 +96,8 @@ int input_validation(char *input, const char *str, int length)
     return 1;
 }
 
-// strict validation for username
-int is_valid_username(const char *username)
+// first character a username may not contain, NULL if there is none
+const char *invalid_username_char(const char *username)
 {
     const char *allowed_special_chars = "_-@.+";
 
@@ -54,24 +105,74 @@ int is_valid_username(const char *username)
     {
         if (!isalnum(username[i]) && strchr(allowed_special_chars, username[i]) == NULL)
         {
-            printf("%s\nInvalid character '%c' in username.\n\n%s", RED_COLOR, username[i], RESET_COLOR);
-            return 0;
+            return &username[i];
         }
     }
+    return NULL;
+}
+
+// strict validation for username
+int is_valid_username(const char *username)
+{
+    const char *invalid = invalid_username_char(username);
+    if (invalid != NULL)
+    {
+        printf("%s\nInvalid character '%c' in username.\n\n%s", RED_COLOR, *invalid, RESET_COLOR);
+        return 0;
+    }
     return 1;
 }
 
-// register new user
-void register_user(redisContext *c)
+// argon2id hash of a password, timed for the stats
+int hash_password(const char *password, const unsigned char *salt, unsigned char *hash)
+{
+    uint64_t start = stats_now();
+    int result = argon2id_hash_raw(ARGON2_TIME_COST, ARGON2_MEMORY_KIB, ARGON2_PARALLELISM, password, strlen(password), salt, SALT_LENGTH, hash, HASHED_PWD_LENGTH);
+    stats_record_since("argon2", start);
+    return result;
+}
+
+// salts and hashes a password into the base64 form that is stored, returns NULL or what failed
+const char *encode_password(const char *password, char *stored)
 {
-    char username[USERNAME_LENGTH] = {0};
-    char password[PWD_LENGTH] = {0};
     unsigned char salt[SALT_LENGTH];
     unsigned char hashed_password[HASHED_PWD_LENGTH];
     unsigned char combined[HASHED_PWD_LENGTH + SALT_LENGTH];
-    char base64_combined[EVP_ENCODE_LENGTH(sizeof(combined))];
+    const char *error = NULL;
 
-    redisReply *reply;
+    // generate salt and hash the password
+    if (!RAND_bytes(salt, sizeof(salt)))
+    {
+        error = "Failed to generate random salt.";
+    }
+    else if (hash_password(password, salt, hashed_password) != ARGON2_OK)
+    {
+        error = "Failed to hash the password.";
+    }
+    else
+    {
+        memcpy(combined, hashed_password, sizeof(hashed_password));
+        memcpy(combined + sizeof(hashed_password), salt, sizeof(salt));
+
+        // base64 encoding
+        if (EVP_EncodeBlock((unsigned char *)stored, combined, sizeof(combined)) == -1)
+        {
+            error = "Base64 encoding failed.";
+        }
+    }
+
+    memset(hashed_password, 0, sizeof(hashed_password));
+    memset(combined, 0, sizeof(combined));
+    memset(salt, 0, sizeof(salt));
+    return error;
+}
+
+// register new user
+void register_user(redisContext *c)
+{
+    char username[USERNAME_LENGTH] = {0};
+    char password[PWD_LENGTH] = {0};
+    char base64_combined[STORED_PASSWORD_LENGTH];
 
     while (1)
     {
@@ -81,23 +182,17 @@ void register_user(redisContext *c)
             continue;
         }
 
-        reply = redisCommand(c, "EXISTS user:%s", username);
-        if (!reply)
+        int exists = db_user_exists(c, username);
+        if (exists < 0)
         {
-            printf("%s\nError: Redis command failed.\n%s", RED_COLOR, RESET_COLOR);
+            printf("%s\nError: Redis command failed: %s\n%s", RED_COLOR, db_last_error(), RESET_COLOR);
             continue;
         }
-
-        if (reply->integer == 1)
-        {
-            printf("%s\nUser '%s' already exists. Please choose a different username.%s\n\n", ORANGE_COLOR, username, RESET_COLOR);
-        }
-        else
+        if (exists == 0)
         {
-            freeReplyObject(reply);
             break;
         }
-        freeReplyObject(reply);
+        printf("%s\nUser '%s' already exists. Please choose a different username.%s\n\n", ORANGE_COLOR, username, RESET_COLOR);
     }
 
     // password validation
@@ -111,48 +206,23 @@ void register_user(redisContext *c)
         break;
     }
 
-    // generate salt
-    if (!RAND_bytes(salt, sizeof(salt)))
-    {
-        printf("%s\nError: Failed to generate random salt.%s\n", RED_COLOR, RESET_COLOR);
-        return;
-    }
-
-    // hash password
-    if (argon2id_hash_raw(2, 1 << 16, 1, password, strlen(password), salt, sizeof(salt), hashed_password, sizeof(hashed_password)) != ARGON2_OK)
-    {
-        printf("%s\nError: Failed to hash the password.%s\n", RED_COLOR, RESET_COLOR);
-        return;
-    }
-
-    memcpy(combined, hashed_password, sizeof(hashed_password));
-    memcpy(combined + sizeof(hashed_password), salt, sizeof(salt));
-
-    // base64 encoding
-    if (EVP_EncodeBlock((unsigned char *)base64_combined, combined, sizeof(combined)) == -1)
+    const char *error = encode_password(password, base64_combined);
+    memset(password, 0, sizeof(password));
+    if (error != NULL)
     {
-        printf("%s\nError: Base64 encoding failed.%s\n", RED_COLOR, RESET_COLOR);
+        printf("%s\nError: %s%s\n", RED_COLOR, error, RESET_COLOR);
         return;
     }
 
-    // store in db
-    time_t now = time(NULL);
-    reply = redisCommand(c, "HSET user:%s password %s created_at %ld", username, base64_combined, now);
-    if (!reply || reply->type != REDIS_REPLY_INTEGER)
+    // store in db, the username index for the user search is updated in the same pipeline
+    if (db_put_user(c, username, base64_combined, (long)time(NULL)) != 0)
     {
-        printf("%s\nError: Failed to save user to Redis.%s\n", RED_COLOR, RESET_COLOR);
-        if (reply)
-            freeReplyObject(reply);
+        printf("%s\nError: Failed to save user to Redis: %s%s\n", RED_COLOR, db_last_error(), RESET_COLOR);
         return;
     }
+    read_route_wrote(&browse_reads);
 
     printf("%s\nUser '%s' registered successfully.%s\n", GREEN_COLOR, username, RESET_COLOR);
-
-    freeReplyObject(reply);
-    memset(password, 0, sizeof(password));
-    memset(hashed_password, 0, sizeof(hashed_password));
-    memset(salt, 0, sizeof(salt));
-
     return;
 }
 
@@ -174,19 +244,17 @@ void login_user(redisContext *c, char *user)
     }
 
     // username check in db
-    redisReply *reply = redisCommand(c, "EXISTS user:%s", username);
-    if (!reply)
+    int exists = db_user_exists(c, username);
+    if (exists < 0)
     {
-        printf("Error: Redis command failed.\n");
+        printf("Error: Redis command failed: %s\n", db_last_error());
         return;
     }
-    if (reply->integer == 0)
+    if (exists == 0)
     {
         printf("%s\nUser '%s' does not exist.%s\n", RED_COLOR, username, RESET_COLOR);
-        freeReplyObject(reply);
         return;
     }
-    freeReplyObject(reply);
 
     // password validation
     printf("Enter password: ");
@@ -196,31 +264,28 @@ void login_user(redisContext *c, char *user)
     }
 
     // retrieve stored hash and salt from db
-    reply = redisCommand(c, "HGET user:%s password", username);
-    if (!reply || reply->type != REDIS_REPLY_STRING)
+    DbUser account;
+    if (db_get_user(c, username, &account) != 1)
     {
         printf("%s\nError: Failed to retrieve user data from Redis.%s\n", RED_COLOR, RESET_COLOR);
-        if (reply)
-            freeReplyObject(reply);
         return;
     }
 
     // base64 decode the stored combined (password + salt)
-    int decoded_length = EVP_DecodeBlock(stored_combined, (unsigned char *)reply->str, strlen(reply->str));
+    int decoded_length = EVP_DecodeBlock(stored_combined, (unsigned char *)account.password, strlen(account.password));
+    memset(&account, 0, sizeof(account));
     if (decoded_length == -1)
     {
         printf("%s\nError: Base64 decoding failed.%s\n", RED_COLOR, RESET_COLOR);
-        freeReplyObject(reply);
         return;
     }
-    freeReplyObject(reply);
 
     // split the decoded combined into the stored password and salt
     memcpy(stored_hashed_password, stored_combined, sizeof(stored_hashed_password));
     memcpy(stored_salt, stored_combined + sizeof(stored_hashed_password), sizeof(stored_salt));
 
     // hash the input password with the stored salt
-    if (argon2id_hash_raw(2, 1 << 16, 1, password, strlen(password), stored_salt, sizeof(stored_salt), hashed_password, sizeof(hashed_password)) != ARGON2_OK)
+    if (hash_password(password, stored_salt, hashed_password) != ARGON2_OK)
     {
         printf("%s\nError: Failed to hash the password.%s\n", RED_COLOR, RESET_COLOR);
         return;
@@ -275,220 +340,1445 @@ void open_calendar(redisContext *c, const char *username, const char *privilege_
     }
 }
 
-// structure to store user data and created_at timestamp
-typedef struct
+// adds the accounts registered before the username index existed, runs once per database
+void prepare_user_index(redisContext *c)
 {
-    char *username;
-    unsigned int created_at;
-} User;
+    redisReply *reply = redis_command(c, "EXISTS " USERS_INDEX_READY);
+    int ready = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (ready)
+    {
+        return;
+    }
 
-// comparison function for sorting users by created_at
-int compare_users(const void *a, const void *b)
-{
-    // compare the created_at timestamps
-    return ((User *)a)->created_at - ((User *)b)->created_at;
+    // SCAN instead of KEYS so redis keeps serving other sessions meanwhile, every node holds some of the accounts
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            reply = scan ? redis_command(scan, "SCAN %llu MATCH user:{* COUNT %d", cursor, USERS_BACKFILL_BATCH) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                char name[USERNAME_LENGTH];
+                db_key_user(keys->element[i]->str, name, sizeof(name));
+                redis_append(c, "ZADD " USERS_INDEX " 0 %s", name);
+            }
+            failed += drain_replies(c, keys->elements);
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+
+    if (failed == 0)
+    {
+        freeReplyObject(redis_command(c, "SET " USERS_INDEX_READY " 1"));
+    }
 }
 
-void display_registered_user(redisContext *c, char *logged_in_user)
+// first usernames starting with the prefix in alphabetical order, returns the number found or -1
+int find_users(redisContext *c, const char *prefix, char users[][USERNAME_LENGTH], long *created_at)
 {
-    // retrieve all user keys from the Redis database
-    redisReply *keys_reply = redisCommand(c, "KEYS user:*");
+    redisReply *reply;
+    if (prefix[0] == '\0')
+    {
+        reply = redis_command(c, "ZRANGEBYLEX " USERS_INDEX " - + LIMIT 0 %d", USER_SEARCH_RESULTS);
+    }
+    else
+    { // every name with the prefix sorts between "prefix" and "prefix\xff"
+        reply = redis_command(c, "ZRANGEBYLEX " USERS_INDEX " [%s (%s\xff LIMIT 0 %d", prefix, prefix, USER_SEARCH_RESULTS);
+    }
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
 
-    if (keys_reply == NULL || keys_reply->type != REDIS_REPLY_ARRAY)
+    int count = 0;
+    for (size_t i = 0; i < reply->elements && count < USER_SEARCH_RESULTS; i++)
     {
-        printf("%sError: Unable to retrieve user data.%s\n", RED_COLOR, RESET_COLOR);
-        freeReplyObject(keys_reply);
-        return;
+        snprintf(users[count++], USERNAME_LENGTH, "%s", reply->element[i]->str);
     }
+    freeReplyObject(reply);
 
-    // if no user keys are found
-    if (keys_reply->elements == 0)
+    // registration times of the matches in one round trip
+    for (int i = 0; i < count; i++)
     {
-        printf("No registered users found.\n");
-        press_enter_to_continue();
-        freeReplyObject(keys_reply);
-        return;
+        redis_append(c, "HGET user:{%s} created_at", users[i]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        created_at[i] = 0;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (reply != NULL && reply->type == REDIS_REPLY_STRING)
+        {
+            created_at[i] = atol(reply->str);
+        }
+        freeReplyObject(reply);
     }
+    return count;
+}
+
+// opens a calendar, the own one with owner rights
+void open_user_calendar(redisContext *c, const char *username, const char *logged_in_user)
+{
+    open_calendar(c, username, strcmp(username, logged_in_user) == 0 ? "1" : "0");
+}
 
-    // prepare memory to store user data
-    User *users = malloc(keys_reply->elements * sizeof(User));
-    size_t user_count = 0;
+// incremental username search, every entry narrows the prefix until a user is picked
+void display_registered_user(redisContext *c, char *logged_in_user)
+{
+    char prefix[USERNAME_LENGTH] = "";
+    char users[USER_SEARCH_RESULTS][USERNAME_LENGTH];
+    long created_at[USER_SEARCH_RESULTS];
 
-    // iterate through all the user keys
-    for (size_t i = 0; i < keys_reply->elements; i++)
+    while (1)
     {
-        char *user_key = keys_reply->element[i]->str;
+        clear();
+        redisContext *r = read_context(&browse_reads, c, USERS_INDEX);
+        int count = find_users(r, prefix, users, created_at);
+        if (count < 0)
+        {
+            printf("%sError: Unable to retrieve user data.%s\n", RED_COLOR, RESET_COLOR);
+            press_enter_to_continue();
+            return;
+        }
 
-        // extract the username from the user key
-        char *username_str = strrchr(user_key, ':');
-        if (!username_str || strlen(username_str) < 2)
-            continue;
-        char *username = username_str + 1;
+        redisReply *reply = redis_command(r, "ZCARD " USERS_INDEX);
+        long long total = (reply != NULL && reply->type == REDIS_REPLY_INTEGER) ? reply->integer : 0;
+        freeReplyObject(reply);
 
-        // retrieve the creation timestamp for the user
-        redisReply *user_reply = redisCommand(c, "HGET %s created_at", user_key);
+        if (prefix[0])
+        {
+            printf("%s%s  %s(starting with '%s', %lld users in total)\n", BOLD, "Registered Users", RESET_COLOR, prefix, total);
+        }
+        else
+        {
+            printf("%s%s  %s(%lld users in total)\n", BOLD, "Registered Users", RESET_COLOR, total);
+        }
+        printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
 
-        // check if user data was retrieved successfully
-        if (user_reply == NULL || user_reply->type != REDIS_REPLY_STRING)
+        if (count == 0)
         {
-            printf("%sError: Unable to retrieve data for user %s.%s\n", RED_COLOR, user_key, RESET_COLOR);
-            freeReplyObject(user_reply);
-            continue;
+            printf("No registered users found.\n\n");
         }
+        for (int i = 0; i < count; i++)
+        {
+            // convert the timestamp to a human-readable format
+            time_t raw_time = (time_t)created_at[i];
+            struct tm *time_info = localtime(&raw_time);
 
-        // convert Unix timestamp to an unsigned int
-        unsigned int created_at = atoi(user_reply->str);
+            char formatted_time[20];
+            strftime(formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M", time_info);
 
-        // store the user data
-        users[user_count].username = strdup(username);
-        users[user_count].created_at = created_at;
-        user_count++;
+            printf("%s%2d.%s %s%s%s  (%s)\n\n", RED_COLOR, i + 1, RESET_COLOR, YELLOW_COLOR, users[i], RESET_COLOR, formatted_time);
+        }
+        if (count == USER_SEARCH_RESULTS)
+        {
+            printf("Only the first %d matches are shown, type more of the name to narrow them down.\n\n", USER_SEARCH_RESULTS);
+        }
 
-        freeReplyObject(user_reply);
-    }
+        printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
+        printf("Type the beginning of a username to search, or a number or full username to view their public events.\n");
+        printf("Press Enter to go back.\n\n%sYour choice: %s", BOLD, RESET_COLOR);
 
-    // sort users by the created_at timestamp
-    qsort(users, user_count, sizeof(User), compare_users);
+        char input[USERNAME_LENGTH] = {0};
+        if (fgets(input, sizeof(input), stdin) == NULL)
+        {
+            return;
+        }
+        if (strchr(input, '\n') == NULL)
+        {
+            empty_input_buffer();
+            printf("%s\nUsername too long.%s\n\n", RED_COLOR, RESET_COLOR);
+            press_enter_to_continue();
+            continue;
+        }
+        input[strcspn(input, "\n")] = '\0';
 
-    // print the table header
-    printf("%s%s  %s(Sorted by Registration Timestamp)\n", BOLD, "Registered Users", RESET_COLOR);
-    printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
+        if (input[0] == '\0')
+        {
+            return;
+        }
 
-    // display sorted user data
-    for (size_t i = 0; i < user_count; i++)
-    {
-        // convert the timestamp to a human-readable format
-        time_t raw_time = (time_t)users[i].created_at;
-        struct tm *time_info = localtime(&raw_time);
+        // a number picks one of the listed users
+        char *end;
+        long choice = strtol(input, &end, 10);
+        if (*end == '\0' && choice >= 1 && choice <= count)
+        {
+            open_user_calendar(c, users[choice - 1], logged_in_user);
+            return;
+        }
 
-        char formatted_time[20];
-        strftime(formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M", time_info);
+        if (!is_valid_username(input))
+        {
+            press_enter_to_continue();
+            continue;
+        }
 
-        // display username and creation time
-        printf("%s%s%s  (%s)\n\n", YELLOW_COLOR, users[i].username, RESET_COLOR, formatted_time);
+        // a complete username opens that calendar right away
+        reply = redis_command(r, "ZSCORE " USERS_INDEX " %s", input);
+        int exists = reply != NULL && reply->type == REDIS_REPLY_STRING;
+        freeReplyObject(reply);
+        if (exists)
+        {
+            open_user_calendar(c, input, logged_in_user);
+            return;
+        }
 
-        free(users[i].username); // free memory for username
+        snprintf(prefix, sizeof(prefix), "%s", input);
     }
+}
 
-    // free memory for the users array
-    free(users);
-    freeReplyObject(keys_reply);
+// WHAT'S ON --------------------
+// one entry of the public events feed
+typedef struct
+{
+    char date[MAX_DATE_LENGTH];
+    char owner[USERNAME_LENGTH];
+    char name[MAX_NAME_LENGTH];
+} FeedEntry;
 
-    printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
-    printf("Select a user to view their public events (visible to everyone).\n\n%sYour choice: %s", BOLD, RESET_COLOR);
+// position in the feed: offset into the stored events in range and index into the expanded occurrences
+typedef struct
+{
+    long stored;
+    int recurring;
+} FeedCursor;
 
-    char username[USERNAME_LENGTH] = {0};
-    if (!input_validation(username, "Username", sizeof(username)) || !is_valid_username(username))
+// adds the public events of one key type to the feed, returns the number of failed commands
+int backfill_public_events(redisContext *c, const char *pattern, int recurring)
+{
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
     {
-        press_enter_to_continue();
-        return;
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH %s COUNT %d", cursor, pattern, USERS_BACKFILL_BATCH) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return failed + 1;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+            freeReplyObject(redis_command(c, "EXPIRE " PUBLIC_INDEX_CLAIM " %d", PUBLIC_INDEX_CLAIM_SECONDS));
+
+            static const char *const names[] = {"visibility", "date", "until"};
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                db_append_event_get(c, keys->element[i]->str, names, 3);
+            }
+
+            int commands = 0;
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                redisReply *values = NULL;
+                if (redis_get_reply(c, (void **)&values) != REDIS_OK)
+                {
+                    freeReplyObject(reply);
+                    return failed + 1;
+                }
+                char member[USERNAME_LENGTH + 16];
+                DbEventFields fields;
+                int year, month, day;
+                if (db_parse_event_get(values, names, 3, &fields) && fields.visibility == 0 && fields.date != NULL &&
+                    parse_date(fields.date, &year, &month, &day) && db_key_member(keys->element[i]->str, member, sizeof(member)))
+                {
+                    if (recurring)
+                    {
+                        int end_year, end_month, end_day;
+                        int end = fields.until != NULL && parse_date(fields.until, &end_year, &end_month, &end_day) ? end_year * 10000 + end_month * 100 + end_day : PUBLIC_RULE_ENDLESS;
+                        redis_append(c, "ZADD " PUBLIC_RULE_STARTS " %d %s", year * 10000 + month * 100 + day, member);
+                        redis_append(c, "ZADD " PUBLIC_RULE_ENDS " %d %s", end, member);
+                        commands += 2;
+                    }
+                    else
+                    {
+                        redis_append(c, "ZADD " PUBLIC_EVENTS_INDEX " %d %s", year * 10000 + month * 100 + day, member);
+                        commands++;
+                    }
+                }
+                freeReplyObject(values);
+            }
+            failed += drain_replies(c, commands);
+            freeReplyObject(reply);
+        } while (cursor != 0);
     }
+    return failed;
+}
 
-    // username check in db
-    redisReply *reply = redisCommand(c, "EXISTS user:%s", username);
-    if (!reply)
+void prepare_public_index(redisContext *c)
+{
+    redisReply *reply = redis_command(c, "EXISTS " PUBLIC_INDEX_READY);
+    int ready = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (ready)
     {
-        printf("Error: Redis command failed.\n");
         return;
     }
-    if (reply->integer == 0)
+
+    // one session scans the whole database, the others start without waiting for it
+    reply = redis_command(c, "SET " PUBLIC_INDEX_CLAIM " 1 NX EX %d", PUBLIC_INDEX_CLAIM_SECONDS);
+    int claimed = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    if (!claimed)
     {
-        printf("%s\nUser '%s' does not exist.%s\n", RED_COLOR, username, RESET_COLOR);
-        press_enter_to_continue();
-        freeReplyObject(reply);
         return;
     }
-    freeReplyObject(reply);
 
-    if (strcmp(username, logged_in_user) == 0)
+    if (backfill_public_events(c, "event:{*", 0) + backfill_public_events(c, "recurrence:{*", 1) == 0)
     {
-        open_calendar(c, username, "1");
+        freeReplyObject(redis_command(c, "DEL " PUBLIC_INDEX_LEGACY));
+        freeReplyObject(redis_command(c, "SET " PUBLIC_INDEX_READY " 1"));
     }
     else
     {
-        open_calendar(c, username, "0");
+        // the next session tries again
+        freeReplyObject(redis_command(c, "DEL " PUBLIC_INDEX_CLAIM));
     }
 }
 
-void show_menu(const char *logged_in_user)
+// order of the feed: by date, then by owner
+int compare_feed_entries(const void *a, const void *b)
 {
-    printf("=====================================\n");
-    printf("%s        %sCommand Line Calendar        \n%s", BOLD, GREEN_COLOR, RESET_COLOR);
-    printf("=====================================\n");
-    printf("\n");
+    const FeedEntry *x = a, *y = b;
+    int cmp = strcmp(x->date, y->date);
+    return cmp != 0 ? cmp : strcmp(x->owner, y->owner);
+}
 
-    if (logged_in_user != NULL && logged_in_user[0] != '\0')
+// fills a feed entry from the owner part of a member and an event date and name
+void set_feed_entry(FeedEntry *entry, const char *member, const char *date, const char *name)
+{
+    snprintf(entry->date, sizeof(entry->date), "%s", date);
+    snprintf(entry->owner, sizeof(entry->owner), "%.*s", (int)strcspn(member, ":"), member);
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+}
+
+// turns a rule hash into a recurring event of any visibility, returns NULL if fields are missing
+Recurrence *recurrence_from_reply(redisReply *reply)
+{
+    DbEventFields fields;
+    if (!db_parse_event(reply, &fields))
     {
-        printf("%sLogged in as: %s%s%s\n", BOLD, YELLOW_COLOR, logged_in_user, RESET_COLOR);
+        return NULL;
     }
-    else
+    if (fields.description == NULL)
     {
-        printf("%sYou are not logged in.\n%s", BOLD, RESET_COLOR);
+        fields.description = "-";
     }
-
-    printf("\n");
-    printf("%s1.%s Register\n", RED_COLOR, RESET_COLOR);
-    printf("%s2.%s Login\n", RED_COLOR, RESET_COLOR);
-    printf("%s3.%s View and Edit Your Calendar\n", RED_COLOR, RESET_COLOR);
-    printf("%s4.%s Browse Users and Their Calendars\n", RED_COLOR, RESET_COLOR);
-
-    printf("\n%s5.%s Logout\n", RED_COLOR, RESET_COLOR);
-    printf("%s6.%s Exit\n", RED_COLOR, RESET_COLOR);
-    printf("\n");
-    printf("=====================================\n");
-    printf("Enter your choice: ");
+    return db_recurrence_from_fields(&fields, 0);
 }
 
-// MAIN ------------
-int main()
+// expands the public recurring events into their occurrences between the two dates, returns the count or -1
+// only the rules whose date range overlaps the dates are read
+int expand_public_recurrences(redisContext *c, const char *from, const char *to, int from_score, int to_score, FeedEntry *entries, int *truncated)
 {
-    clear();
-    redisContext *c = connect_redis();
-    char user[USERNAME_LENGTH] = "";
-
-    char choice;
+    redisReply *members = redis_command(c, "EVAL %s 2 " PUBLIC_RULE_STARTS " " PUBLIC_RULE_ENDS " %d %d", PUBLIC_RULES_SCRIPT, from_score, to_score);
+    if (members == NULL || members->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(members);
+        return -1;
+    }
 
-    do
+    for (size_t i = 0; i < members->elements; i++)
     {
-        show_menu(user);
+        char key[USERNAME_LENGTH + 32];
+        db_member_key("recurrence", members->element[i]->str, key, sizeof(key));
+        redis_append(c, "HGETALL %s", key);
+    }
 
-        choice = getchar();
-        empty_input_buffer();
+    int count = 0;
+    *truncated = 0;
+    for (size_t i = 0; i < members->elements; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            freeReplyObject(members);
+            return -1;
+        }
 
-        switch (choice)
+        Recurrence *recurrence = reply != NULL && reply->type == REDIS_REPLY_ARRAY ? recurrence_from_reply(reply) : NULL;
+        if (recurrence != NULL && recurrence->event->visibility != 0)
         {
-        case '1':
-            clear();
-            register_user(c);
-            press_enter_to_continue();
-            break;
+            free_recurrence(recurrence);
+            recurrence = NULL;
+        }
+        char position[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH];
+        snprintf(position, sizeof(position), "%s", from);
+        while (recurrence != NULL && recurrence_next(recurrence, position, date) && strcmp(date, to) <= 0)
+        {
+            if (count == FEED_MAX_OCCURRENCES)
+            {
+                *truncated = 1;
+                break;
+            }
+            set_feed_entry(&entries[count++], members->element[i]->str, date, recurrence->event->name);
+
+            int year, month, day;
+            parse_date(date, &year, &month, &day);
+            days_to_date(date_to_days(year, month, day) + 1, &year, &month, &day);
+            snprintf(position, sizeof(position), "%04d-%02d-%02d", year, month, day);
+        }
 
-        case '2':
-            clear();
-            login_user(c, user);
-            press_enter_to_continue();
-            break;
+        if (recurrence != NULL)
+            free_recurrence(recurrence);
+        freeReplyObject(reply);
+    }
+    freeReplyObject(members);
 
-        case '3':
-            clear();
-            open_calendar(c, user, "1");
-            break;
+    qsort(entries, count, sizeof(FeedEntry), compare_feed_entries);
+    return count;
+}
 
-        case '4':
-            clear();
-            display_registered_user(c, user);
-            break;
+// reads up to one page of stored public events at the offset, returns how many index entries were read or -1
+int read_public_events(redisContext *c, int from_score, int to_score, long offset, FeedEntry *entries, int *valid)
+{
+    redisReply *members = redis_command(c, "ZRANGEBYSCORE " PUBLIC_EVENTS_INDEX " %d %d LIMIT %ld %d", from_score, to_score, offset, FEED_PAGE_SIZE);
+    if (members == NULL || members->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(members);
+        return -1;
+    }
 
-        case '5':
-            clear();
-            memset(user, 0, USERNAME_LENGTH);
+    static const char *const names[] = {"date", "name"};
+    for (size_t i = 0; i < members->elements; i++)
+    {
+        char key[USERNAME_LENGTH + 32];
+        db_member_key("event", members->element[i]->str, key, sizeof(key));
+        db_append_event_get(c, key, names, 2);
+    }
+
+    // an event removed since it was indexed is skipped but still counts for the offset
+    int read = members->elements;
+    for (size_t i = 0; i < members->elements; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            freeReplyObject(members);
+            return -1;
+        }
+        DbEventFields fields;
+        valid[i] = db_parse_event_get(reply, names, 2, &fields) && fields.date != NULL && fields.name != NULL;
+        if (valid[i])
+        {
+            set_feed_entry(&entries[i], members->element[i]->str, fields.date, fields.name);
+        }
+        freeReplyObject(reply);
+    }
+    freeReplyObject(members);
+    return read;
+}
+
+// reads a date, an empty line is today, returns 0 if the input was invalid
+int read_date_or_today(const char *prompt, int *year, int *month, int *day)
+{
+    char input[MAX_DATE_LENGTH + 2];
+    printf("%s", prompt);
+    if (fgets(input, sizeof(input), stdin) == NULL)
+    {
+        return 0;
+    }
+    if (strchr(input, '\n') == NULL)
+    {
+        empty_input_buffer();
+    }
+    input[strcspn(input, "\n")] = '\0';
+
+    if (input[0] == '\0')
+    {
+        time_t now = time(NULL);
+        struct tm *tm_info = localtime(&now);
+        *year = tm_info->tm_year + 1900;
+        *month = tm_info->tm_mon + 1;
+        *day = tm_info->tm_mday;
+    }
+    else if (!parse_date(input, year, month, day))
+    {
+        printf("%s\nInvalid date. Please enter a valid date.\n%s", RED_COLOR, RESET_COLOR);
+        return 0;
+    }
+    return 1;
+}
+
+// asks for the day, week or month to show, returns 0 if the input was invalid
+int get_feed_range(char *from, char *to, char *title, size_t title_size)
+{
+    printf("Show the public events of a (d)ay, (w)eek or (m)onth? ");
+    char range = tolower(getchar());
+    empty_input_buffer();
+    if (range != 'd' && range != 'w' && range != 'm')
+    {
+        printf("%s\nInvalid input. Please enter 'd', 'w' or 'm'.\n%s", RED_COLOR, RESET_COLOR);
+        return 0;
+    }
+
+    int year, month, day;
+    if (!read_date_or_today("Enter a date in that range (YYYY-MM-DD) or leave empty for today: ", &year, &month, &day))
+    {
+        return 0;
+    }
+
+    long first = date_to_days(year, month, day), last = first;
+    if (range == 'w')
+    { // monday to sunday, day 0 of the day numbers is a thursday
+        long weekday = ((first + 3) % 7 + 7) % 7;
+        first -= weekday;
+        last = first + 6;
+    }
+    else if (range == 'm')
+    {
+        first = date_to_days(year, month, 1);
+        last = first + get_days_in_month(month, year) - 1;
+    }
+
+    days_to_date(first, &year, &month, &day);
+    snprintf(from, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+    days_to_date(last, &year, &month, &day);
+    snprintf(to, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+
+    if (range == 'd')
+        snprintf(title, title_size, "on %s", from);
+    else
+        snprintf(title, title_size, "from %s to %s", from, to);
+    return 1;
+}
+
+// public events of all users for a day, week or month, one page at a time
+void display_whats_on(redisContext *c)
+{
+    char from[MAX_DATE_LENGTH], to[MAX_DATE_LENGTH], title[64];
+    if (!get_feed_range(from, to, title, sizeof(title)))
+    {
+        press_enter_to_continue();
+        return;
+    }
+
+    int from_year, from_month, from_day, to_year, to_month, to_day;
+    parse_date(from, &from_year, &from_month, &from_day);
+    parse_date(to, &to_year, &to_month, &to_day);
+    int from_score = from_year * 10000 + from_month * 100 + from_day;
+    int to_score = to_year * 10000 + to_month * 100 + to_day;
+
+    FeedEntry *occurrences = malloc(FEED_MAX_OCCURRENCES * sizeof(FeedEntry));
+    FeedCursor *history = malloc(FEED_MAX_PAGES * sizeof(FeedCursor));
+    if (occurrences == NULL || history == NULL)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        free(occurrences);
+        free(history);
+        press_enter_to_continue();
+        return;
+    }
+
+    int truncated;
+    int occurrence_count = expand_public_recurrences(c, from, to, from_score, to_score, occurrences, &truncated);
+    if (occurrence_count < 0)
+    {
+        printf("%sError: Unable to retrieve the public events.%s\n", RED_COLOR, RESET_COLOR);
+        free(occurrences);
+        free(history);
+        press_enter_to_continue();
+        return;
+    }
+
+    int page = 0;
+    history[0] = (FeedCursor){0, 0};
+    char choice;
+
+    while (1)
+    {
+        clear();
+        printf("%sWhat's On%s  (public events %s)\n", BOLD, RESET_COLOR, title);
+        printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
+
+        // merge one page of stored events with the expanded occurrences
+        FeedEntry stored[FEED_PAGE_SIZE];
+        int valid[FEED_PAGE_SIZE];
+        FeedCursor cursor = history[page];
+        int read = read_public_events(c, from_score, to_score, cursor.stored, stored, valid);
+        if (read < 0)
+        {
+            printf("%sError: Unable to retrieve the public events.%s\n", RED_COLOR, RESET_COLOR);
+            break;
+        }
+
+        int i = 0, shown = 0;
+        while (shown < FEED_PAGE_SIZE && (i < read || cursor.recurring < occurrence_count))
+        {
+            if (i < read && !valid[i])
+            {
+                i++;
+                continue;
+            }
+
+            const FeedEntry *entry;
+            if (i < read && (cursor.recurring >= occurrence_count || compare_feed_entries(&stored[i], &occurrences[cursor.recurring]) <= 0))
+            {
+                entry = &stored[i++];
+            }
+            else
+            {
+                entry = &occurrences[cursor.recurring++];
+            }
+            printf("%s%s%s  %s  %s(by %s)%s\n\n", BLUE_COLOR, entry->date, RESET_COLOR, entry->name, GREY, entry->owner, RESET_COLOR);
+            shown++;
+        }
+        cursor.stored += i;
+
+        // there is more if this page is full and either source has entries left
+        int more = shown == FEED_PAGE_SIZE;
+        if (more && cursor.recurring >= occurrence_count && i == read)
+        {
+            int peek_valid[FEED_PAGE_SIZE];
+            FeedEntry peek[FEED_PAGE_SIZE];
+            more = read_public_events(c, from_score, to_score, cursor.stored, peek, peek_valid) > 0;
+        }
+
+        if (page == 0 && shown == 0)
+        {
+            printf("No public events found.\n\n");
+        }
+        if (truncated)
+        {
+            printf("%sOnly the first %d occurrences of recurring events are included.%s\n\n", ORANGE_COLOR, FEED_MAX_OCCURRENCES, RESET_COLOR);
+        }
+        printf("%s----------------------------------------------------------------%s\n", BLUE_COLOR, RESET_COLOR);
+        printf("Page %d. Use 'n' for next page, 'p' for previous page, 'q' to quit.\n", page + 1);
+
+        if (scanf(" %c", &choice) != 1)
+        {
+            break;
+        }
+        empty_input_buffer();
+
+        if (choice == 'n' && more && page + 1 < FEED_MAX_PAGES)
+        {
+            history[++page] = cursor;
+        }
+        else if (choice == 'p' && page > 0)
+        {
+            page--;
+        }
+        else if (choice == 'q')
+        {
+            break;
+        }
+    }
+
+    free(occurrences);
+    free(history);
+}
+
+// FREE DAYS --------------------
+// adds the rules from before the per user rule index to it, returns the number of failed commands
+int backfill_rule_index(redisContext *c)
+{
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH recurrence:{* COUNT %d", cursor, USERS_BACKFILL_BATCH) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return failed + 1;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+            freeReplyObject(redis_command(c, "EXPIRE " RULES_INDEX_CLAIM " %d", BUSY_INDEX_CLAIM_SECONDS));
+
+            // "recurrence:{<user>}:<id>"
+            int commands = 0;
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                char owner[USERNAME_LENGTH];
+                const char *id = strrchr(keys->element[i]->str, ':');
+                if (db_key_user(keys->element[i]->str, owner, sizeof(owner)) && id != NULL)
+                {
+                    redis_append(c, "SADD rules:{%s} %s", owner, id + 1);
+                    commands++;
+                }
+            }
+            failed += drain_replies(c, commands);
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+    return failed;
+}
+
+// indexes the rules of every user, runs once per database, calendars scan for their rules until it is done
+void prepare_rule_index(redisContext *c)
+{
+    redisReply *reply = redis_command(c, "EXISTS " DB_RULES_READY);
+    int ready = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (ready)
+    {
+        return;
+    }
+
+    // adding a rule twice changes nothing, the claim only keeps sessions from scanning all at once
+    reply = redis_command(c, "SET " RULES_INDEX_CLAIM " 1 NX EX %d", BUSY_INDEX_CLAIM_SECONDS);
+    int claimed = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    if (!claimed)
+    {
+        return;
+    }
+
+    if (backfill_rule_index(c) == 0)
+    {
+        freeReplyObject(redis_command(c, "SET " DB_RULES_READY " 1"));
+    }
+    else
+    {
+        freeReplyObject(redis_command(c, "DEL " RULES_INDEX_CLAIM));
+    }
+}
+
+// recounts the busy days of every user from their date index, returns the number of failed commands
+int backfill_busy_days(redisContext *c)
+{
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH user:{* COUNT %d", cursor, USERS_BACKFILL_BATCH) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return failed + 1;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+            freeReplyObject(redis_command(c, "EXPIRE " BUSY_INDEX_CLAIM " %d", BUSY_INDEX_CLAIM_SECONDS));
+
+            // "user:{<user>}"
+            int commands = 0;
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                char owner[USERNAME_LENGTH];
+                if (db_key_user(keys->element[i]->str, owner, sizeof(owner)))
+                {
+                    commands += busy_append_recount(c, owner);
+                }
+            }
+            failed += drain_replies(c, commands);
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+    return failed;
+}
+
+// deletes the keys matching any of the patterns on every node, returns the number of failed commands
+int delete_busy_keys(redisContext *c, const char *const *patterns, size_t pattern_count)
+{
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        for (size_t p = 0; p < pattern_count; p++)
+        {
+            unsigned long long cursor = 0;
+            do
+            {
+                redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH %s COUNT %d", cursor, patterns[p], USERS_BACKFILL_BATCH) : NULL;
+                if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+                {
+                    freeReplyObject(reply);
+                    return failed + 1;
+                }
+                cursor = strtoull(reply->element[0]->str, NULL, 10);
+
+                redisReply *keys = reply->element[1];
+                for (size_t i = 0; i < keys->elements; i++)
+                {
+                    redis_append(scan, "DEL %s", keys->element[i]->str);
+                }
+                failed += drain_replies(scan, keys->elements);
+                freeReplyObject(reply);
+            } while (cursor != 0);
+        }
+    }
+    return failed;
+}
+
+// counts the events from before the busy bitmaps existed, runs once per database
+void prepare_busy_index(redisContext *c)
+{
+    redisReply *reply = redis_command(c, "EXISTS " BUSY_INDEX_READY);
+    int ready = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (ready)
+    {
+        return;
+    }
+
+    reply = redis_command(c, "SET " BUSY_INDEX_CLAIM " 1 NX EX %d", BUSY_INDEX_CLAIM_SECONDS);
+    int claimed = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    if (!claimed)
+    {
+        return;
+    }
+
+    // the bitmaps and counts that still held the first two years of each rule go, the current ones are
+    // replaced a user at a time by a recount that sessions writing meanwhile cannot interleave with
+    static const char *const patterns[] = {"busy:{*", "busy_days:{*", "busy_days_*"};
+    if (delete_busy_keys(c, patterns, sizeof(patterns) / sizeof(patterns[0])) == 0 && backfill_busy_days(c) == 0)
+    {
+        freeReplyObject(redis_command(c, "SET " BUSY_INDEX_READY " 1"));
+    }
+    else
+    {
+        // the next session tries again
+        freeReplyObject(redis_command(c, "DEL " BUSY_INDEX_CLAIM));
+    }
+}
+
+// prints one run of free days
+void print_free_days(long first, long last)
+{
+    static const char *weekdays[] = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+    int year, month, day;
+
+    days_to_date(first, &year, &month, &day);
+    printf("%s%04d-%02d-%02d%s (%s)", GREEN_COLOR, year, month, day, RESET_COLOR, weekdays[first % 7]);
+    if (last > first)
+    {
+        days_to_date(last, &year, &month, &day);
+        printf(" to %s%04d-%02d-%02d%s (%s)", GREEN_COLOR, year, month, day, RESET_COLOR, weekdays[last % 7]);
+    }
+    printf("\n");
+}
+
+// days in a range on which the logged in user and the other participants have no event
+void find_common_free_days(redisContext *c, const char *logged_in_user)
+{
+    if (logged_in_user == NULL || logged_in_user[0] == '\0')
+    {
+        printf("%sYou must be logged in to find free days.\n%s", RED_COLOR, RESET_COLOR);
+        press_enter_to_continue();
+        return;
+    }
+
+    char line[BUSY_MAX_USERS * USERNAME_LENGTH];
+    const char *users[BUSY_MAX_USERS];
+    int user_count = 0;
+    users[user_count++] = logged_in_user;
+
+    printf("Enter the usernames of the other participants, separated by spaces: ");
+    if (fgets(line, sizeof(line), stdin) == NULL)
+    {
+        return;
+    }
+    if (strchr(line, '\n') == NULL)
+    {
+        empty_input_buffer();
+    }
+
+    for (char *name = strtok(line, " \t\n"); name != NULL; name = strtok(NULL, " \t\n"))
+    {
+        if (user_count == BUSY_MAX_USERS)
+        {
+            printf("%s\nAt most %d participants can be compared at once.\n%s", RED_COLOR, BUSY_MAX_USERS, RESET_COLOR);
+            press_enter_to_continue();
+            return;
+        }
+        if (strlen(name) >= USERNAME_LENGTH || !is_valid_username(name))
+        {
+            printf("%s\nInvalid username '%s'.\n%s", RED_COLOR, name, RESET_COLOR);
+            press_enter_to_continue();
+            return;
+        }
+        users[user_count++] = name;
+    }
+
+    // every participant must exist, a typo would otherwise look like a user who is always free
+    for (int i = 1; i < user_count; i++)
+    {
+        redis_append(c, "EXISTS user:{%s}", users[i]);
+    }
+    int unknown = 0;
+    for (int i = 1; i < user_count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK || reply == NULL || reply->type != REDIS_REPLY_INTEGER || reply->integer != 1)
+        {
+            printf("%s\nUser '%s' does not exist.%s", RED_COLOR, users[i], RESET_COLOR);
+            unknown++;
+        }
+        freeReplyObject(reply);
+    }
+    if (unknown)
+    {
+        printf("\n");
+        press_enter_to_continue();
+        return;
+    }
+
+    int year, month, day;
+    if (!read_date_or_today("Enter the first day (YYYY-MM-DD) or leave empty for today: ", &year, &month, &day))
+    {
+        press_enter_to_continue();
+        return;
+    }
+    long first = date_to_days(year, month, day);
+
+    char input[8];
+    int range = FREE_DAYS_DEFAULT_RANGE;
+    printf("Number of days to check (1-%d, empty for %d): ", BUSY_MAX_RANGE_DAYS, FREE_DAYS_DEFAULT_RANGE);
+    if (fgets(input, sizeof(input), stdin) != NULL)
+    {
+        if (strchr(input, '\n') == NULL)
+            empty_input_buffer();
+        if (input[0] != '\n')
+            range = atoi(input);
+    }
+    if (range < 1 || range > BUSY_MAX_RANGE_DAYS)
+    {
+        printf("%s\nInvalid number of days.\n%s", RED_COLOR, RESET_COLOR);
+        press_enter_to_continue();
+        return;
+    }
+    long last = first + range - 1;
+
+    unsigned char free_days[BUSY_MAX_RANGE_DAYS];
+    uint64_t start = stats_now();
+    int failed = busy_free_days(c, users, user_count, first, last, free_days);
+    stats_record_since("busy.free_days", start);
+    if (failed)
+    {
+        printf("%sError: Unable to look up the free days.%s\n", RED_COLOR, RESET_COLOR);
+        press_enter_to_continue();
+        return;
+    }
+
+    clear();
+    printf("%sDays on which all %d participants are free%s\n", BOLD, user_count, RESET_COLOR);
+    printf("%s----------------------------------------------------------------%s\n\n", BLUE_COLOR, RESET_COLOR);
+
+    int found = 0;
+    for (long d = first; d <= last; d++)
+    {
+        if (!free_days[d - first])
+            continue;
+        long run_end = d;
+        while (run_end < last && free_days[run_end + 1 - first])
+            run_end++;
+        print_free_days(d, run_end);
+        found += run_end - d + 1;
+        d = run_end;
+    }
+    if (found == 0)
+    {
+        printf("No common free day in this range.\n");
+    }
+    printf("\n%s----------------------------------------------------------------%s\n", BLUE_COLOR, RESET_COLOR);
+    printf("%d of %d days free.\n", found, range);
+    press_enter_to_continue();
+}
+
+// BULK IMPORT --------------------
+// one account of an import file, error stays NULL while the record is fine
+typedef struct
+{
+    long line;
+    char username[USERNAME_LENGTH];
+    char password[PWD_LENGTH];
+    char stored[STORED_PASSWORD_LENGTH];
+    const char *error;
+} ImportRecord;
+
+// workers hash the records of one batch, the semaphore keeps the argon2 memory under the cap
+typedef struct
+{
+    ImportRecord *records;
+    int count;
+    int next; // next record to hash
+    int done;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    sem_t memory; // one slot per hash that fits into the cap
+} ImportPool;
+
+void *import_worker(void *arg)
+{
+    ImportPool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->stop && pool->next >= pool->count)
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->next >= pool->count)
+        {
+            break;
+        }
+        ImportRecord *record = &pool->records[pool->next++];
+        pthread_mutex_unlock(&pool->lock);
+
+        if (record->error == NULL)
+        {
+            sem_wait(&pool->memory);
+            record->error = encode_password(record->password, record->stored);
+            sem_post(&pool->memory);
+        }
+        memset(record->password, 0, sizeof(record->password));
+
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->done == pool->count)
+        {
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// hands a batch to the workers and waits until every record is hashed
+void import_hash(ImportPool *pool, ImportRecord *records, int count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->records = records;
+    pool->count = count;
+    pool->next = 0;
+    pool->done = 0;
+    pthread_cond_broadcast(&pool->work);
+    while (pool->done < pool->count)
+    {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// splits "username<TAB>password" into a record, problems are kept in record->error
+void import_parse(const char *line, long number, ImportRecord *record)
+{
+    memset(record, 0, sizeof(*record));
+    record->line = number;
+
+    size_t name_length = strcspn(line, "\t");
+    snprintf(record->username, sizeof(record->username), "%.*s", (int)name_length, line);
+    if (line[name_length] != '\t')
+    {
+        record->error = "expected username<TAB>password";
+        return;
+    }
+    const char *password = line + name_length + 1;
+    if (name_length == 0 || name_length >= USERNAME_LENGTH - 1 || invalid_username_char(record->username) != NULL)
+    {
+        record->error = "invalid username";
+    }
+    else if (password[0] == '\0' || strlen(password) >= PWD_LENGTH - 1)
+    {
+        record->error = "invalid password";
+    }
+    else
+    {
+        snprintf(record->password, sizeof(record->password), "%s", password);
+    }
+}
+
+// creates the hashed accounts of a batch in one pipeline, returns the number created, c->err is set if the connection failed
+int import_write(redisContext *c, ImportRecord *records, int count)
+{
+    long now = (long)time(NULL);
+    int queued[IMPORT_BATCH];
+    for (int i = 0; i < count; i++)
+    {
+        queued[i] = records[i].error == NULL ? db_append_new_user(c, records[i].username, records[i].stored, now) : 0;
+        if (records[i].error == NULL && queued[i] == 0)
+        {
+            records[i].error = db_last_error();
+        }
+    }
+
+    int created = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < queued[i]; j++)
+        {
+            redisReply *reply = NULL;
+            if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+            {
+                // an account whose creation was confirmed keeps its success
+                for (int k = j == 0 ? i : i + 1; k < count; k++)
+                {
+                    if (records[k].error == NULL)
+                        records[k].error = "connection lost";
+                }
+                return created;
+            }
+            if (j == 0 && (reply == NULL || reply->type != REDIS_REPLY_INTEGER))
+            {
+                records[i].error = reply != NULL && reply->type == REDIS_REPLY_ERROR ? "redis error" : "unexpected reply";
+            }
+            else if (j == 0 && reply->integer == 0)
+            {
+                records[i].error = "user exists";
+            }
+            else if (j == 0)
+            {
+                created++;
+            }
+            freeReplyObject(reply);
+        }
+    }
+    return created;
+}
+
+// one JSON line per record on stdout
+void import_report(const ImportRecord *records, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        printf("{\"line\":%ld,\"user\":", records[i].line);
+        print_json_string(stdout, records[i].username);
+        if (records[i].error == NULL)
+        {
+            printf(",\"ok\":true}\n");
+        }
+        else
+        {
+            printf(",\"ok\":false,\"error\":");
+            print_json_string(stdout, records[i].error);
+            printf("}\n");
+        }
+    }
+    fflush(stdout);
+}
+
+// admin mode: creates the accounts listed in a file ("-" for stdin), one "username<TAB>password" per line
+int import_users(redisContext *c, const char *path)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "%sError: Cannot open %s.%s\n", RED_COLOR, path, RESET_COLOR);
+        return 1;
+    }
+
+    const char *memory_env = getenv(IMPORT_MEMORY_ENV);
+    long memory_mb = memory_env != NULL && atol(memory_env) > 0 ? atol(memory_env) : IMPORT_DEFAULT_MEMORY_MB;
+    long slots = memory_mb * 1024 / ARGON2_MEMORY_KIB;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (slots < 1)
+        slots = 1;
+    if (threads < 1)
+        threads = 1;
+
+    ImportRecord *records = malloc(IMPORT_BATCH * sizeof(ImportRecord));
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    ImportPool pool = {.stop = 0};
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    sem_init(&pool.memory, 0, (unsigned int)slots);
+
+    int started = 0;
+    while (records != NULL && workers != NULL && started < threads && pthread_create(&workers[started], NULL, import_worker, &pool) == 0)
+    {
+        started++;
+    }
+
+    long total = 0, created = 0, number = 0;
+    int failed = started == 0;
+    if (failed)
+    {
+        fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+    }
+    uint64_t start = stats_now();
+    char line[IMPORT_LINE_LENGTH];
+
+    while (!failed)
+    {
+        int count = 0;
+        while (count < IMPORT_BATCH && fgets(line, sizeof(line), file) != NULL)
+        {
+            number++;
+            if (strchr(line, '\n') == NULL && !feof(file))
+            {
+                // the rest of an overlong line is dropped with it
+                int ch;
+                while ((ch = fgetc(file)) != '\n' && ch != EOF)
+                    ;
+                import_parse("", number, &records[count]);
+                records[count++].error = "line too long";
+                continue;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+            {
+                continue;
+            }
+            import_parse(line, number, &records[count++]);
+        }
+        if (count == 0)
+        {
+            break;
+        }
+
+        uint64_t batch_start = stats_now();
+        import_hash(&pool, records, count);
+        stats_record_since("import.hash", batch_start);
+
+        batch_start = stats_now();
+        created += import_write(c, records, count);
+        stats_record_since("import.write", batch_start);
+
+        import_report(records, count);
+        total += count;
+        failed = c->err != 0;
+    }
+
+    // wakes the workers so they see there is nothing left
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    double seconds = (stats_now() - start) / 1e9;
+    fprintf(stderr, "%ld of %ld accounts created in %.1f s (%.1f records/s, %ld threads, at most %ld hashes at a time)\n", created, total, seconds,
+            seconds > 0 ? total / seconds : 0.0, threads, slots < threads ? slots : threads);
+    if (failed && started > 0)
+    {
+        fprintf(stderr, "%sError: Redis connection lost: %s%s\n", RED_COLOR, c->errstr, RESET_COLOR);
+    }
+
+    sem_destroy(&pool.memory);
+    pthread_cond_destroy(&pool.finished);
+    pthread_cond_destroy(&pool.work);
+    pthread_mutex_destroy(&pool.lock);
+    free(workers);
+    free(records);
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+    return failed || created < total ? 1 : 0;
+}
+
+// ARCHIVE --------------------
+// runs the archive command of the calendar for every account in name order, returns the exit code
+int archive_calendars(redisContext *c, const char *days)
+{
+    char start[USERNAME_LENGTH + 1] = "-";
+    long calendars = 0, failed = 0;
+    uint64_t started = stats_now();
+
+    while (1)
+    {
+        redisReply *reply = redis_command(c, "ZRANGEBYLEX " USERS_INDEX " %s + LIMIT 0 %d", start, USERS_BACKFILL_BATCH);
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        {
+            fprintf(stderr, "%sError reading the accounts: %s%s\n", RED_COLOR, c->err ? c->errstr : "unexpected reply", RESET_COLOR);
+            freeReplyObject(reply);
+            return 1;
+        }
+
+        for (size_t i = 0; i < reply->elements; i++)
+        {
+            const char *name = reply->element[i]->str;
+            if (!is_valid_username(name))
+            {
+                continue;
+            }
+
+            // one calendar process per account, it prints its own result line
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                execl("./calendar", "./calendar", name, "1", "archive", days, (char *)NULL);
+                fprintf(stderr, "%sFailed to start calendar.%s\n", RED_COLOR, RESET_COLOR);
+                exit(1);
+            }
+            int status = 1;
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "%sArchiving the calendar of %s failed.%s\n", RED_COLOR, name, RESET_COLOR);
+                failed++;
+            }
+            calendars++;
+        }
+
+        // the next page starts after the last name of this one
+        size_t count = reply->elements;
+        if (count > 0)
+        {
+            snprintf(start, sizeof(start), "(%s", reply->element[count - 1]->str);
+        }
+        freeReplyObject(reply);
+        if (count < USERS_BACKFILL_BATCH)
+        {
+            break;
+        }
+    }
+
+    fprintf(stderr, "%ld calendars archived in %.1f s, %ld failed\n", calendars - failed, (stats_now() - started) / 1e9, failed);
+    return failed > 0 ? 1 : 0;
+}
+
+void show_menu(const char *logged_in_user)
+{
+    printf("=====================================\n");
+    printf("%s        %sCommand Line Calendar        \n%s", BOLD, GREEN_COLOR, RESET_COLOR);
+    printf("=====================================\n");
+    printf("\n");
+
+    if (logged_in_user != NULL && logged_in_user[0] != '\0')
+    {
+        printf("%sLogged in as: %s%s%s\n", BOLD, YELLOW_COLOR, logged_in_user, RESET_COLOR);
+    }
+    else
+    {
+        printf("%sYou are not logged in.\n%s", BOLD, RESET_COLOR);
+    }
+
+    printf("\n");
+    printf("%s1.%s Register\n", RED_COLOR, RESET_COLOR);
+    printf("%s2.%s Login\n", RED_COLOR, RESET_COLOR);
+    printf("%s3.%s View and Edit Your Calendar\n", RED_COLOR, RESET_COLOR);
+    printf("%s4.%s Browse Users and Their Calendars\n", RED_COLOR, RESET_COLOR);
+    printf("%s5.%s What's On (Public Events of All Users)\n", RED_COLOR, RESET_COLOR);
+    printf("%s6.%s Find a Common Free Day\n", RED_COLOR, RESET_COLOR);
+
+    printf("\n%s7.%s Logout\n", RED_COLOR, RESET_COLOR);
+    printf("%s8.%s Exit\n", RED_COLOR, RESET_COLOR);
+    printf("\n");
+    printf("=====================================\n");
+    printf("Enter your choice: ");
+}
+
+// MAIN ------------
+int main(int argc, char *argv[])
+{
+    // admin mode, "auth import <file>" creates the accounts listed in the file, "-" reads them from stdin
+    // "auth archive <days>" moves the single events older than that out of every calendar
+    if (argc > 1)
+    {
+        int import = argc == 3 && strcmp(argv[1], "import") == 0;
+        if (!import && (argc != 3 || strcmp(argv[1], "archive") != 0 || atoi(argv[2]) < 1))
+        {
+            fprintf(stderr, "usage: %s [import <file or -> | archive <days>]\n", argv[0]);
+            return 1;
+        }
+        stats_init("auth");
+        redisContext *c = connect_redis(NULL);
+        prepare_user_index(c);
+        int status = import ? import_users(c, argv[2]) : archive_calendars(c, argv[2]);
+        redisFree(c);
+        stats_shutdown();
+        return status;
+    }
+
+    clear();
+    stats_init("auth");
+    redisContext *c = connect_redis(NULL);
+    read_route_init(&browse_reads);
+    prepare_user_index(c);
+    prepare_public_index(c);
+    prepare_rule_index(c);
+    prepare_busy_index(c);
+    char user[USERNAME_LENGTH] = "";
+
+    char choice;
+
+    do
+    {
+        uint64_t start = stats_now();
+        show_menu(user);
+        fflush(stdout);
+        stats_record_since("render.menu", start);
+
+        // closed input leaves like Exit
+        int key = getchar();
+        choice = key == EOF ? '8' : (char)key;
+        empty_input_buffer();
+
+        switch (choice)
+        {
+        case '1':
+            clear();
+            register_user(c);
+            press_enter_to_continue();
+            break;
+
+        case '2':
+            clear();
+            login_user(c, user);
+            press_enter_to_continue();
+            break;
+
+        case '3':
+            clear();
+            open_calendar(c, user, "1");
+            break;
+
+        case '4':
+            clear();
+            display_registered_user(c, user);
+            break;
+
+        case '5':
+            clear();
+            display_whats_on(read_context(&browse_reads, c, PUBLIC_EVENTS_INDEX));
+            break;
+
+        case '6':
+            clear();
+            find_common_free_days(c, user);
+            break;
+
+        case '7':
+            clear();
+            memset(user, 0, USERNAME_LENGTH);
+            break;
+
+        case 's': // hidden: latency statistics of this session
+            clear();
+            stats_print();
+            press_enter_to_continue();
             break;
 
         default:;
         }
         clear();
-    } while (choice != '6');
+    } while (choice != '8');
 
+    read_route_close(&browse_reads);
     redisFree(c);
+    stats_shutdown();
     return 0;
 }
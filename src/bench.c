@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <hiredis/hiredis.h>
+#include <argon2.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include "common.h"
+#include "shard.h"
+#include "db.h"
+#include "event.h"
+#include "interval.h"
+#include "journal.h"
+#include "timeline.h"
+#include "recurrence.h"
+
+// bench parameter
+#define BENCH_USER_PREFIX "bench_user_"
+#define BENCH_PASSWORD "bench-password"
+#define BENCH_DB 15 // keeps the synthetic data away from the real calendars
+#define SEED_BATCH_SIZE 1000
+#define RECURRING_PERCENT 2
+#define CLEANUP_BATCH_SIZE 1000
+
+// the code under test, calendar.c and auth.c are linked in with their main renamed
+extern Timeline timeline;
+extern int view_mode, view_day, view_month, view_year;
+int load_events_from_redis(redisContext *c, const char *user, int privilege_level);
+void reset_events();
+void display_day_view();
+void display_month_view();
+void view_events();
+int append_event_write(redisContext *c, const char *user, const Event *event, const char *uid);
+int append_recurrence_write(redisContext *c, const char *user, const Recurrence *recurrence, const char *uid);
+void login_user(redisContext *c, char *user);
+void display_registered_user(redisContext *c, char *logged_in_user);
+
+// results go to the real stdout, everything the timed code prints goes to /dev/null
+FILE *report;
+
+// latency samples of one benchmark in microseconds
+typedef struct
+{
+    const char *name;
+    double *samples;
+    int count;
+} Samples;
+
+double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compare_samples(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples
+double percentile(const Samples *s, double p)
+{
+    int rank = (int)(p / 100.0 * s->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > s->count)
+        rank = s->count;
+    return s->samples[rank - 1];
+}
+
+// one JSON line per benchmark, the keys and their order do not change between versions
+void print_samples(Samples *s)
+{
+    if (s->count == 0)
+    {
+        return;
+    }
+
+    double sum = 0;
+    for (int i = 0; i < s->count; i++)
+    {
+        sum += s->samples[i];
+    }
+    qsort(s->samples, s->count, sizeof(double), compare_samples);
+
+    fprintf(report, "{\"benchmark\":\"%s\",\"iterations\":%d,\"min_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"mean_us\":%.1f}\n",
+            s->name, s->count, s->samples[0], percentile(s, 50), percentile(s, 90), percentile(s, 99), s->samples[s->count - 1], sum / s->count);
+    fflush(report);
+}
+
+// runs a function that reads the menu input from the given keystrokes
+void with_input(const char *keys, void (*run)(void *), void *arg)
+{
+    FILE *input = fmemopen((void *)keys, strlen(keys), "r");
+    if (input == NULL)
+    {
+        return;
+    }
+    FILE *saved = stdin;
+    stdin = input;
+    run(arg);
+    stdin = saved;
+    fclose(input);
+}
+
+// SYNTHETIC DATA --------------------
+const char *words[] = {"team", "sync", "dentist", "review", "lunch", "gym", "standup", "planning", "call", "birthday",
+                       "release", "demo", "workshop", "doctor", "dinner", "meeting", "retro", "interview", "trip", "concert"};
+#define WORD_COUNT (int)(sizeof(words) / sizeof(words[0]))
+
+// password field of a user, hashed the same way register_user does it
+int make_password_field(char *field)
+{
+    unsigned char salt[16], combined[32 + 16];
+    if (!RAND_bytes(salt, sizeof(salt)) ||
+        argon2id_hash_raw(2, 1 << 16, 1, BENCH_PASSWORD, strlen(BENCH_PASSWORD), salt, sizeof(salt), combined, 32) != ARGON2_OK)
+    {
+        return -1;
+    }
+    memcpy(combined + 32, salt, sizeof(salt));
+    return EVP_EncodeBlock((unsigned char *)field, combined, sizeof(combined)) == -1 ? -1 : 0;
+}
+
+// deletes every key of the synthetic users on every node
+void cleanup(redisContext *c)
+{
+    long deleted = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH *" BENCH_USER_PREFIX "* COUNT %d", cursor, CLEANUP_BATCH_SIZE) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                redis_append(c, "UNLINK %s", keys->element[i]->str);
+            }
+            drain_replies(c, keys->elements);
+            deleted += keys->elements;
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+
+    fprintf(stderr, "removed %ld keys of earlier runs\n", deleted);
+}
+
+// fills redis with users and events, events spread over the two years around today
+int seed(redisContext *c, int users, int events_per_user)
+{
+    char password[128];
+    if (make_password_field(password) != 0)
+    {
+        fprintf(stderr, "%sError: Failed to hash the password.%s\n", RED_COLOR, RESET_COLOR);
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+    long today = date_to_days(tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday);
+
+    double start = now_us();
+    long failed = 0;
+    for (int u = 0; u < users; u++)
+    {
+        char user[32], date[MAX_DATE_LENGTH], name[MAX_NAME_LENGTH], description[MAX_DESC_LENGTH];
+        snprintf(user, sizeof(user), BENCH_USER_PREFIX "%d", u);
+        redis_append(c, "HSET user:{%s} password %s created_at %ld", user, password, (long)now - users + u);
+        redis_append(c, "ZADD users_lex 0 %s", user);
+        int pending = 2;
+
+        for (int e = 1; e <= events_per_user; e++)
+        {
+            int year, month, day;
+            days_to_date(today - 365 + rand() % 730, &year, &month, &day);
+            snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
+            snprintf(name, sizeof(name), "%s %s", words[rand() % WORD_COUNT], words[rand() % WORD_COUNT]);
+            snprintf(description, sizeof(description), "%s with %s about %s", words[rand() % WORD_COUNT], words[rand() % WORD_COUNT], words[rand() % WORD_COUNT]);
+
+            Event *event = create_event(e, rand() % 2, date, name, description);
+            if (event == NULL)
+            {
+                failed++;
+                continue;
+            }
+            if (rand() % 100 < RECURRING_PERCENT)
+            {
+                Recurrence *recurrence = create_recurrence(event, REPEAT_DAILY + rand() % 4, 1 + rand() % 3, "", NULL);
+                int queued = recurrence ? append_recurrence_write(c, user, recurrence, NULL) : -1;
+                if (recurrence)
+                    free_recurrence(recurrence);
+                else
+                    free_event(event);
+                if (queued < 0)
+                {
+                    failed++;
+                    continue;
+                }
+                pending += queued;
+            }
+            else
+            {
+                pending += append_event_write(c, user, event, NULL);
+                free_event(event);
+            }
+
+            if (pending >= SEED_BATCH_SIZE)
+            {
+                failed += drain_replies(c, pending);
+                pending = 0;
+            }
+        }
+        failed += drain_replies(c, pending);
+    }
+
+    fprintf(stderr, "seeded %d users with %d events each in %.2f s, %ld failed commands\n",
+            users, events_per_user, (now_us() - start) / 1e6, failed);
+    return failed ? -1 : 0;
+}
+
+// BENCHMARKS --------------------
+redisContext *context;
+char bench_user[32];
+
+void run_login(void *arg)
+{
+    char user[32] = "";
+    login_user(context, user);
+}
+
+void run_view_events(void *arg)
+{
+    view_events();
+}
+
+void run_registered_users(void *arg)
+{
+    display_registered_user(context, bench_user);
+}
+
+// adds a sample of one timed run of a function
+#define TIME_RUN(s, call)                                 \
+    do                                                    \
+    {                                                     \
+        double start_us = now_us();                       \
+        call;                                             \
+        (s)->samples[(s)->count++] = now_us() - start_us; \
+    } while (0)
+
+void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-u users] [-e events per user] [-i iterations] [-l login iterations] [-d db] [-s] [-k]\n"
+                    "  -s  reuse the data of an earlier run instead of seeding\n"
+                    "  -k  keep the data after the run\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    int users = 100, events_per_user = 1000, iterations = 50, login_iterations = 10, db = BENCH_DB, reuse = 0, keep = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:e:i:l:d:skh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            users = atoi(optarg);
+            break;
+        case 'e':
+            events_per_user = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'l':
+            login_iterations = atoi(optarg);
+            break;
+        case 'd':
+            db = atoi(optarg);
+            break;
+        case 's':
+            reuse = 1;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (users < 1 || events_per_user < 1 || events_per_user > MAX_EVENTS || iterations < 1 || login_iterations < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // numbers from a broken encoder or index would be meaningless, the pure code is checked before anything is timed
+    const char *(*checks[])() = {db_check_packing, interval_check, journal_check};
+    const char *names[] = {"packed encoding", "interval index", "journal frame"};
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        const char *failed = checks[i]();
+        if (failed != NULL)
+        {
+            fprintf(stderr, "%sError: %s check failed on %s.%s\n", RED_COLOR, names[i], failed, RESET_COLOR);
+            return 1;
+        }
+    }
+
+    // the calendar and auth code print their screens to stdout
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "%sError: Could not redirect the output.%s\n", RED_COLOR, RESET_COLOR);
+        return 1;
+    }
+
+    // every node uses the benchmark database, the routed connections are opened here and kept
+    context = connect_redis(NULL);
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *target = shard_node(context, node);
+        redisReply *reply = target ? redis_command(target, "SELECT %d", db) : NULL;
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+        {
+            fprintf(stderr, "%sError: Could not select database %d.%s\n", RED_COLOR, db, RESET_COLOR);
+            freeReplyObject(reply);
+            shard_detach(context);
+            redisFree(context);
+            return 1;
+        }
+        freeReplyObject(reply);
+    }
+
+    srand(1); // the same data on every run
+    if (!reuse)
+    {
+        cleanup(context);
+        if (seed(context, users, events_per_user) != 0)
+        {
+            shard_detach(context);
+            redisFree(context);
+            return 1;
+        }
+    }
+    snprintf(bench_user, sizeof(bench_user), BENCH_USER_PREFIX "%d", users / 2);
+
+    fprintf(report, "{\"config\":{\"users\":%d,\"events_per_user\":%d,\"iterations\":%d,\"login_iterations\":%d}}\n",
+            users, events_per_user, iterations, login_iterations);
+
+    int max_iterations = iterations > login_iterations ? iterations : login_iterations;
+    double *buffer = malloc(max_iterations * sizeof(double));
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+        shard_detach(context);
+        redisFree(context);
+        return 1;
+    }
+
+    // argon2 login, the hash dominates
+    char login_keys[128];
+    snprintf(login_keys, sizeof(login_keys), "%s\n%s\n", bench_user, BENCH_PASSWORD);
+    Samples s = {"login", buffer, 0};
+    for (int i = 0; i < login_iterations; i++)
+    {
+        TIME_RUN(&s, with_input(login_keys, run_login, NULL));
+    }
+    print_samples(&s);
+
+    // loading one calendar from redis
+    s = (Samples){"load_events_from_redis", buffer, 0};
+    for (int i = 0; i < iterations; i++)
+    {
+        reset_events();
+        TIME_RUN(&s, load_events_from_redis(context, bench_user, 1));
+    }
+    print_samples(&s);
+
+    // rendering works on the loaded calendar
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+    view_day = tm_info->tm_mday;
+    view_month = tm_info->tm_mon + 1;
+    view_year = tm_info->tm_year + 1900;
+
+    s = (Samples){"display_day_view", buffer, 0};
+    for (int i = 0; i < iterations; i++)
+    {
+        TIME_RUN(&s, display_day_view());
+    }
+    print_samples(&s);
+
+    s = (Samples){"display_month_view", buffer, 0};
+    for (int i = 0; i < iterations; i++)
+    {
+        TIME_RUN(&s, display_month_view());
+    }
+    print_samples(&s);
+
+    // the first page of the event list and three page turns
+    s = (Samples){"view_events", buffer, 0};
+    for (int i = 0; i < iterations; i++)
+    {
+        TIME_RUN(&s, with_input("n\nn\nn\nq\n", run_view_events, NULL));
+    }
+    print_samples(&s);
+
+    // the user search, one prefix that matches every synthetic user, then back to the menu
+    s = (Samples){"display_registered_user", buffer, 0};
+    for (int i = 0; i < iterations; i++)
+    {
+        TIME_RUN(&s, with_input(BENCH_USER_PREFIX "\n\n", run_registered_users, NULL));
+    }
+    print_samples(&s);
+
+    free(buffer);
+    reset_events();
+    if (!keep)
+    {
+        cleanup(context);
+    }
+    shard_detach(context);
+    redisFree(context);
+    fclose(report);
+    return 0;
+}
@@ -6,27 +6,107 @@
 #include <limits.h>
 #include <hiredis/hiredis.h>
 #include "common.h"
+#include "event.h"
+#include "timeline.h"
+#include "trigram.h"
+#include "recurrence.h"
+#include "ics.h"
+#include "snapshot.h"
+#include "pubcache.h"
+#include "stats.h"
+#include "busy.h"
+#include "months.h"
+#include "interval.h"
+#include "db.h"
+#include "journal.h"
+#include "replica.h"
+#include "archive.h"
+#include "reminder.h"
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
 
-// event parameter
-#define MAX_EVENTS 2
-#define MAX_NAME_LENGTH 50
-#define MAX_DESC_LENGTH 256
-#define MAX_DATE_LENGTH 12
+// event list parameter
+#define EVENTS_PER_PAGE 5
 
-// structure for an event
+// time of day parameter
+#define MAX_OVERLAPS 20
+#define BUSY_LIGHT_MINUTES 120 // day grid marks: '.' below, ':' from here
+#define BUSY_HEAVY_MINUTES 360 // '*' from here
+
+// search parameter
+#define INDEX_VERSION 4 // bump to rebuild the secondary indexes of a calendar on load
+#define MAX_SEARCH_RESULTS 20
+#define MAX_EVENT_TRIGRAMS (MAX_NAME_LENGTH + MAX_DESC_LENGTH)
+#define INDEX_BATCH_SIZE 1000
+
+// import/export parameter
+#define ICS_BATCH_SIZE 500
+
+// batch mode parameter
+#define BATCH_LINE_LENGTH 4096
+#define BATCH_MAX_FIELDS 8
+#define BATCH_PIPELINE_SIZE 512 // writes queued before their replies are read
+
+// heatmap parameter
+#define HEATMAP_YEARS 5  // years shown, the viewed one in the middle
+#define HEATMAP_LEVELS 4 // shades from the emptiest to the busiest month
+
+// snapshot parameter
+#define SNAPSHOT_DIR "snapshots" // overridden by CALENDAR_SNAPSHOT_DIR
+
+// import/export directory parameter
+#define ICS_DIR "ics" // overridden by CALENDAR_ICS_DIR, the menu only reads and writes files in <dir>/<user>
+
+// archive parameter
+#define ARCHIVE_DEFAULT_DAYS 365 // age in days of the events "archive" moves when none is given
+#define ARCHIVE_RETRIES 3        // attempts at a month whose events another session changed meanwhile
+
+// bumps version:{<user>} and logs the changed ids in changes:{<user>} with the new version as score
+#define CHANGE_SCRIPT "local v = redis.call('INCR', KEYS[1]) for i = 1, #ARGV do redis.call('ZADD', KEYS[2], v, ARGV[i]) end return v"
+
+// global event variables
+Timeline timeline;
+IntervalIndex intervals; // the timed events of the timeline
+Recurrence **recurrences;
+int recurrence_count;
+int next_event_id;
+int search_index_ready;
+
+// global snapshot variables
+SnapshotInfo snapshot_info;
+int snapshot_dirty;
+
+// global offline variables, changes redis has not confirmed wait in the journal
+Journal journal = {.fd = -1};
+Breaker breaker;
+
+// global replica variables, the calendar is loaded from a replica when REDIS_REPLICAS lists one
+ReadRoute reads;
+
+// global archive variables, months whose past events were moved to archive:{<user>} and the events fetched back from them
+typedef struct
+{
+    int month;  // year * 12 + month - 1
+    int loaded; // its events are in memory
+} ArchivedMonth;
+
+ArchivedMonth *archived_months;
+int archived_month_count;
+int *archived_ids; // read only, they are dropped again before the snapshot is saved
+int archived_id_count;
+
+// global batch mode variables, writes whose replies are still pending
 typedef struct
 {
     int id;
-    int visibility;
-    char *date;
-    char *name;
-    char *description;
-} Event;
+    int commands;
+    int failed;
+} BatchWrite;
 
-// global event variables
-Event *events[MAX_EVENTS];
-int event_count;
-int next_event_id;
+BatchWrite batch_writes[BATCH_PIPELINE_SIZE];
+int batch_write_count;
+int batch_failed;
 
 // golbal view variables
 int view_mode;
@@ -35,22 +115,6 @@ int view_month;
 int view_year;
 
 // CALENDAR VIEW --------------------
-// function to calculate the number of days in the current month
-int get_days_in_month(int month, int year)
-{
-    if (month == 2)
-    { // february
-        if ((year % 4 == 0 && year % 100 != 0) || (year % 400 == 0))
-            return 29; // leap year
-        return 28;
-    }
-    // months with 31 days
-    if (month == 1 || month == 3 || month == 5 || month == 7 ||
-        month == 8 || month == 10 || month == 12)
-        return 31;
-    return 30; // months with 30 days
-}
-
 // function to get the current day, month and year
 void get_current_day_month_year(int *day, int *month, int *year)
 {
@@ -62,35 +126,112 @@ void get_current_day_month_year(int *day, int *month, int *year)
     *year = tm_info->tm_year + 1900;
 }
 
-// function to check if a day/month has an event (for highlighting in view)
-int has_event(int day, int month, int year)
+// today as YYYY-MM-DD, date holds MAX_DATE_LENGTH bytes
+void get_today(char *date)
+{
+    time_t now = time(NULL);
+    strftime(date, MAX_DATE_LENGTH, "%Y-%m-%d", localtime(&now));
+}
+
+// the day after a YYYY-MM-DD date
+void next_day(const char *date, char *next)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+    {
+        snprintf(next, MAX_DATE_LENGTH, "%s", date);
+        return;
+    }
+    days_to_date(date_to_days(year, month, day) + 1, &year, &month, &day);
+    snprintf(next, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+}
+
+// adds the length of a timed event to the booked minutes of its day, capped at a full day
+void book_minutes(int *booked, int day, const Event *event)
+{
+    if (booked != NULL && event_is_timed(event))
+    {
+        booked[day] += event->end - event->start;
+        if (booked[day] > MINUTES_PER_DAY)
+            booked[day] = MINUTES_PER_DAY;
+    }
+}
+
+// marks the days of a month that have an event (for highlighting in view), occupied[1..31]
+// booked[1..31] gets the minutes taken by timed events on each day, it may be NULL
+void month_occupancy(int month, int year, int *occupied, int *booked)
 {
-    if (day == 0)
-    { // check if there is any event in the given month
-        for (int i = 0; i < event_count; i++)
+    char prefix[MAX_DATE_LENGTH];
+    snprintf(prefix, sizeof(prefix), "%04d-%02d", year, month);
+    memset(occupied, 0, 32 * sizeof(int));
+    if (booked != NULL)
+        memset(booked, 0, 32 * sizeof(int));
+
+    // stored events of the month are consecutive in the timeline
+    for (TimelineNode *node = timeline_seek(&timeline, prefix); node && strncmp(node->event->date, prefix, 7) == 0; node = node->next[0])
+    {
+        occupied[atoi(node->event->date + 8)] = 1;
+        book_minutes(booked, atoi(node->event->date + 8), node->event);
+    }
+
+    // recurring events are only expanded for the month on screen
+    char from[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH];
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        snprintf(from, sizeof(from), "%04d-%02d-01", year, month);
+        while (recurrence_next(recurrences[i], from, date) && strncmp(date, prefix, 7) == 0)
         {
-            int event_month = atoi(events[i]->date + 5); // extract the month from the date
-            int event_year = atoi(events[i]->date);      // extract the year from the date
-            if (event_month == month && event_year == year)
-            {
-                return 1; // event found in this month
-            }
+            occupied[atoi(date + 8)] = 1;
+            book_minutes(booked, atoi(date + 8), recurrences[i]->event);
+            next_day(date, from);
         }
-        return 0; // no events found in this month
     }
+}
 
-    char date[MAX_DATE_LENGTH];
-    snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
+// mark in front of a day of the grid, how much of it is taken by timed events
+char busy_mark(int minutes)
+{
+    if (minutes >= BUSY_HEAVY_MINUTES)
+        return '*';
+    if (minutes >= BUSY_LIGHT_MINUTES)
+        return ':';
+    return minutes > 0 ? '.' : ' ';
+}
+
+// adds the occurrences of the loaded rules per month of years first_year.. to counts[year][1..12]
+void count_recurrences(int first_year, int years, int (*counts)[13])
+{
+    char from[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH], end[MAX_DATE_LENGTH];
+    snprintf(end, sizeof(end), "%04d-01-01", first_year + years);
 
-    // search for an event with the same date in the events array
-    for (int i = 0; i < event_count; i++)
+    for (int i = 0; i < recurrence_count; i++)
     {
-        if (strcmp(events[i]->date, date) == 0)
+        snprintf(from, sizeof(from), "%04d-01-01", first_year);
+        while (recurrence_next(recurrences[i], from, date) && strcmp(date, end) < 0)
         {
-            return 1; // event found on this date
+            int year, month, day;
+            parse_date(date, &year, &month, &day);
+            counts[year - first_year][month]++;
+            next_day(date, from);
         }
     }
-    return 0; // no event found on this date
+}
+
+// counts the loaded events and occurrences per month of years first_year.., counts[year][1..12]
+void count_months(int first_year, int years, int (*counts)[13])
+{
+    char from[MAX_DATE_LENGTH], end[MAX_DATE_LENGTH];
+    memset(counts, 0, years * sizeof(*counts));
+    snprintf(from, sizeof(from), "%04d-01-01", first_year);
+    snprintf(end, sizeof(end), "%04d-01-01", first_year + years);
+
+    for (TimelineNode *node = timeline_seek(&timeline, from); node && strcmp(node->event->date, end) < 0; node = node->next[0])
+    {
+        int year, month, day;
+        if (parse_date(node->event->date, &year, &month, &day))
+            counts[year - first_year][month]++;
+    }
+    count_recurrences(first_year, years, counts);
 }
 
 // function to display a month
@@ -117,35 +258,42 @@ void display_day_view()
 
     int current_day, current_month, current_year;
     get_current_day_month_year(&current_day, &current_month, &current_year);
+
+    int occupied[32], booked[32], any_booked = 0;
+    month_occupancy(month, year, occupied, booked);
+
     // display the days of the month
     for (int day_i = 1; day_i <= days_in_month; day_i++)
     {
-        if (has_event(day_i, month, year))
+        char mark = busy_mark(booked[day_i]);
+        any_booked |= mark != ' ';
+
+        if (occupied[day_i])
         {
             if (year == current_year && month == current_month && day_i == current_day)
             {
-                printf(MAGENTA_COLOR " %2d" RESET_COLOR, day_i); // marks current day with event
+                printf(MAGENTA_COLOR "%c%2d" RESET_COLOR, mark, day_i); // marks current day with event
             }
             else if ((year < current_year) ||
                      (year == current_year && month < current_month) ||
                      (year == current_year && month == current_month && day_i < current_day))
             {
-                printf(GRAY_COLOR " %2d" RESET_COLOR, day_i); // marks past events
+                printf(GRAY_COLOR "%c%2d" RESET_COLOR, mark, day_i); // marks past events
             }
             else
             {
-                printf(BLUE_COLOR " %2d" RESET_COLOR, day_i); // marks future events
+                printf(BLUE_COLOR "%c%2d" RESET_COLOR, mark, day_i); // marks future events
             }
         }
         else
         {
             if (year == current_year && month == current_month && day_i == current_day)
             {
-                printf(RED_COLOR " %2d" RESET_COLOR, day_i); // marks current day
+                printf(RED_COLOR "%c%2d" RESET_COLOR, mark, day_i); // marks current day
             }
             else
             {
-                printf(" %2d", day_i); // marks other days
+                printf("%c%2d", mark, day_i); // marks other days
             }
         }
 
@@ -159,10 +307,15 @@ void display_day_view()
         }
     }
     printf("\n");
+    if (any_booked)
+    {
+        printf("\n%s.%s under %dh  %s:%s under %dh  %s*%s %dh or more of timed events\n", BOLD, RESET_COLOR, BUSY_LIGHT_MINUTES / 60,
+               BOLD, RESET_COLOR, BUSY_HEAVY_MINUTES / 60, BOLD, RESET_COLOR, BUSY_HEAVY_MINUTES / 60);
+    }
 }
 
-// display the months of the year
-void display_month_view()
+// display the months of the year, counts[1..12] tells which months have events
+void display_month_view(const int *counts)
 {
     int year = view_year;
 
@@ -172,10 +325,11 @@ void display_month_view()
 
     int current_day, current_month, current_year;
     get_current_day_month_year(&current_day, &current_month, &current_year);
+
     printf("Calendar for " RED_COLOR "%d" RESET_COLOR ":\n\n", year);
     for (int month_i = 1; month_i <= 12; month_i++)
     {
-        if (has_event(0, month_i, year))
+        if (counts[month_i] > 0)
         {
             if (year == current_year && month_i == current_month)
             {
@@ -245,493 +399,3584 @@ int input_validation_addEvent(char *date, int length)
     return 1;
 }
 
-// allocates heap memory for a event
-Event *create_event(int id, int visibility, const char *date, const char *name, const char *description)
+// queues the trigram index updates of an event on the pipeline, returns the number of queued commands
+int append_search_index(redisContext *c, const char *user, const Event *event, int add)
 {
-    Event *new_event = (Event *)malloc(sizeof(Event));
-    if (new_event == NULL)
-    {
-        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
-        return NULL;
-    }
-
-    new_event->id = id;
-    new_event->visibility = visibility;
-    new_event->date = strdup(date);
-    new_event->name = strdup(name);
-    new_event->description = strdup(description);
+    Trigram trigrams[MAX_EVENT_TRIGRAMS];
 
-    return new_event;
-}
+    // name and description are indexed separately so no trigram spans both
+    int count = trigram_extract(event->name, trigrams, 0, MAX_EVENT_TRIGRAMS);
+    count = trigram_extract(event->description, trigrams, count, MAX_EVENT_TRIGRAMS);
+    count = trigram_unique(trigrams, count);
 
-// stores added event in the redis db
-void add_event_to_redis(redisContext *c, const char *user, int id, int visibility, const char *date, const char *name, const char *description)
-{
-    redisReply *reply = redisCommand(c, "HSET event:%s:%d visibility %d date %s name %s description %s", user, id, visibility, date, name, description);
-    if (reply == NULL)
+    for (int i = 0; i < count; i++)
     {
-        printf("%sError adding the event to Redis.\n%s", RED_COLOR, RESET_COLOR);
-        freeReplyObject(reply);
-        return;
+        redis_append(c, "%s trigram:{%s}:%b %d", add ? "SADD" : "SREM", user, trigrams[i].bytes, (size_t)TRIGRAM_LENGTH, event->id);
     }
-    freeReplyObject(reply);
+    return count;
 }
 
-// function for adding a new event (heap + redis)
-void add_event(redisContext *c, const char *user)
+// queues the date index update of an event, the index lets exports stream events in date order
+int append_date_index(redisContext *c, const char *user, const Event *event, int add)
 {
-    if (event_count >= MAX_EVENTS)
+    if (add)
     {
-        printf("%sEvent limit reached. Cannot add more events.\n%s", RED_COLOR, RESET_COLOR);
-        return;
+        int year = 0, month = 0, day = 0;
+        sscanf(event->date, "%d-%d-%d", &year, &month, &day);
+        redis_append(c, "ZADD events_by_date:{%s} %d %d", user, year * 10000 + month * 100 + day, event->id);
     }
-
-    char visibility;
-    char date[MAX_DATE_LENGTH];
-    char name[MAX_NAME_LENGTH];
-    char description[MAX_DESC_LENGTH];
-
-    // get the current date
-    int current_day, current_month, current_year;
-    get_current_day_month_year(&current_day, &current_month, &current_year);
-
-    int year, month, day;
-
-    while (1)
+    else
     {
-        printf("Should the event be public? (y/n): ");
-        char ch = getchar();
-        empty_input_buffer();
-        if (ch == 'y' || ch == 'Y')
-        {
-            visibility = 0;
-            break;
-        }
-        else if (ch == 'n' || ch == 'N')
-        {
-            visibility = 1;
-            break;
-        }
-        else
-        {
-            printf("%s\nInvalid input. Please enter 'y' or 'n'.\n\n%s", RED_COLOR, RESET_COLOR);
-            continue;
-        }
+        redis_append(c, "ZREM events_by_date:{%s} %d", user, event->id);
     }
+    return 1;
+}
 
-    while (1)
+// queues the update of the global public events feed, returns the number of queued commands
+int append_public_index(redisContext *c, const char *user, const Event *event, const Recurrence *recurrence, int add)
+{
+    add = add && event->visibility == 0; // an event that turned private leaves the feed
+    int year = 0, month = 0, day = 0;
+    sscanf(event->date, "%d-%d-%d", &year, &month, &day);
+    if (recurrence != NULL && add)
     {
-        printf("Enter the event date (YYYY-MM-DD): ");
-        if (input_validation_addEvent(date, MAX_DATE_LENGTH))
+        // a rule is indexed by the dates it can occur between, so the feed only reads the rules of its range
+        int end = PUBLIC_RULE_ENDLESS, until_year, until_month, until_day;
+        if (recurrence->until[0] != '\0' && sscanf(recurrence->until, "%d-%d-%d", &until_year, &until_month, &until_day) == 3)
         {
-            if (sscanf(date, "%d-%d-%d", &year, &month, &day) != 3 || month < 1 || month > 12 || day < 1 || day > get_days_in_month(month, year) || year < 1 || year > 9999)
-            {
-                printf("%s\nInvalid date. Please enter a valid date.\n\n%s", RED_COLOR, RESET_COLOR);
-                continue;
-            }
-            break;
+            end = until_year * 10000 + until_month * 100 + until_day;
         }
+        redis_append(c, "ZADD " PUBLIC_RULE_STARTS " %d %s:%d", year * 10000 + month * 100 + day, user, event->id);
+        redis_append(c, "ZADD " PUBLIC_RULE_ENDS " %d %s:%d", end, user, event->id);
+        return 2;
     }
-
-    // validate and format the entered date
-    /*
-    if (sscanf(date, "%d-%d-%d", &year, &month, &day) != 3 ||
-        year < current_year || year > 2100 ||
-        (year == current_year && (month < current_month || (month == current_month && day < current_day))) ||
-        month < 1 || month > 12 || day < 1 || day > 31)
+    else if (recurrence != NULL)
     {
-        printf("%s\nInvalid date. Please enter a valid date between today and the year 2100.\n%s", RED_COLOR, RESET_COLOR);
-        return;
+        redis_append(c, "ZREM " PUBLIC_RULE_STARTS " %s:%d", user, event->id);
+        redis_append(c, "ZREM " PUBLIC_RULE_ENDS " %s:%d", user, event->id);
+        return 2;
     }
-    */
-
-    // format the date to ensure two digits for month and day
-    snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
-
-    while (1)
+    else if (add)
     {
-        printf("Enter the event name (maximum %d characters): ", MAX_NAME_LENGTH);
-        if (input_validation_addEvent(name, MAX_NAME_LENGTH))
-        {
-            break;
-        }
+        redis_append(c, "ZADD " PUBLIC_EVENTS_INDEX " %d %s:%d", year * 10000 + month * 100 + day, user, event->id);
     }
-
-    while (1)
+    else
     {
-        printf("Enter the event description (maximum %d characters): ", MAX_DESC_LENGTH);
-        if (input_validation_addEvent(description, MAX_DESC_LENGTH))
-        {
-            break;
-        }
+        redis_append(c, "ZREM " PUBLIC_EVENTS_INDEX " %s:%d", user, event->id);
     }
+    return 1;
+}
 
-    // add the event to the array and redis
-    events[event_count++] = create_event(next_event_id, visibility, date, name, description);
-    add_event_to_redis(c, user, next_event_id, visibility, date, name, description);
-    next_event_id++;
+// queues the version bump for a changed event, other sessions catch up on it from their snapshot
+int append_change(redisContext *c, const char *user, int id)
+{
+    redis_append(c, "EVAL %s 2 version:{%s} changes:{%s} %d", CHANGE_SCRIPT, user, user, id);
+    snapshot_dirty = 1;
+    read_route_wrote(&reads);
+    return 1;
+}
 
-    printf("%s\nEvent added successfully!\n%s", GREEN_COLOR, RESET_COLOR);
+// queues the reminder schedule update of an event or rule, one that has no start ahead is taken off
+int append_reminder(redisContext *c, const char *user, const Event *event, const Recurrence *recurrence)
+{
+    return reminder_append(c, user, event->id, reminder_next(event, recurrence, time(NULL)));
 }
 
-// loads the pre-existing events from redis when the calendar is opened
-void load_events_from_redis(redisContext *c, const char *user, int privilege_level)
+// HH:MM start and end of a timed event, empty for an all-day event
+void event_times(const Event *event, char *start, char *end)
 {
-    redisReply *keys_reply = redisCommand(c, "KEYS event:%s:*", user);
-    if (keys_reply == NULL || keys_reply->type != REDIS_REPLY_ARRAY)
+    start[0] = end[0] = '\0';
+    if (event_is_timed(event))
     {
-        printf("%sError retrieving event keys from Redis.\n%s", RED_COLOR, RESET_COLOR);
-        freeReplyObject(keys_reply);
-        exit(1);
+        format_time(event->start, start);
+        format_time(event->end, end);
     }
+}
 
-    event_count = 0;
-    next_event_id = 1;
+// queues the writes for a new event and its own indexes, returns the number of queued commands
+int append_event_write(redisContext *c, const char *user, const Event *event, const char *uid)
+{
+    return db_put_event(c, user, event, uid) + append_search_index(c, user, event, 1) + append_date_index(c, user, event, 1) +
+           busy_append_date(c, user, event->date, 1) + months_append_date(c, user, event->visibility, event->date, 1) + append_change(c, user, event->id);
+}
 
-    // iterate over all found event keys
-    for (size_t i = 0; i < keys_reply->elements; i++)
+// queues the write of a recurring event rule, returns the number of queued commands or -1
+int append_recurrence_write(redisContext *c, const char *user, const Recurrence *recurrence, const char *uid)
+{
+    const Event *event = recurrence->event;
+    int queued = db_put_recurrence(c, user, recurrence, uid);
+    if (queued < 0)
     {
-        char *event_key = keys_reply->element[i]->str;
-
-        // extract event ID from the key
-        char *event_id_str = strrchr(event_key, ':');
-        if (!event_id_str || strlen(event_id_str) < 2)
-            continue;
-        int event_id = atoi(event_id_str + 1);
-
-        // retrieve event data
-        redisReply *event_reply = redisCommand(c, "HGETALL %s", event_key);
-        if (event_reply == NULL || event_reply->type != REDIS_REPLY_ARRAY || event_reply->elements % 2 != 0)
-        {
-            printf("%sError retrieving event data for %s.\n%s", RED_COLOR, event_key, RESET_COLOR);
-            continue;
-        }
-
-        char *date = NULL, *name = NULL, *description = NULL;
-        int visibility = -1;
-
-        // extract event data from the hash structure
-        for (size_t j = 0; j < event_reply->elements; j += 2)
-        {
-            char *field = event_reply->element[j]->str;
-            char *value = event_reply->element[j + 1]->str;
-
-            if (strcmp(field, "visibility") == 0)
-                visibility = atoi(value);
-            else if (strcmp(field, "date") == 0)
-                date = value;
-            else if (strcmp(field, "name") == 0)
-                name = value;
-            else if (strcmp(field, "description") == 0)
-                description = value;
-        }
-
-        // if all fields are present, save the event
-        if (visibility != -1 && date && name && description && event_count < MAX_EVENTS && visibility <= privilege_level)
-        {
-            events[event_count] = create_event(event_id, visibility, date, name, description);
-            event_count++;
-
-            if (event_id >= next_event_id)
-            {
-                next_event_id = event_id + 1;
-            }
-        }
-
-        freeReplyObject(event_reply);
+        return -1;
     }
-
-    freeReplyObject(keys_reply);
+    return queued + append_search_index(c, user, event, 1) + append_change(c, user, event->id);
 }
 
-// strict input validation to get unsigned int id to remove event
-unsigned int get_valid_unsigned_integer()
+// queues the removal of an event and its own indexes, returns the number of queued commands
+int append_event_delete(redisContext *c, const char *user, const Event *event)
 {
-    char input[16];
-    int temp_id;
-    unsigned int id;
-    char extra;
-
-    while (1)
-    {
-        printf("Enter the ID of the event to remove: ");
-        if (fgets(input, sizeof(input), stdin) != NULL)
-        {
-            if (strchr(input, '\n') == NULL)
-            {
-                empty_input_buffer();
-                printf("%s\nEnter a valid number.%s\n\n", RED_COLOR, RESET_COLOR);
-                continue;
-            }
-            if (sscanf(input, "%d %c", &temp_id, &extra) == 1)
-            {
-                if (temp_id < 0)
-                {
-                    printf("%s\nNegative numbers are not allowed.%s\n\n", RED_COLOR, RESET_COLOR);
-                    continue;
-                }
-
-                id = (unsigned int)temp_id;
-                return id;
-            }
-            else
-            {
-                printf("%s\nEnter a valid number.%s\n\n", RED_COLOR, RESET_COLOR);
-            }
-        }
-        else
-        {
-            printf("%s\nInput error.\n\n%s", RED_COLOR, RESET_COLOR);
-        }
-    }
+    return db_delete_event(c, user, event->id, 0) + append_search_index(c, user, event, 0) + append_date_index(c, user, event, 0) +
+           busy_append_date(c, user, event->date, -1) + months_append_date(c, user, event->visibility, event->date, -1) + append_change(c, user, event->id);
 }
 
-// function to free an event
-void free_event(Event *event)
+// queues the removal of a recurring event rule, returns the number of queued commands
+int append_recurrence_delete(redisContext *c, const char *user, const Recurrence *recurrence)
 {
-    free(event->date);
-    free(event->name);
-    free(event->description);
-    free(event);
+    return db_delete_event(c, user, recurrence->event->id, 1) + append_search_index(c, user, recurrence->event, 0) + append_change(c, user, recurrence->event->id);
 }
 
-// free all events
-void free_events()
+// queues the update of a recurring event after a date was added to its skipped occurrences, returns the number of queued commands or -1
+int append_exception_write(redisContext *c, const char *user, const Recurrence *recurrence)
 {
-    for (int i = 0; i < event_count; i++)
+    int queued = db_put_exceptions(c, user, recurrence);
+    if (queued < 0)
     {
-        free_event(events[i]);
+        return -1;
     }
+    return queued + append_change(c, user, recurrence->event->id);
 }
 
-// removes event from the redis db
-void delete_event_from_redis(redisContext *c, const char *user, unsigned int id)
+// queues the public feed and reminder updates of a change, returns the number of queued commands
+// these keys are shared by all users and may live on another node, so they are never part of a user's transaction
+int append_change_indexes(redisContext *c, const char *user, int op, const Event *event, const Recurrence *recurrence)
 {
-    redisReply *reply = redisCommand(c, "DEL event:%s:%d", user, id);
-    if (reply == NULL)
+    if (op == JOURNAL_SKIP)
     {
-        printf("%sError deleting the event from Redis.\n%s", RED_COLOR, RESET_COLOR);
-        freeReplyObject(reply);
-        return;
+        return append_reminder(c, user, event, recurrence);
     }
-    freeReplyObject(reply);
+    if (op == JOURNAL_REMOVE)
+    {
+        return append_public_index(c, user, event, recurrence, 0) + reminder_append(c, user, event->id, -1);
+    }
+    return append_public_index(c, user, event, recurrence, 1) + append_reminder(c, user, event, recurrence);
 }
 
-// function to remove an event from the event array
-void remove_event(redisContext *c, const char *user)
+// index of the first recurring event whose id is not below id, they are kept ordered by id
+int recurrence_position(int id)
 {
-    if (event_count == 0)
+    int low = 0, high = recurrence_count;
+    while (low < high)
     {
-        printf("%sNo events to remove.\n%s", RED_COLOR, RESET_COLOR);
-        return;
+        int middle = low + (high - low) / 2;
+        if (recurrences[middle]->event->id < id)
+            low = middle + 1;
+        else
+            high = middle;
     }
+    return low;
+}
 
-    unsigned int id = get_valid_unsigned_integer();
+// keeps a recurring event in memory
+int store_recurrence(Recurrence *recurrence)
+{
+    Recurrence **grown = realloc(recurrences, (recurrence_count + 1) * sizeof(Recurrence *));
+    if (grown == NULL)
+    {
+        return -1;
+    }
+    recurrences = grown;
+    int position = recurrence_position(recurrence->event->id);
+    memmove(&recurrences[position + 1], &recurrences[position], (recurrence_count - position) * sizeof(Recurrence *));
+    recurrences[position] = recurrence;
+    recurrence_count++;
+    return 0;
+}
 
-    // find and remove the event
-    for (int i = 0; i < event_count; i++)
+// drops a recurring event rule from memory, the rule itself is not freed
+void unlink_recurrence(Recurrence *recurrence)
+{
+    for (int i = recurrence_position(recurrence->event->id); i < recurrence_count && recurrences[i]->event->id == recurrence->event->id; i++)
     {
-        if (events[i]->id == id)
+        if (recurrences[i] == recurrence)
         {
-            free_event(events[i]);
-            delete_event_from_redis(c, user, id);
-            printf("%s\nEvent removed successfully!\n%s", GREEN_COLOR, RESET_COLOR);
-
-            // shift remaining events
-            for (int j = i; j < event_count - 1; j++)
-            {
-                events[j] = events[j + 1];
-            }
-            event_count--;
+            memmove(&recurrences[i], &recurrences[i + 1], (recurrence_count - i - 1) * sizeof(Recurrence *));
+            recurrence_count--;
             return;
         }
     }
-
-    printf("%s\nNo event found with ID %u.\n%s", RED_COLOR, id, RESET_COLOR);
 }
 
-// helper function for sorting events by date
+// keeps a single event in memory, timed ones also in the interval index
+int store_event(Event *event)
+{
+    if (timeline_insert(&timeline, event) != 0)
+    {
+        return -1;
+    }
+    if (interval_insert(&intervals, event) != 0)
+    {
+        timeline_remove(&timeline, event->id);
+        return -1;
+    }
+    return 0;
+}
+
+// takes a single event out of memory without freeing it, NULL if there is none with the id
+Event *unstore_event(int id)
+{
+    Event *event = timeline_remove(&timeline, id);
+    if (event != NULL)
+    {
+        interval_remove(&intervals, event);
+    }
+    return event;
+}
+
+// adds the timed events of a timeline that was filled directly, e.g. from a snapshot
+int index_timeline()
+{
+    for (TimelineNode *node = timeline_first(&timeline); node != NULL; node = node->next[0])
+    {
+        if (interval_insert(&intervals, node->event) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// events overlapping a time span on a date, stored ones from the interval index and recurring ones by their occurrence that day
+int find_overlaps(const char *date, int start, int end, Event **results, int max)
+{
+    int year, month, day;
+    if (!parse_date(date, &year, &month, &day))
+    {
+        return 0;
+    }
+
+    long midnight = date_to_days(year, month, day) * MINUTES_PER_DAY;
+    int count = interval_overlapping(&intervals, midnight + start, midnight + end, results, max);
+
+    char occurrence[MAX_DATE_LENGTH];
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        Event *event = recurrences[i]->event;
+        if (event_is_timed(event) && event->start < end && event->end > start &&
+            recurrence_next(recurrences[i], date, occurrence) && strcmp(occurrence, date) == 0)
+        {
+            if (count < max)
+                results[count] = event;
+            count++;
+        }
+    }
+    return count;
+}
+
+// looks up a recurring event by id
+Recurrence *find_recurrence(int id)
+{
+    int position = recurrence_position(id);
+    return position < recurrence_count && recurrences[position]->event->id == id ? recurrences[position] : NULL;
+}
+
+// looks up a stored or recurring event by id
+Event *find_event(int id)
+{
+    Event *event = timeline_find(&timeline, id);
+    if (event == NULL)
+    {
+        Recurrence *recurrence = find_recurrence(id);
+        event = recurrence ? recurrence->event : NULL;
+    }
+    return event;
+}
+
+// OFFLINE --------------------
+// queues the writes of a journaled change to the user's own keys, returns the number of queued commands or -1
+int append_change_write(redisContext *c, const char *user, int op, const Event *event, const Recurrence *recurrence)
+{
+    if (op == JOURNAL_SKIP)
+    {
+        return append_exception_write(c, user, recurrence);
+    }
+    if (op == JOURNAL_REMOVE)
+    {
+        return recurrence ? append_recurrence_delete(c, user, recurrence) : append_event_delete(c, user, event);
+    }
+    return recurrence ? append_recurrence_write(c, user, recurrence, NULL) : append_event_write(c, user, event, NULL);
+}
+
+// queues all redis writes of a change, returns the number of queued commands or -1
+int append_change_all(redisContext *c, const char *user, int op, const Event *event, const Recurrence *recurrence)
+{
+    int queued = append_change_write(c, user, op, event, recurrence);
+    return queued < 0 ? -1 : queued + append_change_indexes(c, user, op, recurrence ? recurrence->event : event, recurrence);
+}
+
+// a broken connection opens the breaker, error replies do not
+void redis_failed(redisContext *c)
+{
+    if (c->err && !breaker.open)
+    {
+        breaker_failure(&breaker);
+    }
+}
+
+// an offline event whose id another session took meanwhile, the changes from its add on are sent under new_id
+typedef struct
+{
+    int id;
+    int record; // position in the journal of the change that added it
+    int new_id;
+} ReplayRename;
+
+// connection and calendar a journal replay writes to
+typedef struct
+{
+    redisContext *c;
+    const char *user;
+    int record; // position in the journal of the change being sent
+    ReplayRename *renames;
+    int rename_count;
+} ReplayContext;
+
+// compares the stored fields of an event or rule with journaled ones, the skipped occurrences may differ
+int same_event_fields(const DbEventFields *a, const DbEventFields *b)
+{
+    return a->visibility == b->visibility && a->start == b->start && a->end == b->end && a->frequency == b->frequency &&
+           (!a->frequency || a->interval == b->interval) && strcmp(a->date ? a->date : "", b->date ? b->date : "") == 0 &&
+           strcmp(a->name ? a->name : "", b->name ? b->name : "") == 0 &&
+           strcmp(a->description ? a->description : "", b->description ? b->description : "") == 0 &&
+           strcmp(a->until ? a->until : "", b->until ? b->until : "") == 0;
+}
+
+// the id redis has a journaled change under, the journaled one unless its add was renamed
+int replay_id(const ReplayContext *replay, int id)
+{
+    for (int i = 0; i < replay->rename_count; i++)
+    {
+        if (replay->renames[i].id == id && replay->renames[i].record <= replay->record)
+        {
+            id = replay->renames[i].new_id;
+        }
+    }
+    return id;
+}
+
+// an id that no event, rule or archived event of the user has yet, -1 if redis failed
+int unused_event_id(redisContext *c, const char *user, int taken)
+{
+    redisReply *reply = redis_command(c, "HGET archive:{%s} " ARCHIVE_MAX_ID_FIELD, user);
+    if (reply == NULL)
+    {
+        return -1;
+    }
+    int id = taken + 1 > next_event_id ? taken + 1 : next_event_id;
+    if (reply->type == REDIS_REPLY_STRING && atoi(reply->str) >= id)
+    {
+        id = atoi(reply->str) + 1;
+    }
+    freeReplyObject(reply);
+
+    // the other session numbered its events from the same place, so the free id is usually close
+    for (;; id++)
+    {
+        reply = redis_command(c, "EXISTS event:{%s}:%d recurrence:{%s}:%d", user, id, user, id);
+        if (reply == NULL || reply->type != REDIS_REPLY_INTEGER)
+        {
+            freeReplyObject(reply);
+            return -1;
+        }
+        int exists = reply->integer > 0;
+        freeReplyObject(reply);
+        if (!exists)
+        {
+            return id;
+        }
+    }
+}
+
+// gives the event or rule kept in memory under id the id redis stores it under
+void renumber_event(int id, int new_id)
+{
+    Event *event = unstore_event(id);
+    if (event != NULL)
+    {
+        event->id = new_id;
+        if (store_event(event) != 0)
+        {
+            free_event(event);
+        }
+        return;
+    }
+
+    // the rule moves to the place of its new id, the slot it leaves is reused so this cannot fail to grow
+    Recurrence *recurrence = find_recurrence(id);
+    if (recurrence != NULL)
+    {
+        unlink_recurrence(recurrence);
+        recurrence->event->id = new_id;
+        if (store_recurrence(recurrence) != 0)
+        {
+            free_recurrence(recurrence);
+        }
+    }
+}
+
+// sends one journaled change unless redis already has it, returns -1 if it could not be sent
+int replay_change(const JournalEntry *entry, void *context)
+{
+    ReplayContext *replay = context;
+    redisContext *c = replay->c;
+    int id = replay_id(replay, entry->id);
+    replay->record++;
+
+    // the change may have reached redis before the connection broke, it is not applied twice
+    // its feed and reminder updates may not have, they are sent again since applying them twice changes nothing
+    static const char *const names[] = {"visibility", "date", "start", "end", "name", "description", "frequency", "interval", "until", "exceptions"};
+    int name_count = sizeof(names) / sizeof(names[0]);
+    char key[DB_KEY_LENGTH];
+    snprintf(key, sizeof(key), "%s:{%s}:%d", entry->recurring ? "recurrence" : "event", replay->user, id);
+    redisReply *reply = NULL;
+    if (!db_append_event_get(c, key, names, name_count) || redis_get_reply(c, (void **)&reply) != REDIS_OK || reply == NULL ||
+        reply->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+    DbEventFields fields;
+    int exists = db_parse_event_get(reply, names, name_count, &fields) && fields.date != NULL;
+    int same = exists && same_event_fields(&fields, &entry->fields);
+    int skipped = exists && strstr(fields.exceptions, entry->skipped) != NULL;
+    freeReplyObject(reply);
+    if (entry->op == JOURNAL_SKIP && !exists)
+    {
+        return 0;
+    }
+    int applied = (entry->op == JOURNAL_ADD && same) || (entry->op == JOURNAL_REMOVE && !exists) || (entry->op == JOURNAL_SKIP && skipped);
+
+    // another session stored a different event under the id while this one was offline, the offline one gets a new id
+    int renamed = !applied && entry->op == JOURNAL_ADD && exists;
+    if (renamed)
+    {
+        int new_id = unused_event_id(c, replay->user, id);
+        ReplayRename *grown = new_id < 0 ? NULL : realloc(replay->renames, (replay->rename_count + 1) * sizeof(ReplayRename));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        replay->renames = grown;
+        replay->renames[replay->rename_count++] = (ReplayRename){entry->id, replay->record - 1, new_id};
+        id = new_id;
+    }
+
+    Event *event = entry->recurring ? NULL : db_event_from_fields(&entry->fields, id);
+    Recurrence *recurrence = entry->recurring ? db_recurrence_from_fields(&entry->fields, id) : NULL;
+    if (event == NULL && recurrence == NULL)
+    {
+        return -1;
+    }
+    if (recurrence)
+    {
+        event = recurrence->event;
+    }
+
+    // the writes to the user's own keys land together or not at all, the rename is kept with them so a later attempt sends the same id
+    int failed = 0;
+    if (!applied)
+    {
+        redis_append(c, "MULTI");
+        int commands = append_change_write(c, replay->user, entry->op, event, recurrence);
+        if (renamed && commands >= 0)
+        {
+            redis_append(c, "HSET replay_ids:{%s} %d:%d %d", replay->user, replay->record - 1, entry->id, id);
+            commands++;
+        }
+        redis_append(c, commands < 0 ? "DISCARD" : "EXEC");
+
+        // MULTI and the queued commands answer OK and QUEUED, EXEC the result of every command or an error if one was refused
+        // a command refused while queueing makes EXEC fail too, so its reply is read whenever the connection still works
+        redisReply *exec = NULL;
+        failed = drain_replies(c, (commands < 0 ? 0 : commands) + 1) != 0;
+        if (c->err || redis_get_reply(c, (void **)&exec) != REDIS_OK || commands < 0 || exec == NULL || exec->type != REDIS_REPLY_ARRAY ||
+            exec->elements != (size_t)commands)
+        {
+            failed = 1;
+        }
+        for (size_t i = 0; !failed && i < exec->elements; i++)
+        {
+            failed = exec->element[i]->type == REDIS_REPLY_ERROR;
+        }
+        freeReplyObject(exec);
+    }
+
+    // the shared indexes follow once the change is in, a failure keeps the record so they are sent again
+    if (!failed)
+    {
+        failed = drain_replies(c, append_change_indexes(c, replay->user, entry->op, event, recurrence)) != 0;
+    }
+
+    if (recurrence)
+        free_recurrence(recurrence);
+    else
+        free_event(event);
+    if (failed)
+    {
+        return -1;
+    }
+    if (renamed)
+    {
+        renumber_event(entry->id, id);
+        if (id >= next_event_id)
+        {
+            next_event_id = id + 1;
+        }
+    }
+    return 0;
+}
+
+// reads the renames an earlier attempt at the journal made, returns -1 if redis failed
+int load_replay_renames(ReplayContext *replay)
+{
+    redisReply *reply = redis_command(replay->c, "HGETALL replay_ids:{%s}", replay->user);
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    replay->renames = reply->elements > 0 ? malloc(reply->elements / 2 * sizeof(ReplayRename)) : NULL;
+    for (size_t i = 0; replay->renames != NULL && i + 1 < reply->elements; i += 2)
+    {
+        ReplayRename *rename = &replay->renames[replay->rename_count];
+        if (sscanf(reply->element[i]->str, "%d:%d", &rename->record, &rename->id) == 2)
+        {
+            rename->new_id = atoi(reply->element[i + 1]->str);
+            replay->rename_count++;
+        }
+    }
+    int failed = reply->elements > 0 && replay->renames == NULL;
+    freeReplyObject(reply);
+    return failed ? -1 : 0;
+}
+
+// sends the changes made while redis was unavailable, returns 0 once the journal is empty
+int replay_journal(redisContext *c, const char *user)
+{
+    if (journal_sync(&journal) != 0)
+    {
+        return -1;
+    }
+    if (journal.records == 0)
+    {
+        return 0;
+    }
+
+    uint64_t start = stats_now();
+    ReplayContext replay = {c, user, 0, NULL, 0};
+    if (load_replay_renames(&replay) != 0 || journal_replay(&journal, replay_change, &replay, 1) < 0)
+    {
+        free(replay.renames);
+        redis_failed(c);
+        return -1;
+    }
+
+    // the journal is empty, its positions mean nothing to the next one
+    if (replay.rename_count > 0)
+    {
+        freeReplyObject(redis_command(c, "DEL replay_ids:{%s}", user));
+    }
+    free(replay.renames);
+    stats_record_since("journal.replay", start);
+    return 0;
+}
+
+// returns 1 if redis can be used, the first request after an outage sends the journal before anything else
+int redis_available(redisContext *c, const char *user)
+{
+    int was_open = breaker.open;
+    if (!breaker_allow(&breaker, c))
+    {
+        return 0;
+    }
+    return !was_open || replay_journal(c, user) == 0;
+}
+
+// journals a change and queues its writes while redis is up, returns the number of queued commands or -1
+// the journal record is dropped or synced when the replies are read
+int queue_change(redisContext *c, const char *user, int op, const Event *event, const Recurrence *recurrence, const char *skipped)
+{
+    int online = redis_available(c, user);
+    if (journal_append(&journal, op, event, recurrence, skipped) != 0)
+    {
+        return -1;
+    }
+    return online ? append_change_all(c, user, op, event, recurrence) : 0;
+}
+
+// sends a change to redis, during an outage it waits in the journal instead
+// returns 0 if redis has it, 1 if it was journaled and -1 if it failed
+int write_change(redisContext *c, const char *user, int op, const Event *event, const Recurrence *recurrence, const char *skipped)
+{
+    int online = redis_available(c, user);
+    if (journal_append(&journal, op, event, recurrence, skipped) != 0)
+    {
+        return -1;
+    }
+
+    if (online)
+    {
+        int commands = append_change_all(c, user, op, event, recurrence);
+        int failed = commands < 0 ? -1 : drain_replies(c, commands);
+        if (!c->err)
+        {
+            journal_discard(&journal);
+            return failed ? -1 : 0;
+        }
+        redis_failed(c);
+    }
+    return journal_sync(&journal) == 0 ? 1 : -1;
+}
+
+// tells the user whether a change reached redis
+void report_change(int result, const char *error)
+{
+    if (result < 0)
+    {
+        printf("%s%s\n%s", RED_COLOR, error, RESET_COLOR);
+    }
+    else if (result > 0)
+    {
+        printf("%sRedis is unavailable, the change is kept locally and sent once it is back.\n%s", ORANGE_COLOR, RESET_COLOR);
+    }
+}
+
+// stores added event in the redis db
+void add_event_to_redis(redisContext *c, const char *user, const Event *event)
+{
+    report_change(write_change(c, user, JOURNAL_ADD, event, NULL, NULL), "Error adding the event to Redis.");
+}
+
+// stores a recurring event as a single rule record in the redis db
+void add_recurrence_to_redis(redisContext *c, const char *user, const Recurrence *recurrence)
+{
+    report_change(write_change(c, user, JOURNAL_ADD, recurrence->event, recurrence, NULL), "Error adding the event to Redis.");
+}
+
+// asks how often an event repeats, returns 0 for a single event
+int get_frequency(int *interval, char *until, const char *date)
+{
+    int frequency;
+    const char *units[] = {"", "days", "weeks", "months", "years"};
+
+    while (1)
+    {
+        printf("Should the event repeat? (n)o, (d)aily, (w)eekly, (m)onthly, (y)early: ");
+        char ch = tolower(getchar());
+        empty_input_buffer();
+        if (ch == 'n')
+            return 0;
+        frequency = ch == 'd' ? REPEAT_DAILY : ch == 'w' ? REPEAT_WEEKLY : ch == 'm' ? REPEAT_MONTHLY : ch == 'y' ? REPEAT_YEARLY : 0;
+        if (frequency)
+            break;
+        printf("%s\nInvalid input. Please enter 'n', 'd', 'w', 'm' or 'y'.\n\n%s", RED_COLOR, RESET_COLOR);
+    }
+
+    char input[MAX_DATE_LENGTH];
+    while (1)
+    {
+        printf("Repeat every how many %s? (1-99): ", units[frequency]);
+        if (input_validation_addEvent(input, sizeof(input)))
+        {
+            if (sscanf(input, "%d", interval) != 1 || *interval < 1 || *interval > 99)
+            {
+                printf("%s\nInvalid number. Please enter a number between 1 and 99.\n\n%s", RED_COLOR, RESET_COLOR);
+                continue;
+            }
+            break;
+        }
+    }
+
+    while (1)
+    {
+        int year, month, day;
+        printf("Enter the last date (YYYY-MM-DD) or leave empty to repeat forever: ");
+        if (fgets(input, sizeof(input), stdin) == NULL)
+        {
+            until[0] = '\0';
+            break;
+        }
+        if (strchr(input, '\n') == NULL)
+        {
+            empty_input_buffer();
+            printf("%s\nInput too long.%s\n\n", RED_COLOR, RESET_COLOR);
+            continue;
+        }
+        input[strcspn(input, "\n")] = '\0';
+        if (input[0] == '\0')
+        {
+            until[0] = '\0';
+            break;
+        }
+        if (!parse_date(input, &year, &month, &day))
+        {
+            printf("%s\nInvalid date. Please enter a valid date.\n\n%s", RED_COLOR, RESET_COLOR);
+            continue;
+        }
+        snprintf(until, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+        if (strcmp(until, date) < 0)
+        {
+            printf("%s\nThe last date cannot be before the first one.\n\n%s", RED_COLOR, RESET_COLOR);
+            continue;
+        }
+        break;
+    }
+
+    return frequency;
+}
+
+// HH:MM-HH:MM within one day, returns 1 if valid
+int parse_time_span(const char *text, int *start, int *end)
+{
+    char first[MAX_TIME_LENGTH];
+    const char *dash = strchr(text, '-');
+    if (dash == NULL || dash - text >= MAX_TIME_LENGTH)
+    {
+        return 0;
+    }
+    snprintf(first, sizeof(first), "%.*s", (int)(dash - text), text);
+    return parse_time(first, start) && parse_time(dash + 1, end) && *start < *end;
+}
+
+// asks for an optional start time and the end time or duration, start stays -1 for an all-day event
+void get_event_time(int *start, int *end)
+{
+    char input[MAX_TIME_LENGTH + 2];
+    *start = *end = -1;
+
+    while (1)
+    {
+        printf("Enter the start time (HH:MM) or leave empty for an all-day event: ");
+        if (fgets(input, sizeof(input), stdin) == NULL)
+        {
+            return;
+        }
+        if (strchr(input, '\n') == NULL)
+        {
+            empty_input_buffer();
+        }
+        input[strcspn(input, "\n")] = '\0';
+        if (input[0] == '\0')
+        {
+            return;
+        }
+        if (parse_time(input, start) && *start < MINUTES_PER_DAY)
+        {
+            break;
+        }
+        printf("%s\nInvalid time. Please enter a time like 09:30.\n\n%s", RED_COLOR, RESET_COLOR);
+    }
+
+    while (1)
+    {
+        printf("Enter the end time (HH:MM) or the duration in minutes: ");
+        if (input_validation_addEvent(input, sizeof(input)))
+        {
+            int minutes = 0;
+            if (strchr(input, ':') ? parse_time(input, end) : (minutes = atoi(input)) > 0)
+            {
+                if (minutes > 0)
+                    *end = *start + minutes;
+                if (*end > *start && *end <= MINUTES_PER_DAY)
+                    break;
+            }
+            printf("%s\nThe event must end after it starts and on the same day.\n\n%s", RED_COLOR, RESET_COLOR);
+        }
+    }
+}
+
+// one line of an overlap or "happening now" list
+void print_timed_event(const Event *event)
+{
+    char start[MAX_TIME_LENGTH], end[MAX_TIME_LENGTH];
+    event_times(event, start, end);
+    printf("  %s%s - %s%s  %s %s(ID %d)%s\n", BLUE_COLOR, start, end, RESET_COLOR, event->name, GREY, event->id, RESET_COLOR);
+}
+
+// lists the events a new timed event would overlap, returns 1 if there are none or the user adds it anyway
+int confirm_overlaps(const char *date, int start, int end)
+{
+    Event *overlaps[MAX_OVERLAPS];
+    int count = find_overlaps(date, start, end, overlaps, MAX_OVERLAPS);
+    if (count == 0)
+    {
+        return 1;
+    }
+
+    printf("%s\nThis event overlaps with %d event%s on %s:\n%s", ORANGE_COLOR, count, count == 1 ? "" : "s", date, RESET_COLOR);
+    for (int i = 0; i < count && i < MAX_OVERLAPS; i++)
+    {
+        print_timed_event(overlaps[i]);
+    }
+    if (count > MAX_OVERLAPS)
+    {
+        printf("  ... and %d more\n", count - MAX_OVERLAPS);
+    }
+
+    while (1)
+    {
+        printf("Add it anyway? (y/n): ");
+        char ch = tolower(getchar());
+        empty_input_buffer();
+        if (ch == 'y' || ch == 'n')
+            return ch == 'y';
+        printf("%s\nInvalid input. Please enter 'y' or 'n'.\n\n%s", RED_COLOR, RESET_COLOR);
+    }
+}
+
+// shows the timed events going on at a date and time
+void happening_at()
+{
+    char input[MAX_DATE_LENGTH + MAX_TIME_LENGTH + 2], date[MAX_DATE_LENGTH], time_text[MAX_TIME_LENGTH];
+    int year, month, day, minute;
+
+    printf("Enter a date and time (YYYY-MM-DD HH:MM): ");
+    if (!input_validation_addEvent(input, sizeof(input)))
+    {
+        press_enter_to_continue();
+        return;
+    }
+    if (sscanf(input, "%11s %5s", date, time_text) != 2 || !parse_date(date, &year, &month, &day) || !parse_time(time_text, &minute) || minute >= MINUTES_PER_DAY)
+    {
+        printf("%s\nInvalid date or time.\n%s", RED_COLOR, RESET_COLOR);
+        press_enter_to_continue();
+        return;
+    }
+    snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
+
+    Event *events[MAX_OVERLAPS];
+    int count = find_overlaps(date, minute, minute + 1, events, MAX_OVERLAPS);
+
+    format_time(minute, time_text);
+    printf("\n%sHappening on %s at %s%s\n\n", BOLD, date, time_text, RESET_COLOR);
+    for (int i = 0; i < count && i < MAX_OVERLAPS; i++)
+    {
+        print_timed_event(events[i]);
+    }
+    if (count == 0)
+    {
+        printf("Nothing is scheduled at that time.\n");
+    }
+    else if (count > MAX_OVERLAPS)
+    {
+        printf("  ... and %d more\n", count - MAX_OVERLAPS);
+    }
+    printf("\n");
+    press_enter_to_continue();
+}
+
+// keeps a new event in memory under the next id, a recurring one as a single rule, returns NULL if it cannot be stored
+Event *store_new_event(int visibility, const char *date, int start, int end, const char *name, const char *description, int frequency, int interval, const char *until, Recurrence **recurrence)
+{
+    *recurrence = NULL;
+    Event *event = create_event(next_event_id, visibility, date, name, description);
+    if (event == NULL)
+    {
+        return NULL;
+    }
+    event->start = start;
+    event->end = end;
+
+    if (frequency)
+    {
+        Recurrence *rule = create_recurrence(event, frequency, interval, until, NULL);
+        if (rule == NULL)
+        {
+            free_event(event);
+            return NULL;
+        }
+        if (store_recurrence(rule) != 0)
+        {
+            free_recurrence(rule);
+            return NULL;
+        }
+        *recurrence = rule;
+    }
+    else if (store_event(event) != 0)
+    {
+        free_event(event);
+        return NULL;
+    }
+
+    next_event_id++;
+    return event;
+}
+
+// function for adding a new event (heap + redis)
+void add_event(redisContext *c, const char *user)
+{
+    if (timeline.count + recurrence_count >= MAX_EVENTS)
+    {
+        printf("%sEvent limit reached. Cannot add more events.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    char visibility;
+    char date[MAX_DATE_LENGTH];
+    char name[MAX_NAME_LENGTH];
+    char description[MAX_DESC_LENGTH];
+
+    // get the current date
+    int current_day, current_month, current_year;
+    get_current_day_month_year(&current_day, &current_month, &current_year);
+
+    int year, month, day;
+
+    while (1)
+    {
+        printf("Should the event be public? (y/n): ");
+        char ch = getchar();
+        empty_input_buffer();
+        if (ch == 'y' || ch == 'Y')
+        {
+            visibility = 0;
+            break;
+        }
+        else if (ch == 'n' || ch == 'N')
+        {
+            visibility = 1;
+            break;
+        }
+        else
+        {
+            printf("%s\nInvalid input. Please enter 'y' or 'n'.\n\n%s", RED_COLOR, RESET_COLOR);
+            continue;
+        }
+    }
+
+    while (1)
+    {
+        printf("Enter the event date (YYYY-MM-DD): ");
+        if (input_validation_addEvent(date, MAX_DATE_LENGTH))
+        {
+            if (sscanf(date, "%d-%d-%d", &year, &month, &day) != 3 || month < 1 || month > 12 || day < 1 || day > get_days_in_month(month, year) || year < 1 || year > 9999)
+            {
+                printf("%s\nInvalid date. Please enter a valid date.\n\n%s", RED_COLOR, RESET_COLOR);
+                continue;
+            }
+            break;
+        }
+    }
+
+    // validate and format the entered date
+    /*
+    if (sscanf(date, "%d-%d-%d", &year, &month, &day) != 3 ||
+        year < current_year || year > 2100 ||
+        (year == current_year && (month < current_month || (month == current_month && day < current_day))) ||
+        month < 1 || month > 12 || day < 1 || day > 31)
+    {
+        printf("%s\nInvalid date. Please enter a valid date between today and the year 2100.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+    */
+
+    // format the date to ensure two digits for month and day
+    snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
+
+    int start, end;
+    get_event_time(&start, &end);
+
+    int interval = 1;
+    char until[MAX_DATE_LENGTH];
+    int frequency = get_frequency(&interval, until, date);
+
+    while (1)
+    {
+        printf("Enter the event name (maximum %d characters): ", MAX_NAME_LENGTH);
+        if (input_validation_addEvent(name, MAX_NAME_LENGTH))
+        {
+            break;
+        }
+    }
+
+    while (1)
+    {
+        printf("Enter the event description (maximum %d characters): ", MAX_DESC_LENGTH);
+        if (input_validation_addEvent(description, MAX_DESC_LENGTH))
+        {
+            break;
+        }
+    }
+
+    // a recurring event is checked on its first day
+    if (start >= 0 && !confirm_overlaps(date, start, end))
+    {
+        printf("%s\nEvent not added.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    Recurrence *recurrence;
+    Event *event = store_new_event(visibility, date, start, end, name, description, frequency, interval, until, &recurrence);
+    if (event == NULL)
+    {
+        printf("%sError: Event could not be stored.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    if (recurrence)
+    {
+        add_recurrence_to_redis(c, user, recurrence);
+    }
+    else
+    {
+        add_event_to_redis(c, user, event);
+    }
+
+    printf("%s\nEvent added successfully!\n%s", GREEN_COLOR, RESET_COLOR);
+}
+
+// turns parsed event or rule fields into an in-memory event, returns 1 if it was stored
+int store_event_fields(const DbEventFields *fields, int event_id, int recurring, void *context)
+{
+    int privilege_level = *(const int *)context;
+
+    if (event_id >= next_event_id)
+    {
+        next_event_id = event_id + 1;
+    }
+
+    // if all fields are present, save the event
+    if (!fields->description || timeline.count + recurrence_count >= MAX_EVENTS || fields->visibility > privilege_level)
+    {
+        return 0;
+    }
+
+    if (!recurring)
+    {
+        Event *event = db_event_from_fields(fields, event_id);
+        if (event == NULL || store_event(event) != 0)
+        {
+            if (event)
+                free_event(event);
+            return 0;
+        }
+        return 1;
+    }
+
+    Recurrence *recurrence = db_recurrence_from_fields(fields, event_id);
+    if (recurrence == NULL || store_recurrence(recurrence) != 0)
+    {
+        if (recurrence)
+            free_recurrence(recurrence);
+        return 0;
+    }
+    return 1;
+}
+
+// turns an event or rule hash into an in-memory event, returns 1 if it was stored
+int store_event_reply(redisReply *reply, int event_id, int privilege_level, int recurring)
+{
+    DbEventFields fields;
+    if (!db_parse_event(reply, &fields))
+    {
+        if (event_id >= next_event_id && reply != NULL && reply->type == REDIS_REPLY_ARRAY && reply->elements > 0)
+            next_event_id = event_id + 1;
+        return 0;
+    }
+    return store_event_fields(&fields, event_id, recurring, &privilege_level);
+}
+
+// loads every event:{<user>}:* or recurrence:{<user>}:* hash, fetched in pipelined batches, returns -1 if redis failed
+int load_hashes_from_redis(redisContext *c, const char *user, int privilege_level, int recurring)
+{
+    return db_load_events(c, user, recurring, store_event_fields, &privilege_level) < 0 ? -1 : 0;
+}
+
+// loads the pre-existing events from redis when the calendar is opened, returns -1 if redis failed
+int load_events_from_redis(redisContext *c, const char *user, int privilege_level)
+{
+    next_event_id = 1;
+
+    // recurring events are loaded as rules, their occurrences are expanded when a view needs them
+    if (load_hashes_from_redis(c, user, privilege_level, 0) != 0 || load_hashes_from_redis(c, user, privilege_level, 1) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// strict input validation to get unsigned int id to remove event
+unsigned int get_valid_unsigned_integer()
+{
+    char input[16];
+    int temp_id;
+    unsigned int id;
+    char extra;
+
+    while (1)
+    {
+        printf("Enter the ID of the event to remove: ");
+        if (fgets(input, sizeof(input), stdin) != NULL)
+        {
+            if (strchr(input, '\n') == NULL)
+            {
+                empty_input_buffer();
+                printf("%s\nEnter a valid number.%s\n\n", RED_COLOR, RESET_COLOR);
+                continue;
+            }
+            if (sscanf(input, "%d %c", &temp_id, &extra) == 1)
+            {
+                if (temp_id < 0)
+                {
+                    printf("%s\nNegative numbers are not allowed.%s\n\n", RED_COLOR, RESET_COLOR);
+                    continue;
+                }
+
+                id = (unsigned int)temp_id;
+                return id;
+            }
+            else
+            {
+                printf("%s\nEnter a valid number.%s\n\n", RED_COLOR, RESET_COLOR);
+            }
+        }
+        else
+        {
+            printf("%s\nInput error.\n\n%s", RED_COLOR, RESET_COLOR);
+        }
+    }
+}
+
+// free all events
+void free_events()
+{
+    interval_clear(&intervals);
+    timeline_clear(&timeline);
+
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        free_recurrence(recurrences[i]);
+    }
+    free(recurrences);
+    recurrences = NULL;
+    recurrence_count = 0;
+}
+
+// removes event from the redis db
+void delete_event_from_redis(redisContext *c, const char *user, const Event *event)
+{
+    report_change(write_change(c, user, JOURNAL_REMOVE, event, NULL, NULL), "Error deleting the event from Redis.");
+}
+
+// removes a recurring event rule from the redis db
+void delete_recurrence_from_redis(redisContext *c, const char *user, const Recurrence *recurrence)
+{
+    report_change(write_change(c, user, JOURNAL_REMOVE, recurrence->event, recurrence, NULL), "Error deleting the event from Redis.");
+}
+
+// removes all occurrences of a recurring event or skips a single one
+void remove_recurrence(redisContext *c, const char *user, Recurrence *recurrence)
+{
+    char ch;
+
+    while (1)
+    {
+        printf("This event repeats %s. Remove (a)ll occurrences or a (s)ingle date? ", frequency_name(recurrence->frequency));
+        ch = tolower(getchar());
+        empty_input_buffer();
+        if (ch == 'a' || ch == 's')
+            break;
+        printf("%s\nInvalid input. Please enter 'a' or 's'.\n\n%s", RED_COLOR, RESET_COLOR);
+    }
+
+    if (ch == 'a')
+    {
+        unlink_recurrence(recurrence);
+        delete_recurrence_from_redis(c, user, recurrence);
+        free_recurrence(recurrence);
+        printf("%s\nEvent removed successfully!\n%s", GREEN_COLOR, RESET_COLOR);
+        return;
+    }
+
+    char date[MAX_DATE_LENGTH], occurrence[MAX_DATE_LENGTH];
+    while (1)
+    {
+        printf("Enter the date of the occurrence to remove (YYYY-MM-DD): ");
+        if (input_validation_addEvent(date, MAX_DATE_LENGTH))
+        {
+            int year, month, day;
+            if (parse_date(date, &year, &month, &day))
+            {
+                snprintf(date, sizeof(date), "%04d-%02d-%02d", year, month, day);
+                if (recurrence_next(recurrence, date, occurrence) && strcmp(occurrence, date) == 0)
+                    break;
+            }
+            printf("%s\nThe event does not take place on that date.\n\n%s", RED_COLOR, RESET_COLOR);
+        }
+    }
+
+    if (recurrence_add_exception(recurrence, date) != 0)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    report_change(write_change(c, user, JOURNAL_SKIP, recurrence->event, recurrence, date), "Error updating the event in Redis.");
+    printf("%s\nOccurrence removed successfully!\n%s", GREEN_COLOR, RESET_COLOR);
+}
+
+// 1 if the event was fetched back from the archive
+int is_archived(int id)
+{
+    for (int i = 0; i < archived_id_count; i++)
+    {
+        if (archived_ids[i] == id)
+            return 1;
+    }
+    return 0;
+}
+
+// function to remove an event from the event array
+void remove_event(redisContext *c, const char *user)
+{
+    if (timeline.count + recurrence_count == 0)
+    {
+        printf("%sNo events to remove.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    unsigned int id = get_valid_unsigned_integer();
+    if (is_archived(id))
+    {
+        printf("%s\nEvent %u is archived and cannot be removed.\n%s", RED_COLOR, id, RESET_COLOR);
+        return;
+    }
+
+    // find and remove the event
+    Event *event = unstore_event(id);
+    if (event != NULL)
+    {
+        delete_event_from_redis(c, user, event);
+        free_event(event);
+        printf("%s\nEvent removed successfully!\n%s", GREEN_COLOR, RESET_COLOR);
+        return;
+    }
+
+    Recurrence *recurrence = find_recurrence(id);
+    if (recurrence != NULL)
+    {
+        remove_recurrence(c, user, recurrence);
+        return;
+    }
+
+    printf("%s\nNo event found with ID %u.\n%s", RED_COLOR, id, RESET_COLOR);
+}
+
+// visibility print
+char *print_visibility(int vis)
+{
+    if (vis)
+    {
+        return "private";
+    }
+    else
+    {
+        return "public";
+    }
+}
+
+// prints a single event of the event list, date is the occurrence for recurring events
+void print_event(const Event *event, const char *date, const char *color)
+{
+    printf("ID: %d\nVisibility: %s\nDate: %s%s%s\n", event->id, print_visibility(event->visibility), color, date, RESET_COLOR);
+    if (event_is_timed(event))
+    {
+        char start[MAX_TIME_LENGTH], end[MAX_TIME_LENGTH];
+        event_times(event, start, end);
+        printf("Time: %s - %s\n", start, end);
+    }
+    printf("Name: %s\nDescription: %s\n", event->name, event->description);
+
+    Recurrence *recurrence = find_recurrence(event->id);
+    if (recurrence != NULL)
+    {
+        printf("Repeats: %s", frequency_name(recurrence->frequency));
+        if (recurrence->interval > 1)
+            printf(" (every %d)", recurrence->interval);
+        if (recurrence->until[0])
+            printf(" until %s", recurrence->until);
+        printf("\n");
+    }
+    printf("-----------------------------\n");
+}
+
+// one entry of the event list, a stored event or one occurrence of a recurring event
+typedef struct
+{
+    const Event *event;
+    char date[MAX_DATE_LENGTH];
+} AgendaItem;
+
+// event list order: by date, then by id
+int agenda_before(const char *date_a, int id_a, const char *date_b, int id_b)
+{
+    int cmp = strcmp(date_a, date_b);
+    return cmp < 0 || (cmp == 0 && id_a < id_b);
+}
+
+// first entry at (after = 0) or after (after = 1) the position (date, id), returns 0 at the end
+int agenda_next(const char *position, int id, int after, AgendaItem *item)
+{
+    int found = 0;
+    char date[MAX_DATE_LENGTH];
+    snprintf(date, sizeof(date), "%s", position); // position may point into item
+
+    // stored events: skip the ones on the same date that come before the position
+    TimelineNode *node = timeline_seek(&timeline, date);
+    while (node && strcmp(node->event->date, date) == 0 && (node->event->id < id || (after && node->event->id == id)))
+    {
+        node = node->next[0];
+    }
+    if (node)
+    {
+        item->event = node->event;
+        snprintf(item->date, sizeof(item->date), "%s", node->event->date);
+        found = 1;
+    }
+
+    // recurring events: only the next occurrence of every rule is expanded
+    char occurrence[MAX_DATE_LENGTH], following[MAX_DATE_LENGTH];
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        const Event *event = recurrences[i]->event;
+        if (!recurrence_next(recurrences[i], date, occurrence))
+            continue;
+        if (strcmp(occurrence, date) == 0 && (event->id < id || (after && event->id == id)))
+        { // same day as the position but not after it, take the following occurrence
+            next_day(date, following);
+            if (!recurrence_next(recurrences[i], following, occurrence))
+                continue;
+        }
+
+        if (!found || agenda_before(occurrence, event->id, item->date, item->event->id))
+        {
+            item->event = event;
+            snprintf(item->date, sizeof(item->date), "%s", occurrence);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// last entry before the position (date, id), returns 0 at the start
+int agenda_prev(const char *position, int id, AgendaItem *item)
+{
+    int found = 0;
+    char date[MAX_DATE_LENGTH];
+    snprintf(date, sizeof(date), "%s", position); // position may point into item
+
+    TimelineNode *node = timeline_seek(&timeline, date);
+    while (node && strcmp(node->event->date, date) == 0 && node->event->id < id)
+    {
+        node = node->next[0];
+    }
+    node = node ? node->prev : timeline_last(&timeline);
+    if (node)
+    {
+        item->event = node->event;
+        snprintf(item->date, sizeof(item->date), "%s", node->event->date);
+        found = 1;
+    }
+
+    char occurrence[MAX_DATE_LENGTH];
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        const Event *event = recurrences[i]->event;
+        int on_date = recurrence_next(recurrences[i], date, occurrence) && strcmp(occurrence, date) == 0 && event->id < id;
+        if (!on_date && !recurrence_prev(recurrences[i], date, occurrence))
+            continue;
+
+        if (!found || agenda_before(item->date, item->event->id, occurrence, event->id))
+        {
+            item->event = event;
+            snprintf(item->date, sizeof(item->date), "%s", occurrence);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// function to view all events, one page at a time starting at today
+void view_events()
+{
+    if (timeline.count + recurrence_count == 0)
+    {
+        printf("-----------------------------\n");
+        printf("No events found.\n");
+        printf("-----------------------------\n");
+        press_enter_to_continue();
+        return;
+    }
+
+    char today[MAX_DATE_LENGTH];
+    get_today(today);
+
+    // the page starts at the entry at or after (page_date, page_id), the first page at today
+    char page_date[MAX_DATE_LENGTH];
+    int page_id = INT_MIN;
+    snprintf(page_date, sizeof(page_date), "%s", today);
+
+    AgendaItem item;
+    if (!agenda_next(page_date, page_id, 0, &item))
+    { // only past events, start behind the last one and go back one page
+        snprintf(page_date, sizeof(page_date), "9999-12-31");
+        page_id = INT_MAX;
+        for (int i = 0; i < EVENTS_PER_PAGE && agenda_prev(page_date, page_id, &item); i++)
+        {
+            snprintf(page_date, sizeof(page_date), "%s", item.date);
+            page_id = item.event->id;
+        }
+    }
+
+    char choice;
+
+    while (1)
+    {
+        uint64_t start = stats_now();
+        clear();
+
+        int past_header = 0, future_header = 0, shown = 0, more;
+        for (more = agenda_next(page_date, page_id, 0, &item); more && shown < EVENTS_PER_PAGE;
+             more = agenda_next(item.date, item.event->id, 1, &item), shown++)
+        {
+            int cmp = strcmp(item.date, today);
+
+            if (cmp < 0)
+            {
+                if (!past_header)
+                {
+                    printf("======== Past Events ========\n");
+                    past_header = 1;
+                }
+                print_event(item.event, item.date, GRAY_COLOR);
+            }
+            else
+            {
+                if (!future_header)
+                {
+                    printf("%s======= Future Events =======\n", past_header ? "\n\n" : "");
+                    future_header = 1;
+                }
+                print_event(item.event, item.date, cmp == 0 ? MAGENTA_COLOR : BLUE_COLOR);
+            }
+        }
+
+        printf("\n%d events and %d recurring events in total.\n", timeline.count, recurrence_count);
+        printf("Use 'n' for next page, 'p' for previous page, 'q' to quit the event list.\n");
+        fflush(stdout);
+        stats_record_since("render.event_list", start);
+
+        // closed input ends the list like 'q'
+        if (scanf(" %c", &choice) != 1)
+        {
+            return;
+        }
+        empty_input_buffer();
+
+        switch (choice)
+        {
+        case 'n':
+            if (more)
+            { // item is the first entry of the next page, stay on the last page at the end
+                snprintf(page_date, sizeof(page_date), "%s", item.date);
+                page_id = item.event->id;
+            }
+            break;
+        case 'p':
+            for (int i = 0; i < EVENTS_PER_PAGE && agenda_prev(page_date, page_id, &item); i++)
+            {
+                snprintf(page_date, sizeof(page_date), "%s", item.date);
+                page_id = item.event->id;
+            }
+            break;
+        case 'q':
+            return;
+        default:;
+        }
+    }
+}
+
+// SEARCH --------------------
+// makes sure the secondary indexes are current, the owner rebuilds outdated ones from the loaded events
+void prepare_indexes(redisContext *c, const char *user, int privilege_level)
+{
+    redisReply *reply = redis_command(c, "GET index_version:{%s}", user);
+    int version = (reply != NULL && reply->type == REDIS_REPLY_STRING) ? atoi(reply->str) : 0;
+    freeReplyObject(reply);
+
+    if (version >= INDEX_VERSION)
+    {
+        search_index_ready = 1;
+        return;
+    }
+
+    // only the owner has every event loaded, viewers fall back to scanning
+    if (!privilege_level)
+    {
+        return;
+    }
+
+    // the month counts are recounted from scratch, adding to what is there would count the events twice
+    redis_append(c, "DEL month_counts:{%s}", user);
+    int pending = 1, failed = 0;
+    for (TimelineNode *node = timeline_first(&timeline); node; node = node->next[0])
+    {
+        pending += append_search_index(c, user, node->event, 1) + append_date_index(c, user, node->event, 1) + months_append_date(c, user, node->event->visibility, node->event->date, 1);
+        if (pending >= INDEX_BATCH_SIZE)
+        {
+            failed += drain_replies(c, pending);
+            pending = 0;
+        }
+    }
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        pending += append_search_index(c, user, recurrences[i]->event, 1);
+    }
+    failed += drain_replies(c, pending);
+
+    if (failed == 0)
+    {
+        reply = redis_command(c, "SET index_version:{%s} %d", user, INDEX_VERSION);
+        search_index_ready = reply != NULL && reply->type != REDIS_REPLY_ERROR;
+        freeReplyObject(reply);
+    }
+}
+
+// helper function for sorting search results by date
 int compare_events(const void *a, const void *b)
 {
-    const Event *event_a = *(const Event **)a;
-    const Event *event_b = *(const Event **)b;
-    return strcmp(event_a->date, event_b->date);
+    const Event *event_a = *(const Event **)a;
+    const Event *event_b = *(const Event **)b;
+    int cmp = strcmp(event_a->date, event_b->date);
+    return cmp != 0 ? cmp : (event_a->id > event_b->id) - (event_a->id < event_b->id);
+}
+
+// candidate ids come from intersecting the trigram sets in redis, returns the match count or -1
+int search_with_index(redisContext *c, const char *user, const char *query, Event ***results)
+{
+    Trigram trigrams[MAX_DESC_LENGTH];
+    int count = trigram_unique(trigrams, trigram_extract(query, trigrams, 0, MAX_DESC_LENGTH));
+
+    size_t prefix_length = strlen("trigram:{}:") + strlen(user);
+    char *keys = malloc(count * (prefix_length + TRIGRAM_LENGTH));
+    const char **argv = malloc((count + 1) * sizeof(char *));
+    size_t *argvlen = malloc((count + 1) * sizeof(size_t));
+    if (keys == NULL || argv == NULL || argvlen == NULL)
+    {
+        free(keys);
+        free(argv);
+        free(argvlen);
+        return -1;
+    }
+
+    argv[0] = "SINTER";
+    argvlen[0] = strlen("SINTER");
+    for (int i = 0; i < count; i++)
+    {
+        char *key = keys + i * (prefix_length + TRIGRAM_LENGTH);
+        snprintf(key, prefix_length + 1, "trigram:{%s}:", user);
+        memcpy(key + prefix_length, trigrams[i].bytes, TRIGRAM_LENGTH);
+        argv[i + 1] = key;
+        argvlen[i + 1] = prefix_length + TRIGRAM_LENGTH;
+    }
+
+    redisReply *reply = redis_command_argv(c, count + 1, argv, argvlen);
+    free(keys);
+    free(argv);
+    free(argvlen);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    *results = malloc((reply->elements + 1) * sizeof(Event *));
+    if (*results == NULL)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    // candidates are verified against the loaded events, which also drops events above the privilege level
+    int matches = 0;
+    for (size_t i = 0; i < reply->elements; i++)
+    {
+        Event *event = find_event(atoi(reply->element[i]->str));
+        if (event && (contains_ignore_case(event->name, query) || contains_ignore_case(event->description, query)))
+        {
+            (*results)[matches++] = event;
+        }
+    }
+    freeReplyObject(reply);
+
+    qsort(*results, matches, sizeof(Event *), compare_events);
+    return matches;
+}
+
+// fallback for short queries and calendars without an index, returns the match count or -1
+int search_by_scan(const char *query, Event ***results)
+{
+    *results = malloc((timeline.count + recurrence_count + 1) * sizeof(Event *));
+    if (*results == NULL)
+    {
+        return -1;
+    }
+
+    int matches = 0;
+    for (TimelineNode *node = timeline_first(&timeline); node; node = node->next[0])
+    {
+        if (contains_ignore_case(node->event->name, query) || contains_ignore_case(node->event->description, query))
+        {
+            (*results)[matches++] = node->event;
+        }
+    }
+    for (int i = 0; i < recurrence_count; i++)
+    {
+        if (contains_ignore_case(recurrences[i]->event->name, query) || contains_ignore_case(recurrences[i]->event->description, query))
+        {
+            (*results)[matches++] = recurrences[i]->event;
+        }
+    }
+
+    qsort(*results, matches, sizeof(Event *), compare_events);
+    return matches;
+}
+
+// events whose name or description contains the query, sorted by date, returns the match count or -1
+int find_matches(redisContext *c, const char *user, const char *query, Event ***results)
+{
+    if (search_index_ready && strlen(query) >= TRIGRAM_LENGTH && redis_available(c, user))
+    {
+        int matches = search_with_index(c, user, query, results);
+        if (matches >= 0 || !c->err)
+        {
+            return matches;
+        }
+        redis_failed(c);
+    }
+    return search_by_scan(query, results);
+}
+
+// function to search events by name and description
+void search_events(redisContext *c, const char *user)
+{
+    char query[MAX_DESC_LENGTH];
+
+    printf("Enter the text to search for: ");
+    if (!input_validation_addEvent(query, sizeof(query)))
+    {
+        return;
+    }
+
+    Event **results = NULL;
+    int matches = find_matches(c, user, query, &results);
+    if (matches < 0)
+    {
+        printf("%s\nError: Search failed.\n%s", RED_COLOR, RESET_COLOR);
+        return;
+    }
+
+    char today[MAX_DATE_LENGTH];
+    get_today(today);
+
+    printf("\n===== Search Results =====\n");
+    for (int i = 0; i < matches && i < MAX_SEARCH_RESULTS; i++)
+    {
+        int cmp = strcmp(results[i]->date, today);
+        print_event(results[i], results[i]->date, cmp < 0 ? GRAY_COLOR : cmp == 0 ? MAGENTA_COLOR : BLUE_COLOR);
+    }
+
+    if (matches > MAX_SEARCH_RESULTS)
+    {
+        printf("\n%d events found, showing the first %d.\n", matches, MAX_SEARCH_RESULTS);
+    }
+    else
+    {
+        printf("\n%d events found.\n", matches);
+    }
+
+    free(results);
+}
+
+// IMPORT / EXPORT --------------------
+// counters of an import run
+typedef struct
+{
+    long imported;
+    long duplicates;
+    long failed;
+    long skipped;      // VEVENTs without date or name
+    long write_errors; // failed redis commands
+} ImportStats;
+
+// turns a parsed VEVENT into a stored event or rule in memory, returns NULL if it cannot be kept
+Event *keep_imported_event(IcsEvent *ics, int id, Recurrence **recurrence)
+{
+    *recurrence = NULL;
+    if (timeline.count + recurrence_count >= MAX_EVENTS)
+    {
+        return NULL;
+    }
+
+    Event *event = create_event(id, ics->visibility, ics->date, ics->name, ics->description);
+    if (event == NULL)
+    {
+        return NULL;
+    }
+    event->start = ics->start;
+    event->end = ics->end;
+
+    if (!ics->frequency)
+    {
+        if (store_event(event) != 0)
+        {
+            free_event(event);
+            return NULL;
+        }
+        return event;
+    }
+
+    Recurrence *rule = create_recurrence(event, ics->frequency, ics->interval, ics->until, NULL);
+    if (rule == NULL)
+    {
+        free_event(event);
+        return NULL;
+    }
+
+    // COUNT counts the skipped occurrences too, so the end date is found before adding them
+    if (ics->count > 0 && !rule->until[0])
+    {
+        char from[MAX_DATE_LENGTH], date[MAX_DATE_LENGTH];
+        snprintf(from, sizeof(from), "%s", ics->date);
+        for (int i = 0; i < ics->count && recurrence_next(rule, from, date); i++)
+        {
+            snprintf(rule->until, sizeof(rule->until), "%s", date);
+            next_day(date, from);
+        }
+    }
+    for (char *part = strtok(ics->exceptions, ","); part; part = strtok(NULL, ","))
+    {
+        recurrence_add_exception(rule, part);
+    }
+
+    if (store_recurrence(rule) != 0)
+    {
+        free_recurrence(rule);
+        return NULL;
+    }
+    *recurrence = rule;
+    return event;
+}
+
+// writes one batch with two round trips: claim the UIDs, then store the events that are new, and releases the UIDs of the ones that failed
+void import_batch(redisContext *c, const char *user, IcsEvent *batch, int count, ImportStats *stats)
+{
+    int ids[ICS_BATCH_SIZE], fresh[ICS_BATCH_SIZE];
+
+    // HSETNX only succeeds for UIDs that were not imported before (or earlier in this batch)
+    for (int i = 0; i < count; i++)
+    {
+        ids[i] = next_event_id++;
+        fresh[i] = 1;
+        if (batch[i].uid[0])
+        {
+            redis_append(c, "HSETNX ics_uid:{%s} %s %d", user, batch[i].uid, ids[i]);
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!batch[i].uid[0])
+        {
+            continue;
+        }
+
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            stats->failed += count;
+            return;
+        }
+        fresh[i] = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+        freeReplyObject(reply);
+    }
+
+    int queued[ICS_BATCH_SIZE];
+    for (int i = 0; i < count; i++)
+    {
+        queued[i] = 0;
+        if (!fresh[i])
+        {
+            stats->duplicates++;
+            continue;
+        }
+
+        Recurrence *recurrence;
+        Event *event = keep_imported_event(&batch[i], ids[i], &recurrence);
+        int written = event == NULL ? -1 : recurrence ? append_recurrence_write(c, user, recurrence, batch[i].uid) : append_event_write(c, user, event, batch[i].uid);
+        if (written < 0)
+        {
+            queued[i] = -1;
+            stats->failed++;
+            continue;
+        }
+        queued[i] = written + append_change_indexes(c, user, JOURNAL_ADD, event, recurrence);
+        stats->imported++;
+    }
+
+    // the UID of an event that was not stored is released again, so importing the file once more retries it
+    int released = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int errors = queued[i] < 0;
+        for (int k = 0; k < queued[i]; k++)
+        {
+            redisReply *reply = NULL;
+            int error = redis_get_reply(c, (void **)&reply) != REDIS_OK || reply == NULL || reply->type == REDIS_REPLY_ERROR;
+            stats->write_errors += error;
+            errors += error;
+            freeReplyObject(reply);
+        }
+        if (errors && batch[i].uid[0])
+        {
+            redis_append(c, "HDEL ics_uid:{%s} %s", user, batch[i].uid);
+            released++;
+        }
+    }
+    stats->write_errors += drain_replies(c, released);
+}
+
+// streams an .ics file into the calendar, memory use does not depend on the file size, returns -1 if it cannot be read
+int import_ics(redisContext *c, const char *user, const char *path, ImportStats *stats)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    IcsEvent *batch = malloc(ICS_BATCH_SIZE * sizeof(IcsEvent));
+    if (batch == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    IcsReader reader;
+    ics_reader_init(&reader, file);
+    int count = 0, more = 1;
+
+    while (more)
+    {
+        more = ics_read_event(&reader, &batch[count]);
+        if (more)
+        {
+            count++;
+        }
+        if (count == ICS_BATCH_SIZE || (!more && count > 0))
+        {
+            import_batch(c, user, batch, count, stats);
+            count = 0;
+        }
+    }
+
+    stats->skipped = reader.skipped;
+    free(batch);
+    fclose(file);
+    return 0;
+}
+
+// asks for an .ics file and imports it
+// file of the user's own .ics directory the menu may open, returns 0 if the name is a plain file name
+// the menu is served to remote clients, so a name must not reach any other file of the server
+int ics_path(const char *user, const char *name, char *path, size_t size)
+{
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL || strcmp(user, ".") == 0 || strcmp(user, "..") == 0)
+    {
+        return -1;
+    }
+
+    const char *dir = getenv("CALENDAR_ICS_DIR");
+    if (dir == NULL || dir[0] == '\0')
+    {
+        dir = ICS_DIR;
+    }
+    mkdir(dir, 0700);
+    snprintf(path, size, "%s/%s", dir, user);
+    mkdir(path, 0700);
+    return snprintf(path, size, "%s/%s/%s", dir, user, name) < (int)size ? 0 : -1;
+}
+
+// reads the name of a file of the user's .ics directory, returns 0 if it is usable
+int get_ics_path(const char *user, const char *prompt, char *path, size_t size)
+{
+    char name[NAME_MAX + 1];
+
+    printf("%s", prompt);
+    if (!input_validation_addEvent(name, sizeof(name)))
+    {
+        return -1;
+    }
+    if (ics_path(user, name, path, size) != 0)
+    {
+        printf("%s\nError: Give a file name without '/', files are kept in your own folder.\n%s", RED_COLOR, RESET_COLOR);
+        return -1;
+    }
+    return 0;
+}
+
+void import_events(redisContext *c, const char *user)
+{
+    char path[PATH_MAX];
+
+    if (get_ics_path(user, "Enter the name of the .ics file to import: ", path, sizeof(path)) != 0)
+    {
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ImportStats stats = {0};
+    if (import_ics(c, user, path, &stats) != 0)
+    {
+        printf("%s\nError: Could not open '%s'.\n%s", RED_COLOR, path, RESET_COLOR);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (stats.write_errors)
+    {
+        printf("%sError adding imported events to Redis.\n%s", RED_COLOR, RESET_COLOR);
+    }
+    printf("%s\nImported %ld events in %.2f s.\n%s", GREEN_COLOR, stats.imported,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, RESET_COLOR);
+    if (stats.duplicates || stats.failed || stats.skipped)
+    {
+        printf("Skipped %ld already imported, %ld without date or name, %ld failed.\n", stats.duplicates, stats.skipped, stats.failed);
+    }
+}
+
+// fills an export record from the fields of an event or rule, returns 1 if it has a date and a name
+int ics_from_fields(const DbEventFields *fields, const char *user, const char *id, IcsEvent *ics)
+{
+    memset(ics, 0, sizeof(IcsEvent));
+    ics->visibility = fields->visibility;
+    ics->start = fields->start;
+    ics->end = fields->end;
+    ics->frequency = fields->frequency;
+    ics->interval = fields->interval;
+    snprintf(ics->date, sizeof(ics->date), "%s", fields->date ? fields->date : "");
+    snprintf(ics->name, sizeof(ics->name), "%s", fields->name ? fields->name : "");
+    snprintf(ics->description, sizeof(ics->description), "%s", fields->description ? fields->description : "");
+    snprintf(ics->uid, sizeof(ics->uid), "%s", fields->uid);
+    snprintf(ics->until, sizeof(ics->until), "%s", fields->until);
+    snprintf(ics->exceptions, sizeof(ics->exceptions), "%s", fields->exceptions);
+
+    // events created in the calendar get a stable UID on their first export
+    if (!ics->uid[0])
+    {
+        snprintf(ics->uid, sizeof(ics->uid), "%s-%s@calendar", id, user);
+    }
+    return ics->date[0] && ics->name[0];
+}
+
+// fills an export record from an event or rule hash, returns 1 if all event fields are present
+int ics_from_reply(redisReply *reply, const char *user, const char *id, IcsEvent *ics)
+{
+    DbEventFields fields;
+    int complete = db_parse_event(reply, &fields);
+    return ics_from_fields(&fields, user, id, ics) && complete;
+}
+
+// file and owner the rules of an export are written with
+typedef struct
+{
+    const char *user;
+    FILE *file;
+} ExportContext;
+
+// writes one rule handed over by db_load_events, returns 1 if it was written
+int export_rule(const DbEventFields *fields, int id, int recurring, void *context)
+{
+    (void)recurring;
+    ExportContext *export = context;
+    char text[16];
+    IcsEvent ics;
+    snprintf(text, sizeof(text), "%d", id);
+    if (!ics_from_fields(fields, export->user, text, &ics))
+    {
+        return 0;
+    }
+    ics_write_event(export->file, &ics);
+    return 1;
+}
+
+// fetches a page of event hashes in one pipeline and writes them, returns the number written or -1 if the connection failed
+long export_page(redisContext *c, const char *user, redisReply *ids, FILE *file)
+{
+    long written = 0;
+    IcsEvent ics;
+
+    for (size_t i = 0; i < ids->elements; i++)
+    {
+        redis_append(c, "HGETALL event:{%s}:%s", user, ids->element[i]->str);
+    }
+    for (size_t i = 0; i < ids->elements; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (ics_from_reply(reply, user, ids->element[i]->str, &ics))
+        {
+            ics_write_event(file, &ics);
+            written++;
+        }
+        freeReplyObject(reply);
+    }
+    return written;
+}
+
+// streams the calendar from redis into an .ics file in date order, returns the number of events or -1
+long export_ics(redisContext *c, const char *user, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    ics_write_begin(file);
+
+    // recurring events first, each one is a single rule record read through the rule index
+    ExportContext export = {user, file};
+    long exported = db_load_events(c, user, 1, export_rule, &export);
+    int failed = exported < 0;
+
+    // single events, one page of the date index at a time
+    for (long start = 0; !failed; start += ICS_BATCH_SIZE)
+    {
+        redisReply *ids = redis_command(c, "ZRANGE events_by_date:{%s} %ld %ld", user, start, start + ICS_BATCH_SIZE - 1);
+        if (ids == NULL || ids->type != REDIS_REPLY_ARRAY)
+        {
+            freeReplyObject(ids);
+            failed = 1;
+            break;
+        }
+
+        size_t page_size = ids->elements;
+        long written = export_page(c, user, ids, file);
+        freeReplyObject(ids);
+        if (written < 0)
+        {
+            failed = 1;
+            break;
+        }
+        exported += written;
+
+        if (page_size < ICS_BATCH_SIZE)
+        {
+            break;
+        }
+    }
+
+    ics_write_end(file);
+    if (fclose(file) != 0 || failed)
+    {
+        return -1;
+    }
+    return exported;
+}
+
+// asks for an .ics file and exports the calendar into it
+void export_events(redisContext *c, const char *user)
+{
+    char path[PATH_MAX];
+
+    if (get_ics_path(user, "Enter the name of the .ics file to write: ", path, sizeof(path)) != 0)
+    {
+        return;
+    }
+
+    long exported = export_ics(c, user, path);
+    if (exported < 0)
+    {
+        printf("%s\nError: Could not write '%s'.\n%s", RED_COLOR, path, RESET_COLOR);
+        return;
+    }
+    printf("%s\nExported %ld events to '%s'.\n%s", GREEN_COLOR, exported, path, RESET_COLOR);
+}
+
+// ARCHIVE --------------------
+// year * 12 + month - 1 of a YYYY-MM-DD date, -1 if it is invalid
+int month_index(const char *date)
+{
+    int year, month, day;
+    return parse_date(date, &year, &month, &day) ? year * 12 + month - 1 : -1;
+}
+
+// "YYYY-MM" field of an archived month in archive:{<user>}
+void archive_field(int month, char *field, size_t size)
+{
+    snprintf(field, size, "%04d-%02d", month / 12, month % 12 + 1);
+}
+
+ArchivedMonth *find_archived_month(int month)
+{
+    for (int i = 0; i < archived_month_count; i++)
+    {
+        if (archived_months[i].month == month)
+            return &archived_months[i];
+    }
+    return NULL;
+}
+
+// remembers that a month has archived events, returns -1 when out of memory
+int add_archived_month(int month)
+{
+    if (find_archived_month(month) != NULL)
+    {
+        return 0;
+    }
+    ArchivedMonth *months = realloc(archived_months, (archived_month_count + 1) * sizeof(ArchivedMonth));
+    if (months == NULL)
+    {
+        return -1;
+    }
+    archived_months = months;
+    archived_months[archived_month_count].month = month;
+    archived_months[archived_month_count++].loaded = 0;
+    return 0;
+}
+
+// reads which months of a calendar are archived, new events never take the id of an archived one
+void load_archive_index(redisContext *c, const char *user)
+{
+    archived_month_count = 0;
+    redis_append(c, "HKEYS archive:{%s}", user);
+    redis_append(c, "HGET archive:{%s} " ARCHIVE_MAX_ID_FIELD, user);
+
+    redisReply *fields = NULL, *max_id = NULL;
+    if (redis_get_reply(c, (void **)&fields) != REDIS_OK || redis_get_reply(c, (void **)&max_id) != REDIS_OK ||
+        fields == NULL || fields->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(fields);
+        freeReplyObject(max_id);
+        redis_failed(c);
+        return;
+    }
+
+    for (size_t i = 0; i < fields->elements; i++)
+    {
+        int year, month;
+        if (sscanf(fields->element[i]->str, "%d-%d", &year, &month) == 2 && month >= 1 && month <= 12)
+        {
+            add_archived_month(year * 12 + month - 1);
+        }
+    }
+    if (max_id != NULL && max_id->type == REDIS_REPLY_STRING && atoi(max_id->str) >= next_event_id)
+    {
+        next_event_id = atoi(max_id->str) + 1;
+    }
+    freeReplyObject(fields);
+    freeReplyObject(max_id);
+}
+
+// keeps an event fetched back from the archive, viewers only get what they may see
+int keep_archived_event(Event *event, void *context)
+{
+    int privilege_level = *(const int *)context;
+    if (event->visibility > privilege_level || find_event(event->id) != NULL || timeline.count + recurrence_count >= MAX_EVENTS)
+    {
+        return 0;
+    }
+
+    int *ids = realloc(archived_ids, (archived_id_count + 1) * sizeof(int));
+    if (ids == NULL)
+    {
+        return 0;
+    }
+    archived_ids = ids;
+    if (store_event(event) != 0)
+    {
+        return 0;
+    }
+    archived_ids[archived_id_count++] = event->id;
+    return 1;
+}
+
+// fetches the archived events of a month back when the month view reaches it, without redis the month stays empty
+void load_archived_month(redisContext *c, const char *user, int privilege_level, int month)
+{
+    ArchivedMonth *archived = find_archived_month(month);
+    if (archived == NULL || archived->loaded || !redis_available(c, user))
+    {
+        return;
+    }
+
+    char field[16], home[64];
+    archive_field(month, field, sizeof(field));
+    snprintf(home, sizeof(home), "{%s}", user);
+
+    // the blob of a month only changes when more of it is archived, a replica serves it as well
+    uint64_t start = stats_now();
+    redisContext *r = read_context(&reads, c, home);
+    redisReply *reply = redis_command(r, "HGET archive:{%s} %s", user, field);
+    if (reply == NULL && r != c)
+    {
+        reply = redis_command(c, "HGET archive:{%s} %s", user, field);
+    }
+    if (reply == NULL)
+    {
+        redis_failed(c);
+        return;
+    }
+
+    if (reply->type == REDIS_REPLY_STRING && archive_unpack((const unsigned char *)reply->str, reply->len, keep_archived_event, &privilege_level) < 0)
+    {
+        printf("%sWarning: the archive of %s is damaged, some of its events are missing.\n%s", ORANGE_COLOR, field, RESET_COLOR);
+    }
+    archived->loaded = 1;
+    freeReplyObject(reply);
+    stats_record_since("load.archive", start);
+}
+
+// drops the events fetched back from the archive, the snapshot only keeps the calendar that is not archived
+void forget_archived_events()
+{
+    for (int i = 0; i < archived_id_count; i++)
+    {
+        Event *event = unstore_event(archived_ids[i]);
+        if (event != NULL)
+            free_event(event);
+    }
+    archived_id_count = 0;
+    for (int i = 0; i < archived_month_count; i++)
+    {
+        archived_months[i].loaded = 0;
+    }
+}
+
+// queues the removal of an event that moved to the archive, the busy days and month counts keep counting it
+// the public feed entry is on a shared key and taken off after the transaction
+int append_event_archive(redisContext *c, const char *user, const Event *event)
+{
+    return db_delete_event(c, user, event->id, 0) + append_search_index(c, user, event, 0) + append_date_index(c, user, event, 0) +
+           append_change(c, user, event->id);
+}
+
+// events collected from an archive blob
+typedef struct
+{
+    Event **events;
+    int count;
+    int capacity;
+} EventList;
+
+int collect_event(Event *event, void *context)
+{
+    EventList *list = context;
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        Event **events = realloc(list->events, capacity * sizeof(Event *));
+        if (events == NULL)
+        {
+            return 0;
+        }
+        list->events = events;
+        list->capacity = capacity;
+    }
+    list->events[list->count++] = event;
+    return 1;
+}
+
+void free_event_list(EventList *list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        free_event(list->events[i]);
+    }
+    free(list->events);
+}
+
+// moves the listed events of one month from their hashes into the month's blob in one transaction
+// returns the number moved, -1 if redis failed and -2 if another session changed them meanwhile
+int archive_month(redisContext *c, const char *user, int month, const int *ids, int count, const char *cutoff)
+{
+    char field[16];
+    archive_field(month, field, sizeof(field));
+
+    // the events are archived as redis has them, a change to one of them before EXEC aborts the transaction
+    for (int i = 0; i < count; i++)
+    {
+        redis_append(c, "WATCH event:{%s}:%d", user, ids[i]);
+    }
+    redis_append(c, "WATCH archive:{%s}", user);
+    for (int i = 0; i < count; i++)
+    {
+        redis_append(c, "HGETALL event:{%s}:%d", user, ids[i]);
+    }
+    redis_append(c, "HMGET archive:{%s} %s " ARCHIVE_MAX_ID_FIELD, user, field);
+    if (drain_replies(c, count + 1) != 0)
+    {
+        return -1;
+    }
+
+    EventList moved = {0};
+    for (int i = 0; i < count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            free_event_list(&moved);
+            return -1;
+        }
+        // an event another session removed or moved to a later date stays where it is
+        DbEventFields fields;
+        Event *event = db_parse_event(reply, &fields) ? db_event_from_fields(&fields, ids[i]) : NULL;
+        if (event != NULL && (month_index(event->date) != month || strcmp(event->date, cutoff) >= 0 || !collect_event(event, &moved)))
+        {
+            free_event(event);
+        }
+        freeReplyObject(reply);
+    }
+
+    redisReply *archive = NULL;
+    if (redis_get_reply(c, (void **)&archive) != REDIS_OK || archive == NULL || archive->type != REDIS_REPLY_ARRAY || archive->elements != 2)
+    {
+        freeReplyObject(archive);
+        free_event_list(&moved);
+        return -1;
+    }
+
+    // the month's blob is rewritten with the events archived before plus the new ones
+    EventList kept = {0};
+    int result;
+    const redisReply *blob = archive->element[0];
+    int max_id = archive->element[1]->type == REDIS_REPLY_STRING ? atoi(archive->element[1]->str) : 0;
+    if (moved.count == 0 || (blob->type == REDIS_REPLY_STRING && archive_unpack((const unsigned char *)blob->str, blob->len, collect_event, &kept) < 0))
+    {
+        result = moved.count == 0 ? 0 : -1;
+        freeReplyObject(archive);
+        free_event_list(&kept);
+        free_event_list(&moved);
+        freeReplyObject(redis_command(c, "UNWATCH"));
+        return result;
+    }
+    freeReplyObject(archive);
+
+    // the moved events are shared with the kept list and only freed with their own
+    int shared = 0;
+    for (int i = 0; i < moved.count; i++)
+    {
+        if (moved.events[i]->id > max_id)
+            max_id = moved.events[i]->id;
+        if (collect_event(moved.events[i], &kept))
+            shared++;
+    }
+    size_t length = 0;
+    unsigned char *packed = shared == moved.count ? archive_pack(kept.events, kept.count, &length) : NULL;
+    if (packed == NULL)
+    {
+        kept.count -= shared;
+        free_event_list(&kept);
+        free_event_list(&moved);
+        freeReplyObject(redis_command(c, "UNWATCH"));
+        return -1;
+    }
+
+    redis_append(c, "MULTI");
+    redis_append(c, "HSET archive:{%s} %s %b " ARCHIVE_MAX_ID_FIELD " %d", user, field, packed, length, max_id);
+    int commands = 2;
+    for (int i = 0; i < moved.count; i++)
+    {
+        commands += append_event_archive(c, user, moved.events[i]);
+    }
+    redis_append(c, "EXEC");
+    free(packed);
+
+    // MULTI and the queued commands answer OK and QUEUED, EXEC the results or nil when a watched key changed
+    redisReply *exec = NULL;
+    if (drain_replies(c, commands) != 0 || redis_get_reply(c, (void **)&exec) != REDIS_OK || exec == NULL || exec->type == REDIS_REPLY_ERROR)
+    {
+        result = -1;
+    }
+    else if (exec->type != REDIS_REPLY_ARRAY)
+    {
+        result = -2;
+    }
+    else
+    {
+        // a feed entry left behind when this fails points at a removed hash, which the feed skips
+        int removed = 0;
+        for (int i = 0; i < moved.count; i++)
+        {
+            removed += append_public_index(c, user, moved.events[i], NULL, 0);
+            Event *event = unstore_event(moved.events[i]->id);
+            if (event != NULL)
+                free_event(event);
+        }
+        drain_replies(c, removed);
+        add_archived_month(month);
+        result = moved.count;
+    }
+    freeReplyObject(exec);
+
+    kept.count -= shared;
+    free_event_list(&kept);
+    free_event_list(&moved);
+    return result;
+}
+
+// moves the single events dated more than days ago into the archive a month at a time, returns the number moved or -1
+// recurring events stay, their rule covers the dates still to come
+long archive_events(redisContext *c, const char *user, int days, int *months)
+{
+    int year, month, day;
+    get_current_day_month_year(&day, &month, &year);
+    days_to_date(date_to_days(year, month, day) - days, &year, &month, &day);
+    char cutoff[MAX_DATE_LENGTH];
+    snprintf(cutoff, sizeof(cutoff), "%04d-%02d-%02d", year, month, day);
+
+    *months = 0;
+    int *ids = malloc((timeline.count + 1) * sizeof(int));
+    if (ids == NULL)
+    {
+        return -1;
+    }
+
+    // the timeline is in date order, so the events of a month come one after another
+    long archived = 0;
+    TimelineNode *node = timeline_first(&timeline);
+    while (node != NULL && strcmp(node->event->date, cutoff) < 0)
+    {
+        int current = month_index(node->event->date), count = 0;
+        for (; node != NULL && strcmp(node->event->date, cutoff) < 0 && month_index(node->event->date) == current; node = node->next[0])
+        {
+            ids[count++] = node->event->id;
+        }
+        if (current < 0)
+        {
+            continue;
+        }
+
+        int moved = -2;
+        for (int attempt = 0; attempt < ARCHIVE_RETRIES && moved == -2; attempt++)
+        {
+            moved = archive_month(c, user, current, ids, count, cutoff);
+        }
+        if (moved < 0)
+        {
+            free(ids);
+            return -1;
+        }
+        archived += moved;
+        *months += moved > 0;
+    }
+    free(ids);
+    return archived;
+}
+
+// SNAPSHOT --------------------
+// local snapshot file of one calendar view
+void snapshot_path(const char *user, int privilege_level, char *path, size_t size)
+{
+    const char *dir = getenv("CALENDAR_SNAPSHOT_DIR");
+    if (dir == NULL || dir[0] == '\0')
+    {
+        dir = SNAPSHOT_DIR;
+    }
+    mkdir(dir, 0700);
+    snprintf(path, size, "%s/%s.%d.snap", dir, user, privilege_level);
+}
+
+// empties the in-memory calendar
+void reset_events()
+{
+    free_events();
+    if (timeline_init(&timeline) != 0)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        exit(1);
+    }
+    next_event_id = 1;
+}
+
+// drops an event or rule from memory before its current state is applied
+void forget_event(int id)
+{
+    Event *event = unstore_event(id);
+    if (event != NULL)
+    {
+        free_event(event);
+        return;
+    }
+
+    Recurrence *recurrence = find_recurrence(id);
+    if (recurrence != NULL)
+    {
+        unlink_recurrence(recurrence);
+        free_recurrence(recurrence);
+    }
+}
+
+// local journal of the changes to a calendar that redis has not confirmed yet
+void journal_path(const char *user, char *path, size_t size)
+{
+    const char *dir = getenv("CALENDAR_SNAPSHOT_DIR");
+    if (dir == NULL || dir[0] == '\0')
+    {
+        dir = SNAPSHOT_DIR;
+    }
+    mkdir(dir, 0700);
+    snprintf(path, size, "%s/%s.journal", dir, user);
+}
+
+// applies a journaled change to the calendar in memory, the state in the record replaces the event
+int restore_change(const JournalEntry *entry, void *context)
+{
+    forget_event(entry->id);
+    if (entry->op != JOURNAL_REMOVE)
+    {
+        store_event_fields(&entry->fields, entry->id, entry->recurring, context);
+    }
+    return 0;
+}
+
+// opens the journal of a calendar and sends what an earlier outage left in it
+void open_journal(redisContext *c, const char *user)
+{
+    char path[PATH_MAX];
+    journal_path(user, path, sizeof(path));
+    if (journal_open(&journal, path) != 0)
+    {
+        printf("%sWarning: the local journal could not be opened, changes need Redis.\n%s", ORANGE_COLOR, RESET_COLOR);
+        return;
+    }
+
+    // before the load, so the calendar read from redis includes them
+    if (!breaker.open)
+    {
+        replay_journal(c, user);
+    }
+}
+
+// catches the snapshot up with the changes logged since it was taken, returns 0 if memory matches redis
+int apply_changes(redisContext *c, const char *user, int privilege_level)
+{
+    // one round trip: the current version and the ids changed after the snapshot
+    redis_append(c, "GET version:{%s}", user);
+    redis_append(c, "ZRANGEBYSCORE changes:{%s} (%lld +inf", user, (long long)snapshot_info.version);
+
+    redisReply *version_reply = NULL, *ids = NULL;
+    if (redis_get_reply(c, (void **)&version_reply) != REDIS_OK || redis_get_reply(c, (void **)&ids) != REDIS_OK ||
+        version_reply == NULL || ids == NULL || ids->type != REDIS_REPLY_ARRAY)
+    {
+        freeReplyObject(version_reply);
+        freeReplyObject(ids);
+        return -1;
+    }
+
+    long long version = version_reply->type == REDIS_REPLY_STRING ? atoll(version_reply->str) : 0;
+    freeReplyObject(version_reply);
+
+    // an older version means redis lost data since the snapshot, it cannot be patched
+    if (version < snapshot_info.version)
+    {
+        freeReplyObject(ids);
+        return -1;
+    }
+
+    // each changed id is either an event or a rule, missing hashes mean it was removed
+    for (size_t i = 0; i < ids->elements; i++)
+    {
+        redis_append(c, "HGETALL event:{%s}:%s", user, ids->element[i]->str);
+        redis_append(c, "HGETALL recurrence:{%s}:%s", user, ids->element[i]->str);
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < ids->elements; i++)
+    {
+        redisReply *event_reply = NULL, *rule_reply = NULL;
+        if (redis_get_reply(c, (void **)&event_reply) != REDIS_OK || redis_get_reply(c, (void **)&rule_reply) != REDIS_OK)
+        {
+            freeReplyObject(event_reply);
+            result = -1;
+            break;
+        }
+
+        int id = atoi(ids->element[i]->str);
+        forget_event(id);
+        if (!store_event_reply(event_reply, id, privilege_level, 0))
+        {
+            store_event_reply(rule_reply, id, privilege_level, 1);
+        }
+
+        freeReplyObject(event_reply);
+        freeReplyObject(rule_reply);
+    }
+    freeReplyObject(ids);
+
+    if (result == 0 && version != snapshot_info.version)
+    {
+        snapshot_info.version = version;
+        snapshot_dirty = 1;
+    }
+    return result;
+}
+
+// connection the calendar is loaded from, the owner only takes a replica that has every change of the calendar already
+redisContext *load_context(redisContext *c, const char *user, int privilege_level)
+{
+    char home[64];
+    snprintf(home, sizeof(home), "{%s}", user);
+    redisContext *r = read_context(&reads, c, home);
+    if (r == c || !privilege_level || !reads.consistent)
+    {
+        return r;
+    }
+
+    // both versions in one round trip, a lagging replica may miss what the last session of the owner wrote
+    redis_append(c, "GET version:{%s}", user);
+    redis_append(r, "GET version:{%s}", user);
+    redisReply *primary = NULL, *replica = NULL;
+    int primary_ok = redis_get_reply(c, (void **)&primary) == REDIS_OK;
+    int replica_ok = redis_get_reply(r, (void **)&replica) == REDIS_OK;
+    long long primary_version = primary_ok && primary != NULL && primary->type == REDIS_REPLY_STRING ? atoll(primary->str) : 0;
+    long long replica_version = replica_ok && replica != NULL && replica->type == REDIS_REPLY_STRING ? atoll(replica->str) : 0;
+    freeReplyObject(primary);
+    freeReplyObject(replica);
+    return primary_ok && replica_ok && replica_version >= primary_version ? r : c;
+}
+
+// reads the version and then every event, changes made during the load are fetched next time, returns -1 if redis failed
+int load_from_redis(redisContext *c, const char *user, int privilege_level)
+{
+    reset_events();
+    redisReply *reply = redis_command(c, "GET version:{%s}", user);
+    if (reply == NULL)
+    {
+        return -1;
+    }
+    snapshot_info.version = reply->type == REDIS_REPLY_STRING ? atoll(reply->str) : 0;
+    freeReplyObject(reply);
+
+    uint64_t load_start = stats_now();
+    int result = load_events_from_redis(c, user, privilege_level);
+    stats_record_since("load.redis", load_start);
+    return result;
+}
+
+// hands the public events just loaded to the other sessions of the host, the shared copy keeps the newest version
+void share_calendar(const char *user, int privilege_level)
+{
+    if (privilege_level || archived_id_count > 0)
+    {
+        return;
+    }
+    snapshot_info.index_version = search_index_ready ? INDEX_VERSION : 0;
+    snapshot_info.next_event_id = next_event_id;
+    pubcache_publish(user, &snapshot_info, &timeline, recurrences, recurrence_count);
+}
+
+// opens the calendar from the local snapshot plus the changes since, or from a full load
+void load_calendar(redisContext *c, const char *user, int privilege_level)
+{
+    char path[PATH_MAX];
+    snapshot_path(user, privilege_level, path, sizeof(path));
+
+    // a replica that fails or lags behind the snapshot leaves the load to the primary
+    uint64_t start = stats_now();
+    redisContext *r = breaker.open ? c : load_context(c, user, privilege_level);
+
+    // viewers take the public events from the copy every session of the host shares, then from their own snapshot
+    int shared = !privilege_level ? pubcache_load(user, &snapshot_info, &timeline, store_recurrence) : -1;
+    if (shared == -2)
+    {
+        reset_events();
+    }
+    if ((shared == 0 || snapshot_load(path, &snapshot_info, privilege_level, &timeline, store_recurrence) == 0) && index_timeline() == 0)
+    {
+        stats_record_since(shared == 0 ? "load.shared" : "load.snapshot", start);
+        next_event_id = snapshot_info.next_event_id;
+        if (!breaker.open && (apply_changes(r, user, privilege_level) == 0 || (r != c && apply_changes(c, user, privilege_level) == 0)))
+        {
+            if (snapshot_info.index_version == INDEX_VERSION)
+            {
+                search_index_ready = 1;
+            }
+            else
+            {
+                prepare_indexes(c, user, privilege_level);
+            }
+            load_archive_index(c, user);
+            share_calendar(user, privilege_level);
+            stats_record_since("load.calendar", start);
+            return;
+        }
+
+        redis_failed(c);
+        if (breaker.open)
+        {
+            // redis is down, the snapshot and the journal stand in for it until it is back
+            search_index_ready = snapshot_info.index_version == INDEX_VERSION;
+            if (journal_replay(&journal, restore_change, &privilege_level, 0) > 0)
+            {
+                snapshot_dirty = 1;
+            }
+            stats_record_since("load.calendar", start);
+            return;
+        }
+    }
+
+    if (breaker.open)
+    {
+        printf("%sError connecting to Redis: %s\n%s", RED_COLOR, c->errstr, RESET_COLOR);
+        exit(1);
+    }
+
+    if (load_from_redis(r, user, privilege_level) != 0 && (r == c || load_from_redis(c, user, privilege_level) != 0))
+    {
+        printf("%sError retrieving events from Redis: %s\n%s", RED_COLOR, db_last_error(), RESET_COLOR);
+        exit(1);
+    }
+    prepare_indexes(c, user, privilege_level);
+    load_archive_index(c, user);
+    snapshot_dirty = 1;
+    share_calendar(user, privilege_level);
+    stats_record_since("load.calendar", start);
+}
+
+// writes the snapshot for the next start, it is only a cache so failures are ignored
+void save_calendar(const char *user, int privilege_level)
+{
+    if (!snapshot_dirty)
+    {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snapshot_path(user, privilege_level, path, sizeof(path));
+
+    // own writes since the load are logged after snapshot_info.version and fetched again next time
+    forget_archived_events();
+    snapshot_info.index_version = search_index_ready ? INDEX_VERSION : 0;
+    snapshot_info.next_event_id = next_event_id;
+    snapshot_save(path, &snapshot_info, privilege_level, &timeline, recurrences, recurrence_count);
+}
+
+// BATCH --------------------
+// the owner of a calendar may change it
+int logged_in(const char *user, int privilege_level)
+{
+    return privilege_level && user != NULL && user[0] != '\0';
+}
+
+// one JSON line per command on stdout, commands come from the arguments or as tab separated lines on stdin
+
+// prints an event as a JSON object, date is the occurrence for recurring events
+void batch_print_event(const Event *event, const char *date)
+{
+    printf("{\"id\":%d,\"date\":\"%s\",\"visibility\":\"%s\",\"name\":", event->id, date, print_visibility(event->visibility));
+    print_json_string(stdout, event->name);
+    printf(",\"description\":");
+    print_json_string(stdout, event->description);
+    if (event_is_timed(event))
+    {
+        char start[MAX_TIME_LENGTH], end[MAX_TIME_LENGTH];
+        event_times(event, start, end);
+        printf(",\"start\":\"%s\",\"end\":\"%s\"", start, end);
+    }
+
+    Recurrence *recurrence = find_recurrence(event->id);
+    if (recurrence != NULL)
+    {
+        printf(",\"repeats\":\"%s\",\"interval\":%d,\"until\":\"%s\"", frequency_name(recurrence->frequency), recurrence->interval, recurrence->until);
+    }
+    printf("}");
+}
+
+// reads the replies of the queued writes and reports each one in order
+void batch_flush(redisContext *c)
+{
+    for (int i = 0; i < batch_write_count; i++)
+    {
+        batch_writes[i].failed = drain_replies(c, batch_writes[i].commands) != 0;
+    }
+
+    // without redis the writes are done once the journal is on disk, a single fsync covers all of them
+    redis_failed(c);
+    int offline = breaker.open;
+    int journal_failed = offline ? journal_sync(&journal) != 0 : 0;
+    if (!offline)
+    {
+        journal_discard(&journal);
+    }
+
+    for (int i = 0; i < batch_write_count; i++)
+    {
+        if (journal_failed || (!offline && batch_writes[i].failed))
+        {
+            printf("{\"ok\":false,\"id\":%d,\"error\":\"%s\"}\n", batch_writes[i].id, offline ? "journal write failed" : "redis write failed");
+            batch_failed++;
+        }
+        else if (offline)
+        {
+            printf("{\"ok\":true,\"id\":%d,\"journaled\":true}\n", batch_writes[i].id);
+        }
+        else
+        {
+            printf("{\"ok\":true,\"id\":%d}\n", batch_writes[i].id);
+        }
+    }
+    batch_write_count = 0;
+    fflush(stdout);
+}
+
+// prints an error result
+void batch_error(redisContext *c, const char *message)
+{
+    batch_flush(c);
+    printf("{\"ok\":false,\"error\":");
+    print_json_string(stdout, message);
+    printf("}\n");
+    batch_failed++;
+}
+
+// remembers a pipelined write, its result is printed when the replies are read
+void batch_queue(redisContext *c, int id, int commands)
+{
+    batch_writes[batch_write_count].id = id;
+    batch_writes[batch_write_count].commands = commands;
+    if (++batch_write_count == BATCH_PIPELINE_SIZE)
+    {
+        batch_flush(c);
+    }
+}
+
+// normalizes a YYYY-MM-DD date, returns 0 if it is invalid
+int batch_date(const char *input, char *date)
+{
+    int year, month, day;
+    if (!parse_date(input, &year, &month, &day))
+    {
+        return 0;
+    }
+    snprintf(date, MAX_DATE_LENGTH, "%04d-%02d-%02d", year, month, day);
+    return 1;
+}
+
+// add <date>[ HH:MM-HH:MM] <name> <description> [public|private] [daily|weekly|monthly|yearly] [interval] [until]
+void batch_add(redisContext *c, const char *user, int argc, char **argv)
+{
+    char date[MAX_DATE_LENGTH], until[MAX_DATE_LENGTH] = "";
+    int start = -1, end = -1;
+    if (argc < 4 || argc > 8)
+    {
+        batch_error(c, "usage: add <date>[ HH:MM-HH:MM] <name> <description> [public|private] [frequency] [interval] [until]");
+        return;
+    }
+    char *span = strchr(argv[1], ' ');
+    if (span != NULL)
+    {
+        *span++ = '\0';
+    }
+    if (!batch_date(argv[1], date) || (span != NULL && !parse_time_span(span, &start, &end)))
+    {
+        batch_error(c, "invalid date or time");
+        return;
+    }
+    if (argv[2][0] == '\0' || strlen(argv[2]) >= MAX_NAME_LENGTH || argv[3][0] == '\0' || strlen(argv[3]) >= MAX_DESC_LENGTH)
+    {
+        batch_error(c, "name or description empty or too long");
+        return;
+    }
+
+    int visibility = 1;
+    if (argc > 4 && strcmp(argv[4], "public") == 0)
+    {
+        visibility = 0;
+    }
+    else if (argc > 4 && strcmp(argv[4], "private") != 0)
+    {
+        batch_error(c, "visibility must be public or private");
+        return;
+    }
+
+    int frequency = argc > 5 ? parse_frequency(argv[5]) : 0;
+    int interval = argc > 6 ? atoi(argv[6]) : 1;
+    if ((argc > 5 && !frequency) || interval < 1 || interval > 99)
+    {
+        batch_error(c, "invalid frequency or interval");
+        return;
+    }
+    if (argc > 7 && (!batch_date(argv[7], until) || strcmp(until, date) < 0))
+    {
+        batch_error(c, "invalid last date");
+        return;
+    }
+
+    if (timeline.count + recurrence_count >= MAX_EVENTS)
+    {
+        batch_error(c, "event limit reached");
+        return;
+    }
+
+    Recurrence *recurrence;
+    Event *event = store_new_event(visibility, date, start, end, argv[2], argv[3], frequency, interval, until, &recurrence);
+    int commands = event == NULL ? -1 : queue_change(c, user, JOURNAL_ADD, event, recurrence, NULL);
+    if (commands < 0)
+    {
+        batch_error(c, "event could not be stored");
+        return;
+    }
+    batch_queue(c, event->id, commands);
+}
+
+// remove <id> [date], with a date only that occurrence of a recurring event is removed
+void batch_remove(redisContext *c, const char *user, int argc, char **argv)
+{
+    char date[MAX_DATE_LENGTH], occurrence[MAX_DATE_LENGTH];
+    if (argc < 2 || argc > 3)
+    {
+        batch_error(c, "usage: remove <id> [date]");
+        return;
+    }
+
+    int id = atoi(argv[1]);
+    Recurrence *recurrence = find_recurrence(id);
+    if (argc == 3)
+    {
+        if (recurrence == NULL || !batch_date(argv[2], date) || !recurrence_next(recurrence, date, occurrence) || strcmp(occurrence, date) != 0)
+        {
+            batch_error(c, "the event does not take place on that date");
+            return;
+        }
+        int commands = recurrence_add_exception(recurrence, date) == 0 ? queue_change(c, user, JOURNAL_SKIP, recurrence->event, recurrence, date) : -1;
+        if (commands < 0)
+        {
+            batch_error(c, "memory could not be allocated");
+            return;
+        }
+        batch_queue(c, id, commands);
+        return;
+    }
+
+    Event *event = unstore_event(id);
+    if (event != NULL)
+    {
+        batch_queue(c, id, queue_change(c, user, JOURNAL_REMOVE, event, NULL, NULL));
+        free_event(event);
+        return;
+    }
+    if (recurrence != NULL)
+    {
+        unlink_recurrence(recurrence);
+        batch_queue(c, id, queue_change(c, user, JOURNAL_REMOVE, recurrence->event, recurrence, NULL));
+        free_recurrence(recurrence);
+        return;
+    }
+    batch_error(c, "no event with that id");
+}
+
+// list-range <from> <to>, every occurrence between the two dates in event list order
+void batch_list_range(redisContext *c, int argc, char **argv)
+{
+    char from[MAX_DATE_LENGTH], to[MAX_DATE_LENGTH];
+    if (argc != 3 || !batch_date(argv[1], from) || !batch_date(argv[2], to) || strcmp(from, to) > 0)
+    {
+        batch_error(c, "usage: list-range <from> <to>");
+        return;
+    }
+
+    int count = 0;
+    AgendaItem item;
+    printf("{\"ok\":true,\"events\":[");
+    for (int found = agenda_next(from, INT_MIN, 0, &item); found && strcmp(item.date, to) <= 0;
+         found = agenda_next(item.date, item.event->id, 1, &item))
+    {
+        printf(count++ ? "," : "");
+        batch_print_event(item.event, item.date);
+    }
+    printf("],\"count\":%d}\n", count);
+}
+
+// month-mask <YYYY-MM>, bit d - 1 is set if day d has an event
+void batch_month_mask(redisContext *c, int argc, char **argv)
+{
+    int year, month;
+    char end;
+    if (argc != 2 || sscanf(argv[1], "%d-%d%c", &year, &month, &end) != 2 || year < 1 || year > 9999 || month < 1 || month > 12)
+    {
+        batch_error(c, "usage: month-mask <YYYY-MM>");
+        return;
+    }
+
+    int occupied[32];
+    month_occupancy(month, year, occupied, NULL);
+
+    unsigned long mask = 0;
+    for (int day = 1; day <= get_days_in_month(month, year); day++)
+    {
+        if (occupied[day])
+            mask |= 1UL << (day - 1);
+    }
+    printf("{\"ok\":true,\"month\":\"%04d-%02d\",\"mask\":%lu}\n", year, month, mask);
+}
+
+// at <date> <HH:MM>, the timed events going on at that minute
+// overlaps <date> <HH:MM-HH:MM>, the timed events that overlap the span
+void batch_overlaps(redisContext *c, int argc, char **argv)
+{
+    char date[MAX_DATE_LENGTH];
+    int start, end;
+    int at = strcmp(argv[0], "at") == 0;
+    if (argc != 3 || !batch_date(argv[1], date) ||
+        (at ? !parse_time(argv[2], &start) || start >= MINUTES_PER_DAY : !parse_time_span(argv[2], &start, &end)))
+    {
+        batch_error(c, at ? "usage: at <date> <HH:MM>" : "usage: overlaps <date> <HH:MM-HH:MM>");
+        return;
+    }
+    if (at)
+    {
+        end = start + 1;
+    }
+
+    Event *events[MAX_OVERLAPS];
+    int count = find_overlaps(date, start, end, events, MAX_OVERLAPS);
+
+    printf("{\"ok\":true,\"events\":[");
+    for (int i = 0; i < count && i < MAX_OVERLAPS; i++)
+    {
+        printf(i ? "," : "");
+        batch_print_event(events[i], date);
+    }
+    printf("],\"count\":%d}\n", count);
+}
+
+// free-days <from> <to> <user>..., the days on which none of the users has an event
+void batch_free_days(redisContext *c, int argc, char **argv)
+{
+    char from[MAX_DATE_LENGTH], to[MAX_DATE_LENGTH];
+    int year, month, day;
+    if (argc < 4 || argc - 3 > BUSY_MAX_USERS || !batch_date(argv[1], from) || !batch_date(argv[2], to) || strcmp(from, to) > 0)
+    {
+        batch_error(c, "usage: free-days <from> <to> <user>...");
+        return;
+    }
+
+    parse_date(from, &year, &month, &day);
+    long first = date_to_days(year, month, day);
+    parse_date(to, &year, &month, &day);
+    long last = date_to_days(year, month, day);
+
+    unsigned char free_days[BUSY_MAX_RANGE_DAYS];
+    if (last - first >= BUSY_MAX_RANGE_DAYS || busy_free_days(c, (const char **)argv + 3, argc - 3, first, last, free_days) != 0)
+    {
+        batch_error(c, "free day lookup failed");
+        return;
+    }
+
+    int count = 0;
+    printf("{\"ok\":true,\"days\":[");
+    for (long d = first; d <= last; d++)
+    {
+        if (free_days[d - first])
+        {
+            days_to_date(d, &year, &month, &day);
+            printf("%s\"%04d-%02d-%02d\"", count++ ? "," : "", year, month, day);
+        }
+    }
+    printf("],\"count\":%d}\n", count);
+}
+
+// search <text>
+void batch_search(redisContext *c, const char *user, int argc, char **argv)
+{
+    if (argc != 2 || argv[1][0] == '\0')
+    {
+        batch_error(c, "usage: search <text>");
+        return;
+    }
+
+    Event **results = NULL;
+    int matches = find_matches(c, user, argv[1], &results);
+    if (matches < 0)
+    {
+        batch_error(c, "search failed");
+        return;
+    }
+
+    printf("{\"ok\":true,\"events\":[");
+    for (int i = 0; i < matches; i++)
+    {
+        printf(i ? "," : "");
+        batch_print_event(results[i], results[i]->date);
+    }
+    printf("],\"count\":%d}\n", matches);
+    free(results);
 }
 
-// visibility print
-char *print_visibility(int vis)
+// archive [days], moves the single events older than days into the archive of their month
+void batch_archive(redisContext *c, const char *user, int argc, char **argv)
 {
-    if (vis)
+    int days = argc == 2 ? atoi(argv[1]) : ARCHIVE_DEFAULT_DAYS;
+    if (argc > 2 || days < 1)
     {
-        return "private";
+        batch_error(c, "usage: archive [days]");
+        return;
     }
-    else
+
+    int months;
+    uint64_t start = stats_now();
+    long archived = archive_events(c, user, days, &months);
+    if (archived < 0)
     {
-        return "public";
+        redis_failed(c);
+        batch_error(c, "archive failed");
+        return;
     }
+    stats_record_since("archive.run", start);
+    printf("{\"ok\":true,\"user\":");
+    print_json_string(stdout, user);
+    printf(",\"archived\":%ld,\"months\":%d}\n", archived, months);
 }
 
-// function to view all events
-void view_events()
+// runs one command, owner-only commands are refused for viewers
+void batch_command(redisContext *c, const char *user, int privilege_level, int argc, char **argv)
 {
-    if (event_count == 0)
+    const char *command = argv[0];
+    int write = strcmp(command, "add") == 0 || strcmp(command, "remove") == 0 || strcmp(command, "import") == 0 || strcmp(command, "export") == 0 ||
+                strcmp(command, "archive") == 0;
+    if (write && !logged_in(user, privilege_level))
     {
-        printf("-----------------------------\n");
-        printf("No events found.\n");
-        printf("-----------------------------\n");
+        batch_error(c, "you must be logged in to do this");
         return;
     }
 
-    // get the current date
-    int current_day, current_month, current_year;
-    get_current_day_month_year(&current_day, &current_month, &current_year);
+    if (strcmp(command, "add") == 0)
+    {
+        batch_add(c, user, argc, argv);
+        return;
+    }
+    if (strcmp(command, "remove") == 0)
+    {
+        batch_remove(c, user, argc, argv);
+        return;
+    }
 
-    // prepare a structure for current time comparison
-    struct tm current_time = {.tm_year = current_year - 1900, .tm_mon = current_month - 1, .tm_mday = current_day};
-    time_t now = mktime(&current_time);
+    // reads see every write before them and their output keeps the command order
+    batch_flush(c);
 
-    // arrays to hold past and future events
-    Event *past_events[MAX_EVENTS];
-    Event *future_events[MAX_EVENTS];
-    int past_count = 0, future_count = 0;
+    int online = strcmp(command, "free-days") == 0 || strcmp(command, "import") == 0 || strcmp(command, "export") == 0 || strcmp(command, "archive") == 0;
+    if (online && !redis_available(c, user))
+    {
+        batch_error(c, "redis is unavailable");
+        return;
+    }
 
-    // categorize events into past and future (including today)
-    for (int i = 0; i < event_count; i++)
+    if (strcmp(command, "list-range") == 0)
     {
-        int event_year, event_month, event_day;
-        sscanf(events[i]->date, "%d-%d-%d", &event_year, &event_month, &event_day);
+        batch_list_range(c, argc, argv);
+    }
+    else if (strcmp(command, "month-mask") == 0)
+    {
+        batch_month_mask(c, argc, argv);
+    }
+    else if (strcmp(command, "search") == 0)
+    {
+        batch_search(c, user, argc, argv);
+    }
+    else if (strcmp(command, "free-days") == 0)
+    {
+        batch_free_days(c, argc, argv);
+    }
+    else if (strcmp(command, "at") == 0 || strcmp(command, "overlaps") == 0)
+    {
+        batch_overlaps(c, argc, argv);
+    }
+    else if (strcmp(command, "import") == 0 && argc == 2)
+    {
+        ImportStats stats = {0};
+        if (import_ics(c, user, argv[1], &stats) != 0 || stats.write_errors)
+        {
+            batch_error(c, "import failed");
+            return;
+        }
+        printf("{\"ok\":true,\"imported\":%ld,\"duplicates\":%ld,\"skipped\":%ld,\"failed\":%ld}\n", stats.imported, stats.duplicates, stats.skipped, stats.failed);
+    }
+    else if (strcmp(command, "archive") == 0)
+    {
+        batch_archive(c, user, argc, argv);
+    }
+    else if (strcmp(command, "export") == 0 && argc == 2)
+    {
+        long exported = export_ics(c, user, argv[1]);
+        if (exported < 0)
+        {
+            batch_error(c, "export failed");
+            return;
+        }
+        printf("{\"ok\":true,\"exported\":%ld}\n", exported);
+    }
+    else
+    {
+        batch_error(c, "unknown command or wrong arguments");
+    }
+}
 
-        struct tm event_time = {.tm_year = event_year - 1900, .tm_mon = event_month - 1, .tm_mday = event_day};
-        time_t event_timestamp = mktime(&event_time);
+// reads the next command line from stdin, returns 1 for a line, 0 at the end and -1 for a line that is too long
+int batch_read_line(redisContext *c, char *line)
+{
+    static char buffer[BATCH_LINE_LENGTH];
+    static size_t start, end;
 
-        if (event_timestamp < now)
+    while (1)
+    {
+        char *newline = memchr(buffer + start, '\n', end - start);
+        if (newline != NULL)
         {
-            past_events[past_count++] = events[i];
+            size_t length = newline - (buffer + start);
+            memcpy(line, buffer + start, length);
+            line[length] = '\0';
+            start += length + 1;
+            return 1;
         }
-        else
+
+        memmove(buffer, buffer + start, end - start);
+        end -= start;
+        start = 0;
+        if (end == sizeof(buffer))
+        { // drop the line up to its end
+            end = 0;
+            while (1)
+            {
+                ssize_t got = read(STDIN_FILENO, buffer, sizeof(buffer));
+                if (got <= 0)
+                    return 0;
+                newline = memchr(buffer, '\n', got);
+                if (newline != NULL)
+                {
+                    start = newline - buffer + 1;
+                    end = got;
+                    return -1;
+                }
+            }
+        }
+
+        // the client waits for results before sending more, answer before blocking
+        struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&input, 1, 0) == 0)
         {
-            future_events[future_count++] = events[i];
+            batch_flush(c);
         }
+
+        ssize_t got = read(STDIN_FILENO, buffer + end, sizeof(buffer) - end);
+        if (got <= 0)
+        {
+            if (end == 0)
+                return 0;
+            memcpy(line, buffer, end); // last line without a newline
+            line[end] = '\0';
+            end = 0;
+            return 1;
+        }
+        end += got;
     }
+}
 
-    // sort events
-    qsort(past_events, past_count, sizeof(Event *), compare_events);
-    qsort(future_events, future_count, sizeof(Event *), compare_events);
+// runs the commands given as arguments, or the command stream on stdin for "-", returns the exit code
+int run_batch(redisContext *c, const char *user, int privilege_level, int argc, char **argv)
+{
+    if (strcmp(argv[0], "-") != 0)
+    {
+        batch_command(c, user, privilege_level, argc, argv);
+        batch_flush(c);
+        return batch_failed ? 1 : 0;
+    }
 
-    // display past events
-    printf("======== Past Events ========\n");
-    for (int i = 0; i < past_count; i++)
+    char line[BATCH_LINE_LENGTH + 1];
+    char *fields[BATCH_MAX_FIELDS];
+    int result;
+    while ((result = batch_read_line(c, line)) != 0)
     {
-        printf("ID: %d\nVisibility: %s\nDate: %s%s%s\nName: %s\nDescription: %s\n",
-               past_events[i]->id, print_visibility(past_events[i]->visibility), GRAY_COLOR, past_events[i]->date, RESET_COLOR, past_events[i]->name, past_events[i]->description);
-        printf("-----------------------------\n");
+        if (result < 0)
+        {
+            batch_flush(c);
+            batch_error(c, "line too long");
+            continue;
+        }
+
+        line[strcspn(line, "\r")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        int count = 0;
+        for (char *field = line; field != NULL && count < BATCH_MAX_FIELDS;)
+        {
+            fields[count++] = field;
+            field = strchr(field, '\t');
+            if (field)
+                *field++ = '\0';
+        }
+        batch_command(c, user, privilege_level, count, fields);
+    }
+
+    batch_flush(c);
+    return batch_failed ? 1 : 0;
+}
+
+// HEATMAP --------------------
+// month backgrounds by density, light to dark
+const char *heatmap_shades[HEATMAP_LEVELS + 1] = {"", "\033[30;48;5;153m", "\033[30;48;5;111m", "\033[97;48;5;69m", "\033[97;48;5;27m"};
+
+// events per month of years first_year.., the single ones from the month counters while they are current and from the loaded events otherwise
+// the occurrences of recurring events always come from the loaded rules
+void get_month_counts(redisContext *c, const char *user, int privilege_level, int first_year, int years, int (*counts)[13])
+{
+    if (search_index_ready && user != NULL && user[0] != '\0' && redis_available(c, user))
+    {
+        if (months_fetch(c, user, privilege_level, first_year, years, counts) == 0)
+        {
+            count_recurrences(first_year, years, counts);
+            return;
+        }
+        redis_failed(c);
+    }
+    count_months(first_year, years, counts);
+}
+
+// shade of a month relative to the busiest month shown
+int heatmap_level(int count, int max)
+{
+    if (count <= 0 || max <= 0)
+        return 0;
+    return (count * HEATMAP_LEVELS + max - 1) / max;
+}
+
+// events per month of the years around the viewed one, shaded by density
+void display_heatmap(redisContext *c, const char *user, int privilege_level)
+{
+    int first_year = view_year - HEATMAP_YEARS / 2;
+    int counts[HEATMAP_YEARS][13];
+    get_month_counts(c, user, privilege_level, first_year, HEATMAP_YEARS, counts);
+
+    int max = 0;
+    for (int year = 0; year < HEATMAP_YEARS; year++)
+    {
+        for (int month = 1; month <= 12; month++)
+        {
+            if (counts[year][month] > max)
+                max = counts[year][month];
+        }
     }
 
-    // display future events (including today)
-    printf("\n\n======= Future Events =======\n");
-    for (int i = 0; i < future_count; i++)
+    int current_day, current_month, current_year;
+    get_current_day_month_year(&current_day, &current_month, &current_year);
+
+    printf("Events per month " RED_COLOR "%d" RESET_COLOR " - " RED_COLOR "%d" RESET_COLOR ":\n\n", first_year, first_year + HEATMAP_YEARS - 1);
+    printf("     ");
+    const char *month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    for (int month = 1; month <= 12; month++)
     {
-        int event_year, event_month, event_day;
-        sscanf(future_events[i]->date, "%d-%d-%d", &event_year, &event_month, &event_day);
+        printf(" %4s", month_names[month - 1]);
+    }
+    printf("\n");
 
-        const char *color = (event_year == current_year && event_month == current_month && event_day == current_day)
-                                ? MAGENTA_COLOR
-                                : BLUE_COLOR;
+    for (int year = 0; year < HEATMAP_YEARS; year++)
+    {
+        int shown_year = first_year + year;
+        printf(shown_year == view_year ? BOLD "%4d " RESET_COLOR : "%4d ", shown_year);
+        for (int month = 1; month <= 12; month++)
+        {
+            int count = counts[year][month];
+            const char *current = shown_year == current_year && month == current_month ? RED_COLOR : "";
+            if (count == 0)
+            {
+                printf(" %s%s%4s" RESET_COLOR, GRAY_COLOR, current, "."); // marks empty months, the current one in red
+            }
+            else
+            {
+                printf(" %s%s%4d" RESET_COLOR, heatmap_shades[heatmap_level(count, max)], current, count);
+            }
+        }
+        printf("\n");
+    }
 
-        printf("ID: %d\nVisibility: %s\nDate: %s%s%s\nName: %s\nDescription: %s\n",
-               future_events[i]->id, print_visibility(future_events[i]->visibility), color, future_events[i]->date, RESET_COLOR, future_events[i]->name, future_events[i]->description);
-        printf("-----------------------------\n");
+    printf("\nfewer ");
+    for (int level = 1; level <= HEATMAP_LEVELS; level++)
+    {
+        printf("%s    " RESET_COLOR, heatmap_shades[level]);
     }
+    printf(" more events\n");
 }
 
 // MENU --------------------
-// Function to navigate between views
-void navigate()
+// moves the month view by a number of months
+void shift_month(int months)
+{
+    int index = view_year * 12 + view_month - 1 + months;
+    view_year = index / 12;
+    view_month = index % 12 + 1;
+}
+
+// applies one navigator key to the view
+void navigate_key(int key)
+{
+    if (view_mode == 0)
+    { // Month View Navigation
+        switch (key)
+        {
+        case 'n':
+        case KEY_RIGHT:
+            shift_month(1);
+            break;
+        case 'p':
+        case KEY_LEFT:
+            shift_month(-1);
+            break;
+        case KEY_DOWN:
+            view_year++;
+            break;
+        case KEY_UP:
+            view_year--;
+            break;
+        case 'y': // Switch to Year View
+            view_mode = 1;
+            break;
+        case 'h': // Switch to Heatmap
+            view_mode = 2;
+            break;
+        default:;
+        }
+    }
+    else
+    { // Year View and Heatmap Navigation
+        switch (key)
+        {
+        case 'n':
+        case KEY_RIGHT:
+        case KEY_DOWN:
+            view_year++;
+            break;
+        case 'p':
+        case KEY_LEFT:
+        case KEY_UP:
+            view_year--;
+            break;
+        case 'm': // Switch to Month View
+            view_mode = 0;
+            break;
+        case 'y': // Switch to Year View
+            view_mode = 1;
+            break;
+        case 'h': // Switch to Heatmap
+            view_mode = 2;
+            break;
+        default:;
+        }
+    }
+}
+
+// next navigator key, a single keystroke in raw mode and the first character of a line otherwise
+// with pending set only keys that were typed already are returned, KEY_NONE if there are none
+int navigator_key(int raw, int pending)
 {
+    if (raw)
+    {
+        return read_key(pending ? 0 : -1);
+    }
+    if (pending)
+    {
+        return KEY_NONE;
+    }
+
     char choice;
+    if (scanf(" %c", &choice) != 1)
+    {
+        return EOF;
+    }
+    empty_input_buffer();
+    return choice;
+}
+
+// Function to navigate between views
+void navigate(redisContext *c, const char *user, int privilege_level)
+{
+    int raw = raw_mode_enter() == 0;
 
     while (1)
     {
+        uint64_t start = stats_now();
         clear();
 
         if (view_mode == 0)
         { // Month View
+            load_archived_month(c, user, privilege_level, view_year * 12 + view_month - 1);
             display_day_view();
-            printf("\nUse 'n' for next month, 'p' for previous month, 'y' for year view, 'q' to quit navigator.\n");
+            printf("\nUse 'n'/right for next month, 'p'/left for previous month, up/down for the year, 'y' for year view, 'h' for heatmap, 't' for what is on at a time, 'q' to quit navigator.\n");
         }
         else if (view_mode == 1)
         { // Year View
-            display_month_view();
-            printf("\nUse 'n' for next year, 'p' for previous year, 'm' for month view, 'q' to quit navigator.\n");
+            int counts[1][13];
+            get_month_counts(c, user, privilege_level, view_year, 1, counts);
+            display_month_view(counts[0]);
+            printf("\nUse 'n'/right for next year, 'p'/left for previous year, 'm' for month view, 'h' for heatmap, 'q' to quit navigator.\n");
         }
+        else
+        { // Heatmap
+            display_heatmap(c, user, privilege_level);
+            printf("\nUse 'n'/right for next year, 'p'/left for previous year, 'm' for month view, 'y' for year view, 'q' to quit navigator.\n");
+        }
+        fflush(stdout);
+        stats_record_since("render.navigate", start);
 
-        scanf(" %c", &choice);
-        empty_input_buffer();
-
-        if (view_mode == 0)
-        { // Month View Navigation
-            switch (choice)
+        // a held key repeats faster than a frame is drawn, every key typed meanwhile is applied before the next one
+        int key = navigator_key(raw, 0), lookup = 0;
+        for (; key != KEY_NONE; key = navigator_key(raw, 1))
+        {
+            if (key == EOF || key == 'q' || key == 27 || key == 3) // ctrl-c quits as well in raw mode
             {
-            case 'n':
-                view_month++;
-                if (view_month > 12)
-                {
-                    view_month = 1;
-                    view_year++;
-                }
-                break;
-            case 'p':
-                view_month--;
-                if (view_month < 1)
-                {
-                    view_month = 12;
-                    view_year--;
-                }
-                break;
-            case 'y': // Switch to Year View
-                view_mode = 1;
-                break;
-            case 'q':
+                raw_mode_leave();
                 return;
-            default:;
             }
-        }
-        else if (view_mode == 1)
-        { // Year View Navigation
-            switch (choice)
+            if (view_mode == 0 && key == 't')
             {
-            case 'n':
-                view_year++;
-                break;
-            case 'p':
-                view_year--;
+                lookup = 1;
                 break;
-            case 'm': // Switch to Month View
-                view_mode = 0;
-                break;
-            case 'q':
-                return;
-            default:;
             }
+            navigate_key(key);
         }
-    }
-}
 
-int logged_in(const char *user, int privilege_level)
-{
-    return privilege_level && user != NULL && user[0] != '\0';
+        if (lookup)
+        { // What is on at a date and time, read as a line
+            raw_mode_leave();
+            happening_at();
+            raw = raw && raw_mode_enter() == 0;
+        }
+    }
 }
 
 // function to display the menu
-void show_menu(const char *user, int privilege_level)
+void show_menu(redisContext *c, const char *user, int privilege_level)
 {
-    if (!view_mode)
+    if (view_mode == 0)
     {
+        load_archived_month(c, user, privilege_level, view_year * 12 + view_month - 1);
         display_day_view();
     }
+    else if (view_mode == 1)
+    {
+        int counts[1][13];
+        get_month_counts(c, user, privilege_level, view_year, 1, counts);
+        display_month_view(counts[0]);
+    }
     else
     {
-        display_month_view();
+        display_heatmap(c, user, privilege_level);
     }
 
     printf("\n============================\n");
@@ -747,6 +3992,10 @@ void show_menu(const char *user, int privilege_level)
     {
         printf("%s\nViewing calendar of: %s%s%s\n", BOLD, GREEN_COLOR, user, RESET_COLOR);
     }
+    if (breaker.open)
+    {
+        printf("%sRedis is unavailable, changes are kept locally until it is back.%s\n", ORANGE_COLOR, RESET_COLOR);
+    }
 
     printf("\n----- %sEvent Management%s -----\n\n", BOLD, RESET_COLOR);
     if (logged_in(user, privilege_level))
@@ -760,12 +4009,23 @@ void show_menu(const char *user, int privilege_level)
         printf("%s2. %sRemove Event\n%s", RED_COLOR, GREY, RESET_COLOR);
     }
     printf("%s3.%s View Events\n", RED_COLOR, RESET_COLOR);
+    printf("%s4.%s Search Events\n", RED_COLOR, RESET_COLOR);
+    if (logged_in(user, privilege_level))
+    {
+        printf("%s5.%s Import Events (.ics)\n", RED_COLOR, RESET_COLOR);
+        printf("%s6.%s Export Events (.ics)\n", RED_COLOR, RESET_COLOR);
+    }
+    else
+    {
+        printf("%s5. %sImport Events (.ics)\n%s", RED_COLOR, GREY, RESET_COLOR);
+        printf("%s6. %sExport Events (.ics)\n%s", RED_COLOR, GREY, RESET_COLOR);
+    }
 
     printf("\n------ %sCalendar View%s -------\n\n", BOLD, RESET_COLOR);
-    printf("%s4.%s Reset View\n", RED_COLOR, RESET_COLOR);
-    printf("%s5.%s Navigate\n\n", RED_COLOR, RESET_COLOR);
+    printf("%s7.%s Reset View\n", RED_COLOR, RESET_COLOR);
+    printf("%s8.%s Navigate\n\n", RED_COLOR, RESET_COLOR);
 
-    printf("%s6.%s Exit\n", RED_COLOR, RESET_COLOR);
+    printf("%s9.%s Exit\n", RED_COLOR, RESET_COLOR);
 
     printf("\n============================\n");
     printf("Choose an option: ");
@@ -774,9 +4034,6 @@ void show_menu(const char *user, int privilege_level)
 // MAIN ----------
 int main(int argc, char *argv[])
 {
-    clear();
-    redisContext *c = connect_redis();
-
     if (argc < 3)
     {
         printf("No user or privilege level provided.\n");
@@ -785,9 +4042,57 @@ int main(int argc, char *argv[])
     char *user = argv[1];
     int privilege_level = atoi(argv[2]);
 
+    stats_init("calendar");
+    read_route_init(&reads);
+
+    // anything after the privilege level is a batch command, "-" reads commands from stdin
+    int batch = argc > 3;
+    if (!batch)
+    {
+        clear();
+    }
+    // without redis the calendar opens from its snapshot and keeps changes in the journal
+    // the connection goes to the node that holds the calendar, every key of it carries the user as hash tag
+    char home[64];
+    snprintf(home, sizeof(home), "{%s}", user);
+    redisContext *c = try_connect_redis(home);
+    if (c == NULL)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        return 1;
+    }
+    if (c->err)
+    {
+        breaker_failure(&breaker);
+    }
+
+    if (timeline_init(&timeline) != 0)
+    {
+        printf("%sError: Memory could not be allocated.\n%s", RED_COLOR, RESET_COLOR);
+        return 1;
+    }
+    interval_init(&intervals);
+
     if (user != NULL && user[0] != '\0')
     {
-        load_events_from_redis(c, user, privilege_level);
+        open_journal(c, user);
+        load_calendar(c, user, privilege_level);
+    }
+
+    if (batch)
+    {
+        int status = run_batch(c, user, privilege_level, argc - 3, argv + 3);
+        if (user[0] != '\0')
+        {
+            save_calendar(user, privilege_level);
+        }
+        free_events();
+        journal_close(&journal);
+        read_route_sync(&reads, c, home);
+        read_route_close(&reads);
+        redisFree(c);
+        stats_shutdown();
+        return status;
     }
 
     char choice;
@@ -795,8 +4100,20 @@ int main(int argc, char *argv[])
 
     do
     {
-        show_menu(user, privilege_level);
-        choice = getchar();
+        // a due reconnect attempt, the journal is sent as soon as redis answers again
+        if (breaker.open)
+        {
+            redis_available(c, user);
+        }
+
+        uint64_t start = stats_now();
+        show_menu(c, user, privilege_level);
+        fflush(stdout);
+        stats_record_since("render.menu", start);
+
+        // closed input leaves like Exit
+        int key = getchar();
+        choice = key == EOF ? '9' : (char)key;
         empty_input_buffer();
 
         switch (choice)
@@ -828,20 +4145,71 @@ int main(int argc, char *argv[])
         case '3':
             clear();
             view_events();
-            press_enter_to_continue();
             break;
         case '4':
-            initialize_view();
+            clear();
+            search_events(c, user);
+            press_enter_to_continue();
             break;
         case '5':
-            navigate();
+            clear();
+            if (logged_in(user, privilege_level) && !redis_available(c, user))
+            {
+                printf("%sRedis is unavailable, try again later.%s\n", RED_COLOR, RESET_COLOR);
+            }
+            else if (logged_in(user, privilege_level))
+            {
+                import_events(c, user);
+            }
+            else
+            {
+                printf("%sYou must be logged in to do this!%s\n", RED_COLOR, RESET_COLOR);
+            }
+            press_enter_to_continue();
+            break;
+        case '6':
+            clear();
+            if (logged_in(user, privilege_level) && !redis_available(c, user))
+            {
+                printf("%sRedis is unavailable, try again later.%s\n", RED_COLOR, RESET_COLOR);
+            }
+            else if (logged_in(user, privilege_level))
+            {
+                export_events(c, user);
+            }
+            else
+            {
+                printf("%sYou must be logged in to do this!%s\n", RED_COLOR, RESET_COLOR);
+            }
+            press_enter_to_continue();
+            break;
+        case '7':
+            initialize_view();
+            break;
+        case '8':
+            navigate(c, user, privilege_level);
+            break;
+        case 's': // hidden: latency statistics of this session
+            clear();
+            stats_print();
+            press_enter_to_continue();
             break;
         default:;
         }
         clear();
-    } while (choice != '6');
+    } while (choice != '9');
 
+    if (user != NULL && user[0] != '\0')
+    {
+        save_calendar(user, privilege_level);
+    }
     free_events();
+    journal_close(&journal);
+
+    // the next session may read from a replica, it should see what this one wrote
+    read_route_sync(&reads, c, home);
+    read_route_close(&reads);
     redisFree(c);
+    stats_shutdown();
     return 0;
 }
@@ -0,0 +1,691 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pty.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include "common.h"
+#include "stats.h"
+
+// load generator parameter
+#define LG_BUFFER_SIZE 65536
+#define LG_KEEP_ON_OVERFLOW 1024 // tail of the output kept when no prompt shows up in a full buffer
+#define LG_TIMEOUT_MS 30000      // a prompt that takes longer counts as an error
+#define LG_PASSWORD "load-test-password"
+#define LG_MAX_SESSIONS 4096
+
+// the scripted actions, an action runs from the main menu back to the main menu
+enum
+{
+    ACTION_REGISTER,
+    ACTION_LOGIN,
+    ACTION_BROWSE,
+    ACTION_EVENT,
+    ACTION_COUNT
+};
+const char *action_names[ACTION_COUNT] = {"register", "login", "browse", "event"};
+
+// one terminal session with the auth front end, over a local pty or a socat listener
+typedef struct
+{
+    int fd;
+    SSL *ssl;
+    pid_t pid; // the auth process of a pty session
+    char buffer[LG_BUFFER_SIZE + 1];
+    size_t length;
+    char before[LG_BUFFER_SIZE + 1]; // output in front of the last matched prompt
+} Connection;
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    unsigned int seed;
+    int counter;
+    char username[32];
+    Connection connection;
+} Session;
+
+// options
+int session_count = 10;
+int ramp_seconds = 10;
+int duration_seconds = 60;
+int think_ms = 1000;
+int report_seconds = 5;
+int mix[ACTION_COUNT] = {1, 3, 4, 2};
+char *auth_path = "./auth";
+char *target_host;
+char *target_port;
+SSL_CTX *tls_context;
+
+// shared results, the interval histograms are reset after every report
+Histogram total_latency[ACTION_COUNT], interval_latency[ACTION_COUNT];
+long total_errors[ACTION_COUNT], interval_errors[ACTION_COUNT];
+pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int active_sessions;
+volatile int stopping;
+
+// usernames registered by the sessions, browse picks one of them
+char registered_users[LG_MAX_SESSIONS][32];
+int registered_count;
+pthread_mutex_t users_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// CONNECTION --------------------
+int open_connection(Connection *conn)
+{
+    memset(conn, 0, sizeof(Connection));
+    conn->fd = -1;
+
+    if (target_host == NULL)
+    {
+        int master;
+        pid_t pid = forkpty(&master, NULL, NULL, NULL);
+        if (pid < 0)
+        {
+            return -1;
+        }
+        if (pid == 0)
+        {
+            execl(auth_path, auth_path, (char *)NULL);
+            _exit(127);
+        }
+        conn->fd = master;
+        conn->pid = pid;
+        return 0;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *addresses;
+    if (getaddrinfo(target_host, target_port, &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+    for (struct addrinfo *a = addresses; a != NULL && conn->fd < 0; a = a->ai_next)
+    {
+        conn->fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (conn->fd >= 0 && connect(conn->fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (conn->fd < 0)
+    {
+        return -1;
+    }
+
+    if (tls_context != NULL)
+    {
+        conn->ssl = SSL_new(tls_context);
+        if (conn->ssl == NULL || SSL_set_fd(conn->ssl, conn->fd) != 1 || SSL_connect(conn->ssl) != 1)
+        {
+            SSL_free(conn->ssl);
+            close(conn->fd);
+            conn->ssl = NULL;
+            conn->fd = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void close_connection(Connection *conn)
+{
+    if (conn->ssl != NULL)
+    {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    if (conn->fd >= 0)
+    {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    if (conn->pid > 0)
+    { // closing the pty hangs up the session, give it a moment before killing it
+        for (int i = 0; i < 50 && waitpid(conn->pid, NULL, WNOHANG) == 0; i++)
+        {
+            usleep(10000);
+        }
+        if (waitpid(conn->pid, NULL, WNOHANG) == 0)
+        {
+            kill(conn->pid, SIGKILL);
+            waitpid(conn->pid, NULL, 0);
+        }
+        conn->pid = 0;
+    }
+}
+
+int send_text(Connection *conn, const char *text)
+{
+    size_t length = strlen(text), sent = 0;
+    while (sent < length)
+    {
+        ssize_t n = conn->ssl ? SSL_write(conn->ssl, text + sent, length - sent) : write(conn->fd, text + sent, length - sent);
+        if (n <= 0)
+        {
+            if (n < 0 && !conn->ssl && errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+// sends one line of input
+int send_line(Connection *conn, const char *line)
+{
+    char text[128];
+    snprintf(text, sizeof(text), "%s\n", line);
+    return send_text(conn, text);
+}
+
+// reads output until one of the prompts appears, returns its index or -1 on timeout or hang up
+int expect_any(Connection *conn, const char **prompts, int count)
+{
+    uint64_t deadline = stats_now() + LG_TIMEOUT_MS * 1000000ULL;
+
+    while (1)
+    {
+        conn->buffer[conn->length] = '\0';
+        for (int i = 0; i < count; i++)
+        {
+            char *match = strstr(conn->buffer, prompts[i]);
+            if (match != NULL)
+            {
+                size_t before = match - conn->buffer, end = before + strlen(prompts[i]);
+                memcpy(conn->before, conn->buffer, before);
+                conn->before[before] = '\0';
+                memmove(conn->buffer, conn->buffer + end, conn->length - end);
+                conn->length -= end;
+                return i;
+            }
+        }
+
+        if (conn->length == LG_BUFFER_SIZE)
+        {
+            memmove(conn->buffer, conn->buffer + LG_BUFFER_SIZE - LG_KEEP_ON_OVERFLOW, LG_KEEP_ON_OVERFLOW);
+            conn->length = LG_KEEP_ON_OVERFLOW;
+        }
+
+        uint64_t now = stats_now();
+        if (now >= deadline)
+        {
+            return -1;
+        }
+        if (conn->ssl == NULL || SSL_pending(conn->ssl) == 0)
+        {
+            struct pollfd input = {conn->fd, POLLIN, 0};
+            int ready = poll(&input, 1, (int)((deadline - now) / 1000000) + 1);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                return -1;
+        }
+
+        ssize_t n = conn->ssl ? SSL_read(conn->ssl, conn->buffer + conn->length, LG_BUFFER_SIZE - conn->length)
+                              : read(conn->fd, conn->buffer + conn->length, LG_BUFFER_SIZE - conn->length);
+        if (n <= 0)
+        {
+            if (n < 0 && !conn->ssl && errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // screen output never contains NUL, drop any so the text search keeps working
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (conn->buffer[conn->length + i] == '\0')
+                conn->buffer[conn->length + i] = ' ';
+        }
+        conn->length += n;
+    }
+}
+
+int expect(Connection *conn, const char *prompt)
+{
+    return expect_any(conn, &prompt, 1) == 0 ? 0 : -1;
+}
+
+// answers a prompt and waits for the next one
+int step(Connection *conn, const char *line, const char *prompt)
+{
+    return send_line(conn, line) == 0 ? expect(conn, prompt) : -1;
+}
+
+// SCRIPTS --------------------
+// every script starts and ends at the main menu of auth, returns 0 if the session did what was expected
+#define MAIN_MENU "Enter your choice: "
+#define CALENDAR_MENU "Choose an option: "
+#define CONTINUE "Press Enter to continue..."
+
+int register_user_as(Connection *conn, const char *username)
+{
+    if (step(conn, "1", "Enter username: ") || step(conn, username, "Enter password: ") || step(conn, LG_PASSWORD, CONTINUE))
+        return -1;
+    int ok = strstr(conn->before, "registered successfully") != NULL;
+    if (step(conn, "", MAIN_MENU))
+        return -1;
+    return ok ? 0 : -1;
+}
+
+int login(Connection *conn, const char *username)
+{
+    if (step(conn, "2", "Enter username: ") || step(conn, username, "Enter password: ") || step(conn, LG_PASSWORD, CONTINUE))
+        return -1;
+    int ok = strstr(conn->before, "successfully logged in") != NULL;
+    if (step(conn, "", MAIN_MENU))
+        return -1;
+    return ok ? 0 : -1;
+}
+
+// a throwaway account, this is where argon2 memory adds up
+int run_register(Session *s)
+{
+    char username[32];
+    snprintf(username, sizeof(username), "lg%d_%d_%d", (int)getpid(), s->id, ++s->counter);
+    return register_user_as(&s->connection, username);
+}
+
+int run_login(Session *s)
+{
+    return login(&s->connection, s->username);
+}
+
+// opens the calendar of a registered user from the user list and pages the event list
+int run_browse(Session *s)
+{
+    Connection *conn = &s->connection;
+    char username[32];
+
+    pthread_mutex_lock(&users_lock);
+    snprintf(username, sizeof(username), "%s", registered_count ? registered_users[rand_r(&s->seed) % registered_count] : s->username);
+    pthread_mutex_unlock(&users_lock);
+
+    if (step(conn, "4", "Your choice: ") || step(conn, username, CALENDAR_MENU))
+        return -1;
+
+    const char *list_prompts[] = {"quit the event list.", CONTINUE};
+    if (send_line(conn, "3") != 0)
+        return -1;
+    int prompt = expect_any(conn, list_prompts, 2);
+    if (prompt < 0)
+        return -1;
+    if (prompt == 0 && step(conn, "n", "quit the event list."))
+        return -1;
+    if (step(conn, prompt == 0 ? "q" : "", CALENDAR_MENU))
+        return -1;
+    return step(conn, "9", MAIN_MENU);
+}
+
+// adds an event to the own calendar, finds it by its unique name and removes it again
+int run_event(Session *s)
+{
+    Connection *conn = &s->connection;
+    char date[16], name[32];
+
+    time_t when = time(NULL) + (rand_r(&s->seed) % 60) * 86400;
+    struct tm tm_info;
+    localtime_r(&when, &tm_info);
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm_info);
+    snprintf(name, sizeof(name), "lg%dx%d", s->id, ++s->counter);
+
+    if (step(conn, "3", CALENDAR_MENU) || step(conn, "1", "(y/n): ") || step(conn, "y", "(YYYY-MM-DD): ") ||
+        step(conn, date, "(y)early: ") || step(conn, "n", "Enter the event name") ||
+        step(conn, name, "Enter the event description") || step(conn, "load test event", CONTINUE))
+        return -1;
+    int ok = strstr(conn->before, "Event added successfully") != NULL;
+
+    if (step(conn, "", CALENDAR_MENU) || step(conn, "4", "search for: ") || step(conn, name, CONTINUE))
+        return -1;
+    char *found = strstr(conn->before, "ID: ");
+    char id[16] = "";
+    if (found != NULL)
+    {
+        snprintf(id, sizeof(id), "%d", atoi(found + 4));
+    }
+
+    if (step(conn, "", CALENDAR_MENU))
+        return -1;
+    if (id[0])
+    {
+        if (step(conn, "2", "event to remove: ") || step(conn, id, CONTINUE))
+            return -1;
+        ok = ok && strstr(conn->before, "removed successfully") != NULL;
+        if (step(conn, "", CALENDAR_MENU))
+            return -1;
+    }
+    if (step(conn, "9", MAIN_MENU))
+        return -1;
+    return ok && id[0] ? 0 : -1;
+}
+
+int (*scripts[ACTION_COUNT])(Session *) = {run_register, run_login, run_browse, run_event};
+
+// SESSIONS --------------------
+void record_result(int action, uint64_t nanoseconds, int ok)
+{
+    pthread_mutex_lock(&results_lock);
+    if (ok)
+    {
+        stats_record(&total_latency[action], nanoseconds);
+        stats_record(&interval_latency[action], nanoseconds);
+    }
+    else
+    {
+        total_errors[action]++;
+        interval_errors[action]++;
+    }
+    pthread_mutex_unlock(&results_lock);
+}
+
+int pick_action(Session *s)
+{
+    int total = 0;
+    for (int i = 0; i < ACTION_COUNT; i++)
+        total += mix[i];
+
+    int r = rand_r(&s->seed) % total;
+    for (int i = 0; i < ACTION_COUNT; i++)
+    {
+        if (r < mix[i])
+            return i;
+        r -= mix[i];
+    }
+    return ACTION_LOGIN;
+}
+
+// sleeps in small steps so the run can stop during think time
+void think(Session *s)
+{
+    int ms = think_ms > 0 ? rand_r(&s->seed) % (2 * think_ms + 1) : 0; // mean think_ms
+    for (; ms > 0 && !stopping; ms -= 100)
+    {
+        usleep((ms < 100 ? ms : 100) * 1000);
+    }
+}
+
+// connects, registers the session user and logs in, retried after errors
+int start_session(Session *s)
+{
+    if (open_connection(&s->connection) != 0 || expect(&s->connection, MAIN_MENU) != 0)
+    {
+        close_connection(&s->connection);
+        return -1;
+    }
+
+    uint64_t start = stats_now();
+    int ok;
+    if (!s->username[0])
+    { // a fresh name on every attempt, a timed out registration may still have gone through
+        char username[32];
+        snprintf(username, sizeof(username), "lg%d_%d_%d", (int)getpid(), s->id, ++s->counter);
+        ok = register_user_as(&s->connection, username) == 0;
+        record_result(ACTION_REGISTER, stats_now() - start, ok);
+        if (!ok)
+        {
+            close_connection(&s->connection);
+            return -1;
+        }
+
+        snprintf(s->username, sizeof(s->username), "%s", username);
+        pthread_mutex_lock(&users_lock);
+        snprintf(registered_users[registered_count++], sizeof(registered_users[0]), "%s", username);
+        pthread_mutex_unlock(&users_lock);
+    }
+
+    start = stats_now();
+    ok = login(&s->connection, s->username) == 0;
+    record_result(ACTION_LOGIN, stats_now() - start, ok);
+    if (!ok)
+    {
+        close_connection(&s->connection);
+        return -1;
+    }
+    return 0;
+}
+
+void *session_thread(void *arg)
+{
+    Session *s = arg;
+
+    // sessions start evenly spread over the ramp
+    for (long delay = (long)ramp_seconds * 1000 * s->id / session_count; delay > 0 && !stopping; delay -= 100)
+    {
+        usleep((delay < 100 ? delay : 100) * 1000);
+    }
+
+    int connected = 0;
+    while (!stopping)
+    {
+        if (!connected)
+        {
+            connected = start_session(s) == 0;
+            if (!connected)
+            {
+                sleep(1);
+                continue;
+            }
+            __atomic_fetch_add(&active_sessions, 1, __ATOMIC_RELAXED);
+        }
+
+        int action = pick_action(s);
+        uint64_t start = stats_now();
+        int ok = scripts[action](s) == 0;
+        record_result(action, stats_now() - start, ok);
+
+        if (!ok)
+        { // the screen state is unknown, start over on a new session
+            close_connection(&s->connection);
+            __atomic_fetch_sub(&active_sessions, 1, __ATOMIC_RELAXED);
+            connected = 0;
+            continue;
+        }
+        think(s);
+    }
+
+    if (connected)
+    {
+        send_line(&s->connection, "8");
+        close_connection(&s->connection);
+        __atomic_fetch_sub(&active_sessions, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// REPORT --------------------
+// one JSON line, per action: successful count, errors and latency percentiles in milliseconds
+void report(FILE *file, const char *kind, double elapsed, double seconds, Histogram *latency, long *errors)
+{
+    long ops = 0, failed = 0;
+    for (int i = 0; i < ACTION_COUNT; i++)
+    {
+        ops += latency[i].count;
+        failed += errors[i];
+    }
+
+    fprintf(file, "{\"report\":\"%s\",\"elapsed_s\":%.1f,\"sessions\":%d,\"ops\":%ld,\"ops_per_s\":%.2f,\"errors\":%ld",
+            kind, elapsed, __atomic_load_n(&active_sessions, __ATOMIC_RELAXED), ops, seconds > 0 ? ops / seconds : 0.0, failed);
+    for (int i = 0; i < ACTION_COUNT; i++)
+    {
+        fprintf(file, ",\"%s\":{\"count\":%llu,\"errors\":%ld,\"p50_ms\":%.1f,\"p90_ms\":%.1f,\"p99_ms\":%.1f,\"max_ms\":%.1f}",
+                action_names[i], (unsigned long long)latency[i].count, errors[i], stats_percentile(&latency[i], 50) / 1e6,
+                stats_percentile(&latency[i], 90) / 1e6, stats_percentile(&latency[i], 99) / 1e6, latency[i].max / 1e6);
+    }
+    fprintf(file, "}\n");
+    fflush(file);
+}
+
+// MAIN --------------------
+// parses "register:1,login:3,browse:4,event:2"
+int parse_mix(char *text)
+{
+    int parsed[ACTION_COUNT] = {0}, total = 0;
+    for (char *part = strtok(text, ","); part; part = strtok(NULL, ","))
+    {
+        char *colon = strchr(part, ':');
+        if (colon == NULL)
+            return -1;
+        *colon = '\0';
+
+        int i = 0;
+        while (i < ACTION_COUNT && strcmp(part, action_names[i]) != 0)
+            i++;
+        if (i == ACTION_COUNT || atoi(colon + 1) < 0)
+            return -1;
+        parsed[i] = atoi(colon + 1);
+        total += parsed[i];
+    }
+    if (total == 0)
+        return -1;
+    memcpy(mix, parsed, sizeof(mix));
+    return 0;
+}
+
+// "pty", "tcp:<host>:<port>" or "tls:<host>:<port>"
+int parse_target(char *text)
+{
+    if (strcmp(text, "pty") == 0)
+        return 0;
+
+    int tls = strncmp(text, "tls:", 4) == 0;
+    if (!tls && strncmp(text, "tcp:", 4) != 0)
+        return -1;
+    target_host = text + 4;
+    target_port = strrchr(target_host, ':');
+    if (target_port == NULL)
+        return -1;
+    *target_port++ = '\0';
+
+    if (tls)
+    { // the listener in connection.txt uses a self-signed certificate and verify=0
+        tls_context = SSL_CTX_new(TLS_client_method());
+        if (tls_context == NULL)
+            return -1;
+        SSL_CTX_set_verify(tls_context, SSL_VERIFY_NONE, NULL);
+    }
+    return 0;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-n sessions] [-r ramp s] [-d duration s] [-t think ms] [-i report interval s]\n"
+                    "          [-m register:1,login:3,browse:4,event:2] [-c pty|tcp:host:port|tls:host:port] [-x auth path]\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:d:t:i:m:c:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            session_count = atoi(optarg);
+            break;
+        case 'r':
+            ramp_seconds = atoi(optarg);
+            break;
+        case 'd':
+            duration_seconds = atoi(optarg);
+            break;
+        case 't':
+            think_ms = atoi(optarg);
+            break;
+        case 'i':
+            report_seconds = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (parse_target(optarg) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'x':
+            auth_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (session_count < 1 || session_count > LG_MAX_SESSIONS || ramp_seconds < 0 || duration_seconds < 1 || think_ms < 0 || report_seconds < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    Session *sessions = calloc(session_count, sizeof(Session));
+    if (sessions == NULL)
+    {
+        fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+        return 1;
+    }
+
+    uint64_t start = stats_now();
+    for (int i = 0; i < session_count; i++)
+    {
+        sessions[i].id = i;
+        sessions[i].seed = (unsigned int)(start + i);
+        if (pthread_create(&sessions[i].thread, NULL, session_thread, &sessions[i]) != 0)
+        {
+            fprintf(stderr, "%sError: Could not start session %d.%s\n", RED_COLOR, i, RESET_COLOR);
+            session_count = i;
+            break;
+        }
+    }
+
+    // one report per interval while the load ramps up and holds
+    uint64_t last = start;
+    while (!stopping)
+    {
+        sleep(report_seconds);
+        uint64_t now = stats_now();
+        stopping = now - start >= (uint64_t)duration_seconds * 1000000000ULL;
+
+        pthread_mutex_lock(&results_lock);
+        report(stdout, "interval", (now - start) / 1e9, (now - last) / 1e9, interval_latency, interval_errors);
+        memset(interval_latency, 0, sizeof(interval_latency));
+        memset(interval_errors, 0, sizeof(interval_errors));
+        pthread_mutex_unlock(&results_lock);
+        last = now;
+    }
+
+    for (int i = 0; i < session_count; i++)
+    {
+        pthread_join(sessions[i].thread, NULL);
+    }
+
+    double elapsed = (stats_now() - start) / 1e9;
+    report(stdout, "total", elapsed, elapsed, total_latency, total_errors);
+
+    free(sessions);
+    if (tls_context != NULL)
+    {
+        SSL_CTX_free(tls_context);
+    }
+    return 0;
+}
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <hiredis/hiredis.h>
+#include "common.h"
+#include "db.h"
+#include "shard.h"
+
+// migration parameter
+#define MIGRATE_BATCH 500         // keys per SCAN and pipeline
+#define MIGRATE_TIMEOUT_MS 5000   // per key moved to another node
+#define MIGRATE_MAX_KEY_LENGTH 512
+#define MIGRATE_RETRIES 5         // times a batch is read again after a calendar wrote to one of its events
+
+// key types that belong to one user, "<type>:<user>..." before the keys carried the user as hash tag
+const char *user_key_types[] = {"user", "event", "recurrence", "events_by_date", "trigram", "version", "changes",
+                                "index_version", "busy", "busy_days", "month_counts", "ics_uid"};
+
+// a node keys are read from, the configured ones and the ones being retired
+typedef struct
+{
+    char host[64];
+    int port;
+    int node; // index in REDIS_NODES, -1 for a retired node
+    redisContext *c;
+} Source;
+
+typedef struct
+{
+    long scanned;
+    long renamed;
+    long moved;
+    long encoded;
+    long conflicts;
+    long failed;
+} MigrateStats;
+
+// writes the tagged name of an old per user key, returns its length or 0 if the key keeps its name
+size_t tagged_name(const char *key, size_t length, char *name)
+{
+    const char *colon = memchr(key, ':', length);
+    if (colon == NULL || colon + 1 == key + length || colon[1] == '{' || length + 2 > MIGRATE_MAX_KEY_LENGTH)
+    {
+        return 0;
+    }
+
+    size_t type_length = colon - key;
+    for (size_t i = 0; i < sizeof(user_key_types) / sizeof(user_key_types[0]); i++)
+    {
+        if (strlen(user_key_types[i]) != type_length || memcmp(key, user_key_types[i], type_length) != 0)
+        {
+            continue;
+        }
+        // the user runs up to the next ':' or the end, trigram keys go on with binary bytes
+        const char *user = colon + 1;
+        const char *end = memchr(user, ':', key + length - user);
+        size_t user_length = end ? (size_t)(end - user) : (size_t)(key + length - user);
+
+        size_t used = 0;
+        memcpy(name, key, type_length + 1);
+        used += type_length + 1;
+        name[used++] = '{';
+        memcpy(name + used, user, user_length);
+        used += user_length;
+        name[used++] = '}';
+        memcpy(name + used, user + user_length, key + length - user - user_length);
+        return used + (key + length - user - user_length);
+    }
+    return 0;
+}
+
+// renames the old keys of one batch where they are and moves the keys another node holds, returns -1 if a node failed
+int migrate_batch(Source *source, redisReply *keys, int dry_run, MigrateStats *stats)
+{
+    static char names[MIGRATE_BATCH][MIGRATE_MAX_KEY_LENGTH];
+    size_t lengths[MIGRATE_BATCH];
+    int targets[MIGRATE_BATCH], renaming[MIGRATE_BATCH];
+    size_t count = keys->elements < MIGRATE_BATCH ? keys->elements : MIGRATE_BATCH;
+
+    // the new names are taken on the node the key is on, RENAMENX keeps a key a newer client already wrote
+    int renames = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const redisReply *key = keys->element[i];
+        lengths[i] = tagged_name(key->str, key->len, names[i]);
+        renaming[i] = lengths[i] > 0;
+        if (!renaming[i] && key->len <= MIGRATE_MAX_KEY_LENGTH)
+        {
+            lengths[i] = key->len;
+            memcpy(names[i], key->str, key->len);
+        }
+        targets[i] = lengths[i] > 0 ? shard_node_of(names[i], lengths[i]) : source->node;
+
+        if (renaming[i] && dry_run)
+        {
+            stats->renamed++;
+        }
+        else if (renaming[i])
+        {
+            redis_append(source->c, "RENAMENX %b %b", key->str, key->len, names[i], lengths[i]);
+            renames++;
+        }
+    }
+    for (size_t i = 0; i < count && renames > 0; i++)
+    {
+        if (!renaming[i])
+        {
+            continue;
+        }
+        redisReply *reply = NULL;
+        if (redis_get_reply(source->c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1)
+        {
+            stats->renamed++;
+        }
+        else
+        {
+            // the tagged key exists already, the old one stays for a look by hand
+            stats->conflicts++;
+            targets[i] = source->node;
+        }
+        freeReplyObject(reply);
+    }
+
+    // MIGRATE moves a key atomically and fails instead of overwriting one the target has
+    int moves = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (targets[i] == source->node)
+        {
+            continue;
+        }
+        if (dry_run)
+        {
+            stats->moved++;
+            continue;
+        }
+        const char *host;
+        int port;
+        shard_address(targets[i], &host, &port);
+        redis_append(source->c, "MIGRATE %s %d %b 0 %d", host, port, names[i], lengths[i], MIGRATE_TIMEOUT_MS);
+        moves++;
+    }
+    for (int i = 0; i < moves; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(source->c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (reply != NULL && reply->type == REDIS_REPLY_STATUS && strcmp(reply->str, "OK") == 0)
+            stats->moved++;
+        else if (reply != NULL && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "BUSYKEY", 7) == 0)
+            stats->conflicts++;
+        else if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+            stats->failed++;
+        freeReplyObject(reply);
+    }
+    return 0;
+}
+
+// walks every key of a node once
+int migrate_node(Source *source, int dry_run, MigrateStats *stats)
+{
+    unsigned long long cursor = 0;
+    do
+    {
+        redisReply *reply = redis_command(source->c, "SCAN %llu COUNT %d", cursor, MIGRATE_BATCH);
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+        {
+            freeReplyObject(reply);
+            return -1;
+        }
+        cursor = strtoull(reply->element[0]->str, NULL, 10);
+
+        // SCAN may hand out a few more than COUNT, the rest waits for the next round of the same cursor
+        redisReply *keys = reply->element[1];
+        for (size_t first = 0; first < keys->elements; first += MIGRATE_BATCH)
+        {
+            redisReply batch = *keys;
+            batch.element = keys->element + first;
+            batch.elements = keys->elements - first;
+            if (migrate_batch(source, &batch, dry_run, stats) != 0)
+            {
+                freeReplyObject(reply);
+                return -1;
+            }
+        }
+        stats->scanned += keys->elements;
+        freeReplyObject(reply);
+    } while (cursor != 0);
+    return 0;
+}
+
+// ENCODING --------------------
+// 1 if an event or rule hash is stored the way it is asked for already
+int has_encoding(const redisReply *hash, int packed)
+{
+    int has_packed = 0;
+    for (size_t j = 0; j < hash->elements; j += 2)
+    {
+        has_packed |= strcmp(hash->element[j]->str, DB_PACKED_FIELD) == 0;
+    }
+    return packed ? has_packed && hash->elements == 2 : !has_packed;
+}
+
+// rewrites the events of one batch in the other encoding, returns 1 if a calendar wrote to one meanwhile and -1 if the node failed
+int encode_batch(Source *source, redisReply *keys, int packed, int dry_run, MigrateStats *stats)
+{
+    redisContext *c = source->c;
+    size_t count = keys->elements < MIGRATE_BATCH ? keys->elements : MIGRATE_BATCH;
+    static const char *argv[MIGRATE_BATCH + 1];
+    static size_t lengths[MIGRATE_BATCH + 1];
+    static redisReply *hashes[MIGRATE_BATCH];
+
+    // the transaction below is dropped if any of the watched keys changes after it was read
+    argv[0] = "WATCH";
+    lengths[0] = 5;
+    for (size_t i = 0; i < count; i++)
+    {
+        argv[i + 1] = keys->element[i]->str;
+        lengths[i + 1] = keys->element[i]->len;
+    }
+    redis_append_argv(c, count + 1, argv, lengths);
+    for (size_t i = 0; i < count; i++)
+    {
+        redis_append(c, "HGETALL %b", keys->element[i]->str, keys->element[i]->len);
+    }
+
+    int result = drain_replies(c, 1) == 0 ? 0 : -1;
+    for (size_t i = 0; i < count; i++)
+    {
+        hashes[i] = NULL;
+        if (result == 0 && redis_get_reply(c, (void **)&hashes[i]) != REDIS_OK)
+        {
+            result = -1;
+        }
+    }
+
+    // a key removed since SCAN found it or a hash that is not an event stays as it is
+    int queued = 0;
+    long encoded = 0, broken = 0;
+    for (size_t i = 0; i < count && result == 0; i++)
+    {
+        DbEventFields fields;
+        if (hashes[i] == NULL || hashes[i]->type != REDIS_REPLY_ARRAY || hashes[i]->elements == 0 || has_encoding(hashes[i], packed))
+        {
+            continue;
+        }
+        if (!db_parse_event(hashes[i], &fields))
+        {
+            broken++;
+            continue;
+        }
+        encoded++;
+        if (dry_run)
+        {
+            continue;
+        }
+        if (queued == 0)
+        {
+            redis_append(c, "MULTI");
+            queued++;
+        }
+        redis_append(c, "DEL %b", keys->element[i]->str, keys->element[i]->len);
+        int put = db_put_fields(c, keys->element[i]->str, &fields, packed);
+        queued += 1 + (put > 0 ? put : 0);
+        if (put <= 0)
+        {
+            result = -1;
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        freeReplyObject(hashes[i]);
+    }
+    if (queued == 0)
+    {
+        freeReplyObject(redis_command(c, "UNWATCH"));
+        stats->encoded += encoded;
+        stats->conflicts += broken;
+        return c->err ? -1 : result;
+    }
+
+    // every command of the transaction is only queued, EXEC says whether it ran
+    redis_append(c, result == 0 ? "EXEC" : "DISCARD");
+    if (drain_replies(c, queued) != 0 && c->err)
+    {
+        return -1;
+    }
+    redisReply *reply = NULL;
+    if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+    {
+        return -1;
+    }
+    int done = result == 0 && reply != NULL && reply->type == REDIS_REPLY_ARRAY;
+    int aborted = result == 0 && reply != NULL && reply->type == REDIS_REPLY_NIL;
+    freeReplyObject(reply);
+    if (done)
+    {
+        stats->encoded += encoded;
+        stats->conflicts += broken;
+        return 0;
+    }
+    return aborted ? 1 : -1;
+}
+
+// walks the events and rules of a node and stores each in the encoding asked for
+int encode_node(Source *source, int packed, int dry_run, MigrateStats *stats)
+{
+    const char *patterns[] = {"event:{*", "recurrence:{*"};
+    for (int p = 0; p < 2; p++)
+    {
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = redis_command(source->c, "SCAN %llu MATCH %s COUNT %d", cursor, patterns[p], MIGRATE_BATCH);
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return -1;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+
+            redisReply *keys = reply->element[1];
+            for (size_t first = 0; first < keys->elements; first += MIGRATE_BATCH)
+            {
+                redisReply batch = *keys;
+                batch.element = keys->element + first;
+                batch.elements = keys->elements - first;
+
+                int result = 1;
+                for (int attempt = 0; attempt < MIGRATE_RETRIES && result == 1; attempt++)
+                {
+                    result = encode_batch(source, &batch, packed, dry_run, stats);
+                }
+                if (result < 0)
+                {
+                    freeReplyObject(reply);
+                    return -1;
+                }
+                // a batch that kept changing is left, running again picks it up
+                stats->failed += result == 1;
+            }
+            stats->scanned += keys->elements;
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+    return 0;
+}
+
+int parse_source(const char *text, Source *source)
+{
+    const char *colon = strrchr(text, ':');
+    if (colon == NULL || colon == text || (size_t)(colon - text) >= sizeof(source->host) || atoi(colon + 1) < 1 || atoi(colon + 1) > 65535)
+    {
+        return -1;
+    }
+    snprintf(source->host, sizeof(source->host), "%.*s", (int)(colon - text), text);
+    source->port = atoi(colon + 1);
+    source->node = -1;
+    return 0;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-n] [-f host:port]... | [-n] -e packed|fields\n"
+                    "  moves every key to the node of REDIS_NODES that holds it and gives old per user keys their hash tag\n"
+                    "  -n  only count what would change\n"
+                    "  -f  also empty a node that is no longer listed in REDIS_NODES\n"
+                    "  -e  instead stores every event and rule as one packed field or back as a field per value\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    Source sources[2 * SHARD_MAX_NODES];
+    int source_count = 0, dry_run = 0, encoding = -1;
+
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        const char *host;
+        shard_address(node, &host, &sources[source_count].port);
+        snprintf(sources[source_count].host, sizeof(sources[source_count].host), "%s", host);
+        sources[source_count++].node = node;
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "nf:e:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            dry_run = 1;
+            break;
+        case 'f':
+            if (source_count == 2 * SHARD_MAX_NODES || parse_source(optarg, &sources[source_count]) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            source_count++;
+            break;
+        case 'e':
+            encoding = strcmp(optarg, "packed") == 0 ? 1 : strcmp(optarg, "fields") == 0 ? 0 : -1;
+            if (encoding < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // keys are moved to the node their slot names, a wrong slot would scatter the calendars
+    const char *mismatch = shard_check_slots();
+    if (mismatch != NULL)
+    {
+        fprintf(stderr, "%sError: %s does not hash to the slot redis cluster gives it.%s\n", RED_COLOR, mismatch, RESET_COLOR);
+        return 1;
+    }
+
+    // -e packed rewrites every event, it must not run with an encoder that loses fields
+    const char *lost = db_check_packing();
+    if (lost != NULL)
+    {
+        fprintf(stderr, "%sError: The packed encoding does not read back the %s event.%s\n", RED_COLOR, lost, RESET_COLOR);
+        return 1;
+    }
+
+    // plain connections, a key is handled on the node it is found on whatever its name hashes to
+    for (int i = 0; i < source_count; i++)
+    {
+        sources[i].c = redisConnect(sources[i].host, sources[i].port);
+        if (sources[i].c == NULL || sources[i].c->err)
+        {
+            fprintf(stderr, "%sError connecting to %s:%d: %s%s\n", RED_COLOR, sources[i].host, sources[i].port,
+                    sources[i].c ? sources[i].c->errstr : "out of memory", RESET_COLOR);
+            return 1;
+        }
+    }
+
+    int result = 0;
+    for (int i = 0; i < source_count; i++)
+    {
+        MigrateStats stats = {0};
+        if ((encoding < 0 ? migrate_node(&sources[i], dry_run, &stats) : encode_node(&sources[i], encoding, dry_run, &stats)) != 0)
+        {
+            fprintf(stderr, "%sError migrating %s:%d: %s%s\n", RED_COLOR, sources[i].host, sources[i].port,
+                    sources[i].c->err ? sources[i].c->errstr : "unexpected reply", RESET_COLOR);
+            result = 1;
+        }
+        if (encoding < 0)
+            printf("%s:%d: %ld keys scanned, %ld %srenamed, %ld %smoved, %ld conflicts, %ld failed\n", sources[i].host, sources[i].port,
+                   stats.scanned, stats.renamed, dry_run ? "to be " : "", stats.moved, dry_run ? "to be " : "", stats.conflicts, stats.failed);
+        else
+            printf("%s:%d: %ld events and rules scanned, %ld %sre-encoded, %ld unreadable, %ld kept changing\n", sources[i].host, sources[i].port,
+                   stats.scanned, stats.encoded, dry_run ? "to be " : "", stats.conflicts, stats.failed);
+        result |= stats.conflicts > 0 || stats.failed > 0;
+        redisFree(sources[i].c);
+    }
+    return result;
+}
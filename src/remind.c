@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <hiredis/hiredis.h>
+#include "common.h"
+#include "stats.h"
+#include "db.h"
+#include "event.h"
+#include "recurrence.h"
+#include "reminder.h"
+#include "shard.h"
+#include "wheel.h"
+
+// reminder daemon parameter
+#define REMIND_LEAD_MINUTES 15   // how long before the start a reminder goes out, -l changes it
+#define REMIND_WINDOW 3600       // seconds of starts held in the wheel, the next window is read before this one runs out
+#define REMIND_PAGE 1000         // schedule entries per read and changes per XREAD
+#define REMIND_BATCH 256         // due reminders fired in one pipeline
+#define REMIND_CLAIM_SECONDS 300 // renewed per page, a backfill claim left by a daemon that died expires
+#define REMIND_USER_LENGTH 64
+#define REMIND_KEY_LENGTH 128
+
+// fires a reminder unless its schedule entry changed since the wheel got it, a recurring one moves on to its next start
+// KEYS: schedule, sink  ARGV: member, start, next start or -1, then the stream length and fields when it is delivered
+#define FIRE_SCRIPT "local s = redis.call('ZSCORE', KEYS[1], ARGV[1]) "                                                            \
+                    "if not s or tonumber(s) ~= tonumber(ARGV[2]) then return 0 end "                                             \
+                    "if ARGV[3] == '-1' then redis.call('ZREM', KEYS[1], ARGV[1]) else redis.call('ZADD', KEYS[1], ARGV[3], ARGV[1]) end " \
+                    "if #ARGV > 3 then redis.call('XADD', KEYS[2], 'MAXLEN', '~', ARGV[4], '*', unpack(ARGV, 5)) return 1 end return 2"
+
+// what a due reminder says, filled in from its event before it is fired
+typedef struct
+{
+    char user[REMIND_USER_LENGTH];
+    int id;
+    char date[MAX_DATE_LENGTH];
+    char time[MAX_TIME_LENGTH]; // HH:MM, empty for an all-day event
+    char name[MAX_NAME_LENGTH];
+    long late; // seconds after the reminder time it went out
+    int deliver;
+    time_t next; // start the schedule moves on to, -1 if there is none
+} Reminder;
+
+// global schedule variables, the wheel holds the reminders whose event starts up to loaded_until
+Wheel wheel;
+int lead; // seconds
+time_t loaded_until;
+char last_change[64] = "0-0"; // id of the last schedule update read from REMINDER_CHANGES
+
+// global delivery variables
+WheelEntry **due_entries;
+size_t due_count;
+size_t due_capacity;
+Reminder reminders[REMIND_BATCH];
+FILE *sink; // a copy of every delivered reminder as a JSON line, NULL without -o
+long delivered;
+long skipped;
+volatile sig_atomic_t stopping;
+
+void stop(int signal)
+{
+    stopping = 1;
+}
+
+// puts a start into the wheel unless it lies beyond the loaded window, that part is read when the window moves on
+void schedule(const char *member, time_t start)
+{
+    if (start <= loaded_until && wheel_insert(&wheel, (int64_t)start - lead, member) != 0)
+    {
+        fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+        exit(1);
+    }
+}
+
+// SCHEDULE --------------------
+// adds the next start of every event or rule under one key pattern, returns the number of failed commands
+int backfill_schedule(redisContext *c, const char *pattern, int recurring, time_t now)
+{
+    int failed = 0;
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *scan = shard_node(c, node);
+        unsigned long long cursor = 0;
+        do
+        {
+            redisReply *reply = scan ? redis_command(scan, "SCAN %llu MATCH %s COUNT %d", cursor, pattern, REMIND_PAGE) : NULL;
+            if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+            {
+                freeReplyObject(reply);
+                return failed + 1;
+            }
+            cursor = strtoull(reply->element[0]->str, NULL, 10);
+            freeReplyObject(redis_command(c, "EXPIRE " REMINDER_CLAIM " %d", REMIND_CLAIM_SECONDS));
+
+            redisReply *keys = reply->element[1];
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                redis_append(c, "HGETALL %s", keys->element[i]->str);
+            }
+
+            int commands = 0;
+            for (size_t i = 0; i < keys->elements; i++)
+            {
+                redisReply *hash = NULL;
+                if (redis_get_reply(c, (void **)&hash) != REDIS_OK)
+                {
+                    freeReplyObject(reply);
+                    return failed + 1;
+                }
+
+                // "<prefix>:{<user>}:<id>"
+                char owner[REMIND_USER_LENGTH];
+                const char *id = strrchr(keys->element[i]->str, ':');
+                DbEventFields fields;
+                if (db_key_user(keys->element[i]->str, owner, sizeof(owner)) && id != NULL && db_parse_event(hash, &fields))
+                {
+                    if (fields.description == NULL)
+                        fields.description = "";
+                    Recurrence *recurrence = recurring ? db_recurrence_from_fields(&fields, atoi(id + 1)) : NULL;
+                    Event *event = recurring ? NULL : db_event_from_fields(&fields, atoi(id + 1));
+                    time_t start = recurrence || event ? reminder_next(recurrence ? recurrence->event : event, recurrence, now) : -1;
+
+                    // NX keeps what the write path scheduled meanwhile
+                    if (start >= 0)
+                    {
+                        redis_append(c, "ZADD " REMINDER_INDEX " NX %lld %s:%s", (long long)start, owner, id + 1);
+                        commands++;
+                    }
+                    if (recurrence)
+                        free_recurrence(recurrence);
+                    if (event)
+                        free_event(event);
+                }
+                freeReplyObject(hash);
+            }
+            failed += drain_replies(c, commands);
+            freeReplyObject(reply);
+        } while (cursor != 0);
+    }
+    return failed;
+}
+
+// schedules the events from before the reminders existed, runs once per database
+void prepare_schedule(redisContext *c)
+{
+    redisReply *reply = redis_command(c, "EXISTS " REMINDER_READY);
+    int ready = reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (ready)
+    {
+        return;
+    }
+
+    reply = redis_command(c, "SET " REMINDER_CLAIM " 1 NX EX %d", REMIND_CLAIM_SECONDS);
+    int claimed = reply != NULL && reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    if (!claimed)
+    {
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (backfill_schedule(c, "event:{*", 0, now) + backfill_schedule(c, "recurrence:{*", 1, now) == 0)
+    {
+        freeReplyObject(redis_command(c, "SET " REMINDER_READY " 1"));
+    }
+    else
+    {
+        // the next daemon tries again
+        freeReplyObject(redis_command(c, "DEL " REMINDER_CLAIM));
+    }
+}
+
+// reads the starts after the loaded window up to until into the wheel, returns -1 if redis failed
+int load_window(redisContext *c, time_t until)
+{
+    // the first window also takes the reminders that were due while no daemon ran
+    char min[32];
+    if (loaded_until == 0)
+        snprintf(min, sizeof(min), "-inf");
+    else
+        snprintf(min, sizeof(min), "(%lld", (long long)loaded_until);
+
+    uint64_t start = stats_now();
+    time_t previous = loaded_until;
+    loaded_until = until;
+
+    // each page goes on from the last score read rather than an offset, which a start removed meanwhile would shift
+    // members of one score come in byte order, so the ones read at that score before are skipped
+    char last_member[REMIND_KEY_LENGTH] = "";
+    long long last_score = 0;
+    long tied = 0; // members read at last_score
+    for (;;)
+    {
+        long limit = tied + REMIND_PAGE;
+        redisReply *reply = redis_command(c, "ZRANGEBYSCORE " REMINDER_INDEX " %s %lld WITHSCORES LIMIT 0 %ld", min, (long long)until, limit);
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        {
+            freeReplyObject(reply);
+            loaded_until = previous;
+            return -1;
+        }
+        for (size_t i = 0; i + 1 < reply->elements; i += 2)
+        {
+            const char *member = reply->element[i]->str;
+            long long score = atoll(reply->element[i + 1]->str);
+            if (tied > 0 && score == last_score && strcmp(member, last_member) <= 0)
+            {
+                continue;
+            }
+            schedule(member, score);
+
+            if (tied == 0 || score != last_score)
+            {
+                last_score = score;
+                tied = 0;
+            }
+            tied++;
+            snprintf(last_member, sizeof(last_member), "%s", member);
+        }
+        size_t count = reply->elements / 2;
+        freeReplyObject(reply);
+        if (count < (size_t)limit)
+        {
+            break;
+        }
+        snprintf(min, sizeof(min), "%lld", last_score);
+    }
+    stats_record_since("remind.load", start);
+    return 0;
+}
+
+// applies the schedule updates written since the last call, waits up to wait_ms for the first, returns -1 if redis failed
+int follow_changes(redisContext *c, int wait_ms)
+{
+    redisReply *reply = redis_command(c, "XREAD COUNT %d BLOCK %d STREAMS " REMINDER_CHANGES " %s", REMIND_PAGE, wait_ms, last_change);
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR)
+    {
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    // [[stream, [[id, [field, value, ...]], ...]]], nil when nothing came in time
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 1 && reply->element[0]->elements == 2)
+    {
+        redisReply *entries = reply->element[0]->element[1];
+        for (size_t i = 0; i < entries->elements; i++)
+        {
+            redisReply *entry = entries->element[i];
+            if (entry->elements != 2)
+                continue;
+            snprintf(last_change, sizeof(last_change), "%s", entry->element[0]->str);
+
+            const char *member = NULL;
+            time_t due = -1;
+            redisReply *fields = entry->element[1];
+            for (size_t j = 0; j + 1 < fields->elements; j += 2)
+            {
+                if (strcmp(fields->element[j]->str, "member") == 0)
+                    member = fields->element[j + 1]->str;
+                else if (strcmp(fields->element[j]->str, "due") == 0)
+                    due = atoll(fields->element[j + 1]->str);
+            }
+
+            // a start that was removed or moved stays in the wheel, the fire script finds its entry changed
+            if (member != NULL && due >= 0)
+            {
+                schedule(member, due);
+            }
+        }
+    }
+    freeReplyObject(reply);
+    return 0;
+}
+
+// DELIVERY --------------------
+void collect_due(WheelEntry *entry, void *context)
+{
+    if (due_count == due_capacity)
+    {
+        size_t capacity = due_capacity ? due_capacity * 2 : REMIND_BATCH;
+        WheelEntry **entries = realloc(due_entries, capacity * sizeof(WheelEntry *));
+        if (entries == NULL)
+        {
+            // it stays in the schedule and is found again by the next daemon
+            free(entry);
+            return;
+        }
+        due_entries = entries;
+        due_capacity = capacity;
+    }
+    due_entries[due_count++] = entry;
+}
+
+// queues the fire script of one due reminder, its event decides whether it is delivered and when it comes next
+void append_fire(redisContext *c, const WheelEntry *entry, const redisReply *event_reply, const redisReply *rule_reply, time_t now, Reminder *reminder)
+{
+    time_t start = entry->due + lead;
+    const char *colon = strrchr(entry->member, ':');
+    int user_length = colon ? (int)(colon - entry->member) : 0;
+    memset(reminder, 0, sizeof(*reminder));
+    snprintf(reminder->user, sizeof(reminder->user), "%.*s", user_length, entry->member);
+    reminder->id = colon ? atoi(colon + 1) : 0;
+
+    DbEventFields fields;
+    Event *event = NULL;
+    Recurrence *recurrence = NULL;
+    if (db_parse_event(event_reply, &fields) || db_parse_event(rule_reply, &fields))
+    {
+        if (fields.description == NULL)
+            fields.description = "";
+        if (fields.frequency)
+            recurrence = db_recurrence_from_fields(&fields, reminder->id);
+        else
+            event = db_event_from_fields(&fields, reminder->id);
+    }
+    const Event *source = recurrence ? recurrence->event : event;
+
+    // a reminder only goes out while its event still starts then and has not begun, late ones after a restart included
+    // a rule moves on to its first start from now, the ones missed while no daemon ran are not scheduled again
+    time_t next = -1;
+    if (source != NULL)
+    {
+        next = recurrence ? reminder_next(source, recurrence, start + 1 > now ? start + 1 : now) : -1;
+        reminder->deliver = reminder_next(source, recurrence, start) == start && start >= now;
+
+        struct tm tm;
+        localtime_r(&start, &tm);
+        strftime(reminder->date, sizeof(reminder->date), "%Y-%m-%d", &tm);
+        if (event_is_timed(source))
+            format_time(source->start, reminder->time);
+        snprintf(reminder->name, sizeof(reminder->name), "%s", source->name);
+        reminder->late = now - entry->due;
+    }
+    reminder->next = next;
+
+    DbCommand command;
+    db_command_init(&command, "EVAL");
+    db_arg(&command, FIRE_SCRIPT);
+    db_arg(&command, "2");
+    db_arg(&command, REMINDER_INDEX);
+    db_arg(&command, REMINDER_SINK);
+    db_arg(&command, entry->member);
+    db_arg_format(&command, "%lld", (long long)start);
+    db_arg_format(&command, "%lld", (long long)next);
+    if (reminder->deliver)
+    {
+        db_arg_format(&command, "%d", REMINDER_STREAM_LENGTH);
+        db_arg(&command, "user");
+        db_arg(&command, reminder->user);
+        db_arg(&command, "id");
+        db_arg_format(&command, "%d", reminder->id);
+        db_arg(&command, "date");
+        db_arg(&command, reminder->date);
+        db_arg(&command, "time");
+        db_arg(&command, reminder->time);
+        db_arg(&command, "name");
+        db_arg(&command, reminder->name);
+        db_arg(&command, "late");
+        db_arg_format(&command, "%ld", reminder->late);
+    }
+    db_append(c, &command);
+
+    if (recurrence)
+        free_recurrence(recurrence);
+    if (event)
+        free_event(event);
+}
+
+void print_reminder(const Reminder *reminder)
+{
+    fprintf(sink, "{\"user\":");
+    print_json_string(sink, reminder->user);
+    fprintf(sink, ",\"id\":%d,\"date\":\"%s\",\"time\":\"%s\",\"name\":", reminder->id, reminder->date, reminder->time);
+    print_json_string(sink, reminder->name);
+    fprintf(sink, ",\"late\":%ld}\n", reminder->late);
+}
+
+// fires one batch in two round trips: the events, then the scripts, returns -1 if redis failed
+int fire_batch(redisContext *c, WheelEntry **entries, size_t count, time_t now)
+{
+    // like a feed member the "<user>:<id>" of a reminder names an event or a rule
+    for (size_t i = 0; i < count; i++)
+    {
+        char key[REMIND_KEY_LENGTH];
+        db_member_key("event", entries[i]->member, key, sizeof(key));
+        redis_append(c, "HGETALL %s", key);
+        db_member_key("recurrence", entries[i]->member, key, sizeof(key));
+        redis_append(c, "HGETALL %s", key);
+    }
+
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        redisReply *event_reply = NULL, *rule_reply = NULL;
+        if (redis_get_reply(c, (void **)&event_reply) != REDIS_OK || redis_get_reply(c, (void **)&rule_reply) != REDIS_OK)
+        {
+            freeReplyObject(event_reply);
+            drain_replies(c, queued);
+            return -1;
+        }
+        append_fire(c, entries[i], event_reply, rule_reply, now, &reminders[i]);
+        queued++;
+        freeReplyObject(event_reply);
+        freeReplyObject(rule_reply);
+    }
+
+    // 1 delivered, 2 dropped as its event is gone or has begun, 0 the schedule moved on and nothing happened
+    for (size_t i = 0; i < count; i++)
+    {
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1)
+        {
+            delivered++;
+            if (sink != NULL)
+                print_reminder(&reminders[i]);
+        }
+        else if (reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer == 2)
+        {
+            skipped++;
+        }
+
+        // the next start of a rule may fall in the window already read, the script moved its entry there
+        if (reply != NULL && reply->type == REDIS_REPLY_INTEGER && reply->integer != 0 && reminders[i].next >= 0)
+        {
+            schedule(entries[i]->member, reminders[i].next);
+        }
+        freeReplyObject(reply);
+    }
+    if (sink != NULL)
+    {
+        fflush(sink);
+    }
+    return 0;
+}
+
+// fires every reminder that is due by now, returns -1 if redis failed
+int fire_due(redisContext *c, time_t now)
+{
+    due_count = 0;
+    wheel_advance(&wheel, now, collect_due, NULL);
+    if (due_count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t start = stats_now();
+    int result = 0;
+    for (size_t first = 0; first < due_count && result == 0; first += REMIND_BATCH)
+    {
+        size_t count = due_count - first < REMIND_BATCH ? due_count - first : REMIND_BATCH;
+        result = fire_batch(c, due_entries + first, count, now);
+    }
+    for (size_t i = 0; i < due_count; i++)
+    {
+        free(due_entries[i]);
+    }
+    stats_record_since("remind.fire", start);
+    return result;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-l minutes] [-o file]\n"
+                    "  sends a reminder to " REMINDER_SINK " before every event starts\n"
+                    "  -l  minutes before the start, %d by default\n"
+                    "  -o  also append each reminder to a file as a JSON line\n",
+            program, REMIND_LEAD_MINUTES);
+}
+
+// MAIN ------------
+int main(int argc, char *argv[])
+{
+    lead = REMIND_LEAD_MINUTES * 60;
+    const char *sink_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            lead = atoi(optarg) * 60;
+            if (lead < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            sink_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (sink_path != NULL && (sink = fopen(sink_path, "a")) == NULL)
+    {
+        fprintf(stderr, "%sError: Cannot open %s.%s\n", RED_COLOR, sink_path, RESET_COLOR);
+        return 1;
+    }
+    // a wheel that fires early or late sends reminders at the wrong time
+    const char *mistimed = wheel_check();
+    if (mistimed != NULL)
+    {
+        fprintf(stderr, "%sError: The timing wheel fired the %s entry in the wrong second.%s\n", RED_COLOR, mistimed, RESET_COLOR);
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    stats_init("remind");
+
+    // the connection goes to the node of the schedule, the events are read from the nodes of their users
+    redisContext *c = connect_redis(REMINDER_INDEX);
+    prepare_schedule(c);
+
+    // updates after this one are followed, the ones before are in the schedule that is read next
+    redisReply *reply = redis_command(c, "XREVRANGE " REMINDER_CHANGES " + - COUNT 1");
+    if (reply != NULL && reply->type == REDIS_REPLY_ARRAY && reply->elements == 1 && reply->element[0]->elements == 2)
+    {
+        snprintf(last_change, sizeof(last_change), "%s", reply->element[0]->element[0]->str);
+    }
+    freeReplyObject(reply);
+
+    // the schedule in redis is the state, the wheel is rebuilt from it on every start
+    time_t now = time(NULL);
+    wheel_init(&wheel, now);
+    int failed = load_window(c, now + lead + REMIND_WINDOW) != 0;
+    while (!stopping && !failed)
+    {
+        now = time(NULL);
+        failed = fire_due(c, now) != 0;
+
+        if (!failed && now + lead + REMIND_WINDOW / 2 > loaded_until)
+        {
+            failed = load_window(c, loaded_until + REMIND_WINDOW) != 0;
+        }
+
+        // the changes are awaited until the next second begins
+        struct timespec clock;
+        clock_gettime(CLOCK_REALTIME, &clock);
+        int wait_ms = 1000 - (int)(clock.tv_nsec / 1000000);
+        if (!failed)
+        {
+            failed = follow_changes(c, wait_ms > 0 ? wait_ms : 1) != 0;
+        }
+    }
+
+    if (failed && !stopping)
+    {
+        fprintf(stderr, "%sError: Redis connection lost: %s%s\n", RED_COLOR, c->err ? c->errstr : "unexpected reply", RESET_COLOR);
+    }
+    fprintf(stderr, "%ld reminders delivered, %ld skipped\n", delivered, skipped);
+
+    wheel_clear(&wheel);
+    free(due_entries);
+    if (sink != NULL)
+    {
+        fclose(sink);
+    }
+    redisFree(c);
+    stats_shutdown();
+    return failed && !stopping ? 1 : 0;
+}
@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <hiredis/hiredis.h>
+#include "common.h"
+#include "stats.h"
+#include "db.h"
+#include "shard.h"
+#include "throttle.h"
+
+// analytics report parameter
+#define REPORT_THREADS 4                  // -t
+#define REPORT_OPS_PER_SECOND 2000        // -r, redis commands per second of all threads together
+#define REPORT_DORMANT_DAYS 180           // -d, accounts without an event dated after that many days ago
+#define REPORT_SCAN_COUNT 200             // keys asked for per SCAN, their fields are read in one pipeline
+#define REPORT_KEYS_PER_PARTITION 64      // a node is only split into as many cursor ranges as its hash table surely has buckets
+#define REPORT_MAX_PARTITIONS 64          // cursor ranges per node, a power of two
+#define REPORT_FIRST_YEAR 1900            // months counted, dates outside are left out of the busiest months
+#define REPORT_YEARS 300
+#define REPORT_MONTHS (REPORT_YEARS * 12)
+#define REPORT_TOP 10                     // users and months listed
+#define REPORT_DORMANT_LISTED 100         // dormant accounts listed by name, all of them are counted
+#define REPORT_USER_LENGTH 64
+#define REPORT_ENDLESS 99991231           // last date of a rule without an end
+
+// per user numbers, kept in an open addressing table
+typedef struct
+{
+    char user[REPORT_USER_LENGTH]; // empty for a free slot
+    long events;                   // single events and rules
+    long public_events;
+    int last;    // yyyymmdd of the latest date, the last possible occurrence for a rule
+    int account; // user:{<user>} exists
+} UserTally;
+
+typedef struct
+{
+    UserTally *slots;
+    size_t capacity; // a power of two
+    size_t used;
+} UserTable;
+
+// what one thread counted, tallies add up into the report
+typedef struct
+{
+    long keys;
+    long events;
+    long rules;
+    long public_events;
+    long private_events;
+    long months[REPORT_MONTHS];
+    UserTable users;
+} Tally;
+
+// a range of SCAN cursors of one node, redis walks its buckets in the order of the bit reversed cursor
+typedef struct
+{
+    int node;
+    uint64_t first; // reversed cursor of the first bucket
+    uint64_t end;   // reversed cursor the next range starts at, 0 for the end of the table
+} Partition;
+
+// global report variables, the workers take partitions in order
+Partition *partitions;
+int partition_count;
+int next_partition;
+volatile int failed;
+char failure[256];
+pthread_mutex_t partition_lock = PTHREAD_MUTEX_INITIALIZER;
+Throttle throttle;
+
+// TALLY --------------------
+static uint64_t reverse_bits(uint64_t v)
+{
+    uint64_t r = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        r = r << 1 | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+// fnv-1a
+static size_t hash_user(const char *user)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)user; *p; p++)
+    {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// slot of a user, a new one is claimed, NULL when memory runs out
+UserTally *find_user(UserTable *table, const char *user)
+{
+    if ((table->used + 1) * 10 > table->capacity * 7)
+    {
+        size_t capacity = table->capacity ? table->capacity * 2 : 1024;
+        UserTally *slots = calloc(capacity, sizeof(UserTally));
+        if (slots == NULL)
+        {
+            return NULL;
+        }
+        for (size_t i = 0; i < table->capacity; i++)
+        {
+            if (table->slots[i].user[0] == '\0')
+                continue;
+            size_t j = hash_user(table->slots[i].user) & (capacity - 1);
+            while (slots[j].user[0] != '\0')
+                j = (j + 1) & (capacity - 1);
+            slots[j] = table->slots[i];
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+
+    size_t i = hash_user(user) & (table->capacity - 1);
+    while (table->slots[i].user[0] != '\0' && strcmp(table->slots[i].user, user) != 0)
+    {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    if (table->slots[i].user[0] == '\0')
+    {
+        snprintf(table->slots[i].user, sizeof(table->slots[i].user), "%s", user);
+        table->used++;
+    }
+    return &table->slots[i];
+}
+
+// yyyymmdd of a date, 0 if it is not one
+int date_number(const char *date)
+{
+    int year, month, day;
+    return date != NULL && parse_date(date, &year, &month, &day) ? year * 10000 + month * 100 + day : 0;
+}
+
+// counts one event or rule, returns -1 when memory runs out
+int tally_event(Tally *tally, const char *user, const DbEventFields *fields, int recurring)
+{
+    int date = date_number(fields->date);
+    int until = date_number(fields->until);
+    int last = !recurring ? date : fields->until[0] ? until : REPORT_ENDLESS;
+    int month = (date / 10000 - REPORT_FIRST_YEAR) * 12 + date / 100 % 100 - 1;
+
+    tally->events += !recurring;
+    tally->rules += recurring;
+    tally->public_events += fields->visibility == 0;
+    tally->private_events += fields->visibility != 0;
+    if (date && month >= 0 && month < REPORT_MONTHS)
+    {
+        tally->months[month]++;
+    }
+
+    UserTally *entry = find_user(&tally->users, user);
+    if (entry == NULL)
+    {
+        return -1;
+    }
+    entry->events++;
+    entry->public_events += fields->visibility == 0;
+    if (last > entry->last)
+    {
+        entry->last = last;
+    }
+    return 0;
+}
+
+// adds a tally into another, returns -1 when memory runs out
+int tally_merge(Tally *into, const Tally *from)
+{
+    into->keys += from->keys;
+    into->events += from->events;
+    into->rules += from->rules;
+    into->public_events += from->public_events;
+    into->private_events += from->private_events;
+    for (int i = 0; i < REPORT_MONTHS; i++)
+    {
+        into->months[i] += from->months[i];
+    }
+    for (size_t i = 0; i < from->users.capacity; i++)
+    {
+        const UserTally *user = &from->users.slots[i];
+        if (user->user[0] == '\0')
+            continue;
+        UserTally *entry = find_user(&into->users, user->user);
+        if (entry == NULL)
+        {
+            return -1;
+        }
+        entry->events += user->events;
+        entry->public_events += user->public_events;
+        entry->account |= user->account;
+        if (user->last > entry->last)
+            entry->last = user->last;
+    }
+    return 0;
+}
+
+// SCAN --------------------
+void fail(const char *message, const redisContext *c)
+{
+    pthread_mutex_lock(&partition_lock);
+    if (!failed)
+    {
+        snprintf(failure, sizeof(failure), "%s: %s", message, c && c->err ? c->errstr : "unexpected reply");
+    }
+    failed = 1;
+    pthread_mutex_unlock(&partition_lock);
+}
+
+// reads the events, rules and accounts of one page of keys, returns -1 if the node failed
+int tally_page(redisContext *c, const redisReply *keys, Tally *tally)
+{
+    static const char *const names[] = {"visibility", "date", "until"};
+    size_t count = keys->elements;
+    char *kinds = malloc(count + 1); // 0 other, 1 event, 2 rule, 3 account
+    int queued = 0;
+    if (kinds == NULL)
+    {
+        return -1;
+    }
+
+    // SCAN TYPE hash still hands out the other per user hashes, the prefix tells them apart
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *key = keys->element[i]->str;
+        kinds[i] = strncmp(key, "event:{", 7) == 0 ? 1 : strncmp(key, "recurrence:{", 12) == 0 ? 2 : strncmp(key, "user:{", 6) == 0 ? 3 : 0;
+        if (kinds[i] == 1 || kinds[i] == 2)
+        {
+            queued += db_append_event_get(c, key, names, 3);
+        }
+    }
+    if (queued > 0)
+    {
+        throttle_take(&throttle, queued);
+    }
+
+    tally->keys += count;
+    int result = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        char user[REPORT_USER_LENGTH];
+        if (kinds[i] == 0 || !db_key_user(keys->element[i]->str, user, sizeof(user)))
+        {
+            continue;
+        }
+        if (kinds[i] == 3)
+        {
+            UserTally *entry = find_user(&tally->users, user);
+            if (entry == NULL)
+                result = -1;
+            else
+                entry->account = 1;
+            continue;
+        }
+
+        redisReply *reply = NULL;
+        if (redis_get_reply(c, (void **)&reply) != REDIS_OK)
+        {
+            free(kinds);
+            return -1;
+        }
+        DbEventFields fields;
+        if (result == 0 && db_parse_event_get(reply, names, 3, &fields) && fields.date != NULL && fields.visibility != -1 &&
+            tally_event(tally, user, &fields, kinds[i] == 2) != 0)
+        {
+            result = -1;
+        }
+        freeReplyObject(reply);
+    }
+    free(kinds);
+    return result;
+}
+
+// walks the buckets of one cursor range, returns -1 if the node failed
+int scan_partition(redisContext *c, const Partition *partition, Tally *tally)
+{
+    uint64_t cursor = reverse_bits(partition->first);
+    int count = REPORT_SCAN_COUNT;
+    while (!failed)
+    {
+        throttle_take(&throttle, 1);
+        redisReply *reply = redis_command(c, "SCAN %llu COUNT %d TYPE hash", (unsigned long long)cursor, count);
+        if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2)
+        {
+            freeReplyObject(reply);
+            return -1;
+        }
+        uint64_t next = strtoull(reply->element[0]->str, NULL, 10);
+
+        // a call that went on past the end of the range returned keys of the next one too, mixed with its own
+        // it is asked again for fewer keys, with COUNT 1 redis stops after the first bucket that has any, which is one side or the other
+        int crossed = partition->end != 0 && (next == 0 || reverse_bits(next) > partition->end);
+        if (crossed && count > 1)
+        {
+            freeReplyObject(reply);
+            count = count / 4 > 1 ? count / 4 : 1;
+            continue;
+        }
+        int result = crossed ? 0 : tally_page(c, reply->element[1], tally);
+        freeReplyObject(reply);
+        if (result != 0)
+        {
+            return -1;
+        }
+        if (crossed || next == 0 || (partition->end != 0 && reverse_bits(next) == partition->end))
+        {
+            break;
+        }
+        cursor = next;
+    }
+    return 0;
+}
+
+// takes cursor ranges until none is left, with its own connection to every node
+void *report_worker(void *arg)
+{
+    Tally *tally = arg;
+    redisContext *nodes[SHARD_MAX_NODES] = {NULL};
+    struct timeval timeout = {REDIS_TIMEOUT_MS / 1000, (REDIS_TIMEOUT_MS % 1000) * 1000};
+
+    while (1)
+    {
+        pthread_mutex_lock(&partition_lock);
+        int index = failed ? partition_count : next_partition++;
+        pthread_mutex_unlock(&partition_lock);
+        if (index >= partition_count)
+        {
+            break;
+        }
+
+        const Partition *partition = &partitions[index];
+        if (nodes[partition->node] == NULL)
+        {
+            const char *host;
+            int port;
+            shard_address(partition->node, &host, &port);
+            nodes[partition->node] = redisConnectWithTimeout(host, port, timeout);
+            if (nodes[partition->node] == NULL || nodes[partition->node]->err || redisSetTimeout(nodes[partition->node], timeout) != REDIS_OK)
+            {
+                fail("Error connecting to redis", nodes[partition->node]);
+                break;
+            }
+        }
+        uint64_t start = stats_now();
+        if (scan_partition(nodes[partition->node], partition, tally) != 0)
+        {
+            fail("Error scanning redis", nodes[partition->node]);
+            break;
+        }
+        stats_record_since("report.partition", start);
+    }
+
+    for (int i = 0; i < SHARD_MAX_NODES; i++)
+    {
+        if (nodes[i] != NULL)
+            redisFree(nodes[i]);
+    }
+    return NULL;
+}
+
+// splits every node into cursor ranges, fewer for small tables so no bucket lies in two ranges, returns -1 on failure
+int plan_partitions(redisContext *c)
+{
+    partitions = malloc(shard_node_count() * REPORT_MAX_PARTITIONS * sizeof(Partition));
+    if (partitions == NULL)
+    {
+        return -1;
+    }
+
+    // redis grows a table once it holds as many keys as buckets (a few times that while it forks),
+    // so with at least REPORT_KEYS_PER_PARTITION keys per range no two ranges start in the same bucket
+    for (int node = 0; node < shard_node_count(); node++)
+    {
+        redisContext *target = shard_node(c, node);
+        redisReply *reply = target ? redis_command(target, "DBSIZE") : NULL;
+        if (reply == NULL || reply->type != REDIS_REPLY_INTEGER)
+        {
+            freeReplyObject(reply);
+            return -1;
+        }
+        int bits = 0;
+        while ((1LL << (bits + 1)) <= REPORT_MAX_PARTITIONS && reply->integer / REPORT_KEYS_PER_PARTITION >= (1LL << (bits + 1)))
+        {
+            bits++;
+        }
+        freeReplyObject(reply);
+
+        for (uint64_t k = 0; k < (1ULL << bits); k++)
+        {
+            Partition *partition = &partitions[partition_count++];
+            partition->node = node;
+            partition->first = bits ? k << (64 - bits) : 0;
+            partition->end = k + 1 < (1ULL << bits) ? (k + 1) << (64 - bits) : 0;
+        }
+    }
+    return 0;
+}
+
+// REPORT --------------------
+int compare_users(const void *a, const void *b)
+{
+    const UserTally *x = *(const UserTally *const *)a, *y = *(const UserTally *const *)b;
+    if (x->events != y->events)
+        return x->events < y->events ? 1 : -1;
+    return strcmp(x->user, y->user);
+}
+
+int compare_names(const void *a, const void *b)
+{
+    return strcmp((*(const UserTally *const *)a)->user, (*(const UserTally *const *)b)->user);
+}
+
+// yyyymmdd of the day that many days ago
+int days_ago(int days)
+{
+    time_t then = time(NULL) - (time_t)days * 86400;
+    struct tm tm;
+    localtime_r(&then, &tm);
+    return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
+
+// prints the report as one JSON object, returns -1 when memory runs out
+int print_report(const Tally *tally, int dormant_days, double seconds)
+{
+    // accounts only, events whose owner has no account count in the totals but not per user
+    UserTally **accounts = malloc((tally->users.used + 1) * sizeof(UserTally *));
+    if (accounts == NULL)
+    {
+        return -1;
+    }
+    size_t account_count = 0, active = 0;
+    for (size_t i = 0; i < tally->users.capacity; i++)
+    {
+        if (tally->users.slots[i].user[0] != '\0' && tally->users.slots[i].account)
+        {
+            accounts[account_count++] = &tally->users.slots[i];
+            active += tally->users.slots[i].events > 0;
+        }
+    }
+    long total = tally->events + tally->rules;
+
+    printf("{\"accounts\":%zu,\"accounts_with_events\":%zu,\"events\":%ld,\"recurring\":%ld,\"public\":%ld,\"private\":%ld,\"public_ratio\":%.3f,",
+           account_count, active, tally->events, tally->rules, tally->public_events, tally->private_events,
+           total ? (double)tally->public_events / total : 0.0);
+
+    qsort(accounts, account_count, sizeof(UserTally *), compare_users);
+    printf("\"events_per_user\":{\"mean\":%.2f,\"median\":%ld,\"max\":%ld,\"top\":[", account_count ? (double)total / account_count : 0.0,
+           account_count ? accounts[account_count / 2]->events : 0, account_count ? accounts[0]->events : 0);
+    for (size_t i = 0; i < account_count && i < REPORT_TOP; i++)
+    {
+        printf("%s{\"user\":", i ? "," : "");
+        print_json_string(stdout, accounts[i]->user);
+        printf(",\"events\":%ld,\"public\":%ld}", accounts[i]->events, accounts[i]->public_events);
+    }
+
+    // the busiest months by events dated in them, a rule counts for the month it starts in
+    printf("]},\"busiest_months\":[");
+    int shown[REPORT_TOP];
+    int shown_count = 0;
+    for (int n = 0; n < REPORT_TOP; n++)
+    {
+        int best = -1;
+        for (int i = 0; i < REPORT_MONTHS; i++)
+        {
+            int taken = 0;
+            for (int j = 0; j < shown_count; j++)
+                taken |= shown[j] == i;
+            if (!taken && tally->months[i] > 0 && (best < 0 || tally->months[i] > tally->months[best]))
+                best = i;
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        shown[shown_count++] = best;
+        printf("%s{\"month\":\"%04d-%02d\",\"events\":%ld}", n ? "," : "", REPORT_FIRST_YEAR + best / 12, best % 12 + 1, tally->months[best]);
+    }
+
+    // dormant: nothing dated since the cutoff and no rule that goes on past it
+    int cutoff = days_ago(dormant_days);
+    size_t dormant = 0;
+    for (size_t i = 0; i < account_count; i++)
+    {
+        if (accounts[i]->last < cutoff)
+            accounts[dormant++] = accounts[i];
+    }
+    qsort(accounts, dormant, sizeof(UserTally *), compare_names);
+    printf("],\"dormant\":{\"days\":%d,\"count\":%zu,\"users\":[", dormant_days, dormant);
+    for (size_t i = 0; i < dormant && i < REPORT_DORMANT_LISTED; i++)
+    {
+        printf("%s", i ? "," : "");
+        print_json_string(stdout, accounts[i]->user);
+    }
+    printf("]},\"keys_scanned\":%ld,\"seconds\":%.1f}\n", tally->keys, seconds);
+
+    free(accounts);
+    return 0;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-r ops per second] [-d days]\n"
+                    "  counts events per user, public and private events, the busiest months and dormant accounts\n"
+                    "  with SCAN on every node of REDIS_NODES, each node split into cursor ranges the threads share\n"
+                    "  -t  threads with their own connections, %d by default\n"
+                    "  -r  redis commands per second of all threads together, %d by default\n"
+                    "  -d  accounts without an event in the last days are dormant, %d by default\n",
+            program, REPORT_THREADS, REPORT_OPS_PER_SECOND, REPORT_DORMANT_DAYS);
+}
+
+// MAIN ------------
+int main(int argc, char *argv[])
+{
+    int threads = REPORT_THREADS, rate = REPORT_OPS_PER_SECOND, dormant_days = REPORT_DORMANT_DAYS;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'd':
+            dormant_days = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1 || threads > 256 || rate < 1 || dormant_days < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stats_init("report");
+    redisContext *c = connect_redis(NULL);
+    if (plan_partitions(c) != 0)
+    {
+        fprintf(stderr, "%sError reading the key count: %s%s\n", RED_COLOR, c->err ? c->errstr : "unexpected reply", RESET_COLOR);
+        return 1;
+    }
+
+    // a burst of one full page per thread, a slower budget than that only spreads the pages out
+    throttle_init(&throttle, rate, REPORT_SCAN_COUNT + 1);
+    Tally *tallies = calloc(threads, sizeof(Tally));
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    uint64_t start = stats_now();
+    while (tallies != NULL && workers != NULL && started < threads && started < partition_count &&
+           pthread_create(&workers[started], NULL, report_worker, &tallies[started]) == 0)
+    {
+        started++;
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    int status = 0;
+    if (started == 0 && partition_count > 0)
+    {
+        fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+        status = 1;
+    }
+    else if (failed)
+    {
+        fprintf(stderr, "%s%s%s\n", RED_COLOR, failure, RESET_COLOR);
+        status = 1;
+    }
+    else
+    {
+        for (int i = 1; i < started && status == 0; i++)
+        {
+            status = tally_merge(&tallies[0], &tallies[i]) != 0;
+        }
+        if (status != 0 || print_report(&tallies[0], dormant_days, (stats_now() - start) / 1e9) != 0)
+        {
+            fprintf(stderr, "%sError: Memory could not be allocated.%s\n", RED_COLOR, RESET_COLOR);
+            status = 1;
+        }
+        fprintf(stderr, "%d cursor ranges on %d nodes, %d threads\n", partition_count, shard_node_count(), started);
+    }
+
+    for (int i = 0; tallies != NULL && i < threads; i++)
+    {
+        free(tallies[i].users.slots);
+    }
+    free(tallies);
+    free(workers);
+    free(partitions);
+    throttle_destroy(&throttle);
+    redisFree(c);
+    stats_shutdown();
+    return status;
+}